@@ -0,0 +1,176 @@
+/**
+ * @file engage.c
+ * @brief Compares planned and naive engagement times.
+ * Usage: engage [max targets] [runs]
+ * Scatters random targets over the launcher's travel, 4, 16 and so on up to
+ * max targets (256 by default), and estimates with ml_engagement_time how
+ * long visiting them takes in the order given and in the order
+ * ml_plan_engagement picks. Also reports how long planning took. The
+ * launcher is a fake sysfs entry with the standard model's axis speeds, so
+ * no hardware is needed and nothing moves or fires.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libmissilelauncher/libmissilelauncher.h>
+
+// Roughly the standard launcher's travel, in millidegrees.
+#define ENGAGE_HORIZONTAL_TRAVEL 330000
+#define ENGAGE_VERTICAL_TRAVEL 45000
+
+static double
+now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1e9) + now.tv_nsec;
+}
+
+static int
+write_attr(const char *dir, const char *attr, const char *value)
+{
+  char path[512];
+  FILE *file = NULL;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, attr);
+  file = fopen(path, "w");
+  if (file == NULL) {
+    return -1;
+  }
+  fputs(value, file);
+  fclose(file);
+  return 0;
+}
+
+/// Builds a sysfs tree with one standard launcher in it.
+static int
+make_tree(const char *root)
+{
+  char dir[256], value[16];
+
+  snprintf(dir, sizeof(dir), "%s/bus", root);
+  mkdir(dir, 0755);
+  snprintf(dir, sizeof(dir), "%s/bus/usb", root);
+  mkdir(dir, 0755);
+  snprintf(dir, sizeof(dir), "%s/bus/usb/devices", root);
+  mkdir(dir, 0755);
+  snprintf(dir, sizeof(dir), "%s/bus/usb/devices/1-1", root);
+  if (mkdir(dir, 0755) != 0) {
+    return -1;
+  }
+  snprintf(value, sizeof(value), "%04x\n", ML_STD_VENDOR_ID);
+  write_attr(dir, "idVendor", value);
+  snprintf(value, sizeof(value), "%04x\n", ML_STD_PRODUCT_ID);
+  write_attr(dir, "idProduct", value);
+  write_attr(dir, "busnum", "1\n");
+  return write_attr(dir, "devnum", "2\n");
+}
+
+static void
+remove_tree(const char *root)
+{
+  char command[512];
+
+  snprintf(command, sizeof(command), "rm -rf '%s'", root);
+  if (system(command) != 0) {
+    fprintf(stderr, "Failed to remove %s\n", root);
+  }
+}
+
+static int
+run(ml_launcher_t *launcher, uint32_t count, uint32_t runs)
+{
+  ml_target_t *targets = NULL;
+  uint32_t *order = NULL;
+  uint32_t naive = 0, planned = 0;
+  double naive_total = 0, planned_total = 0, plan_ns = 0, start = 0;
+  ml_error_code rv = ML_OK;
+
+  targets = calloc(sizeof(ml_target_t), count);
+  order = calloc(sizeof(uint32_t), count);
+  if (targets == NULL || order == NULL) {
+    free(targets);
+    free(order);
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < runs && rv == ML_OK; i++) {
+    for (uint32_t j = 0; j < count; j++) {
+      targets[j].horizontal = rand() % ENGAGE_HORIZONTAL_TRAVEL;
+      targets[j].vertical = rand() % ENGAGE_VERTICAL_TRAVEL;
+    }
+    start = now_ns();
+    rv = ml_plan_engagement(launcher, targets, count, order);
+    plan_ns += now_ns() - start;
+    if (rv == ML_OK) {
+      rv = ml_engagement_time(launcher, targets, count, NULL, &naive);
+    }
+    if (rv == ML_OK) {
+      rv = ml_engagement_time(launcher, targets, count, order, &planned);
+    }
+    naive_total += naive;
+    planned_total += planned;
+  }
+
+  free(targets);
+  free(order);
+  if (rv != ML_OK) {
+    fprintf(stderr, "Planning %u targets failed: %s\n", count,
+            ml_error_to_str(rv));
+    return -1;
+  }
+  printf("%5u targets  naive %9.1f s  planned %9.1f s  %5.1f%%  "
+         "planning %9.3f ms\n", count, naive_total / runs / 1e3,
+         planned_total / runs / 1e3, 100 * planned_total / naive_total,
+         plan_ns / runs / 1e6);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/ml-engage-XXXXXX";
+  ml_launcher_t **launchers = NULL;
+  uint32_t max_count = 256, runs = 10, found = 0;
+  int status = EXIT_SUCCESS;
+
+  if (argc > 1) {
+    max_count = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    runs = strtoul(argv[2], NULL, 10);
+  }
+  if (runs == 0) {
+    runs = 1;
+  }
+
+  if (mkdtemp(root) == NULL || make_tree(root) != 0) {
+    fprintf(stderr, "Failed to create a sysfs tree\n");
+    return EXIT_FAILURE;
+  }
+  ml_library_init();
+  ml_library_set_sysfs_root(root, root);
+  if (ml_launcher_array_new(&launchers, &found) != ML_OK || found == 0) {
+    fprintf(stderr, "The fake launcher wasn't found\n");
+    status = EXIT_FAILURE;
+  }
+
+  srand(1);
+  for (uint32_t count = 4; status == EXIT_SUCCESS && count <= max_count;
+       count *= 4) {
+    if (run(launchers[0], count, runs) != 0) {
+      status = EXIT_FAILURE;
+    }
+  }
+
+  ml_launcher_array_free(launchers);
+  ml_library_cleanup();
+  remove_tree(root);
+  return status;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file fleet.c
+ * @brief Measures polls and status sweeps over a large simulated fleet.
+ * Usage: fleet [max launchers] [polls]
+ * Builds a fake sysfs tree with 256 launchers, then 512 and so on up to
+ * max launchers (4096 by default), and points the library at it. Nothing is
+ * opened, so no hardware is needed. Reports how long the first poll takes
+ * to add the launchers, how long a poll that finds nothing new takes, and
+ * how long it takes to read the type, LED state and USB location of every
+ * launcher, one getter at a time and all at once with ml_launcher_query_all.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libmissilelauncher/libmissilelauncher.h>
+
+// Device numbers are 7 bits, spread the launchers over buses.
+#define FLEET_DEVICES_PER_BUS 120
+
+static double
+now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1e9) + now.tv_nsec;
+}
+
+static int
+write_attr(const char *dir, const char *attr, const char *value)
+{
+  char path[512];
+  FILE *file = NULL;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, attr);
+  file = fopen(path, "w");
+  if (file == NULL) {
+    return -1;
+  }
+  fputs(value, file);
+  fclose(file);
+  return 0;
+}
+
+/// Adds launchers to the fake tree until it has count of them.
+static int
+add_launchers(const char *root, uint32_t from, uint32_t count)
+{
+  char dir[256], value[16];
+
+  for (uint32_t i = from; i < count; i++) {
+    uint32_t bus = 1 + (i / FLEET_DEVICES_PER_BUS);
+    uint32_t number = 1 + (i % FLEET_DEVICES_PER_BUS);
+
+    snprintf(dir, sizeof(dir), "%s/bus/usb/devices/%u-%u", root, bus, number);
+    if (mkdir(dir, 0755) != 0) {
+      return -1;
+    }
+    snprintf(value, sizeof(value), "%04x\n", ML_STD_VENDOR_ID);
+    write_attr(dir, "idVendor", value);
+    snprintf(value, sizeof(value), "%04x\n", ML_STD_PRODUCT_ID);
+    write_attr(dir, "idProduct", value);
+    snprintf(value, sizeof(value), "%u\n", bus);
+    write_attr(dir, "busnum", value);
+    snprintf(value, sizeof(value), "%u\n", number);
+    if (write_attr(dir, "devnum", value) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void
+remove_tree(const char *root)
+{
+  char command[512];
+
+  snprintf(command, sizeof(command), "rm -rf '%s'", root);
+  if (system(command) != 0) {
+    fprintf(stderr, "Failed to remove %s\n", root);
+  }
+}
+
+static int
+run(const char *root, uint32_t launcher_count, uint32_t polls,
+    ml_launcher_state_t *states)
+{
+  ml_launcher_t **launchers = NULL;
+  uint32_t count = 0;
+  uint8_t bus = 0, number = 0;
+  uint32_t standard = 0, lit = 0;
+  double start = 0, first_poll = 0, poll = 0, sweep = 0, query = 0;
+  ml_error_code rv;
+
+  ml_library_init();
+  ml_library_set_sysfs_root(root, root);
+
+  start = now_ns();
+  rv = ml_launcher_array_new(&launchers, &count);
+  first_poll = now_ns() - start;
+  if (rv != ML_OK || count != launcher_count) {
+    fprintf(stderr, "Found %u of %u launchers: %s\n", count, launcher_count,
+            ml_error_to_str(rv));
+    ml_launcher_array_free(launchers);
+    ml_library_cleanup();
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < polls; i++) {
+    ml_launcher_t **again = NULL;
+
+    start = now_ns();
+    ml_launcher_array_new(&again, &count);
+    poll += now_ns() - start;
+    ml_launcher_array_free(again);
+  }
+
+  for (uint32_t i = 0; i < polls; i++) {
+    start = now_ns();
+    for (uint32_t j = 0; j < launcher_count; j++) {
+      lit += ml_launcher_get_led_state(launchers[j]);
+      standard += ml_launcher_get_type(launchers[j]) == ML_STANDARD_LAUNCHER;
+      ml_launcher_get_usb_location(launchers[j], &bus, &number);
+    }
+    sweep += now_ns() - start;
+  }
+
+  for (uint32_t i = 0; i < polls; i++) {
+    start = now_ns();
+    ml_launcher_query_all(states, launcher_count, &count);
+    for (uint32_t j = 0; j < count; j++) {
+      lit += states[j].led_state;
+      standard += states[j].type == ML_STANDARD_LAUNCHER;
+    }
+    query += now_ns() - start;
+  }
+
+  printf("%5u launchers  first poll %8.2f ms  poll %8.2f ms  "
+         "%7.1f ns/launcher  getters %6.1f ns/launcher  "
+         "query %6.1f ns/launcher%s%s\n",
+         launcher_count, first_poll / 1e6, poll / polls / 1e6,
+         poll / polls / launcher_count, sweep / polls / launcher_count,
+         query / polls / launcher_count,
+         standard != launcher_count * polls * 2 ? " (mixed)" : "",
+         lit != 0 ? " (lit)" : "");
+
+  ml_launcher_array_free(launchers);
+  ml_library_cleanup();
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char root[] = "/tmp/ml-fleet-XXXXXX";
+  char devices[64];
+  ml_launcher_state_t *states = NULL;
+  uint32_t max_count = 4096, polls = 10, have = 0;
+  int status = EXIT_SUCCESS;
+
+  if (argc > 1) {
+    max_count = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    polls = strtoul(argv[2], NULL, 10);
+  }
+  if (polls == 0) {
+    polls = 1;
+  }
+
+  // Queries fill this, they never allocate.
+  states = calloc(sizeof(ml_launcher_state_t), max_count);
+  if (states == NULL || mkdtemp(root) == NULL) {
+    fprintf(stderr, "Failed to create a sysfs tree\n");
+    free(states);
+    return EXIT_FAILURE;
+  }
+  snprintf(devices, sizeof(devices), "%s/bus", root);
+  mkdir(devices, 0755);
+  snprintf(devices, sizeof(devices), "%s/bus/usb", root);
+  mkdir(devices, 0755);
+  snprintf(devices, sizeof(devices), "%s/bus/usb/devices", root);
+  mkdir(devices, 0755);
+
+  for (uint32_t count = 256; count <= max_count; count *= 2) {
+    if (add_launchers(root, have, count) != 0) {
+      fprintf(stderr, "Failed to add launchers to %s\n", root);
+      status = EXIT_FAILURE;
+      break;
+    }
+    have = count;
+    if (run(root, count, polls, states) != 0) {
+      status = EXIT_FAILURE;
+      break;
+    }
+  }
+
+  remove_tree(root);
+  free(states);
+  return status;
+}
@@ -0,0 +1,193 @@
+/**
+ * @file jitter.c
+ * @brief Measures how close timed moves stop to the requested duration.
+ * Usage: jitter [samples] [duration ms] [spin us]
+ * Runs the same timed moves with ML_TIMING_DEFAULT and ML_TIMING_PRECISE,
+ * journaling them, and reports how late each stop was sent after its move.
+ * Every move is followed by the coast time, so a run takes a while, more
+ * launchers make it go faster.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libmissilelauncher/libmissilelauncher.h>
+
+static uint32_t jitter_duration_ms = 50;
+static uint32_t jitter_remaining = 0;
+static uint32_t jitter_running = 0;
+
+static int
+compare_i64(const void *a, const void *b)
+{
+  int64_t ia = *(const int64_t *)a, ib = *(const int64_t *)b;
+  return ia < ib ? -1 : (ia > ib);
+}
+
+/// Hands out one of the remaining samples.
+static int
+take_sample()
+{
+  uint32_t left = __atomic_load_n(&jitter_remaining, __ATOMIC_RELAXED);
+
+  do {
+    if (left == 0) {
+      return 0;
+    }
+  } while (!__atomic_compare_exchange_n(&jitter_remaining, &left, left - 1, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+/// Queues the next move, alternating directions to stay off the end stops.
+static void
+next_move(ml_launcher_t *launcher, ml_error_code status, void *user_data)
+{
+  ml_command_t cmd = {
+    .type = ML_COMMAND_MOVE_TIMED,
+    .duration_ms = jitter_duration_ms,
+    .callback = next_move
+  };
+  uintptr_t count = (uintptr_t)user_data;
+  (void)status;
+
+  if (!take_sample()) {
+    __atomic_sub_fetch(&jitter_running, 1, __ATOMIC_RELEASE);
+    return;
+  }
+  cmd.direction = (count & 1) ? ML_LEFT : ML_RIGHT;
+  cmd.user_data = (void *)(count + 1);
+  if (ml_launcher_submit(launcher, &cmd) != ML_OK) {
+    __atomic_sub_fetch(&jitter_running, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static int
+run(const char *name, ml_timing_mode mode, uint32_t spin_us,
+    ml_launcher_t **launchers, uint32_t launcher_count, uint32_t samples)
+{
+  char path[] = "/tmp/ml-jitter-XXXXXX";
+  ml_journal_record_t *records = NULL;
+  uint32_t record_count = 0, found = 0;
+  int64_t *lateness = NULL;
+  struct timespec poll = { 0, 10000000 };
+  ml_error_code rv;
+  int fd = -1;
+
+  fd = mkstemp(path);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create a journal file\n");
+    return -1;
+  }
+  close(fd);
+
+  ml_library_set_timing(mode, spin_us);
+  rv = ml_journal_start(path, (samples * 2) + 16);
+  if (rv != ML_OK) {
+    fprintf(stderr, "Failed to start journal: %s\n", ml_error_to_str(rv));
+    unlink(path);
+    return -1;
+  }
+
+  jitter_remaining = samples;
+  jitter_running = launcher_count;
+  for (uint32_t i = 0; i < launcher_count; i++) {
+    next_move(launchers[i], ML_OK, NULL);
+  }
+  while (__atomic_load_n(&jitter_running, __ATOMIC_ACQUIRE) != 0) {
+    nanosleep(&poll, NULL);
+  }
+  ml_journal_stop();
+
+  rv = ml_journal_read(path, &records, &record_count);
+  unlink(path);
+  if (rv != ML_OK) {
+    fprintf(stderr, "Failed to read journal: %s\n", ml_error_to_str(rv));
+    return -1;
+  }
+
+  // Records are in sequence order, pair each move with the next stop sent
+  // to the same launcher.
+  lateness = calloc(sizeof(int64_t), record_count);
+  for (uint32_t i = 0; lateness != NULL && i < record_count; i++) {
+    ml_command_type type;
+    ml_launcher_direction direction;
+
+    if (ml_journal_command_to_type(records[i].command, &type,
+                                   &direction) != ML_OK ||
+        type != ML_COMMAND_MOVE) {
+      continue;
+    }
+    for (uint32_t j = i + 1; j < record_count; j++) {
+      if (records[j].launcher_id != records[i].launcher_id) {
+        continue;
+      }
+      if (ml_journal_command_to_type(records[j].command, &type,
+                                     &direction) == ML_OK &&
+          type == ML_COMMAND_STOP) {
+        lateness[found++] = (int64_t)(records[j].timestamp_ns -
+                                      records[i].timestamp_ns) -
+          ((int64_t)jitter_duration_ms * 1000000);
+      }
+      break;
+    }
+  }
+
+  if (found == 0) {
+    printf("%-8s no samples\n", name);
+  } else {
+    qsort(lateness, found, sizeof(int64_t), compare_i64);
+    printf("%-8s %5u stops, late by p50 %8.1f us, p99 %8.1f us, "
+           "p999 %8.1f us, max %8.1f us\n", name, found,
+           lateness[found / 2] / 1e3,
+           lateness[(found * 99) / 100] / 1e3,
+           lateness[(found * 999) / 1000] / 1e3,
+           lateness[found - 1] / 1e3);
+  }
+
+  free(lateness);
+  ml_journal_records_free(records);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  ml_launcher_t **launchers = NULL;
+  uint32_t launcher_count = 0, samples = 200, spin_us = 200;
+  ml_error_code rv;
+
+  if (argc > 1) {
+    samples = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    jitter_duration_ms = strtoul(argv[2], NULL, 10);
+  }
+  if (argc > 3) {
+    spin_us = strtoul(argv[3], NULL, 10);
+  }
+
+  ml_library_init();
+  rv = ml_launcher_array_new(&launchers, &launcher_count);
+  if (rv != ML_OK) {
+    fprintf(stderr, "No launchers to measure: %s\n", ml_error_to_str(rv));
+    ml_library_cleanup();
+    return EXIT_FAILURE;
+  }
+  ml_launcher_array_claim(launchers, ML_CLAIM_DEFAULT, NULL);
+
+  printf("%u timed moves of %u ms on %u launchers, spin %u us\n",
+         samples, jitter_duration_ms, launcher_count, spin_us);
+  run("default", ML_TIMING_DEFAULT, 0, launchers, launcher_count, samples);
+  run("precise", ML_TIMING_PRECISE, spin_us, launchers, launcher_count,
+      samples);
+
+  ml_launcher_array_unclaim(launchers, ML_CLAIM_DEFAULT, NULL);
+  ml_launcher_array_free(launchers);
+  ml_library_cleanup();
+  return EXIT_SUCCESS;
+}
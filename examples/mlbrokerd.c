@@ -0,0 +1,383 @@
+/**
+ * @file mlbrokerd.c
+ * @brief Launcher broker daemon, see libmissilelauncher_broker.h.
+ * Usage: mlbrokerd [segment name]
+ * Claims every connected launcher and serves commands from other processes
+ * over shared memory rings, so several programs can drive the same launchers
+ * without going through USB claims or a socket per command. The broker polls
+ * the rings while there is work and backs off to short sleeps when idle.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libmissilelauncher/libmissilelauncher.h>
+#include <libmissilelauncher/libmissilelauncher_broker.h>
+
+// Empty polls before the broker starts sleeping between polls.
+#define BROKER_SPIN_POLLS 20000
+#define BROKER_IDLE_SLEEP_NS 50000
+// How often to check whether client processes are still alive.
+#define BROKER_LIVENESS_MS 250
+
+/// A request the scheduler is working on.
+typedef struct broker_inflight_t
+{
+  struct broker_client_t *client;
+  uint64_t tag;
+  uint16_t launcher;
+  uint8_t type;
+} broker_inflight_t;
+
+/// Broker side state for a client slot. Scheduler threads finish commands
+/// concurrently, the lock makes them a single producer for the completion
+/// ring.
+typedef struct broker_client_t
+{
+  ml_broker_client_slot_t *slot;
+  pthread_mutex_t lock;
+  uint32_t inflight_count;
+  uint32_t free_count;
+  broker_inflight_t *free_list[ML_BROKER_RING_SIZE];
+  broker_inflight_t inflight[ML_BROKER_RING_SIZE];
+} broker_client_t;
+
+static volatile sig_atomic_t broker_running = 1;
+static ml_broker_shm_t *broker_shm = NULL;
+static ml_launcher_t *broker_launchers[ML_BROKER_MAX_LAUNCHERS];
+static uint32_t broker_launcher_count = 0;
+static broker_client_t broker_clients[ML_BROKER_MAX_CLIENTS];
+
+static void
+handle_signal(int sig)
+{
+  (void)sig;
+  broker_running = 0;
+}
+
+static uint64_t
+now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+/**
+ * @brief Publishes a completion. Hold the client lock.
+ * There is always room, a request is only taken while
+ * in flight + unread completions < ML_BROKER_RING_SIZE.
+ */
+static void
+push_completion_unsafe(broker_client_t *client, uint64_t tag,
+                       ml_error_code status)
+{
+  ml_broker_completion_ring_t *ring = &client->slot->completions;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  ml_broker_completion_t *completion =
+    &ring->entries[head & (ML_BROKER_RING_SIZE - 1)];
+
+  completion->tag = tag;
+  completion->status = (uint32_t)status;
+  completion->reserved = 0;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/// Runs on a bus scheduler thread when a command finishes.
+static void
+command_done(ml_launcher_t *launcher, ml_error_code status, void *user_data)
+{
+  broker_inflight_t *inflight = user_data;
+  broker_client_t *client = inflight->client;
+  ml_broker_launcher_status_t *state =
+    &broker_shm->launchers[inflight->launcher];
+
+  if (status == ML_OK && (inflight->type == ML_COMMAND_LED_ON ||
+                          inflight->type == ML_COMMAND_LED_OFF)) {
+    __atomic_store_n(&state->led, ml_launcher_get_led_state(launcher),
+                     __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&state->last_status, (uint32_t)status, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&state->pending, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&state->completed, 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&client->lock);
+  push_completion_unsafe(client, inflight->tag, status);
+  client->free_list[client->free_count++] = inflight;
+  client->inflight_count--;
+  pthread_mutex_unlock(&client->lock);
+}
+
+/**
+ * @brief Hands one request to the launcher's scheduler. Failures are
+ * completed straight away.
+ */
+static void
+dispatch(broker_client_t *client, const ml_broker_request_t *request)
+{
+  broker_inflight_t *inflight = NULL;
+  ml_command_t cmd;
+  ml_error_code rv = ML_OK;
+
+  pthread_mutex_lock(&client->lock);
+  if (request->launcher >= broker_launcher_count) {
+    push_completion_unsafe(client, request->tag, ML_INDEX_OUT_OF_BOUNDS);
+    pthread_mutex_unlock(&client->lock);
+    return;
+  }
+  inflight = client->free_list[--client->free_count];
+  client->inflight_count++;
+  pthread_mutex_unlock(&client->lock);
+
+  inflight->client = client;
+  inflight->tag = request->tag;
+  inflight->launcher = request->launcher;
+  inflight->type = request->type;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = (ml_command_type)request->type;
+  cmd.direction = (ml_launcher_direction)request->direction;
+  cmd.duration_ms = request->duration_ms;
+  cmd.priority = (ml_command_priority)request->priority;
+  cmd.deadline_ms = request->deadline_ms;
+  cmd.callback = command_done;
+  cmd.user_data = inflight;
+
+  __atomic_add_fetch(&broker_shm->launchers[request->launcher].pending, 1,
+                     __ATOMIC_RELAXED);
+  rv = ml_launcher_submit(broker_launchers[request->launcher], &cmd);
+  if (rv != ML_OK) {
+    // Never queued, so the callback won't run.
+    __atomic_sub_fetch(&broker_shm->launchers[request->launcher].pending, 1,
+                       __ATOMIC_RELAXED);
+    pthread_mutex_lock(&client->lock);
+    push_completion_unsafe(client, request->tag, rv);
+    client->free_list[client->free_count++] = inflight;
+    client->inflight_count--;
+    pthread_mutex_unlock(&client->lock);
+  }
+}
+
+/**
+ * @brief Takes every request the client has queued, as long as there is
+ * room to complete them.
+ *
+ * @return How many requests were taken.
+ */
+static uint32_t
+drain_requests(broker_client_t *client)
+{
+  ml_broker_request_ring_t *ring = &client->slot->requests;
+  ml_broker_completion_ring_t *completions = &client->slot->completions;
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint32_t taken = 0, unread = 0, inflight = 0;
+
+  while (tail != head) {
+    pthread_mutex_lock(&client->lock);
+    unread = __atomic_load_n(&completions->head, __ATOMIC_RELAXED) -
+      __atomic_load_n(&completions->tail, __ATOMIC_ACQUIRE);
+    inflight = client->inflight_count;
+    pthread_mutex_unlock(&client->lock);
+    if (inflight + unread >= ML_BROKER_RING_SIZE) {
+      // The client isn't reading its completions, leave the rest queued.
+      break;
+    }
+
+    dispatch(client, &ring->entries[tail & (ML_BROKER_RING_SIZE - 1)]);
+    tail++;
+    taken++;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+  return taken;
+}
+
+/**
+ * @brief Frees a slot whose client disconnected or died, once nothing is
+ * in flight for it any more.
+ */
+static void
+reap_client(broker_client_t *client, int check_alive)
+{
+  ml_broker_client_slot_t *slot = client->slot;
+  int32_t owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+  uint32_t inflight = 0;
+
+  if (owner == 0) {
+    return;
+  }
+  if (!__atomic_load_n(&slot->closing, __ATOMIC_ACQUIRE) &&
+      !(check_alive && kill(owner, 0) != 0 && errno == ESRCH)) {
+    return;
+  }
+
+  pthread_mutex_lock(&client->lock);
+  inflight = client->inflight_count;
+  pthread_mutex_unlock(&client->lock);
+  if (inflight != 0) {
+    return;
+  }
+
+  slot->requests.head = 0;
+  slot->requests.tail = 0;
+  slot->completions.head = 0;
+  slot->completions.tail = 0;
+  slot->closing = 0;
+  __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+  printf("Client %d disconnected\n", owner);
+}
+
+static ml_error_code
+create_segment(const char *name)
+{
+  int fd = -1;
+
+  // A broker that crashed leaves its segment behind.
+  shm_unlink(name);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0) {
+    return ML_NOT_FOUND;
+  }
+  if (ftruncate(fd, sizeof(ml_broker_shm_t)) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return ML_ALLOC_FAILED;
+  }
+  broker_shm = mmap(NULL, sizeof(ml_broker_shm_t), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (broker_shm == MAP_FAILED) {
+    broker_shm = NULL;
+    shm_unlink(name);
+    return ML_ALLOC_FAILED;
+  }
+  memset(broker_shm, 0, sizeof(ml_broker_shm_t));
+  return ML_OK;
+}
+
+int main(int argc, char **argv)
+{
+  const char *name = argc > 1 ? argv[1] : ML_BROKER_SHM_NAME;
+  ml_launcher_t **launchers = NULL;
+  ml_error_code claims[ML_BROKER_MAX_LAUNCHERS];
+  uint32_t count = 0, idle_polls = 0;
+  uint64_t next_liveness = 0, now = 0;
+  struct timespec idle_sleep = { 0, BROKER_IDLE_SLEEP_NS };
+  ml_error_code rv;
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  ml_library_init();
+  rv = ml_launcher_array_new(&launchers, &count);
+  if (rv != ML_OK) {
+    fprintf(stderr, "No launchers to serve: %s\n", ml_error_to_str(rv));
+    ml_library_cleanup();
+    return EXIT_FAILURE;
+  }
+  if (count > ML_BROKER_MAX_LAUNCHERS) {
+    fprintf(stderr, "Only serving the first %d of %u launchers\n",
+            ML_BROKER_MAX_LAUNCHERS, count);
+    ml_launcher_dereference(launchers[ML_BROKER_MAX_LAUNCHERS]);
+    // array_free stops at the first NULL, drop the rest ourselves.
+    for (uint32_t i = ML_BROKER_MAX_LAUNCHERS + 1; i < count; i++) {
+      ml_launcher_dereference(launchers[i]);
+    }
+    launchers[ML_BROKER_MAX_LAUNCHERS] = NULL;
+    count = ML_BROKER_MAX_LAUNCHERS;
+  }
+  ml_launcher_array_claim(launchers, ML_CLAIM_DEFAULT, claims);
+
+  rv = create_segment(name);
+  if (rv != ML_OK) {
+    fprintf(stderr, "Failed to create %s: %s\n", name, ml_error_to_str(rv));
+    ml_launcher_array_unclaim(launchers, ML_CLAIM_DEFAULT, NULL);
+    ml_launcher_array_free(launchers);
+    ml_library_cleanup();
+    return EXIT_FAILURE;
+  }
+
+  broker_launcher_count = count;
+  for (uint32_t i = 0; i < count; i++) {
+    ml_broker_launcher_status_t *state = &broker_shm->launchers[i];
+    uint8_t bus = 0, device = 0;
+
+    broker_launchers[i] = launchers[i];
+    ml_launcher_get_usb_location(launchers[i], &bus, &device);
+    state->claimed = claims[i] == ML_OK;
+    state->led = ml_launcher_get_led_state(launchers[i]);
+    state->type = ml_launcher_get_type(launchers[i]);
+    state->usb_bus = bus;
+    state->usb_device_number = device;
+    state->last_status = claims[i];
+  }
+  for (uint32_t i = 0; i < ML_BROKER_MAX_CLIENTS; i++) {
+    broker_client_t *client = &broker_clients[i];
+    client->slot = &broker_shm->clients[i];
+    pthread_mutex_init(&client->lock, NULL);
+    client->free_count = ML_BROKER_RING_SIZE;
+    for (uint32_t j = 0; j < ML_BROKER_RING_SIZE; j++) {
+      client->free_list[j] = &client->inflight[j];
+    }
+  }
+  broker_shm->version = ML_BROKER_VERSION;
+  broker_shm->broker_pid = getpid();
+  broker_shm->launcher_count = count;
+  __atomic_store_n(&broker_shm->magic, ML_BROKER_MAGIC, __ATOMIC_RELEASE);
+  printf("Serving %u launchers on %s\n", count, name);
+
+  while (broker_running) {
+    uint32_t taken = 0;
+    int check_alive = 0;
+
+    now = now_ms();
+    if (now >= next_liveness) {
+      check_alive = 1;
+      next_liveness = now + BROKER_LIVENESS_MS;
+    }
+
+    for (uint32_t i = 0; i < ML_BROKER_MAX_CLIENTS; i++) {
+      broker_client_t *client = &broker_clients[i];
+      if (__atomic_load_n(&client->slot->owner, __ATOMIC_ACQUIRE) == 0) {
+        continue;
+      }
+      taken += drain_requests(client);
+      reap_client(client, check_alive);
+    }
+    __atomic_add_fetch(&broker_shm->heartbeat, 1, __ATOMIC_RELAXED);
+
+    if (taken != 0) {
+      idle_polls = 0;
+    } else if (idle_polls < BROKER_SPIN_POLLS) {
+      idle_polls++;
+      sched_yield();
+    } else {
+      nanosleep(&idle_sleep, NULL);
+    }
+  }
+
+  // Clients see the broker go away before the launchers do.
+  __atomic_store_n(&broker_shm->magic, 0, __ATOMIC_RELEASE);
+  shm_unlink(name);
+
+  // Cleaning up the library flushes queued commands, so every callback
+  // has run before the segment is unmapped.
+  ml_launcher_array_unclaim(launchers, ML_CLAIM_DEFAULT, NULL);
+  ml_launcher_array_free(launchers);
+  ml_library_cleanup();
+  munmap(broker_shm, sizeof(ml_broker_shm_t));
+  for (uint32_t i = 0; i < ML_BROKER_MAX_CLIENTS; i++) {
+    pthread_mutex_destroy(&broker_clients[i].lock);
+  }
+  printf("Broker stopped\n");
+  return EXIT_SUCCESS;
+}
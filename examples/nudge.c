@@ -0,0 +1,163 @@
+/**
+ * @file nudge.c
+ * @brief Compares fine aiming with ml_launcher_nudge against timed moves.
+ * Usage: nudge [runs] [--simulate]
+ * Zeroes the first launcher, then makes corrections of growing size, back
+ * and forth so it stays near the middle, once with ml_launcher_nudge and
+ * once with a timed move through ml_group_aim. Reports how long each took
+ * and the quantization, how far from the correction asked for the pulse
+ * tables and axis speeds planned to go. That is only rounding to whole
+ * pulses and milliseconds, the library never sees where the turret really
+ * went, so mark the turret to check a launcher's calibration. With
+ * --simulate it runs on a simulated launcher instead, which does say where
+ * it went, and also reports the real error.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libmissilelauncher/libmissilelauncher.h>
+
+static double
+now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1e3) + (now.tv_nsec / 1e6);
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return da < db ? -1 : (da > db);
+}
+
+static int simulate = 0;
+
+/// Makes one correction and measures it. The real error is only known on a
+/// simulated launcher.
+static ml_error_code
+correct(ml_launcher_t *launcher, ml_group_t *group, int nudge,
+        int32_t delta, double *latency, double *quantization, double *error)
+{
+  uint32_t horizontal = 0, vertical = 0, after = 0;
+  ml_sim_state_t real_before, real_after;
+  double start = 0;
+  ml_error_code rv;
+
+  ml_launcher_get_position(launcher, &horizontal, &vertical);
+  if (simulate) {
+    ml_sim_get_state(launcher, &real_before);
+  }
+  start = now_ms();
+  if (nudge) {
+    rv = ml_launcher_nudge(launcher, delta, 0);
+  } else {
+    rv = ml_group_aim(group, horizontal + delta, vertical, NULL);
+  }
+  (*latency) = now_ms() - start;
+  ml_launcher_get_position(launcher, &after, &vertical);
+  (*quantization) = abs((int32_t)(after - horizontal) - delta);
+  (*error) = 0;
+  if (simulate) {
+    ml_sim_get_state(launcher, &real_after);
+    (*error) = abs((int32_t)(real_after.horizontal - real_before.horizontal) -
+                   delta);
+  }
+  return rv;
+}
+
+static int
+run(ml_launcher_t *launcher, ml_group_t *group, int nudge, int32_t size,
+    uint32_t runs)
+{
+  double *latency = NULL, quantization = 0, total_quantization = 0;
+  double error = 0, total_error = 0;
+  ml_error_code rv = ML_OK;
+
+  latency = calloc(sizeof(double), runs);
+  if (latency == NULL) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < runs && rv == ML_OK; i++) {
+    rv = correct(launcher, group, nudge, (i & 1) ? -size : size,
+                 &latency[i], &quantization, &error);
+    total_quantization += quantization;
+    total_error += error;
+  }
+  if (rv != ML_OK) {
+    printf("  %-6s %s\n", nudge ? "nudge" : "move", ml_error_to_str(rv));
+    free(latency);
+    return -1;
+  }
+
+  qsort(latency, runs, sizeof(double), compare_double);
+  printf("  %-6s p50 %7.1f ms  max %7.1f ms  quantization %6.0f mdeg",
+         nudge ? "nudge" : "move", latency[runs / 2], latency[runs - 1],
+         total_quantization / runs);
+  if (simulate) {
+    printf("  error %6.0f mdeg", total_error / runs);
+  }
+  printf("\n");
+  free(latency);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  static const int32_t sizes[] = { 100, 250, 500, 1000, 2000, 4000, 8000 };
+  ml_launcher_t **launchers = NULL;
+  ml_group_t *group = NULL;
+  uint32_t launcher_count = 0, runs = 10;
+  ml_error_code rv;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--simulate") == 0) {
+      simulate = 1;
+    } else {
+      runs = strtoul(argv[i], NULL, 10);
+    }
+  }
+  if (runs == 0) {
+    runs = 1;
+  }
+
+  if (simulate) {
+    ml_library_init_flags(ML_INIT_SKIP_SCAN);
+    ml_sim_add(1, ML_SIM_DEFAULT);
+  } else {
+    ml_library_init();
+  }
+  rv = ml_launcher_array_new(&launchers, &launcher_count);
+  if (rv != ML_OK) {
+    fprintf(stderr, "No launchers to measure: %s\n", ml_error_to_str(rv));
+    ml_library_cleanup();
+    return EXIT_FAILURE;
+  }
+  ml_launcher_claim(launchers[0]);
+  ml_group_new(launchers, 1, &group);
+
+  // Zeroing ends near the middle, with room either way.
+  rv = ml_launcher_zero(launchers[0]);
+  if (rv != ML_OK) {
+    fprintf(stderr, "Zeroing failed: %s\n", ml_error_to_str(rv));
+  }
+  for (uint32_t i = 0; rv == ML_OK && i < sizeof(sizes) / sizeof(sizes[0]);
+       i++) {
+    printf("%5d mdeg, %u runs\n", sizes[i], runs);
+    run(launchers[0], group, 1, sizes[i], runs);
+    run(launchers[0], group, 0, sizes[i], runs);
+  }
+
+  ml_group_free(group);
+  ml_launcher_unclaim(launchers[0]);
+  ml_launcher_array_free(launchers);
+  ml_library_cleanup();
+  return rv == ML_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
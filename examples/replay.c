@@ -0,0 +1,240 @@
+/**
+ * @file replay.c
+ * @brief Replays a command journal recorded with ml_journal_start.
+ * Usage: replay <journal> [speed] [--simulate]
+ * A speed of 1 replays in real time, 10 ten times faster and 0 as fast as
+ * possible. With --simulate no real launcher is touched, every launcher in
+ * the journal gets a simulated one instead, see ml_sim_add, and the
+ * commands go through the same queues as they would for real ones.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libmissilelauncher/libmissilelauncher.h>
+
+/// Launchers are matched by their recorded USB location, anything else is
+/// handed the next unmatched launcher.
+typedef struct replay_target_t
+{
+  uint16_t launcher_id;
+  ml_launcher_t *launcher;
+} replay_target_t;
+
+static uint32_t replay_failures = 0;
+static uint32_t replay_pending = 0;
+
+static uint64_t
+now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+static void
+sleep_until_ns(uint64_t when)
+{
+  struct timespec abs_time;
+  abs_time.tv_sec = when / 1000000000;
+  abs_time.tv_nsec = when % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &abs_time, NULL)) {
+  }
+}
+
+static int
+compare_records(const void *a, const void *b)
+{
+  const ml_journal_record_t *ra = a, *rb = b;
+  if (ra->timestamp_ns != rb->timestamp_ns) {
+    return ra->timestamp_ns < rb->timestamp_ns ? -1 : 1;
+  }
+  return ra->sequence < rb->sequence ? -1 : 1;
+}
+
+/// Counts the launchers a journal sent commands to.
+static uint32_t
+count_launchers(const ml_journal_record_t *records, uint32_t record_count)
+{
+  static uint8_t seen[(UINT16_MAX + 1) / 8];
+  uint32_t count = 0;
+
+  memset(seen, 0, sizeof(seen));
+  for (uint32_t i = 0; i < record_count; i++) {
+    uint16_t id = records[i].launcher_id;
+    if (!(seen[id / 8] & (1 << (id % 8)))) {
+      seen[id / 8] |= 1 << (id % 8);
+      count++;
+    }
+  }
+  return count;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+  return ua < ub ? -1 : (ua > ub);
+}
+
+static void
+command_done(ml_launcher_t *launcher, ml_error_code status, void *user_data)
+{
+  (void)launcher;
+  (void)user_data;
+  if (status != ML_OK) {
+    __atomic_add_fetch(&replay_failures, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_sub_fetch(&replay_pending, 1, __ATOMIC_RELEASE);
+}
+
+static ml_launcher_t *
+find_target(replay_target_t *targets, uint32_t *target_count,
+            ml_launcher_t **launchers, uint32_t launcher_count,
+            uint16_t launcher_id)
+{
+  uint8_t bus = 0, device = 0;
+
+  for (uint32_t i = 0; i < (*target_count); i++) {
+    if (targets[i].launcher_id == launcher_id) {
+      return targets[i].launcher;
+    }
+  }
+
+  // First choice, the launcher at the same USB location.
+  for (uint32_t i = 0; i < launcher_count; i++) {
+    ml_launcher_get_usb_location(launchers[i], &bus, &device);
+    if (((bus << 8) | device) == launcher_id) {
+      targets[*target_count].launcher_id = launcher_id;
+      targets[*target_count].launcher = launchers[i];
+      return targets[(*target_count)++].launcher;
+    }
+  }
+
+  // Otherwise hand out launchers round robin.
+  targets[*target_count].launcher_id = launcher_id;
+  targets[*target_count].launcher = launchers[(*target_count) % launcher_count];
+  return targets[(*target_count)++].launcher;
+}
+
+int main(int argc, char **argv)
+{
+  ml_journal_record_t *records = NULL;
+  ml_launcher_t **launchers = NULL;
+  replay_target_t *targets = NULL;
+  uint32_t record_count = 0, launcher_count = 0, target_count = 0;
+  uint64_t *lateness = NULL, start = 0, due = 0, elapsed = 0;
+  double speed = 1.0;
+  int simulate = 0;
+  ml_error_code rv;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <journal> [speed] [--simulate]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--simulate") == 0) {
+      simulate = 1;
+    } else {
+      speed = atof(argv[i]);
+    }
+  }
+
+  rv = ml_journal_read(argv[1], &records, &record_count);
+  if (rv != ML_OK) {
+    fprintf(stderr, "Failed to read journal: %s\n", ml_error_to_str(rv));
+    return EXIT_FAILURE;
+  }
+  if (record_count == 0) {
+    printf("Journal is empty.\n");
+    return EXIT_SUCCESS;
+  }
+  qsort(records, record_count, sizeof(ml_journal_record_t), compare_records);
+
+  if (simulate) {
+    // One simulated launcher for every launcher in the journal, they are
+    // handed out in order as each one first shows up.
+    ml_library_init_flags(ML_INIT_SKIP_SCAN);
+    ml_sim_add(count_launchers(records, record_count), ML_SIM_DEFAULT);
+  } else {
+    ml_library_init();
+  }
+  rv = ml_launcher_array_new(&launchers, &launcher_count);
+  if (rv != ML_OK) {
+    fprintf(stderr, "No launchers to replay against: %s\n",
+            ml_error_to_str(rv));
+    ml_library_cleanup();
+    return EXIT_FAILURE;
+  }
+  ml_launcher_array_claim(launchers, ML_CLAIM_DEFAULT, NULL);
+
+  targets = calloc(sizeof(replay_target_t), record_count);
+  lateness = calloc(sizeof(uint64_t), record_count);
+  if (targets == NULL || lateness == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  start = now_ns();
+  for (uint32_t i = 0; i < record_count; i++) {
+    ml_command_t cmd = {
+      // Keep the recorded order, stop and fire would otherwise jump ahead.
+      .priority = ML_PRIORITY_NORMAL,
+      .callback = command_done
+    };
+
+    if (speed > 0) {
+      due = start + (uint64_t)((records[i].timestamp_ns -
+                                records[0].timestamp_ns) / speed);
+      sleep_until_ns(due);
+      lateness[i] = now_ns() - due;
+    }
+
+    if (ml_journal_command_to_type(records[i].command, &cmd.type,
+                                   &cmd.direction) != ML_OK) {
+      __atomic_add_fetch(&replay_failures, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    __atomic_add_fetch(&replay_pending, 1, __ATOMIC_RELAXED);
+    rv = ml_launcher_submit(find_target(targets, &target_count, launchers,
+                                        launcher_count,
+                                        records[i].launcher_id), &cmd);
+    if (rv != ML_OK) {
+      __atomic_sub_fetch(&replay_pending, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&replay_failures, 1, __ATOMIC_RELAXED);
+    }
+  }
+  // Let the last commands finish.
+  while (__atomic_load_n(&replay_pending, __ATOMIC_ACQUIRE) != 0) {
+    sleep_until_ns(now_ns() + 1000000);
+  }
+  elapsed = now_ns() - start;
+
+  ml_launcher_array_unclaim(launchers, ML_CLAIM_DEFAULT, NULL);
+  ml_launcher_array_free(launchers);
+  ml_library_cleanup();
+
+  printf("Replayed %u commands in %.3f s (recorded span %.3f s)\n",
+         record_count, elapsed / 1e9,
+         (records[record_count - 1].timestamp_ns - records[0].timestamp_ns) /
+         1e9);
+  printf("Failures: %u\n", replay_failures);
+  if (speed > 0) {
+    qsort(lateness, record_count, sizeof(uint64_t), compare_u64);
+    printf("Send lateness p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           lateness[record_count / 2] / 1e3,
+           lateness[(record_count * 99) / 100] / 1e3,
+           lateness[record_count - 1] / 1e3);
+  }
+
+  free(lateness);
+  free(targets);
+  ml_journal_records_free(records);
+  return replay_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
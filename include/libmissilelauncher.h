@@ -40,6 +40,13 @@ typedef enum ml_launcher_direction
 } ml_launcher_direction;
 
 typedef struct ml_launcher_t ml_launcher_t; ///< An individual launcher.
+typedef struct ml_group_t ml_group_t; ///< Launchers aimed together.
+
+// Limit switch bits, one per ml_launcher_direction (1 << direction).
+#define ML_LIMIT_DOWN  0x01 ///< The launcher is at its lowest elevation
+#define ML_LIMIT_UP    0x02 ///< The launcher is at its highest elevation
+#define ML_LIMIT_LEFT  0x04 ///< The launcher is turned fully left
+#define ML_LIMIT_RIGHT 0x08 ///< The launcher is turned fully right
 
 ///< Error codes used in the library an enumeration is used
 typedef enum ml_error_code
@@ -62,20 +69,231 @@ typedef enum ml_error_code
     ML_NOT_NULL_POINTER,///< A null pointer was expected, but a non-null was found.
     ML_NO_LAUNCHERS,///< No launchers were detected.
     ML_LAUNCHER_OPEN,///< Launcher already open.
+    ML_DEADLINE_MISSED,///< A queued command didn't start before its deadline and was dropped.
+    ML_PREEMPTED,///< A move was cut short by a higher priority command.
+    ML_CANCELLED,///< A queued command was discarded because the library shut down.
+    ML_WOULD_BLOCK,///< A blocking call was made from a command callback, use ml_launcher_submit instead.
+    ML_NO_AMMO,///< The launcher is out of missiles, see ml_launcher_set_ammo.
+    ML_REAL_CLOCK,///< The library runs on the real clock, initialize it with ML_INIT_VIRTUAL_CLOCK.
+    ML_IN_USE,///< Another process is using the file, see ml_pose_start.
     ML_ERROR_END///< Sentinel
 } ml_error_code;
 
+/// Commands that can be queued on a launcher with ml_launcher_submit.
+typedef enum ml_command_type
+{
+    ML_COMMAND_MOVE, ///< Start moving in a direction until stopped
+    ML_COMMAND_MOVE_TIMED, ///< Move in a direction for duration_ms, then stop
+    ML_COMMAND_MOVE_TO_LIMIT, ///< Move until the end stop, at most duration_ms
+    ML_COMMAND_STOP, ///< Stop moving
+    ML_COMMAND_FIRE, ///< Fire a missile
+    ML_COMMAND_LED_ON, ///< Turn the LED on
+    ML_COMMAND_LED_OFF, ///< Turn the LED off
+    ML_COMMAND_PULSE ///< Move in a direction for duration_ms, then stop and settle briefly, see ml_launcher_nudge
+} ml_command_type;
+
+/// Queued commands run highest priority first. A command with a higher
+/// priority than a running timed move cuts the move short.
+typedef enum ml_command_priority
+{
+    ML_PRIORITY_DEFAULT, ///< Stop and fire are high, everything else normal
+    ML_PRIORITY_LOW, ///< Runs after everything else
+    ML_PRIORITY_NORMAL, ///< The priority of moves
+    ML_PRIORITY_HIGH ///< Jumps ahead of and preempts moves
+} ml_command_priority;
+
+/// How the scheduler times the stop at the end of a timed move.
+typedef enum ml_timing_mode
+{
+    ML_TIMING_DEFAULT, ///< Wait on a condition variable, about a millisecond of jitter
+    ML_TIMING_PRECISE ///< Sleep to an absolute deadline, then spin until it
+} ml_timing_mode;
+
+/// How much the library logs, see ml_log_set_level. Each level includes the
+/// ones before it.
+typedef enum ml_log_level
+{
+    ML_LOG_NONE, ///< Log nothing, the default
+    ML_LOG_ERROR, ///< Failed USB operations
+    ML_LOG_WARNING, ///< Things that didn't work but were worked around
+    ML_LOG_INFO, ///< Launchers coming and going, slow commands
+    ML_LOG_DEBUG ///< Every command sent
+} ml_log_level;
+
+/// Receives log messages as they are drained, see ml_log_set_callback.
+typedef void (*ml_log_callback)(ml_log_level level, uint64_t timestamp_ns,
+                                const char *message, void *user_data);
+
+/// Called from the scheduler thread when a queued command finishes.
+typedef void (*ml_command_callback)(ml_launcher_t *launcher,
+                                    ml_error_code status,
+                                    void *user_data);
+
+/// A command for ml_launcher_submit.
+typedef struct ml_command_t
+{
+    ml_command_type type; ///< What to do
+    ml_launcher_direction direction; ///< Which way to move, for moves
+    uint32_t duration_ms; ///< How long to move for, for timed moves
+    ml_command_priority priority; ///< Where the command goes in the queue
+    uint32_t deadline_ms; ///< Drop the command if it hasn't started this many milliseconds after submission, 0 for no deadline
+    ml_command_callback callback; ///< Called on completion, may be NULL
+    void *user_data; ///< Passed to the callback
+    uint32_t flags; ///< ML_FIRE_* flags, for fires
+} ml_command_t;
+
+/// Where to aim, see ml_plan_engagement.
+typedef struct ml_target_t
+{
+    uint32_t horizontal; ///< Millidegrees from the left stop
+    uint32_t vertical; ///< Millidegrees from the bottom stop
+} ml_target_t;
+
+/// A point on a launcher's pulse calibration, see ml_launcher_set_pulse_table.
+typedef struct ml_pulse_t
+{
+    uint32_t duration_ms; ///< How long the motor is driven for
+    uint32_t mdeg; ///< How far the launcher turns, coast included, in millidegrees
+} ml_pulse_t;
+
+/// One entry in a command journal, see ml_journal_start.
+typedef struct ml_journal_record_t
+{
+    uint64_t timestamp_ns; ///< When the command was sent, monotonic nanoseconds
+    uint64_t sequence; ///< Position in the journal, starting at 1
+    uint32_t latency_ns; ///< How long the USB transfer took
+    uint16_t launcher_id; ///< The launcher's USB bus << 8 | device number
+    uint8_t command; ///< The raw command sent, see ml_journal_command_to_type
+    uint8_t status; ///< The ml_error_code of the transfer
+    uint8_t reserved[8]; ///< Always zero
+} ml_journal_record_t;
+
+/// A snapshot of one launcher, see ml_launcher_query_all.
+typedef struct ml_launcher_state_t
+{
+    uint32_t id; ///< Stays the same across reconnects, see ml_launcher_get_id
+    ml_launcher_type type; ///< The model of launcher
+    uint8_t connected; ///< 1 if the device is plugged in
+    uint8_t claimed; ///< 1 if the launcher is claimed
+    uint8_t led_state; ///< 1 if the LED is on
+    uint8_t limits; ///< ML_LIMIT_* bits from the last limit read
+    uint32_t lease_count; ///< Leases held on the launcher
+    uint32_t horizontal_position; ///< Tracked horizontal position
+    uint32_t vertical_position; ///< Tracked vertical position
+    uint8_t usb_bus; ///< The USB bus, changes on reconnect
+    uint8_t usb_device_number; ///< The device number, changes on reconnect
+} ml_launcher_state_t;
+
+/// Power management counters for one launcher, see ml_launcher_get_power_stats
+typedef struct ml_power_stats_t
+{
+    uint8_t pinned;       ///< 1 while autosuspend is off, see ML_CLAIM_NO_SUSPEND
+    uint32_t commands;    ///< Commands sent to the launcher
+    uint32_t resumes;     ///< Commands slowed down by the device resuming after an idle period
+    uint32_t keep_alives; ///< Keep-alive requests sent, see ml_library_set_keep_alive
+} ml_power_stats_t;
+
+/// What a simulated launcher is really doing, see ml_sim_get_state.
+typedef struct ml_sim_state_t
+{
+    uint32_t horizontal; ///< Millidegrees from the left stop
+    uint32_t vertical; ///< Millidegrees from the bottom stop
+    uint8_t moving; ///< 1 while a motor is driven or still coasting
+    uint8_t led_state; ///< 1 if the LED is on
+    uint32_t shots; ///< Fire commands received
+    uint32_t commands; ///< Commands received of any kind
+} ml_sim_state_t;
+
 // ********** API Functions **********
 // Library init
+/// Flags for ml_library_init_flags
+#define ML_INIT_DEFAULT   0x00 ///< Scan the bus in ml_launcher_array_new
+#define ML_INIT_SKIP_SCAN 0x01 ///< Never scan, open launchers by path or ID
+#define ML_INIT_VIRTUAL_CLOCK 0x02 ///< Run on a clock that only moves with ml_clock_advance, for tests
+
 ml_error_code ml_library_init();
+ml_error_code ml_library_init_flags(uint32_t);
 ml_error_code ml_library_cleanup();
 uint8_t ml_library_is_init();
+ml_error_code ml_library_set_claim_idle_timeout(uint32_t);
+uint32_t ml_library_get_claim_idle_timeout();
+ml_error_code ml_library_set_bus_affinity(uint8_t, int);
+ml_error_code ml_library_set_bus_rate_limit(uint8_t, uint32_t);
+ml_error_code ml_library_set_timing(ml_timing_mode, uint32_t);
+uint64_t ml_clock_now_ns();
+ml_error_code ml_clock_advance(uint64_t);
+ml_error_code ml_library_set_sysfs_root(const char *, const char *);
+ml_error_code ml_library_set_keep_alive(uint32_t);
 
 const char *ml_error_to_str(ml_error_code ec);
 
+// Logging
+ml_error_code ml_log_set_level(ml_log_level);
+ml_log_level ml_log_get_level();
+ml_error_code ml_log_set_callback(ml_log_callback, void *);
+ml_error_code ml_log_start();
+ml_error_code ml_log_stop();
+uint32_t ml_log_drain();
+uint64_t ml_log_get_dropped();
+
+// Command journal
+ml_error_code ml_journal_start(const char *, uint32_t);
+ml_error_code ml_journal_stop();
+ml_error_code ml_journal_read(const char *, ml_journal_record_t **,
+                              uint32_t *);
+ml_error_code ml_journal_records_free(ml_journal_record_t *);
+ml_error_code ml_journal_command_to_type(uint8_t, ml_command_type *,
+                                         ml_launcher_direction *);
+
+// Pose file
+ml_error_code ml_pose_start(const char *);
+ml_error_code ml_pose_stop();
+
 // Launcher arrays
 ml_error_code ml_launcher_array_new(ml_launcher_t ***, uint32_t *);
 ml_error_code ml_launcher_array_free(ml_launcher_t **);
+ml_error_code ml_launcher_query_all(ml_launcher_state_t *, uint32_t,
+                                    uint32_t *);
+
+// Opening launchers without a scan
+ml_error_code ml_launcher_open_by_path(const char *, ml_launcher_t **);
+ml_error_code ml_launcher_open_by_vid_pid(uint16_t, uint16_t,
+                                          ml_launcher_t **);
+
+/// Flags for ml_launcher_array_claim and ml_launcher_array_unclaim
+#define ML_CLAIM_DEFAULT 0x00 ///< Claim (or unclaim) every launcher
+#define ML_CLAIM_LEASE   0x01 ///< Take (or return) a lease instead of a claim
+#define ML_CLAIM_NO_SUSPEND 0x02 ///< Keep claimed launchers out of USB autosuspend
+
+/// Flags for ml_launcher_fire_n and fire commands
+#define ML_FIRE_DEFAULT     0x00 ///< A shot is done when the status report says so, or the firing cycle is over
+#define ML_FIRE_TIMED       0x01 ///< Ignore the status report, always wait out the firing cycle
+#define ML_FIRE_IGNORE_AMMO 0x02 ///< Fire even if the ammo count says the launcher is empty
+
+/// Most points in a pulse table, see ml_launcher_set_pulse_table
+#define ML_PULSE_TABLE_SIZE 8
+
+/// Flags for ml_sim_add
+#define ML_SIM_DEFAULT        0x00 ///< Reports limit switches and finished shots like a standard launcher
+#define ML_SIM_NO_STATUS      0x01 ///< Never answers a status report
+#define ML_SIM_NO_FIRE_REPORT 0x02 ///< The status report never says a shot is done
+
+ml_error_code ml_launcher_array_claim(ml_launcher_t **, uint32_t,
+                                      ml_error_code *);
+ml_error_code ml_launcher_array_unclaim(ml_launcher_t **, uint32_t,
+                                        ml_error_code *);
+
+// Launcher groups
+ml_error_code ml_group_new(ml_launcher_t **, uint32_t, ml_group_t **);
+ml_error_code ml_group_free(ml_group_t *);
+ml_error_code ml_group_aim(ml_group_t *, uint32_t, uint32_t, ml_error_code *);
+ml_error_code ml_group_aim_submit(ml_group_t *, uint32_t, uint32_t,
+                                  ml_command_callback, void *);
+
+// Target tracking
+ml_error_code ml_tracker_push(ml_launcher_t *, uint32_t, uint32_t, uint64_t);
+ml_error_code ml_tracker_stop(ml_launcher_t *);
+ml_error_code ml_tracker_configure(ml_launcher_t *, uint32_t, uint32_t);
 
 // Launcher refrence
 ml_error_code ml_launcher_reference(ml_launcher_t *);
@@ -83,18 +301,54 @@ ml_error_code ml_launcher_dereference(ml_launcher_t *);
 
 // Launcher control
 ml_error_code ml_launcher_claim(ml_launcher_t *);
+ml_error_code ml_launcher_claim_flags(ml_launcher_t *, uint32_t);
 ml_error_code ml_launcher_unclaim(ml_launcher_t *);
+ml_error_code ml_launcher_lease(ml_launcher_t *);
+ml_error_code ml_launcher_release(ml_launcher_t *);
 
 ml_launcher_type ml_launcher_get_type(ml_launcher_t *);
+uint32_t ml_launcher_get_id(ml_launcher_t *);
+ml_error_code ml_launcher_get_usb_location(ml_launcher_t *, uint8_t *,
+                                           uint8_t *);
+ml_error_code ml_launcher_get_port_path(ml_launcher_t *, char *, uint32_t);
 ml_error_code ml_launcher_fire(ml_launcher_t *);
+ml_error_code ml_launcher_fire_n(ml_launcher_t *, uint32_t, uint32_t);
+ml_error_code ml_launcher_set_ammo(ml_launcher_t *, uint32_t);
+ml_error_code ml_launcher_get_ammo(ml_launcher_t *, uint32_t *);
 ml_error_code ml_launcher_move(ml_launcher_t *, ml_launcher_direction);
 ml_error_code ml_launcher_stop(ml_launcher_t *);
 ml_error_code ml_launcher_move_mseconds(ml_launcher_t *,
                                   ml_launcher_direction, uint32_t);
 ml_error_code ml_launcher_zero(ml_launcher_t *);
+ml_error_code ml_launcher_zero_submit(ml_launcher_t *, ml_command_callback,
+                                      void *);
+uint8_t ml_launcher_has_position(ml_launcher_t *);
+ml_error_code ml_plan_engagement(ml_launcher_t *, const ml_target_t *,
+                                 uint32_t, uint32_t *);
+ml_error_code ml_engagement_time(ml_launcher_t *, const ml_target_t *,
+                                 uint32_t, const uint32_t *, uint32_t *);
+ml_error_code ml_launcher_engage(ml_launcher_t *, const ml_target_t *,
+                                 uint32_t, const uint32_t *);
+ml_error_code ml_launcher_submit(ml_launcher_t *, const ml_command_t *);
 ml_error_code ml_launcher_led_on(ml_launcher_t *);
 ml_error_code ml_launcher_led_off(ml_launcher_t *);
 uint8_t ml_launcher_get_led_state(ml_launcher_t *);
+ml_error_code ml_launcher_get_limits(ml_launcher_t *, uint8_t *);
+ml_error_code ml_launcher_get_position(ml_launcher_t *, uint32_t *,
+                                       uint32_t *);
+ml_error_code ml_launcher_set_axis_speed(ml_launcher_t *,
+                                         ml_launcher_direction, uint32_t);
+ml_error_code ml_launcher_set_pulse_table(ml_launcher_t *,
+                                          ml_launcher_direction,
+                                          const ml_pulse_t *, uint32_t);
+ml_error_code ml_launcher_nudge(ml_launcher_t *, int32_t, int32_t);
+ml_error_code ml_launcher_get_power_stats(ml_launcher_t *,
+                                          ml_power_stats_t *);
+
+// Simulated launchers
+ml_error_code ml_sim_add(uint32_t, uint32_t);
+ml_error_code ml_sim_get_state(ml_launcher_t *, ml_sim_state_t *);
+ml_error_code ml_sim_set_position(ml_launcher_t *, uint32_t, uint32_t);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,387 @@
+/**
+ * @file libmissilelauncher.hpp
+ * @brief Header only C++20 binding for libmissilelauncher.
+ * Launchers are wrapped in move only RAII handles and every command can be
+ * co_await'ed. Awaiting a command queues it with ml_launcher_submit and
+ * resumes the coroutine from the bus scheduler thread once it is done, so a
+ * single thread can run any number of interleaved launcher sequences.
+ * Coroutines resumed this way run on a scheduler thread, so they must only
+ * await commands and never call the blocking C functions.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#ifndef LIBMISSILELAUNCHER_HPP
+#define LIBMISSILELAUNCHER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "libmissilelauncher.h"
+
+namespace ml {
+
+/// Awaitable for one queued launcher command, co_await gives the
+/// ml_error_code the command finished with.
+class command
+{
+  public:
+    command(ml_launcher_t *launcher, const ml_command_t &cmd)
+      : launcher_(launcher), cmd_(cmd), status_(ML_OK) {}
+
+    /// Sets the queue priority of the command.
+    command &priority(ml_command_priority priority)
+    {
+      cmd_.priority = priority;
+      return *this;
+    }
+
+    /// Drops the command if it hasn't started within the deadline.
+    command &deadline(std::chrono::milliseconds deadline)
+    {
+      cmd_.deadline_ms = static_cast<uint32_t>(deadline.count());
+      return *this;
+    }
+
+    bool await_ready() const noexcept
+    {
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+      ml_error_code result;
+
+      handle_ = handle;
+      cmd_.callback = &command::on_done;
+      cmd_.user_data = this;
+      result = ml_launcher_submit(launcher_, &cmd_);
+      if (result != ML_OK) {
+        // Never queued, carry on right away.
+        status_ = result;
+        return false;
+      }
+      // The scheduler may already have resumed us, don't touch this.
+      return true;
+    }
+
+    ml_error_code await_resume() const noexcept
+    {
+      return status_;
+    }
+
+  private:
+    static void on_done(ml_launcher_t *, ml_error_code status,
+                        void *user_data)
+    {
+      command *self = static_cast<command *>(user_data);
+      self->status_ = status;
+      self->handle_.resume();
+    }
+
+    ml_launcher_t *launcher_;
+    ml_command_t cmd_;
+    ml_error_code status_;
+    std::coroutine_handle<> handle_;
+};
+
+/// A move only handle on a launcher. It holds a reference for its whole
+/// life and unclaims the launcher on destruction if it claimed it.
+class launcher
+{
+  public:
+    launcher() noexcept : launcher_(nullptr), claimed_(false) {}
+
+    explicit launcher(ml_launcher_t *raw) noexcept
+      : launcher_(raw), claimed_(false)
+    {
+      if (launcher_ != nullptr) {
+        ml_launcher_reference(launcher_);
+      }
+    }
+
+    launcher(const launcher &) = delete;
+    launcher &operator=(const launcher &) = delete;
+
+    launcher(launcher &&other) noexcept
+      : launcher_(std::exchange(other.launcher_, nullptr)),
+        claimed_(std::exchange(other.claimed_, false)) {}
+
+    launcher &operator=(launcher &&other) noexcept
+    {
+      if (this != &other) {
+        reset();
+        launcher_ = std::exchange(other.launcher_, nullptr);
+        claimed_ = std::exchange(other.claimed_, false);
+      }
+      return *this;
+    }
+
+    ~launcher()
+    {
+      reset();
+    }
+
+    /// Gets a handle for every connected launcher.
+    static ml_error_code all(std::vector<launcher> &out)
+    {
+      ml_launcher_t **arr = nullptr;
+      uint32_t count = 0;
+      ml_error_code result = ml_launcher_array_new(&arr, &count);
+
+      if (result != ML_OK) {
+        return result;
+      }
+      out.reserve(out.size() + count);
+      for (uint32_t i = 0; i < count; i++) {
+        out.emplace_back(arr[i]);
+      }
+      return ml_launcher_array_free(arr);
+    }
+
+    /// Opens the launcher on a USB port without scanning the bus.
+    static ml_error_code open(const char *path, launcher &out)
+    {
+      ml_launcher_t *raw = nullptr;
+      ml_error_code result = ml_launcher_open_by_path(path, &raw);
+
+      if (result == ML_OK) {
+        out = launcher(raw);
+        ml_launcher_dereference(raw);
+      }
+      return result;
+    }
+
+    ml_error_code claim()
+    {
+      ml_error_code result = ml_launcher_claim(launcher_);
+      if (result == ML_OK) {
+        claimed_ = true;
+      }
+      return result;
+    }
+
+    ml_error_code unclaim()
+    {
+      claimed_ = false;
+      return ml_launcher_unclaim(launcher_);
+    }
+
+    /// Drops the claim and the reference, leaving an empty handle.
+    void reset() noexcept
+    {
+      if (launcher_ == nullptr) {
+        return;
+      }
+      if (claimed_) {
+        ml_launcher_unclaim(launcher_);
+        claimed_ = false;
+      }
+      ml_launcher_dereference(launcher_);
+      launcher_ = nullptr;
+    }
+
+    ml_launcher_t *get() const noexcept
+    {
+      return launcher_;
+    }
+
+    explicit operator bool() const noexcept
+    {
+      return launcher_ != nullptr;
+    }
+
+    /// Starts moving until stopped.
+    command move(ml_launcher_direction direction) const
+    {
+      ml_command_t cmd = {};
+      cmd.type = ML_COMMAND_MOVE;
+      cmd.direction = direction;
+      return command(launcher_, cmd);
+    }
+
+    /// Moves for a while, then stops and waits out the coast.
+    command move_for(ml_launcher_direction direction,
+                     std::chrono::milliseconds duration) const
+    {
+      ml_command_t cmd = {};
+      cmd.type = ML_COMMAND_MOVE_TIMED;
+      cmd.direction = direction;
+      cmd.duration_ms = static_cast<uint32_t>(duration.count());
+      return command(launcher_, cmd);
+    }
+
+    /// Moves into the end stop, giving up after max_duration.
+    command move_to_limit(ml_launcher_direction direction,
+                          std::chrono::milliseconds max_duration) const
+    {
+      ml_command_t cmd = {};
+      cmd.type = ML_COMMAND_MOVE_TO_LIMIT;
+      cmd.direction = direction;
+      cmd.duration_ms = static_cast<uint32_t>(max_duration.count());
+      return command(launcher_, cmd);
+    }
+
+    /// Drives the motor briefly for a fine correction, see ml_launcher_nudge.
+    command pulse(ml_launcher_direction direction,
+                  std::chrono::milliseconds duration) const
+    {
+      ml_command_t cmd = {};
+      cmd.type = ML_COMMAND_PULSE;
+      cmd.direction = direction;
+      cmd.duration_ms = static_cast<uint32_t>(duration.count());
+      return command(launcher_, cmd);
+    }
+
+    command stop() const
+    {
+      return simple(ML_COMMAND_STOP);
+    }
+
+    command fire() const
+    {
+      return simple(ML_COMMAND_FIRE);
+    }
+
+    command led_on() const
+    {
+      return simple(ML_COMMAND_LED_ON);
+    }
+
+    command led_off() const
+    {
+      return simple(ML_COMMAND_LED_OFF);
+    }
+
+  private:
+    command simple(ml_command_type type) const
+    {
+      ml_command_t cmd = {};
+      cmd.type = type;
+      return command(launcher_, cmd);
+    }
+
+    ml_launcher_t *launcher_;
+    bool claimed_;
+};
+
+/// An eagerly started coroutine returning nothing. Destroying the task
+/// waits for the coroutine to finish, or call wait() directly.
+class task
+{
+  public:
+    struct promise_type
+    {
+      // Outside the frame, the task may destroy the frame as soon as this
+      // is set and the notify must still have something to touch.
+      std::shared_ptr<std::atomic<bool>> finished =
+        std::make_shared<std::atomic<bool>>(false);
+
+      task get_return_object()
+      {
+        return task(std::coroutine_handle<promise_type>::from_promise(*this),
+                    finished);
+      }
+
+      std::suspend_never initial_suspend() noexcept
+      {
+        return {};
+      }
+
+      auto final_suspend() noexcept
+      {
+        struct final_awaiter
+        {
+          bool await_ready() const noexcept
+          {
+            return false;
+          }
+
+          void await_suspend(
+            std::coroutine_handle<promise_type> handle) const noexcept
+          {
+            std::shared_ptr<std::atomic<bool>> finished =
+              handle.promise().finished;
+            finished->store(true, std::memory_order_release);
+            finished->notify_all();
+          }
+
+          void await_resume() const noexcept {}
+        };
+        return final_awaiter{};
+      }
+
+      void return_void() noexcept {}
+
+      void unhandled_exception() noexcept
+      {
+        std::terminate();
+      }
+    };
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    task(task &&other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)),
+        finished_(std::move(other.finished_)) {}
+
+    task &operator=(task &&other) noexcept
+    {
+      if (this != &other) {
+        reset();
+        handle_ = std::exchange(other.handle_, nullptr);
+        finished_ = std::move(other.finished_);
+      }
+      return *this;
+    }
+
+    ~task()
+    {
+      reset();
+    }
+
+    bool done() const noexcept
+    {
+      return handle_ == nullptr ||
+        finished_->load(std::memory_order_acquire);
+    }
+
+    /// Blocks until the coroutine has run to the end.
+    void wait() const noexcept
+    {
+      if (handle_ == nullptr) {
+        return;
+      }
+      finished_->wait(false, std::memory_order_acquire);
+    }
+
+  private:
+    task(std::coroutine_handle<promise_type> handle,
+         std::shared_ptr<std::atomic<bool>> finished)
+      : handle_(handle), finished_(std::move(finished)) {}
+
+    void reset() noexcept
+    {
+      if (handle_ != nullptr) {
+        wait();
+        handle_.destroy();
+        handle_ = nullptr;
+        finished_.reset();
+      }
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+    std::shared_ptr<std::atomic<bool>> finished_;
+};
+
+} // namespace ml
+
+#endif
@@ -0,0 +1,241 @@
+/**
+ * @file libmissilelauncher_broker.h
+ * @brief Shared memory interface to the launcher broker daemon.
+ * Only one process can claim a launcher, so the broker (examples/mlbrokerd.c)
+ * claims them all and serves other processes through a POSIX shared memory
+ * segment. Each client gets a pair of single producer, single consumer rings,
+ * one for commands and one for completions, and everyone can read the
+ * launcher status page. The client side is header only.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#ifndef LIBMISSILELAUNCHER_BROKER_H
+#define LIBMISSILELAUNCHER_BROKER_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libmissilelauncher.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ML_BROKER_SHM_NAME "/libmissilelauncher-broker" ///< Default segment name
+#define ML_BROKER_MAGIC 0x4d4c42524f4b4552ULL ///< "MLBROKER"
+#define ML_BROKER_VERSION 1 ///< Bumped when the layout changes
+#define ML_BROKER_MAX_LAUNCHERS 64 ///< Launchers on the status page
+#define ML_BROKER_MAX_CLIENTS 16 ///< Processes that can connect at once
+#define ML_BROKER_RING_SIZE 256 ///< Entries per ring, a power of two
+#define ML_BROKER_CACHE_LINE 64 ///< Keeps producer and consumer apart
+
+/// A command from a client to the broker.
+typedef struct ml_broker_request_t
+{
+    uint64_t tag; ///< Chosen by the client, echoed in the completion
+    uint32_t duration_ms; ///< See ml_command_t
+    uint32_t deadline_ms; ///< See ml_command_t
+    uint16_t launcher; ///< Index on the status page
+    uint8_t type; ///< An ml_command_type
+    uint8_t direction; ///< An ml_launcher_direction
+    uint8_t priority; ///< An ml_command_priority
+    uint8_t reserved[7]; ///< Always zero
+} ml_broker_request_t;
+
+/// The result of a command, in the order the broker finished them.
+typedef struct ml_broker_completion_t
+{
+    uint64_t tag; ///< The tag of the request
+    uint32_t status; ///< An ml_error_code
+    uint32_t reserved; ///< Always zero
+} ml_broker_completion_t;
+
+/// A single producer, single consumer ring. The producer only writes head,
+/// the consumer only writes tail, and they live on separate cache lines.
+#define ML_BROKER_RING(name, entry_type)                                   \
+typedef struct name                                                        \
+{                                                                          \
+    uint32_t head;                                                         \
+    uint8_t head_pad[ML_BROKER_CACHE_LINE - sizeof(uint32_t)];             \
+    uint32_t tail;                                                         \
+    uint8_t tail_pad[ML_BROKER_CACHE_LINE - sizeof(uint32_t)];             \
+    entry_type entries[ML_BROKER_RING_SIZE];                               \
+} name
+
+ML_BROKER_RING(ml_broker_request_ring_t, ml_broker_request_t);
+ML_BROKER_RING(ml_broker_completion_ring_t, ml_broker_completion_t);
+
+/// One client's connection.
+typedef struct ml_broker_client_slot_t
+{
+    int32_t owner; ///< The client's pid, 0 while free. Taken with a compare and swap
+    uint32_t closing; ///< Set by the client on disconnect, the broker then frees the slot
+    uint8_t pad[ML_BROKER_CACHE_LINE - 8];
+    ml_broker_request_ring_t requests; ///< Client to broker
+    ml_broker_completion_ring_t completions; ///< Broker to client
+} ml_broker_client_slot_t;
+
+/// What the broker knows about one launcher, refreshed as it changes.
+typedef struct ml_broker_launcher_status_t
+{
+    uint32_t claimed; ///< 1 while the broker holds the launcher
+    uint32_t led; ///< 1 while the LED is on
+    uint32_t type; ///< An ml_launcher_type
+    uint32_t usb_bus; ///< See ml_launcher_get_usb_location
+    uint32_t usb_device_number; ///< See ml_launcher_get_usb_location
+    uint32_t last_status; ///< The ml_error_code of the last finished command
+    uint32_t pending; ///< Commands queued or running on this launcher
+    uint32_t reserved;
+    uint64_t completed; ///< Commands finished on this launcher
+} ml_broker_launcher_status_t;
+
+/// The whole shared segment.
+typedef struct ml_broker_shm_t
+{
+    uint64_t magic; ///< ML_BROKER_MAGIC once the broker is ready
+    uint32_t version; ///< ML_BROKER_VERSION
+    int32_t broker_pid; ///< The broker process
+    uint32_t launcher_count; ///< Valid entries in launchers
+    uint32_t reserved;
+    uint64_t heartbeat; ///< Counts up while the broker is alive
+    uint8_t pad[ML_BROKER_CACHE_LINE - 32];
+    ml_broker_launcher_status_t launchers[ML_BROKER_MAX_LAUNCHERS];
+    ml_broker_client_slot_t clients[ML_BROKER_MAX_CLIENTS];
+} ml_broker_shm_t;
+
+/// A connected client.
+typedef struct ml_broker_client_t
+{
+    ml_broker_shm_t *shm; ///< The mapped segment
+    ml_broker_client_slot_t *slot; ///< This client's rings
+} ml_broker_client_t;
+
+/**
+ * @brief Maps the broker's segment and takes a free client slot.
+ *
+ * @param client The client to connect.
+ * @param name The segment name, NULL for ML_BROKER_SHM_NAME.
+ *
+ * @return A status code, ML_NOT_FOUND if no broker is running and
+ * ML_INDEX_OUT_OF_BOUNDS if every slot is taken.
+ */
+static inline ml_error_code
+ml_broker_connect(ml_broker_client_t *client, const char *name)
+{
+    ml_broker_shm_t *shm = NULL;
+    int fd = -1;
+
+    if (client == NULL) {
+        return ML_NULL_POINTER;
+    }
+    fd = shm_open(name != NULL ? name : ML_BROKER_SHM_NAME, O_RDWR, 0);
+    if (fd < 0) {
+        return ML_NOT_FOUND;
+    }
+    shm = (ml_broker_shm_t *)mmap(NULL, sizeof(ml_broker_shm_t),
+                                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return ML_ALLOC_FAILED;
+    }
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != ML_BROKER_MAGIC ||
+        shm->version != ML_BROKER_VERSION) {
+        munmap(shm, sizeof(ml_broker_shm_t));
+        return ML_NOT_FOUND;
+    }
+
+    for (uint32_t i = 0; i < ML_BROKER_MAX_CLIENTS; i++) {
+        ml_broker_client_slot_t *slot = &shm->clients[i];
+        int32_t expected = 0;
+        // The broker resets the rings before it frees a slot.
+        if (__atomic_compare_exchange_n(&slot->owner, &expected,
+                                        (int32_t)getpid(), 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            client->shm = shm;
+            client->slot = slot;
+            return ML_OK;
+        }
+    }
+
+    munmap(shm, sizeof(ml_broker_shm_t));
+    return ML_INDEX_OUT_OF_BOUNDS;
+}
+
+/**
+ * @brief Gives the client slot back and unmaps the segment.
+ *
+ * @param client The client.
+ *
+ * @return A status code.
+ */
+static inline ml_error_code
+ml_broker_disconnect(ml_broker_client_t *client)
+{
+    if (client == NULL || client->shm == NULL) {
+        return ML_NULL_POINTER;
+    }
+    // The broker recycles the slot once our commands have finished.
+    __atomic_store_n(&client->slot->closing, 1, __ATOMIC_RELEASE);
+    munmap(client->shm, sizeof(ml_broker_shm_t));
+    client->shm = NULL;
+    client->slot = NULL;
+    return ML_OK;
+}
+
+/**
+ * @brief Queues a command with the broker, never blocks.
+ *
+ * @param client The client.
+ * @param request The command.
+ *
+ * @return A status code, ML_INDEX_OUT_OF_BOUNDS if the ring is full.
+ */
+static inline ml_error_code
+ml_broker_submit(ml_broker_client_t *client,
+                 const ml_broker_request_t *request)
+{
+    ml_broker_request_ring_t *ring = &client->slot->requests;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == ML_BROKER_RING_SIZE) {
+        return ML_INDEX_OUT_OF_BOUNDS;
+    }
+    ring->entries[head & (ML_BROKER_RING_SIZE - 1)] = *request;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return ML_OK;
+}
+
+/**
+ * @brief Takes the next completion, never blocks.
+ *
+ * @param client The client.
+ * @param completion Where to put the completion.
+ *
+ * @return ML_OK if there was one, ML_COUNT_ZERO if not.
+ */
+static inline ml_error_code
+ml_broker_poll(ml_broker_client_t *client, ml_broker_completion_t *completion)
+{
+    ml_broker_completion_ring_t *ring = &client->slot->completions;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return ML_COUNT_ZERO;
+    }
+    *completion = ring->entries[tail & (ML_BROKER_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return ML_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,6 +9,7 @@
 #ifndef LIBMISSILELAUNCHER_INTERNAL_H
 #define LIBMISSILELAUNCHER_INTERNAL_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -16,75 +17,553 @@
 
 #include "libmissilelauncher.h"
 
-// Cross platform compatibility
-#if defined(WINDOWS)
-/* Use for only second values */
-#define ml_second_sleep(seconds) Sleep(1000 * seconds) // Seconds to milliseconds
-/* Use for less than one second */
-#define ml_msecond_sleep(mseconds) Sleep(mseconds) // milliseconds
-#else
+#if !defined(WINDOWS)
 #include <unistd.h>
-/* Use only for second values */
-#define ml_second_sleep(seconds) sleep(seconds)  // No conversion necessary
-/* Use for less than one second */
-#define ml_msecond_sleep(mseconds) usleep(mseconds * 1000)
 #endif
 
-#define ML_MAX_LAUNCHER_ARRAY_SIZE 256
+#define ML_MAX_LAUNCHER_ARRAY_SIZE 4096
 #define ML_INITIAL_LAUNCHER_ARRAY_SIZE 8
+#define ML_CACHE_LINE_SIZE 64
+// USB device numbers are 7 bits.
+#define ML_MAX_USB_DEVICES 128
 
-#define ML_CMD_ARR_SIZE 2
-#define ML_REQUEST_TYPE_SEND 0x21
-#define ML_REQUEST_FIELD_SEND 0x09
+// Longest command any driver sends.
+#define ML_MAX_CMD_SIZE 8
+#define ML_DRIVER_HASH_BITS 6
+#define ML_DRIVER_HASH_SIZE (1 << ML_DRIVER_HASH_BITS)
+
+// Status reports come back on the driver's interrupt IN endpoint.
+#define ML_STATUS_SIZE 8
+#define ML_STATUS_TIMEOUT_MS 20
+// How often to check the limit switches while driving to an end stop.
+#define ML_LIMIT_POLL_MS 10
+// How long the launcher keeps moving after a stop command.
+#define ML_COAST_MS 200
+// A pulse is too short to get the motor up to speed, it settles this long
+// after its stop instead of coasting, see ML_COMMAND_PULSE.
+#define ML_PULSE_SETTLE_MS 25
+// Most pulses a nudge sends per axis. Past about this many a move gets
+// there sooner, coast and all.
+#define ML_NUDGE_MAX_PULSES 8
+// The fire done bit is left over from the last shot until this long after
+// a fire is sent. If it hasn't shown up this long after the firing cycle
+// should have ended, the model's report doesn't have it.
+#define ML_FIRE_SETTLE_MS 500
+#define ML_FIRE_GRACE_MS 1000
+// In precise timing mode the scheduler stops listening for new commands
+// this long before a stop is due and sleeps straight to it.
+#define ML_PRECISE_WINDOW_NS 2000000
+// Where ML_INIT_VIRTUAL_CLOCK starts, an hour in, so no time is mistaken
+// for 0, which means unset in many places.
+#define ML_VIRTUAL_CLOCK_START_NS 3600000000000ULL
+// Defaults for ml_tracker_configure.
+#define ML_TRACK_DEADBAND_MDEG 1000
+#define ML_TRACK_LATENCY_MS 20
+// How often the tracker looks again while its target is moving.
+#define ML_TRACK_REPLAN_MS 20
+// Samples further apart than this don't give a velocity, and a target is
+// never extrapolated further than this past its last sample.
+#define ML_TRACK_STALE_MS 250
+
+// A command slower than this after the launcher sat idle for
+// ML_RESUME_IDLE_MS, the kernel's default autosuspend delay, is counted as
+// waiting for the device to resume.
+#define ML_RESUME_SLOW_NS 10000000
+#define ML_RESUME_IDLE_MS 2000
+#define ML_POWER_CONTROL_SIZE 8
+
+// Most targets ml_plan_engagement orders, its cost table is this squared.
+#define ML_PLAN_MAX_TARGETS 1024
+
+// Log ring slots, a power of two. Records that don't fit are dropped.
+#define ML_LOG_RING_SIZE 1024
+#define ML_LOG_MAX_ARGS 4
+#define ML_LOG_MESSAGE_SIZE 256
+// How often the log thread drains the ring, see ml_log_start.
+#define ML_LOG_DRAIN_MS 50
+
+// How long an unclaimed launcher keeps its USB handle open by default.
+#define ML_DEFAULT_CLAIM_IDLE_TIMEOUT_MS 5000
+// Most threads ml_launcher_array_claim will use to open launchers.
+#define ML_MAX_CLAIM_WORKERS 8
+
+#define ML_INITIAL_QUEUE_SIZE 8
+#define ML_INITIAL_SCHEDULER_SIZE 8
+#define ML_MAX_USB_BUSES 256
+
+// Where devices are looked up and opened on Linux, see
+// ml_library_set_sysfs_root.
+#define ML_SYSFS_ROOT "/sys"
+#define ML_USBFS_ROOT "/dev/bus/usb"
+#define ML_SYSFS_ROOT_SIZE 128
+// Longest port path, the bus and port numbers like 1-4.2. It is also the
+// device's name in sysfs.
+#define ML_PORT_PATH_SIZE 32
+#define ML_MAX_PORT_DEPTH 7
+#define ML_SERIAL_SIZE 64
+#define ML_SYSFS_PATH_SIZE 256
+
+// libusb 1.0.23 can wrap a file descriptor the library opened itself, which
+// is how launchers are opened without enumerating the bus.
+#if defined(LINUX) && defined(LIBUSB_API_VERSION) && \
+    LIBUSB_API_VERSION >= 0x01000107
+#define ML_HAVE_USB_WRAP 1
+#endif
+
+// Simulated launchers, see ml_sim_add, are put on the highest bus numbers
+// counting down. How far they turn, in millidegrees.
+#define ML_SIM_TRAVEL_HORIZONTAL 270000
+#define ML_SIM_TRAVEL_VERTICAL 45000
+// How long a simulated motor takes to get up to speed, and to stop again.
+// The two are the same, so a long enough move covers exactly its axis
+// speed times the time it was driven, like _ml_launcher_position_at says.
+#define ML_SIM_RAMP_MS 40
+// How long after a fire a simulated launcher reports the shot as done.
+#define ML_SIM_FIRE_MS 2800
+
+// A USB device as described by sysfs.
+typedef struct ml_sysfs_device_t
+{
+	char      port_path[ML_PORT_PATH_SIZE];
+	char      serial[ML_SERIAL_SIZE];
+	uint16_t  vendor_id;
+	uint16_t  product_id;
+	uint8_t   usb_bus;
+	uint8_t   usb_device_number;
+} ml_sysfs_device_t;
+
+// Who a launcher found by a libusb poll is, read before the controller
+// lock is taken. Not read for devices the controller already has.
+typedef struct ml_usb_identity_t
+{
+	char      port_path[ML_PORT_PATH_SIZE];
+	char      serial[ML_SERIAL_SIZE];
+	bool      read;
+} ml_usb_identity_t;
+
+// How a launcher's transfers reach its device, see ml_usb_transport. The
+// transfers take and return what their libusb counterparts do.
+typedef struct ml_transport_t
+{
+	ml_error_code (*open)(ml_launcher_t *);
+	void (*close)(ml_launcher_t *);
+	int (*control)(ml_launcher_t *, uint8_t, uint8_t, uint16_t, uint16_t,
+	    unsigned char *, uint16_t, unsigned int);
+	int (*interrupt)(ml_launcher_t *, unsigned char, unsigned char *, int,
+	    int *, unsigned int);
+} ml_transport_t;
+
+// A launcher that only exists in memory, see ml_sim_add. Positions are in
+// millidegrees and velocities in millidegrees per second, horizontal first.
+// Everything is brought up to date on each transfer.
+typedef struct ml_sim_device_t
+{
+	pthread_mutex_t lock;
+	uint32_t  flags;
+	double    position[2];
+	double    velocity[2];
+	// The direction the motor is driven in, -1 for none.
+	int8_t    driven;
+	uint64_t  updated_ns;
+	// When the last fire came in, 0 for never.
+	uint64_t  fired_ns;
+	uint32_t  shots;
+	uint32_t  commands;
+	bool      led;
+} ml_sim_device_t;
+
+// A command waiting in a launcher's queue.
+typedef struct ml_sched_entry_t
+{
+	ml_command_t cmd;
+	uint64_t  seq;
+	uint64_t  deadline;
+} ml_sched_entry_t;
+
+// A submitted command on its way from ml_launcher_submit to the scheduler.
+// It comes with a reference and a lease on its launcher, taken by the
+// submitter so the scheduler never opens a launcher itself.
+typedef struct ml_sched_node_t
+{
+	struct ml_sched_node_t *next;
+	struct ml_launcher_t *launcher;
+	ml_error_code status;
+	// Still holds its reference and lease, unless the launcher's
+	// membership took them over.
+	bool      held;
+	ml_sched_entry_t entry;
+} ml_sched_node_t;
+
+// Everything the library logs. Records only hold the event and its raw
+// arguments, the format strings are in ml_log.c.
+typedef enum ml_log_event
+{
+	ML_LOG_USB_OPEN_FAILED,
+	ML_LOG_USB_WRAP_FAILED,
+	ML_LOG_USB_DETACH_FAILED,
+	ML_LOG_USB_CLAIM_FAILED,
+	ML_LOG_CMD_FAILED,
+	ML_LOG_CMD_SENT,
+	ML_LOG_CMD_RESUMED,
+	ML_LOG_STATUS_FAILED,
+	ML_LOG_KEEP_ALIVE_FAILED,
+	ML_LOG_POWER_PIN_FAILED,
+	ML_LOG_LAUNCHER_ADDED,
+	ML_LOG_LAUNCHER_DISCONNECTED,
+	ML_LOG_LAUNCHER_RECONNECTED,
+	ML_LOG_DEADLINE_MISSED,
+	ML_LOG_EVENT_COUNT
+} ml_log_event;
+
+// A logged event waiting to be formatted. seq says whose turn the slot is,
+// see _ml_log.
+typedef struct ml_log_record_t
+{
+	uint64_t  seq;
+	uint64_t  timestamp_ns;
+	int64_t   args[ML_LOG_MAX_ARGS];
+	ml_log_event event;
+} ml_log_record_t;
+
+// A launcher's streaming target, see ml_tracker_push.
+typedef struct ml_tracker_t
+{
+	// The latest sample, written by one pushing thread at a time. seq is
+	// odd while a write is in progress.
+	uint32_t  seq;
+	uint32_t  horizontal;
+	uint32_t  vertical;
+	uint64_t  sample_ns;
+	bool      stop;
+	// Millidegrees and milliseconds, see ml_tracker_configure.
+	uint32_t  deadband;
+	uint32_t  latency_ms;
+	// Pushed onto the launcher's inbox to wake the scheduler, set while it
+	// is there.
+	bool      queued;
+	ml_sched_node_t node;
+
+	// Owned by the scheduler thread, see _ml_tracker_plan.
+	bool      active;
+	uint32_t  seen;
+	int64_t   goal[2];
+	int64_t   rate[2];
+	uint64_t  goal_ns;
+} ml_tracker_t;
+
+// Where a launcher's current timed move is at.
+typedef enum ml_sched_phase
+{
+	ML_SCHED_IDLE,
+	ML_SCHED_MOVING,
+	ML_SCHED_COASTING,
+	ML_SCHED_FIRING
+} ml_sched_phase;
+
+// Hot per launcher state, one array per field indexed by the launcher's
+// slot in the launcher array, see ML_FLEET. Scans over the whole fleet read
+// only the fields they need a cache line at a time instead of chasing a
+// pointer per launcher. The arrays are sized for ML_MAX_LAUNCHER_ARRAY_SIZE
+// up front and never move, so the scheduler can update a launcher without
+// the controller lock. Anything else needs the controller lock.
+typedef struct ml_fleet_t
+{
+	uint8_t   *connected;
+	uint8_t   *claimed;
+	uint8_t   *led_status;
+	// Written by the scheduler thread.
+	uint8_t   *limit_status;
+	uint32_t  *lease_count;
+	// Millidegrees from the left and bottom end stops, written by the
+	// scheduler thread, see _ml_launcher_track_cmd.
+	uint32_t  *horizontal_position;
+	uint32_t  *vertical_position;
+	// Handed out when a launcher is added, never reused.
+	uint32_t  *id;
+	// Copies of the launcher's own fields for scans.
+	uint8_t   *type;
+	uint8_t   *usb_bus;
+	uint8_t   *usb_device_number;
+	// The slot plus one of the connected launcher at each USB location,
+	// bus * ML_MAX_USB_DEVICES + device number, 0 if there is none.
+	int16_t   *by_location;
+	void      *block;
+} ml_fleet_t;
+
+// A launcher's hot state, only valid while it is in the launcher array.
+#define ML_FLEET(launcher, field) \
+	((launcher)->controller->fleet.field[(launcher)->slot])
 
 typedef struct ml_launcher_t
 {
 	ml_launcher_type type;
 	uint8_t   usb_bus;
 	uint8_t   usb_device_number;
-	uint8_t   device_connected;
 	uint32_t  ref_count;
-	bool      claimed;
+	// Index in the launcher array and the fleet table, -1 if not added.
+	int16_t   slot;
 
-	uint32_t  horizontal_position;
-	uint32_t  vertical_position;
-	uint8_t   led_status;
+	// The USB handle may outlive a claim, see ml_launcher_unclaim.
+	bool      usb_open;
+	bool      usb_opening;
+	uint64_t  usb_idle_since;
+	// Opened through usbfs rather than libusb_open, see
+	// ml_launcher_open_by_path. The descriptor is closed with the handle.
+	bool      usb_wrapped;
+	int       usb_fd;
+	// Set by a poll that found the launcher again on a new device, the old
+	// handle is swapped for a new one once the poll is done.
+	bool      usb_reattach;
+	// While set transfers fail instead of touching the handle, see
+	// _ml_launcher_usb_enter.
+	bool      usb_stale;
+	uint32_t  usb_transfers;
+	// Monotonic milliseconds at the end of the last transfer.
+	uint64_t  usb_last_io;
+	// Links launchers with a keep-alive due, only used by the reaper, see
+	// _ml_controller_keep_alive_due_unsafe.
+	struct ml_launcher_t *keep_alive_next;
+
+	// Set while claimed with ML_CLAIM_NO_SUSPEND, protected by the
+	// controller lock. power_control is the setting to put back once
+	// autosuspend is no longer pinned off.
+	bool      power_keep;
+	bool      power_pinned;
+	char      power_control[ML_POWER_CONTROL_SIZE];
+	// See ml_power_stats_t.
+	uint32_t  power_commands;
+	uint32_t  power_resumes;
+	uint32_t  power_keep_alives;
+
+	// Identifies the launcher across reconnects, see
+	// _ml_launcher_same_identity.
+	char      port_path[ML_PORT_PATH_SIZE];
+	char      serial[ML_SERIAL_SIZE];
 
 	libusb_device *usb_device;
 	libusb_device_handle *usb_handle;
+	const struct ml_driver_t *driver;
+	// How transfers get to the device. A simulated launcher has its device
+	// in sim, see ml_sim_add.
+	const ml_transport_t *transport;
+	ml_sim_device_t *sim;
+
+	// Millidegrees per second, indexed by ml_launcher_direction. Starts
+	// out as the driver's, see ml_launcher_set_axis_speed.
+	uint32_t  axis_speed[4];
+	// How far short pulses turn, indexed the same way, see
+	// ml_launcher_set_pulse_table. The running pulse started at pulse_from
+	// on its axis.
+	ml_pulse_t pulse_table[4][ML_PULSE_TABLE_SIZE];
+	uint32_t  pulse_count[4];
+	uint32_t  pulse_from;
+	// Missiles left, see ml_launcher_set_ammo. Fires only stop at zero
+	// once the count has been set.
+	uint32_t  ammo;
+	bool      ammo_enforced;
+	// When the running fire was sent, monotonic milliseconds.
+	uint64_t  fire_sent;
+	// Set until a shot runs out its cycle without the status report saying
+	// it was done, from then on this launcher's shots are timed.
+	bool      fire_reported;
+
+	// The move that was sent last and when, -1 while stopped.
+	int8_t    motion_direction;
+	uint64_t  motion_since_ns;
+	// Set once the position was found by zeroing or restored from the
+	// pose file, see ml_launcher_has_position.
+	bool      pose_known;
+	// This launcher's entry in the pose file, -1 for none.
+	int32_t   pose_slot;
+
+	// Lock free stack of submitted commands, newest first. Any thread may
+	// push, only the scheduler thread takes them off.
+	ml_sched_node_t *inbox;
+	struct ml_launcher_t *ready_next;
+
+	// Command queue, protected by the scheduler lock.
+	ml_sched_entry_t *queue;
+	uint32_t  queue_length;
+	uint32_t  queue_size;
+	ml_sched_entry_t active;
+	ml_sched_phase active_phase;
+	uint64_t  active_until;
+	uint64_t  stop_at_ns;
+	uint64_t  next_limit_poll;
+	bool      limit_polling;
+	uint64_t  sched_wake;
+	bool      sched_member;
+
+	ml_tracker_t tracker;
 
 	struct ml_controller_t *controller;
 } ml_arr_launcher_t;
 
+// Launchers aimed together, see ml_group_new.
+struct ml_group_t
+{
+	uint32_t count;
+	ml_launcher_t **members;
+};
+
+// Runs queued launcher commands on its own thread, one per USB bus.
+typedef struct ml_scheduler_t
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	uint64_t next_seq;
+
+	// Launchers whose inbox went from empty to not empty, pushed lock free
+	// by submitters. Submitters only take the lock to wake a sleeping
+	// scheduler.
+	struct ml_launcher_t *ready;
+	bool sleeping;
+
+	uint8_t usb_bus;
+	int cpu;
+
+	// Token bucket limiting how many commands are started on the bus.
+	uint32_t rate_limit;
+	uint64_t rate_tokens;
+	uint64_t rate_refilled;
+
+	// Launchers with queued or running commands.
+	struct ml_launcher_t **members;
+	uint32_t member_count;
+	uint32_t member_size;
+} ml_scheduler_t;
+
 struct ml_controller_t
 {
 	int16_t  launcher_count;
 	int16_t  launcher_array_size;
+	// No free slot below this one.
+	int16_t  launcher_free_hint;
+	uint32_t next_launcher_id;
 	uint8_t  poll_rate_seconds;
 	uint8_t  control_initialized;
 	uint8_t  currently_polling;
+	// ML_INIT_* flags the library was started with.
+	uint32_t init_flags;
+	char     sysfs_root[ML_SYSFS_ROOT_SIZE];
+	char     usbfs_root[ML_SYSFS_ROOT_SIZE];
+	// Simulated launchers added so far, see ml_sim_add.
+	uint32_t sim_count;
+
+	// Protects the launcher array, reference counts and claim state.
+	pthread_mutex_t lock;
+	// Signaled when a launcher finishes opening its USB handle.
+	pthread_cond_t open_cond;
+
+	// Closes USB handles that have been idle too long.
+	uint32_t claim_idle_timeout_ms;
+	// See ml_library_set_keep_alive, 0 for off.
+	uint32_t keep_alive_ms;
+	pthread_t reaper_thread;
+	pthread_cond_t reaper_cond;
+	bool reaper_running;
+
+	// How schedulers time stops, read without the lock.
+	ml_timing_mode timing_mode;
+	uint32_t timing_spin_us;
+
+	// Indexed by USB bus number, created on first use.
+	ml_scheduler_t *schedulers[ML_MAX_USB_BUSES];
+
+	// Records every command sent while set, see ml_journal_start.
+	struct ml_journal_t *journal;
+	uint32_t journal_writers;
+
+	// Saves every launcher's pose while set, see ml_pose_start.
+	struct ml_pose_t *pose;
+	uint32_t pose_writers;
 
 	struct ml_launcher_t **launchers;
+	ml_fleet_t fleet;
 };
 
+// Start of a journal file, followed by capacity records.
+#define ML_JOURNAL_MAGIC "MLJRNL01"
+#define ML_JOURNAL_VERSION 1
+
+typedef struct ml_journal_header_t
+{
+	char      magic[8];
+	uint32_t  version;
+	uint32_t  record_size;
+	uint32_t  capacity;
+	uint32_t  reserved;
+	// Realtime clock when the journal was started, to anchor timestamps.
+	uint64_t  started_realtime_ns;
+	uint64_t  started_monotonic_ns;
+	// Records written so far, the next one goes in head % capacity.
+	uint64_t  head;
+	uint8_t   padding[16];
+} ml_journal_header_t;
+
+typedef struct ml_journal_t
+{
+	int       fd;
+	void     *map;
+	size_t    map_size;
+	ml_journal_header_t *header;
+	ml_journal_record_t *records;
+	uint32_t  capacity;
+} ml_journal_t;
+
+// Start of a pose file, followed by capacity entries.
+#define ML_POSE_MAGIC "MLPOSE01"
+#define ML_POSE_VERSION 1
+#define ML_POSE_CAPACITY 256
+
+typedef struct ml_pose_header_t
+{
+	char      magic[8];
+	uint32_t  version;
+	uint32_t  entry_size;
+	uint32_t  capacity;
+	uint32_t  reserved;
+} ml_pose_header_t;
+
+// Where a launcher was left, found again by _ml_launcher_same_identity.
+typedef struct ml_pose_entry_t
+{
+	uint8_t   used;
+	// Set when the library let go of the launcher in an orderly way,
+	// cleared while it is in use.
+	uint8_t   clean;
+	// The position was found by zeroing, it isn't a guess.
+	uint8_t   known;
+	// A move was running when the entry was written.
+	uint8_t   moving;
+	uint32_t  horizontal;
+	uint32_t  vertical;
+	uint32_t  reserved;
+	char      port_path[ML_PORT_PATH_SIZE];
+	char      serial[ML_SERIAL_SIZE];
+} ml_pose_entry_t;
+
+typedef struct ml_pose_t
+{
+	int       fd;
+	void     *map;
+	size_t    map_size;
+	ml_pose_header_t *header;
+	ml_pose_entry_t *entries;
+} ml_pose_t;
+
 typedef struct ml_time_t
 {
 	uint32_t seconds;
 	uint32_t mseconds;
 } ml_time_t;
 
-// ***** Global Statics *****
-static ml_controller_t __attribute__ ((unused)) *ml_main_controller = NULL;
-
-// Launcher commands
-static unsigned char ml_down_cmd[ML_CMD_ARR_SIZE] =      {0x02, 0x01};
-static unsigned char ml_up_cmd[ML_CMD_ARR_SIZE] =        {0x02, 0x02};
-static unsigned char ml_left_cmd[ML_CMD_ARR_SIZE] =      {0x02, 0x04};
-static unsigned char ml_right_cmd[ML_CMD_ARR_SIZE] =     {0x02, 0x08};
-static unsigned char ml_led_on_cmd[ML_CMD_ARR_SIZE] =    {0x03, 0x01};
-static unsigned char ml_led_off_cmd[ML_CMD_ARR_SIZE] =   {0x03, 0x00};
-static unsigned char ml_fire_cmd[ML_CMD_ARR_SIZE] =      {0x02, 0x10};
-static unsigned char ml_stop_cmd[ML_CMD_ARR_SIZE] =      {0x02, 0x20};
+// ***** Globals *****
+extern ml_controller_t *ml_main_controller;
+extern const ml_transport_t ml_usb_transport;
+extern const ml_transport_t ml_sim_transport;
 
 // Launcher Command Enum
 typedef enum ml_launcher_cmd
@@ -100,12 +579,42 @@ typedef enum ml_launcher_cmd
     ML_COMMAND_COUNT
 } ml_launcher_cmd;
 
-// Launcher command array for fast look up
-static unsigned char __attribute__ ((unused)) *ml_cmd_arr[ML_COMMAND_COUNT] =
+// Everything that differs between launcher models, see ml_driver.c.
+typedef struct ml_driver_t
 {
-	ml_down_cmd, ml_up_cmd, ml_left_cmd, ml_right_cmd, ml_fire_cmd,
-	ml_stop_cmd, ml_led_on_cmd, ml_led_off_cmd
-};
+	const char *name;
+	ml_launcher_type type;
+	uint16_t vendor_id;
+	uint16_t product_id;
+
+	// Commands go out as control transfers.
+	uint8_t  request_type;
+	uint8_t  request_field;
+	uint16_t request_value;
+	uint16_t request_index;
+	uint8_t  cmd_size;
+	unsigned char cmds[ML_COMMAND_COUNT][ML_MAX_CMD_SIZE];
+
+	// Interrupt IN endpoint with limit switch reports, 0 for none.
+	uint8_t  status_endpoint;
+	// Where the status report says a shot has gone, a mask of 0 if it
+	// doesn't.
+	uint8_t  fire_done_byte;
+	uint8_t  fire_done_mask;
+	// How long one shot takes at worst, and how many missiles it holds.
+	uint32_t fire_cycle_ms;
+	uint32_t ammo_capacity;
+
+	// What ml_launcher_zero runs.
+	const ml_command_t *zero_steps;
+	uint32_t zero_step_count;
+
+	// Millidegrees per second, indexed by ml_launcher_direction.
+	uint32_t axis_speed[4];
+	// A typical unit's pulse calibration, indexed the same way.
+	ml_pulse_t pulse_table[4][ML_PULSE_TABLE_SIZE];
+	uint32_t pulse_count[4];
+} ml_driver_t;
 
 // ********** Library Functions **********
 #ifdef __cplusplus
@@ -116,16 +625,48 @@ extern "C" {
 ml_error_code _ml_controller_init(ml_controller_t *);
 ml_error_code _ml_controller_cleanup(ml_controller_t *);
 
+// Idle handle reaping
+ml_error_code _ml_controller_start_reaper(ml_controller_t *);
+ml_error_code _ml_controller_stop_reaper(ml_controller_t *);
+void _ml_controller_reap_idle_unsafe(ml_controller_t *, uint64_t *);
+ml_launcher_t *_ml_controller_keep_alive_due_unsafe(ml_controller_t *,
+                                                    uint64_t *);
+void _ml_controller_send_keep_alives(ml_controller_t *, ml_launcher_t *);
+
+// Scheduler
+ml_error_code _ml_scheduler_init(ml_scheduler_t *, uint8_t);
+ml_error_code _ml_scheduler_cleanup(ml_scheduler_t *);
+ml_error_code _ml_controller_get_scheduler(ml_controller_t *, uint8_t,
+    ml_scheduler_t **);
+ml_error_code _ml_scheduler_set_affinity(ml_scheduler_t *, int);
+ml_error_code _ml_scheduler_set_rate_limit(ml_scheduler_t *, uint32_t);
+ml_error_code _ml_launcher_submit_wait(ml_launcher_t *, ml_command_t *);
+ml_error_code _ml_launcher_submit_wait_n(ml_launcher_t *, ml_command_t *,
+                                         uint32_t);
+bool _ml_scheduler_is_current();
+ml_error_code _ml_scheduler_wake_tracker(ml_launcher_t *);
+
+// Tracking
+bool _ml_tracker_plan(ml_launcher_t *, uint64_t, ml_launcher_cmd *,
+    uint64_t *);
+
 // Polling
 ml_error_code _ml_poll_for_launchers(ml_controller_t *cont);
 ml_error_code _ml_update_launchers(ml_controller_t *,
-    struct libusb_device **, int);
+    libusb_device **, uint32_t, ml_usb_identity_t *);
 ml_error_code _ml_get_launchers_from_devices(libusb_device **,
     int, libusb_device ***, uint32_t *);
 ml_error_code _ml_remove_disconnected_launchers(ml_controller_t *,
     libusb_device **, uint32_t);
 ml_error_code _ml_add_new_launchers(ml_controller_t *,
-    libusb_device **, uint32_t *);
+    libusb_device **, uint32_t *, ml_usb_identity_t *);
+
+// Fleet
+ml_error_code _ml_fleet_init(ml_fleet_t *);
+void _ml_fleet_cleanup(ml_fleet_t *);
+void _ml_fleet_attach_unsafe(ml_launcher_t *);
+void _ml_fleet_detach_unsafe(ml_launcher_t *);
+ml_launcher_t *_ml_fleet_find_unsafe(ml_controller_t *, uint8_t, uint8_t);
 
 // Launcher Array
 ml_error_code _ml_remove_launcher(ml_controller_t *, ml_launcher_t *);
@@ -137,19 +678,88 @@ ml_error_code _ml_add_launcher_index(ml_controller_t *,
 // Launcher Init
 ml_error_code _ml_launcher_init(ml_controller_t *,
     ml_launcher_t *, libusb_device *);
+ml_error_code _ml_launcher_init_sysfs(ml_controller_t *,
+    ml_launcher_t *, ml_sysfs_device_t *);
+ml_error_code _ml_launcher_init_sim(ml_controller_t *,
+    ml_launcher_t *, uint32_t, ml_sim_device_t *);
 ml_error_code _ml_launcher_cleanup(ml_launcher_t **);
 uint8_t _ml_catagorize_device(struct libusb_device_descriptor *);
+const ml_driver_t *_ml_driver_find(uint16_t, uint16_t);
+
+// Sysfs
+ml_error_code _ml_sysfs_read_device(ml_controller_t *, const char *,
+    ml_sysfs_device_t *);
+ml_error_code _ml_sysfs_find_vid_pid(ml_controller_t *, uint16_t, uint16_t,
+    ml_sysfs_device_t *);
+ml_error_code _ml_sysfs_find_launchers(ml_controller_t *,
+    ml_sysfs_device_t **, uint32_t *);
+ml_error_code _ml_update_launchers_sysfs(ml_controller_t *,
+    ml_sysfs_device_t *, uint32_t);
+ml_error_code _ml_sysfs_pin_power(ml_controller_t *, const char *, char *);
+ml_error_code _ml_sysfs_restore_power(ml_controller_t *, const char *,
+    const char *);
+
+// Launcher Identity
+ml_error_code _ml_usb_port_path(libusb_device *, char *);
+ml_error_code _ml_usb_read_serial(libusb_device *, libusb_device_handle *,
+    char *);
+bool _ml_launcher_same_identity(ml_launcher_t *, const char *, const char *);
+ml_error_code _ml_launcher_reattach_unsafe(ml_launcher_t *, libusb_device *,
+    const char *);
+ml_error_code _ml_launcher_reattach_sysfs_unsafe(ml_launcher_t *,
+    ml_sysfs_device_t *);
+ml_error_code _ml_launcher_usb_reopen_unsafe(ml_launcher_t *);
 
 // Launcher Control
 ml_error_code ml_usb_open_launcher(ml_launcher_t *launcher);
 ml_error_code ml_usb_close_launcher(ml_launcher_t *launcher);
+ml_error_code _ml_launcher_usb_acquire_unsafe(ml_launcher_t *);
+ml_error_code _ml_launcher_usb_release_unsafe(ml_launcher_t *);
+bool _ml_launcher_is_claimed(ml_launcher_t *);
 ml_error_code _ml_launcher_move_unsafe(ml_launcher_t *, ml_launcher_direction);
-ml_error_code _ml_launcher_move_time_unsafe(ml_launcher_t *,
-    ml_launcher_direction, ml_time_t *);
 ml_error_code _ml_launcher_send_cmd_unsafe(ml_launcher_t *, ml_launcher_cmd);
+ml_error_code _ml_launcher_read_fire_unsafe(ml_launcher_t *, bool *);
+ml_error_code _ml_launcher_read_limits_unsafe(ml_launcher_t *, uint8_t *);
+ml_error_code _ml_launcher_keep_alive_unsafe(ml_launcher_t *);
+void _ml_launcher_position_at(ml_launcher_t *, uint64_t, uint32_t *,
+    uint32_t *);
+
+// Journal
+void _ml_journal_append(ml_controller_t *, ml_launcher_t *, ml_launcher_cmd,
+    ml_error_code, uint64_t);
+ml_error_code _ml_journal_close(ml_controller_t *);
+
+// Pose file
+void _ml_pose_attach_unsafe(ml_controller_t *, ml_launcher_t *);
+void _ml_pose_release_unsafe(ml_controller_t *, ml_launcher_t *);
+void _ml_pose_save(ml_launcher_t *);
+ml_error_code _ml_pose_close(ml_controller_t *);
+
+// Simulated launchers
+void _ml_sim_free(ml_sim_device_t *);
+
+// Fine aiming
+void _ml_pulse_begin(ml_launcher_t *);
+void _ml_pulse_end(ml_launcher_t *, uint32_t);
+uint32_t _ml_pulse_ran_ms(ml_launcher_t *);
+
+// Logging
+void _ml_log(ml_log_event, int64_t, int64_t, int64_t, int64_t);
+void _ml_log_cleanup();
 
 // Time Conversions
 ml_error_code _ml_mseconds_to_time(uint32_t, ml_time_t *);
+uint64_t _ml_monotonic_mseconds();
+uint64_t _ml_monotonic_nseconds();
+ml_error_code _ml_cond_init(pthread_cond_t *);
+bool _ml_cond_wait_until(pthread_cond_t *, pthread_mutex_t *, uint64_t);
+bool _ml_cond_wait_until_ns(pthread_cond_t *, pthread_mutex_t *, uint64_t);
+void _ml_sleep_until_ns(uint64_t, uint64_t);
+void _ml_cond_wait(pthread_cond_t *, pthread_mutex_t *);
+void _ml_cond_signal(pthread_cond_t *);
+ml_error_code _ml_thread_create(pthread_t *, void *(*)(void *), void *);
+void _ml_clock_init(bool);
+void _ml_clock_cleanup();
 
 #ifdef __cplusplus
 }
@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libmissilelauncher.h"
 #include "libmissilelauncher_internal.h"
@@ -32,9 +33,26 @@ _ml_controller_init(ml_controller_t *controller)
   if (controller->launchers == NULL) {
     return ML_ALLOC_FAILED;
   }
+  if (_ml_fleet_init(&controller->fleet) != ML_OK) {
+    free(controller->launchers);
+    controller->launchers = NULL;
+    return ML_ALLOC_FAILED;
+  }
+  if (pthread_mutex_init(&controller->lock, NULL) != 0 ||
+      pthread_cond_init(&controller->open_cond, NULL) != 0 ||
+      _ml_cond_init(&controller->reaper_cond) != ML_OK) {
+    _ml_fleet_cleanup(&controller->fleet);
+    free(controller->launchers);
+    controller->launchers = NULL;
+    return ML_ALLOC_FAILED;
+  }
   // Set default variables
   controller->launcher_array_size = ML_INITIAL_LAUNCHER_ARRAY_SIZE;
   controller->launcher_count = 0;
+  controller->launcher_free_hint = 0;
+  controller->claim_idle_timeout_ms = ML_DEFAULT_CLAIM_IDLE_TIMEOUT_MS;
+  strcpy(controller->sysfs_root, ML_SYSFS_ROOT);
+  strcpy(controller->usbfs_root, ML_USBFS_ROOT);
   // Good to go!
   controller->control_initialized = 1;
   return ML_OK;
@@ -61,6 +79,18 @@ _ml_controller_cleanup(ml_controller_t *controller)
   if (controller->launchers == NULL) {
     return ML_LAUNCHER_ARRAY_INCONSISTENT;
   }
+  // Finish with the launchers before they go away.
+  for (int i = 0; i < ML_MAX_USB_BUSES; i++) {
+    if (controller->schedulers[i] != NULL) {
+      _ml_scheduler_cleanup(controller->schedulers[i]);
+      free(controller->schedulers[i]);
+      controller->schedulers[i] = NULL;
+    }
+  }
+  _ml_controller_stop_reaper(controller);
+  _ml_journal_close(controller);
+  // Every launcher has stopped, so their poses can be trusted next time.
+  _ml_pose_close(controller);
   // Cleaning up the library. Free up every launcher.
   for (int16_t i = 0; i < controller->launcher_array_size; i++) {
     cur_launcher = controller->launchers[i];
@@ -75,13 +105,327 @@ _ml_controller_cleanup(ml_controller_t *controller)
   controller->launchers = NULL;
   controller->launcher_array_size = 0;
   controller->launcher_count = 0;
+  _ml_fleet_cleanup(&controller->fleet);
+  pthread_cond_destroy(&controller->reaper_cond);
+  pthread_cond_destroy(&controller->open_cond);
+  pthread_mutex_destroy(&controller->lock);
   // Controll is no longer initialized
   controller->control_initialized = 0;
   return ML_OK;
 }
 
+/**
+ * @brief Body of the reaper thread, closes idle USB handles once they pass
+ * the claim idle timeout and sends keep-alives, see
+ * ml_library_set_keep_alive.
+ *
+ * @param arg The controller.
+ *
+ * @return Nothing.
+ */
+static void *
+_ml_controller_reaper(void *arg)
+{
+  ml_controller_t *cont = arg;
+  ml_launcher_t *due = NULL;
+  uint64_t next_expiry = 0, next_keep_alive = 0;
+
+  pthread_mutex_lock(&cont->lock);
+  while (cont->reaper_running) {
+    _ml_controller_reap_idle_unsafe(cont, &next_expiry);
+    due = _ml_controller_keep_alive_due_unsafe(cont, &next_keep_alive);
+    if (due != NULL) {
+      // A keep-alive waits on the device, don't hold up everyone else.
+      pthread_mutex_unlock(&cont->lock);
+      _ml_controller_send_keep_alives(cont, due);
+      pthread_mutex_lock(&cont->lock);
+      // Anything may have changed while unlocked, including a stop.
+      continue;
+    }
+    if (next_expiry == 0 ||
+        (next_keep_alive != 0 && next_keep_alive < next_expiry)) {
+      next_expiry = next_keep_alive;
+    }
+    if (next_expiry == 0) {
+      // Nothing is idle, sleep until a handle is released or a keep-alive
+      // is turned on.
+      _ml_cond_wait(&cont->reaper_cond, &cont->lock);
+    } else {
+      _ml_cond_wait_until(&cont->reaper_cond, &cont->lock, next_expiry);
+    }
+  }
+  pthread_mutex_unlock(&cont->lock);
+  return NULL;
+}
+
+/**
+ * @brief Starts the reaper thread. Hold the controller lock.
+ *
+ * @param cont The controller.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_controller_start_reaper(ml_controller_t *cont)
+{
+  if (cont->reaper_running) {
+    return ML_OK;
+  }
+  cont->reaper_running = true;
+  if (_ml_thread_create(&cont->reaper_thread, _ml_controller_reaper,
+                        cont) != ML_OK) {
+    cont->reaper_running = false;
+    return ML_ALLOC_FAILED;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Stops the reaper thread and waits for it to exit.
+ * Don't hold the controller lock.
+ *
+ * @param cont The controller.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_controller_stop_reaper(ml_controller_t *cont)
+{
+  pthread_mutex_lock(&cont->lock);
+  if (!cont->reaper_running) {
+    pthread_mutex_unlock(&cont->lock);
+    return ML_OK;
+  }
+  cont->reaper_running = false;
+  _ml_cond_signal(&cont->reaper_cond);
+  pthread_mutex_unlock(&cont->lock);
+
+  pthread_join(cont->reaper_thread, NULL);
+  return ML_OK;
+}
+
+/**
+ * @brief Closes every USB handle that nobody holds and that has been idle
+ * longer than the claim idle timeout. Hold the controller lock.
+ *
+ * @param cont The controller.
+ * @param next_expiry Set to when the next idle handle expires, 0 if none.
+ */
+void
+_ml_controller_reap_idle_unsafe(ml_controller_t *cont, uint64_t *next_expiry)
+{
+  ml_launcher_t *launcher = NULL;
+  uint64_t now = _ml_monotonic_mseconds(), expiry = 0;
+
+  (*next_expiry) = 0;
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+    launcher = cont->launchers[i];
+    if (launcher == NULL || launcher->usb_opening || !launcher->usb_open ||
+        _ml_launcher_is_claimed(launcher)) {
+      continue;
+    }
+
+    expiry = launcher->usb_idle_since + cont->claim_idle_timeout_ms;
+    if (expiry <= now) {
+      ml_usb_close_launcher(launcher);
+    } else if ((*next_expiry) == 0 || expiry < (*next_expiry)) {
+      (*next_expiry) = expiry;
+    }
+  }
+}
+
+/**
+ * @brief Finds every launcher claimed with ML_CLAIM_NO_SUSPEND that has had
+ * no traffic for the keep-alive interval. Each one found is referenced and
+ * leased so it stays open once the lock is dropped, see
+ * _ml_controller_send_keep_alives. Hold the controller lock.
+ *
+ * @param cont The controller.
+ * @param next_due Set to when the next keep-alive is due, 0 if none.
+ *
+ * @return The launchers with a keep-alive due, linked through
+ * keep_alive_next, NULL if none.
+ */
+ml_launcher_t *
+_ml_controller_keep_alive_due_unsafe(ml_controller_t *cont,
+                                     uint64_t *next_due)
+{
+  ml_launcher_t *launcher = NULL, *due_list = NULL;
+  uint64_t now = _ml_monotonic_mseconds(), due = 0;
+
+  (*next_due) = 0;
+  if (cont->keep_alive_ms == 0) {
+    return NULL;
+  }
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+    launcher = cont->launchers[i];
+    if (launcher == NULL || !launcher->power_keep || !launcher->usb_open ||
+        !ML_FLEET(launcher, connected)) {
+      continue;
+    }
+
+    due = __atomic_load_n(&launcher->usb_last_io, __ATOMIC_RELAXED) +
+      cont->keep_alive_ms;
+    if (due <= now) {
+      __atomic_add_fetch(&launcher->ref_count, 1, __ATOMIC_RELAXED);
+      ML_FLEET(launcher, lease_count) += 1;
+      launcher->keep_alive_next = due_list;
+      due_list = launcher;
+      due = now + cont->keep_alive_ms;
+    }
+    if ((*next_due) == 0 || due < (*next_due)) {
+      (*next_due) = due;
+    }
+  }
+  return due_list;
+}
+
+/**
+ * @brief Sends a keep-alive to each launcher found by
+ * _ml_controller_keep_alive_due_unsafe and gives back the reference and
+ * lease it took. Don't hold the controller lock.
+ *
+ * @param cont The controller.
+ * @param due_list The launchers, linked through keep_alive_next.
+ */
+void
+_ml_controller_send_keep_alives(ml_controller_t *cont,
+                                ml_launcher_t *due_list)
+{
+  ml_launcher_t *launcher = NULL;
+
+  for (launcher = due_list; launcher != NULL;
+       launcher = launcher->keep_alive_next) {
+    _ml_launcher_keep_alive_unsafe(launcher);
+  }
+
+  pthread_mutex_lock(&cont->lock);
+  for (launcher = due_list; launcher != NULL;
+       launcher = launcher->keep_alive_next) {
+    ML_FLEET(launcher, lease_count) -= 1;
+    _ml_launcher_usb_release_unsafe(launcher);
+  }
+  pthread_mutex_unlock(&cont->lock);
+
+  while (due_list != NULL) {
+    launcher = due_list;
+    due_list = launcher->keep_alive_next;
+    ml_launcher_dereference(launcher);
+  }
+}
+
+/**
+ * @brief Gets the scheduler for a USB bus, creating it if needed.
+ * Each bus gets its own scheduler thread so a busy bus doesn't hold up
+ * launchers on another.
+ *
+ * @param cont The controller.
+ * @param usb_bus The bus number.
+ * @param sched Where to put the scheduler.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_controller_get_scheduler(ml_controller_t *cont, uint8_t usb_bus,
+                             ml_scheduler_t **sched)
+{
+  ml_scheduler_t *new_sched = NULL;
+  ml_error_code result = ML_OK;
+
+  // Schedulers live until cleanup, so once one exists no lock is needed.
+  (*sched) = __atomic_load_n(&cont->schedulers[usb_bus], __ATOMIC_ACQUIRE);
+  if ((*sched) != NULL) {
+    return ML_OK;
+  }
+
+  pthread_mutex_lock(&cont->lock);
+  if (cont->schedulers[usb_bus] == NULL) {
+    new_sched = calloc(sizeof(ml_scheduler_t), 1);
+    if (new_sched == NULL) {
+      result = ML_ALLOC_FAILED;
+      goto out;
+    }
+    result = _ml_scheduler_init(new_sched, usb_bus);
+    if (result != ML_OK) {
+      free(new_sched);
+      goto out;
+    }
+    __atomic_store_n(&cont->schedulers[usb_bus], new_sched, __ATOMIC_RELEASE);
+  }
+  (*sched) = cont->schedulers[usb_bus];
+
+out:
+  pthread_mutex_unlock(&cont->lock);
+  return result;
+}
+
+/**
+ * @brief Gives launchers that came back while in use a handle on their new
+ * device. Hold the controller lock.
+ *
+ * @param cont The active controller.
+ */
+static void
+_ml_reopen_reattached_unsafe(ml_controller_t *cont)
+{
+  ml_launcher_t *launcher = NULL;
+
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+    launcher = cont->launchers[i];
+    if (launcher == NULL || !launcher->usb_reattach) {
+      continue;
+    }
+    launcher->usb_reattach = false;
+    // Keep it around while the lock is dropped.
+    __atomic_add_fetch(&launcher->ref_count, 1, __ATOMIC_RELAXED);
+    _ml_launcher_usb_reopen_unsafe(launcher);
+    __atomic_sub_fetch(&launcher->ref_count, 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief Reads the port path and serial of every launcher found by a
+ * libusb poll that the controller doesn't have yet. Reading a serial opens
+ * the device, so only the check for known devices holds the controller
+ * lock.
+ *
+ * @param cont The active controller.
+ * @param found_launchers The launchers found.
+ * @param found_launchers_count The number of launchers found.
+ * @param identities Where to put each launcher's identity, zeroed.
+ */
+static void
+_ml_read_identities(ml_controller_t *cont, libusb_device **found_launchers,
+                    uint32_t found_launchers_count,
+                    ml_usb_identity_t *identities)
+{
+  ml_launcher_t *known_launcher = NULL;
+  libusb_device *found_device = NULL;
+
+  pthread_mutex_lock(&cont->lock);
+  for (uint32_t i = 0; i < found_launchers_count; i++) {
+    found_device = found_launchers[i];
+    known_launcher = _ml_fleet_find_unsafe(
+      cont, libusb_get_bus_number(found_device),
+      libusb_get_device_address(found_device));
+    identities[i].read = known_launcher == NULL ||
+      known_launcher->usb_device != found_device;
+  }
+  pthread_mutex_unlock(&cont->lock);
+
+  for (uint32_t i = 0; i < found_launchers_count; i++) {
+    if (identities[i].read) {
+      _ml_usb_port_path(found_launchers[i], identities[i].port_path);
+      _ml_usb_read_serial(found_launchers[i], NULL, identities[i].serial);
+    }
+  }
+}
+
 /**
  * @brief Polls for new launchers.
+ * On Linux sysfs is read instead of asking libusb for a device list, which
+ * builds descriptors for every device on the system. libusb is only used
+ * when sysfs can't be read.
  *
  * @param cont The controller to poll.
  *
@@ -92,17 +436,53 @@ _ml_poll_for_launchers(ml_controller_t *cont)
 {
   int device_count = 0;
   ml_error_code status = 0;
-  libusb_device **devices = NULL;
+  libusb_device **devices = NULL, **found_launchers = NULL;
+  uint32_t found_launchers_count = 0;
+  ml_usb_identity_t *identities = NULL;
+
+#ifdef ML_HAVE_USB_WRAP
+  ml_sysfs_device_t *found = NULL;
+  uint32_t found_count = 0;
+
+  status = _ml_sysfs_find_launchers(cont, &found, &found_count);
+  if (status == ML_OK) {
+    pthread_mutex_lock(&cont->lock);
+    status = _ml_update_launchers_sysfs(cont, found, found_count);
+    _ml_reopen_reattached_unsafe(cont);
+    pthread_mutex_unlock(&cont->lock);
+    free(found);
+    return status;
+  }
+#endif
+
   device_count = libusb_get_device_list(NULL, &devices);
-  status = _ml_update_launchers(cont, devices, device_count);
+  status = _ml_get_launchers_from_devices(devices, device_count,
+                                          &found_launchers,
+                                          &found_launchers_count);
+  if (status == ML_OK) {
+    identities = calloc(found_launchers_count + 1, sizeof(ml_usb_identity_t));
+    if (identities == NULL) {
+      status = ML_ALLOC_FAILED;
+    }
+  }
+  if (status == ML_OK) {
+    _ml_read_identities(cont, found_launchers, found_launchers_count,
+                        identities);
+    pthread_mutex_lock(&cont->lock);
+    status = _ml_update_launchers(cont, found_launchers,
+                                  found_launchers_count, identities);
+    _ml_reopen_reattached_unsafe(cont);
+    pthread_mutex_unlock(&cont->lock);
+  }
+  free(identities);
+  free(found_launchers);
   libusb_free_device_list(devices, 1);
   return status;
 }
 
 /**
  * @brief This function catagorizes the type of launcher.
- * For now we only support:
- * Thunder Launchers - ML_STANDARD_LAUNCHER
+ * Supported models are listed in the driver table, see ml_driver.c.
  *
  * @param desc The USB device descriptor.
  *
@@ -111,44 +491,42 @@ _ml_poll_for_launchers(ml_controller_t *cont)
 uint8_t
 _ml_catagorize_device(struct libusb_device_descriptor *desc)
 {
-  if (desc->idProduct == ML_STD_PRODUCT_ID &&
-      desc->idVendor == ML_STD_VENDOR_ID) {
-    return ML_STANDARD_LAUNCHER;
+  const ml_driver_t *driver = NULL;
+
+  driver = _ml_driver_find(desc->idVendor, desc->idProduct);
+  if (driver == NULL) {
+    return ML_NOT_LAUNCHER;
   }
-  return ML_NOT_LAUNCHER;
+  return driver->type;
 }
 
 /**
- * @brief Checks the USB device array and sees if any devices were added or
+ * @brief Checks the launchers libusb found and sees if any were added or
  * removed.
- * If any devices were added or removed we update the array.
+ * If any launchers were added or removed we update the array. Hold the
+ * controller lock.
  *
  * @param cont The active controller.
- * @param devices The devices libusb found.
- * @param device_count the number of devices found.
+ * @param found_launchers The launchers libusb found.
+ * @param found_launchers_count The number of launchers found.
+ * @param identities Who they are, see _ml_read_identities.
  *
  * @return A status code, ML_OK if everything went well.
  */
 ml_error_code
-_ml_update_launchers(ml_controller_t *cont,
-                     struct libusb_device **devices, int device_count)
+_ml_update_launchers(ml_controller_t *cont, libusb_device **found_launchers,
+                     uint32_t found_launchers_count,
+                     ml_usb_identity_t *identities)
 {
-
-  libusb_device **found_launchers = NULL;
-  uint32_t found_launchers_count = 0;
-
-  _ml_get_launchers_from_devices(devices, device_count, &found_launchers,
-                                 &found_launchers_count);
-
-
   _ml_remove_disconnected_launchers(cont,
                                     found_launchers, found_launchers_count);
 
-  _ml_add_new_launchers(cont, found_launchers, &found_launchers_count);
-
-  free(found_launchers);
+  _ml_add_new_launchers(cont, found_launchers, &found_launchers_count,
+                        identities);
 
-  cont->launcher_count = found_launchers_count;
+  // launcher_count is kept by _ml_add_launcher and _ml_remove_launcher_index
+  // so it covers launchers opened by path and disconnected ones that are
+  // still referenced.
   return ML_OK;
 }
 
@@ -203,9 +581,169 @@ _ml_get_launchers_from_devices(libusb_device **devices,
   return ML_OK;
 }
 
+/**
+ * @brief Finds a connected launcher by its port path and references it.
+ * Hold the controller lock.
+ *
+ * @param cont The active controller.
+ * @param port_path The port path.
+ *
+ * @return The referenced launcher or NULL.
+ */
+static ml_launcher_t *
+_ml_find_launcher_unsafe(ml_controller_t *cont, const char *port_path)
+{
+  ml_launcher_t *cur_launcher = NULL;
+
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+    cur_launcher = cont->launchers[i];
+    if (cont->fleet.connected[i] &&
+        strcmp(cur_launcher->port_path, port_path) == 0) {
+      __atomic_add_fetch(&cur_launcher->ref_count, 1, __ATOMIC_RELAXED);
+      return cur_launcher;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Finds a disconnected launcher that a device is, see
+ * _ml_launcher_same_identity. Hold the controller lock.
+ *
+ * @param cont The active controller.
+ * @param port_path The port path of the device.
+ * @param serial The serial of the device, empty if it has none.
+ *
+ * @return The launcher or NULL.
+ */
+static ml_launcher_t *
+_ml_find_disconnected_unsafe(ml_controller_t *cont, const char *port_path,
+                             const char *serial)
+{
+  ml_launcher_t *cur_launcher = NULL;
+
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+    cur_launcher = cont->launchers[i];
+    if (cur_launcher != NULL && !cont->fleet.connected[i] &&
+        _ml_launcher_same_identity(cur_launcher, port_path, serial)) {
+      return cur_launcher;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Updates the connected state of a launcher after a poll. A
+ * launcher that is gone is freed unless someone still references it.
+ * Hold the controller lock.
+ *
+ * @param cont The active controller.
+ * @param index The index of the launcher in the array.
+ * @param found If the launcher was found by the poll.
+ */
+static void
+_ml_set_connected_unsafe(ml_controller_t *cont, int16_t index, uint8_t found)
+{
+  ml_launcher_t *known_launcher = cont->launchers[index];
+
+  // Update the connected state
+  if (!found && cont->fleet.connected[index]) {
+    _ml_log(ML_LOG_LAUNCHER_DISCONNECTED, known_launcher->usb_bus,
+            known_launcher->usb_device_number, cont->fleet.id[index], 0);
+    _ml_fleet_detach_unsafe(known_launcher);
+  }
+  // Nobody is using a cached handle, it's no good now.
+  if (!found && known_launcher->usb_open && !known_launcher->usb_opening &&
+      !_ml_launcher_is_claimed(known_launcher)) {
+    ml_usb_close_launcher(known_launcher);
+  }
+
+  if (!found &&
+      __atomic_load_n(&known_launcher->ref_count, __ATOMIC_ACQUIRE) == 0) {
+
+    // No one is refrencing the device, so we can free it.
+    _ml_remove_launcher_index(cont, index);
+    _ml_launcher_cleanup(&known_launcher);
+  }
+}
+
+/**
+ * @brief Updates the array from the launchers found in sysfs, like
+ * _ml_update_launchers does for libusb devices. A launcher is still
+ * connected if its port has the same device number. New launchers aren't
+ * opened until they are used. Known launchers are looked up by USB
+ * location, so this is linear in launchers plus devices. Hold the
+ * controller lock.
+ *
+ * @param cont The active controller.
+ * @param found The launchers found in sysfs.
+ * @param found_count The number of launchers found.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_update_launchers_sysfs(ml_controller_t *cont, ml_sysfs_device_t *found,
+                           uint32_t found_count)
+{
+  ml_launcher_t *known_launcher = NULL, *new_launcher = NULL;
+  uint8_t *matched = NULL, *seen = NULL;
+
+  matched = calloc(sizeof(uint8_t), found_count + 1);
+  seen = calloc(sizeof(uint8_t), cont->launcher_array_size);
+  if (matched == NULL || seen == NULL) {
+    free(matched);
+    free(seen);
+    return ML_ALLOC_FAILED;
+  }
+
+  for (uint32_t found_it = 0; found_it < found_count; found_it++) {
+    known_launcher = _ml_fleet_find_unsafe(cont, found[found_it].usb_bus,
+                                           found[found_it].usb_device_number);
+    if (known_launcher != NULL && !seen[known_launcher->slot] &&
+        strcmp(found[found_it].port_path, known_launcher->port_path) == 0) {
+      matched[found_it] = 1;
+      seen[known_launcher->slot] = 1;
+    }
+  }
+  for (int16_t known_it = 0; known_it < cont->launcher_array_size;
+       known_it++) {
+    // Simulated launchers are never found by a poll, nor unplugged.
+    if (cont->launchers[known_it] != NULL &&
+        cont->launchers[known_it]->sim == NULL) {
+      _ml_set_connected_unsafe(cont, known_it, seen[known_it]);
+    }
+  }
+
+  for (uint32_t found_it = 0; found_it < found_count; found_it++) {
+    if (matched[found_it]) {
+      continue;
+    }
+    known_launcher = _ml_find_disconnected_unsafe(cont,
+                                                  found[found_it].port_path,
+                                                  found[found_it].serial);
+    if (known_launcher != NULL) {
+      _ml_launcher_reattach_sysfs_unsafe(known_launcher, &found[found_it]);
+      continue;
+    }
+    new_launcher = calloc(sizeof(ml_launcher_t), 1);
+    if (new_launcher == NULL) {
+      break;
+    }
+    _ml_launcher_init_sysfs(cont, new_launcher, &found[found_it]);
+    if (_ml_add_launcher(cont, new_launcher) != ML_OK) {
+      _ml_launcher_cleanup(&new_launcher);
+    }
+  }
+
+  free(matched);
+  free(seen);
+  return ML_OK;
+}
+
 /**
  * @brief Sets launchers that have been removed as such and frees them if
- * proper.
+ * proper. Referenced launchers are kept so they can be reattached if the
+ * device comes back, see _ml_add_new_launchers.
  *
  * @param cont The active controller.
  * @param found_launchers An array of libusb_devices which are all launchers.
@@ -221,61 +759,53 @@ _ml_remove_disconnected_launchers(ml_controller_t *cont,
 
   libusb_device *found_device = NULL;
   ml_launcher_t *known_launcher = NULL;
+  uint8_t *seen = NULL;
 
-  // Check to see if we need to remove any devices
-  for (uint16_t known_it = 0;
-       known_it < cont->launcher_array_size; known_it++) {
-    // We'll be checking if the known device was not found in the new array of
-    // mounted devices.
-    uint8_t found = 0;
-
-    known_launcher = cont->launchers[known_it];
-    if (known_launcher == NULL) {
-      continue;
-    }
-
-    // Check if any devices were found.
-    if (found_launchers != NULL) {
-      // Check the devices we found
-      for (uint16_t found_it = 0;
-           found_it < found_launchers_count &&
-           (found_device = found_launchers[found_it]) != NULL && found == 0;
-           found_it++) {
-
-        if (known_launcher->usb_device == found_device) {
-          found = 1;
-        }
-      }
+  seen = calloc(sizeof(uint8_t), cont->launcher_array_size);
+  if (seen == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  // Mark the known launchers whose device was found.
+  for (uint32_t found_it = 0;
+       found_launchers != NULL && found_it < found_launchers_count &&
+       (found_device = found_launchers[found_it]) != NULL; found_it++) {
+    known_launcher = _ml_fleet_find_unsafe(
+      cont, libusb_get_bus_number(found_device),
+      libusb_get_device_address(found_device));
+    if (known_launcher != NULL && known_launcher->usb_device == found_device) {
+      seen[known_launcher->slot] = 1;
     }
-    // Update the connected state
-    known_launcher->device_connected = found;
-
-    if (known_launcher->device_connected == 0 &&
-        known_launcher->ref_count == 0) {
-
-      // No one is refrencing the device, so we can free it.
-      _ml_remove_launcher_index(cont, known_it);
-      _ml_launcher_cleanup(&known_launcher);
-    } else {
+  }
+  for (int16_t known_it = 0; known_it < cont->launcher_array_size;
+       known_it++) {
+    // Simulated launchers are never found by a poll, nor unplugged.
+    if (cont->launchers[known_it] != NULL &&
+        cont->launchers[known_it]->sim == NULL) {
+      _ml_set_connected_unsafe(cont, known_it, seen[known_it]);
     }
   }
 
+  free(seen);
   return ML_OK;
 }
 
 /**
- * @brief Adds new launchers to the main array.
+ * @brief Adds new launchers to the main array. A device that is a known
+ * launcher plugged back in, by port path or serial number, is reattached
+ * to it instead so its claim and state survive the reconnect.
  *
  * @param cont The active controller.
  * @param found_launchers The launchers found previously.
  * @param found_launchers_count The number of launchers found.
+ * @param identities Who they are, see _ml_read_identities.
  *
  * @return A status code.
  */
 ml_error_code
 _ml_add_new_launchers(ml_controller_t *cont,
                       libusb_device **found_launchers,
-                      uint32_t *found_launchers_count)
+                      uint32_t *found_launchers_count,
+                      ml_usb_identity_t *identities)
 {
 
   libusb_device *found_device = NULL;
@@ -289,15 +819,25 @@ _ml_add_new_launchers(ml_controller_t *cont,
        found_it++) {
     // We'll be checking if the device is already present
     uint8_t found = 0;
+    const char *port_path = identities[found_it].port_path;
+    const char *serial = identities[found_it].serial;
 
-    for (uint16_t known_it = 0;
-         known_it < cont->launcher_array_size && found == 0;
-         known_it++) {
-
-      known_launcher = cont->launchers[known_it];
-      if (known_launcher != NULL &&
-          known_launcher->usb_device == found_device) {
-        // Found something identical
+    known_launcher = _ml_fleet_find_unsafe(
+      cont, libusb_get_bus_number(found_device),
+      libusb_get_device_address(found_device));
+    if (known_launcher != NULL && known_launcher->usb_device == found_device) {
+      // Found something identical
+      found = 1;
+    }
+    if (found == 0 && !identities[found_it].read) {
+      // Known when identities were read but not any more, the next poll
+      // reads who it is.
+      found = 1;
+    }
+    if (found == 0) {
+      known_launcher = _ml_find_disconnected_unsafe(cont, port_path, serial);
+      if (known_launcher != NULL) {
+        _ml_launcher_reattach_unsafe(known_launcher, found_device, port_path);
         found = 1;
       }
     }
@@ -308,6 +848,8 @@ _ml_add_new_launchers(ml_controller_t *cont,
       } else {
         status = _ml_launcher_init(cont, new_launcher, found_device);
         if (status == ML_OK) {
+          strcpy(new_launcher->port_path, port_path);
+          strcpy(new_launcher->serial, serial);
           _ml_add_launcher(cont, new_launcher);
         } else {
           free(new_launcher);
@@ -325,6 +867,8 @@ _ml_add_new_launchers(ml_controller_t *cont,
  * will produce undexpected results. Treat this array as a constant.
  * NOTE: if you don't want to lose access to a launcher use
  * ml_launcher_reference and ml_launcher_dereference when you are done.
+ * The bus is scanned first unless the library was started with
+ * ML_INIT_SKIP_SCAN.
  *
  * @param new_arr Pointer to where you want the array.
  * @param count The number of items found.
@@ -345,19 +889,24 @@ ml_launcher_array_new(ml_launcher_t ***new_arr, uint32_t *count)
     return ML_NOT_NULL_POINTER;
   }
 
-  status = _ml_poll_for_launchers(ml_main_controller);
-  if(status != ML_OK) {
-    return status;
+  if (!(ml_main_controller->init_flags & ML_INIT_SKIP_SCAN)) {
+    status = _ml_poll_for_launchers(ml_main_controller);
+    if(status != ML_OK) {
+      return status;
+    }
   }
+  pthread_mutex_lock(&ml_main_controller->lock);
   new_count = ml_main_controller->launcher_count;
   (*count) = new_count;
   if (new_count == 0) {
-    return ML_NO_LAUNCHERS;
+    status = ML_NO_LAUNCHERS;
+    goto out;
   }
   // Allocate space for the new array.
   (*new_arr) = malloc(sizeof(ml_launcher_t *) * (new_count + 1));
   if ((*new_arr) == NULL) {
-    return ML_ALLOC_FAILED;
+    status = ML_ALLOC_FAILED;
+    goto out;
   }
 
   (*new_arr)[new_count] = NULL;
@@ -367,19 +916,174 @@ ml_launcher_array_new(ml_launcher_t ***new_arr, uint32_t *count)
     // Found a launcher
     cur_launcher = ml_main_controller->launchers[i];
     if (cur_launcher != NULL) {
-      if (new_index >= ml_main_controller->launcher_count) {
-        return ML_LAUNCHER_ARRAY_INCONSISTENT;
+      if (new_index >= new_count) {
+        status = ML_LAUNCHER_ARRAY_INCONSISTENT;
+        break;
       }
       // Refrence the launcher since this will be going back to the programmer
-      ml_launcher_reference(cur_launcher);
+      __atomic_add_fetch(&cur_launcher->ref_count, 1, __ATOMIC_RELAXED);
       (*new_arr)[new_index] = cur_launcher;
       new_index += 1;
     }
   }
 
+out:
+  pthread_mutex_unlock(&ml_main_controller->lock);
+
+  return status;
+}
+
+/**
+ * @brief Opens a launcher found in sysfs and adds it to the array, or
+ * references it if it is already known.
+ *
+ * @param cont The active controller.
+ * @param device The device to open.
+ * @param launcher Where to put the referenced launcher.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_open_sysfs_device(ml_controller_t *cont, ml_sysfs_device_t *device,
+                      ml_launcher_t **launcher)
+{
+  ml_launcher_t *new_launcher = NULL, *known_launcher = NULL;
+  ml_error_code result = ML_OK;
+
+  if (_ml_driver_find(device->vendor_id, device->product_id) == NULL) {
+    return ML_NOT_FOUND;
+  }
+
+  pthread_mutex_lock(&cont->lock);
+  known_launcher = _ml_find_launcher_unsafe(cont, device->port_path);
+  if (known_launcher == NULL) {
+    // A launcher that was unplugged is picked up where it left off.
+    known_launcher = _ml_find_disconnected_unsafe(cont, device->port_path,
+                                                  device->serial);
+    if (known_launcher != NULL) {
+      __atomic_add_fetch(&known_launcher->ref_count, 1, __ATOMIC_RELAXED);
+      _ml_launcher_reattach_sysfs_unsafe(known_launcher, device);
+      if (known_launcher->usb_reattach) {
+        known_launcher->usb_reattach = false;
+        _ml_launcher_usb_reopen_unsafe(known_launcher);
+      }
+    }
+  }
+  pthread_mutex_unlock(&cont->lock);
+  if (known_launcher != NULL) {
+    (*launcher) = known_launcher;
+    return ML_OK;
+  }
+
+  new_launcher = calloc(sizeof(ml_launcher_t), 1);
+  if (new_launcher == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  _ml_launcher_init_sysfs(cont, new_launcher, device);
+  result = ml_usb_open_launcher(new_launcher);
+  if (result != ML_OK) {
+    free(new_launcher);
+    return result;
+  }
+
+  pthread_mutex_lock(&cont->lock);
+  // It may have been opened while the lock was dropped.
+  known_launcher = _ml_find_launcher_unsafe(cont, device->port_path);
+  if (known_launcher == NULL) {
+    result = _ml_add_launcher(cont, new_launcher);
+  }
+  if (known_launcher != NULL || result != ML_OK) {
+    pthread_mutex_unlock(&cont->lock);
+    _ml_launcher_cleanup(&new_launcher);
+    (*launcher) = known_launcher;
+    return known_launcher != NULL ? ML_OK : result;
+  }
+  new_launcher->ref_count = 1;
+  // Leave the handle open for the first command, the reaper closes it if
+  // nothing comes.
+  _ml_launcher_usb_release_unsafe(new_launcher);
+  pthread_mutex_unlock(&cont->lock);
+
+  (*launcher) = new_launcher;
   return ML_OK;
 }
 
+/**
+ * @brief Opens the launcher plugged into a USB port without scanning the
+ * bus. The path is the device's sysfs name, the bus and port numbers like
+ * 1-4.2. Only supported on Linux.
+ * The launcher is referenced, use ml_launcher_dereference when done.
+ *
+ * @param path The port path of the launcher.
+ * @param launcher Where to put the launcher, must point to NULL.
+ *
+ * @return A status code, ML_NOT_FOUND if no launcher is on that port.
+ */
+ml_error_code
+ml_launcher_open_by_path(const char *path, ml_launcher_t **launcher)
+{
+  ml_sysfs_device_t device;
+  ml_error_code result = ML_OK;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (path == NULL || launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if ((*launcher) != NULL) {
+    return ML_NOT_NULL_POINTER;
+  }
+#ifndef ML_HAVE_USB_WRAP
+  return ML_NOT_IMPLEMENTED;
+#endif
+
+  result = _ml_sysfs_read_device(ml_main_controller, path, &device);
+  if (result != ML_OK) {
+    return result;
+  }
+  return _ml_open_sysfs_device(ml_main_controller, &device, launcher);
+}
+
+/**
+ * @brief Opens the first launcher with a vendor and product ID without
+ * scanning the bus. Only supported on Linux.
+ * The launcher is referenced, use ml_launcher_dereference when done.
+ *
+ * @param vendor_id The USB vendor ID.
+ * @param product_id The USB product ID.
+ * @param launcher Where to put the launcher, must point to NULL.
+ *
+ * @return A status code, ML_NOT_FOUND if there is no such launcher.
+ */
+ml_error_code
+ml_launcher_open_by_vid_pid(uint16_t vendor_id, uint16_t product_id,
+                            ml_launcher_t **launcher)
+{
+  ml_sysfs_device_t device;
+  ml_error_code result = ML_OK;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if ((*launcher) != NULL) {
+    return ML_NOT_NULL_POINTER;
+  }
+#ifndef ML_HAVE_USB_WRAP
+  return ML_NOT_IMPLEMENTED;
+#endif
+
+  result = _ml_sysfs_find_vid_pid(ml_main_controller, vendor_id, product_id,
+                                  &device);
+  if (result != ML_OK) {
+    return result;
+  }
+  return _ml_open_sysfs_device(ml_main_controller, &device, launcher);
+}
+
 /**
  * @brief Frees the array of launchers ml_get_launcher_array provides.
  * Dereferences every launcher in the array so they can be cleaned up later.
@@ -410,6 +1114,215 @@ ml_launcher_array_free(ml_launcher_t **free_arr)
   return ML_OK;
 }
 
+/**
+ * @brief Copies the state of every launcher into an array you provide.
+ * Nothing is allocated, referenced or read from the bus, the state is what
+ * the library last saw. Launchers only show up once a poll or an open has
+ * found them. Use the id to match entries to launchers, bus and device
+ * numbers change when a launcher is reconnected.
+ *
+ * @param states Where to put the states, may be NULL if capacity is 0.
+ * @param capacity The number of states that fit.
+ * @param count Set to the number of launchers, which may be more than
+ * capacity.
+ *
+ * @return A status code, ML_INDEX_OUT_OF_BOUNDS if only the first capacity
+ * launchers fit.
+ */
+ml_error_code
+ml_launcher_query_all(ml_launcher_state_t *states, uint32_t capacity,
+                      uint32_t *count)
+{
+  ml_controller_t *cont = ml_main_controller;
+  ml_fleet_t *fleet = NULL;
+  ml_launcher_state_t *state = NULL;
+  uint32_t written = 0;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (count == NULL || (states == NULL && capacity > 0)) {
+    return ML_NULL_POINTER;
+  }
+
+  fleet = &cont->fleet;
+  pthread_mutex_lock(&cont->lock);
+  for (int16_t i = 0;
+       i < cont->launcher_array_size && written < capacity; i++) {
+    if (cont->launchers[i] == NULL) {
+      continue;
+    }
+    state = &states[written++];
+    state->id = fleet->id[i];
+    state->type = fleet->type[i];
+    state->connected = fleet->connected[i];
+    state->claimed = fleet->claimed[i];
+    state->led_state = fleet->led_status[i];
+    state->limits = fleet->limit_status[i];
+    state->lease_count = fleet->lease_count[i];
+    state->horizontal_position = fleet->horizontal_position[i];
+    state->vertical_position = fleet->vertical_position[i];
+    state->usb_bus = fleet->usb_bus[i];
+    state->usb_device_number = fleet->usb_device_number[i];
+  }
+  (*count) = cont->launcher_count;
+  pthread_mutex_unlock(&cont->lock);
+
+  return (*count) > capacity ? ML_INDEX_OUT_OF_BOUNDS : ML_OK;
+}
+
+/// Shared state for the workers of a bulk claim or unclaim.
+typedef struct ml_array_claim_job_t
+{
+  ml_launcher_t **launchers;
+  ml_error_code *results;
+  uint32_t count;
+  uint32_t flags;
+  bool claim;
+  uint32_t next;
+} ml_array_claim_job_t;
+
+/**
+ * @brief Worker for bulk claims, takes launchers off the job until none are
+ * left.
+ *
+ * @param arg The job.
+ *
+ * @return Nothing.
+ */
+static void *
+_ml_array_claim_worker(void *arg)
+{
+  ml_array_claim_job_t *job = arg;
+  ml_launcher_t *launcher = NULL;
+  ml_error_code result = ML_OK;
+  uint32_t index = 0;
+
+  while ((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+         job->count) {
+    launcher = job->launchers[index];
+    if (job->claim) {
+      result = (job->flags & ML_CLAIM_LEASE) ?
+        ml_launcher_lease(launcher) :
+        ml_launcher_claim_flags(launcher, job->flags);
+    } else {
+      result = (job->flags & ML_CLAIM_LEASE) ?
+        ml_launcher_release(launcher) : ml_launcher_unclaim(launcher);
+    }
+    job->results[index] = result;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Runs a bulk claim or unclaim over a small pool of threads.
+ *
+ * @param launchers A NULL terminated launcher array.
+ * @param flags ML_CLAIM_* flags.
+ * @param results Per launcher results, may be NULL.
+ * @param claim true to claim, false to unclaim.
+ *
+ * @return ML_OK if every launcher succeeded, otherwise the first failure.
+ */
+static ml_error_code
+_ml_launcher_array_claim_common(ml_launcher_t **launchers, uint32_t flags,
+                                ml_error_code *results, bool claim)
+{
+  pthread_t workers[ML_MAX_CLAIM_WORKERS];
+  ml_array_claim_job_t job;
+  uint32_t worker_count = 0, started = 0;
+  ml_error_code status = ML_OK;
+
+  if (launchers == NULL) {
+    return ML_NULL_POINTER;
+  }
+
+  job.launchers = launchers;
+  job.flags = flags;
+  job.claim = claim;
+  job.next = 0;
+  job.count = 0;
+  while (launchers[job.count] != NULL) {
+    job.count++;
+  }
+  if (job.count == 0) {
+    return ML_NO_LAUNCHERS;
+  }
+
+  job.results = results;
+  if (job.results == NULL) {
+    job.results = malloc(sizeof(ml_error_code) * job.count);
+    if (job.results == NULL) {
+      return ML_ALLOC_FAILED;
+    }
+  }
+
+  // The calling thread works too, so start one less than we need.
+  worker_count = job.count < ML_MAX_CLAIM_WORKERS ?
+    job.count : ML_MAX_CLAIM_WORKERS;
+  for (started = 0; started < worker_count - 1; started++) {
+    if (pthread_create(&workers[started], NULL,
+                       _ml_array_claim_worker, &job) != 0) {
+      // Carry on with what we have.
+      break;
+    }
+  }
+  _ml_array_claim_worker(&job);
+  for (uint32_t i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  for (uint32_t i = 0; i < job.count; i++) {
+    if (job.results[i] != ML_OK) {
+      status = job.results[i];
+      break;
+    }
+  }
+
+  if (results == NULL) {
+    free(job.results);
+  }
+  return status;
+}
+
+/**
+ * @brief Claims every launcher in an array at once.
+ * Opening a launcher blocks on several USB requests, so the launchers are
+ * opened in parallel on up to ML_MAX_CLAIM_WORKERS threads.
+ *
+ * @param launchers A NULL terminated array from ml_launcher_array_new.
+ * @param flags ML_CLAIM_DEFAULT, ML_CLAIM_LEASE to take leases or
+ * ML_CLAIM_NO_SUSPEND, see ml_launcher_claim_flags.
+ * @param results If not NULL, gets the status of each launcher in the
+ * same order as the array.
+ *
+ * @return ML_OK if every launcher was claimed, otherwise the first failure.
+ */
+ml_error_code
+ml_launcher_array_claim(ml_launcher_t **launchers, uint32_t flags,
+                        ml_error_code *results)
+{
+  return _ml_launcher_array_claim_common(launchers, flags, results, true);
+}
+
+/**
+ * @brief Unclaims every launcher in an array at once, the reverse of
+ * ml_launcher_array_claim.
+ *
+ * @param launchers A NULL terminated array from ml_launcher_array_new.
+ * @param flags ML_CLAIM_DEFAULT or ML_CLAIM_LEASE to return leases.
+ * @param results If not NULL, gets the status of each launcher in the
+ * same order as the array.
+ *
+ * @return ML_OK if every launcher was unclaimed, otherwise the first failure.
+ */
+ml_error_code
+ml_launcher_array_unclaim(ml_launcher_t **launchers, uint32_t flags,
+                          ml_error_code *results)
+{
+  return _ml_launcher_array_claim_common(launchers, flags, results, false);
+}
+
 /**
  * @brief Removes a launcher from the array.
  *
@@ -423,7 +1336,7 @@ _ml_remove_launcher(ml_controller_t *cont, ml_launcher_t *launcher)
 {
   /* This function is not thread safe, please lock the array first */
 
-  for (int16_t i = 0; i < cont->launcher_count; i++) {
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
     // Search for the launcher of interest
     if (cont->launchers[i] == launcher) {
       return _ml_remove_launcher_index(cont, i);
@@ -457,8 +1370,14 @@ _ml_remove_launcher_index(ml_controller_t *cont, int16_t index)
   }
 
   // Everything looks good, decrement and set as null. We do not free here.
+  _ml_fleet_detach_unsafe(cont->launchers[index]);
+  _ml_pose_release_unsafe(cont, cont->launchers[index]);
+  cont->launchers[index]->slot = -1;
   cont->launcher_count -= 1;
   cont->launchers[index] = NULL;
+  if (index < cont->launcher_free_hint) {
+    cont->launcher_free_hint = index;
+  }
   return ML_OK;
 }
 
@@ -474,16 +1393,36 @@ ml_error_code
 _ml_add_launcher(ml_controller_t *cont, ml_launcher_t *launcher)
 {
   /* This function is not thread safe, please lock the array first */
-  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+  ml_launcher_t **resized = NULL;
+  int16_t old_size = cont->launcher_array_size, new_size = 0;
+
+  for (int16_t i = cont->launcher_free_hint; i < old_size; i++) {
     // Find an empty spot
     if (cont->launchers[i] == NULL) {
+      cont->launcher_free_hint = i + 1;
       return _ml_add_launcher_index(cont, launcher, i);
     }
   }
 
-  // No freespace found, needs a resize.
-  // Not yet implemented...
-  return ML_NOT_IMPLEMENTED;
+  // No freespace found, double the array. The fleet table is already big
+  // enough for the largest array.
+  if (old_size >= ML_MAX_LAUNCHER_ARRAY_SIZE) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+  new_size = old_size * 2;
+  if (new_size > ML_MAX_LAUNCHER_ARRAY_SIZE) {
+    new_size = ML_MAX_LAUNCHER_ARRAY_SIZE;
+  }
+  resized = realloc(cont->launchers, new_size * sizeof(ml_launcher_t *));
+  if (resized == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  memset(&resized[old_size], 0,
+         (new_size - old_size) * sizeof(ml_launcher_t *));
+  cont->launchers = resized;
+  cont->launcher_array_size = new_size;
+  cont->launcher_free_hint = old_size + 1;
+  return _ml_add_launcher_index(cont, launcher, old_size);
 }
 
 /**
@@ -507,5 +1446,18 @@ _ml_add_launcher_index(ml_controller_t *cont,
   // Update index and add
   cont->launcher_count += 1;
   cont->launchers[index] = launcher;
+  launcher->slot = index;
+  // Whatever was in the slot belonged to a launcher that is gone.
+  cont->fleet.claimed[index] = 0;
+  cont->fleet.lease_count[index] = 0;
+  cont->fleet.led_status[index] = 0;
+  cont->fleet.limit_status[index] = 0;
+  cont->fleet.horizontal_position[index] = 0;
+  cont->fleet.vertical_position[index] = 0;
+  cont->fleet.id[index] = ++cont->next_launcher_id;
+  _ml_fleet_attach_unsafe(launcher);
+  _ml_log(ML_LOG_LAUNCHER_ADDED, launcher->usb_bus,
+          launcher->usb_device_number, cont->fleet.id[index], 0);
+  _ml_pose_attach_unsafe(cont, launcher);
   return ML_OK;
 }
@@ -0,0 +1,145 @@
+/**
+ * @file ml_driver.c
+ * @brief The launcher models the library knows how to drive.
+ * Everything that differs between models lives in a driver descriptor, so
+ * supporting a new model means adding an entry to ml_drivers. Devices are
+ * matched to a driver through a small hash on vendor and product ID, and
+ * each launcher keeps a pointer to its driver.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+// Find the end stops first, the times are only an upper bound. Then move to
+// 0 deg vert and center.
+static const ml_command_t ml_standard_zero[] = {
+  { .type = ML_COMMAND_MOVE_TO_LIMIT, .direction = ML_LEFT,
+    .duration_ms = 6000 }, // Correct
+  { .type = ML_COMMAND_MOVE_TO_LIMIT, .direction = ML_DOWN,
+    .duration_ms = 2000 }, // Correct
+  { .type = ML_COMMAND_MOVE_TIMED, .direction = ML_RIGHT,
+    .duration_ms = 2750 },
+  { .type = ML_COMMAND_MOVE_TIMED, .direction = ML_UP,
+    .duration_ms = 100 } // Correct
+};
+
+/// Every supported model.
+static const ml_driver_t ml_drivers[] = {
+  {
+    .name = "Dream Cheeky Thunder",
+    .type = ML_STANDARD_LAUNCHER,
+    .vendor_id = ML_STD_VENDOR_ID,
+    .product_id = ML_STD_PRODUCT_ID,
+    .request_type = 0x21,
+    .request_field = 0x09,
+    .request_value = 0,
+    .request_index = 0,
+    .cmd_size = 2,
+    .cmds = {
+      [ML_DOWN_CMD] =    {0x02, 0x01},
+      [ML_UP_CMD] =      {0x02, 0x02},
+      [ML_LEFT_CMD] =    {0x02, 0x04},
+      [ML_RIGHT_CMD] =   {0x02, 0x08},
+      [ML_FIRE_CMD] =    {0x02, 0x10},
+      [ML_STOP_CMD] =    {0x02, 0x20},
+      [ML_LED_ON_CMD] =  {0x03, 0x01},
+      [ML_LED_OFF_CMD] = {0x03, 0x00}
+    },
+    .status_endpoint = 0x81,
+    // Raised once the firing cycle is over. A shot takes up to 3.5 s and
+    // the turret holds 4 missiles.
+    .fire_done_byte = 1,
+    .fire_done_mask = 0x80,
+    .fire_cycle_ms = 3500,
+    .ammo_capacity = 4,
+    .zero_steps = ml_standard_zero,
+    .zero_step_count = sizeof(ml_standard_zero) / sizeof(ml_standard_zero[0]),
+    // Rough figures, about 270 degrees across in 5.5 seconds.
+    .axis_speed = {
+      [ML_DOWN] = 30000, [ML_UP] = 30000,
+      [ML_LEFT] = 49000, [ML_RIGHT] = 49000
+    },
+    // Also rough. The motors take about 40 ms to get up to speed, and
+    // pulses shorter than 8 ms don't reliably move the turret at all.
+    .pulse_table = {
+      [ML_DOWN] = {{8, 100}, {15, 250}, {25, 500}, {40, 950}},
+      [ML_UP] = {{8, 80}, {15, 200}, {25, 420}, {40, 850}},
+      [ML_LEFT] = {{8, 150}, {15, 400}, {25, 850}, {40, 1600}},
+      [ML_RIGHT] = {{8, 150}, {15, 400}, {25, 850}, {40, 1600}}
+    },
+    .pulse_count = {
+      [ML_DOWN] = 4, [ML_UP] = 4, [ML_LEFT] = 4, [ML_RIGHT] = 4
+    }
+  }
+};
+
+#define ML_DRIVER_COUNT (sizeof(ml_drivers) / sizeof(ml_drivers[0]))
+
+// Open addressed, kept at most half full.
+static const ml_driver_t *ml_driver_hash[ML_DRIVER_HASH_SIZE];
+static pthread_once_t ml_driver_hash_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Hashes a vendor and product ID pair into the driver table.
+ *
+ * @param vendor_id The USB vendor ID.
+ * @param product_id The USB product ID.
+ *
+ * @return The first slot to probe.
+ */
+static uint32_t
+_ml_driver_slot(uint16_t vendor_id, uint16_t product_id)
+{
+  uint32_t key = ((uint32_t)vendor_id << 16) | product_id;
+  // Fibonacci hashing, the top bits are the best mixed.
+  return (key * 2654435769u) >> (32 - ML_DRIVER_HASH_BITS);
+}
+
+/**
+ * @brief Fills in the driver hash, runs once.
+ */
+static void
+_ml_driver_hash_init()
+{
+  uint32_t slot = 0;
+
+  for (uint32_t i = 0; i < ML_DRIVER_COUNT; i++) {
+    slot = _ml_driver_slot(ml_drivers[i].vendor_id, ml_drivers[i].product_id);
+    while (ml_driver_hash[slot] != NULL) {
+      slot = (slot + 1) & (ML_DRIVER_HASH_SIZE - 1);
+    }
+    ml_driver_hash[slot] = &ml_drivers[i];
+  }
+}
+
+/**
+ * @brief Finds the driver for a USB device.
+ *
+ * @param vendor_id The USB vendor ID.
+ * @param product_id The USB product ID.
+ *
+ * @return The driver or NULL if the device isn't a launcher.
+ */
+const ml_driver_t *
+_ml_driver_find(uint16_t vendor_id, uint16_t product_id)
+{
+  const ml_driver_t *driver = NULL;
+  uint32_t slot = 0;
+
+  pthread_once(&ml_driver_hash_once, _ml_driver_hash_init);
+
+  slot = _ml_driver_slot(vendor_id, product_id);
+  while ((driver = ml_driver_hash[slot]) != NULL) {
+    if (driver->vendor_id == vendor_id && driver->product_id == product_id) {
+      return driver;
+    }
+    slot = (slot + 1) & (ML_DRIVER_HASH_SIZE - 1);
+  }
+  return NULL;
+}
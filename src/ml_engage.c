@@ -0,0 +1,522 @@
+/**
+ * @file ml_engage.c
+ * @brief Visits a list of targets with one launcher and fires at each.
+ * Every move stops and then coasts, so how long an engagement takes depends
+ * mostly on the order the targets are visited in. The planner orders them
+ * by nearest neighbour and then improves the order with 2-opt, using the
+ * launcher's own axis speeds.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/// An engagement in progress, see ml_launcher_engage.
+typedef struct ml_engagement_t
+{
+  ml_launcher_t *launcher;
+  const ml_target_t *targets;
+  const uint32_t *order;
+  uint32_t count;
+  // The next target to move to.
+  uint32_t next;
+  // Moves to the current target still running.
+  uint32_t moves;
+  // Where the queued moves leave the launcher.
+  uint32_t horizontal;
+  uint32_t vertical;
+  // Commands queued and not done yet.
+  uint32_t pending;
+  ml_error_code status;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} ml_engagement_t;
+
+/**
+ * @brief Gets a launcher's axis speeds, all of which are needed to plan.
+ *
+ * @param launcher The launcher.
+ * @param speed Where to put the speeds, indexed by ml_launcher_direction.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_engage_speeds(ml_launcher_t *launcher, uint32_t *speed)
+{
+  for (int i = 0; i < 4; i++) {
+    speed[i] = __atomic_load_n(&launcher->axis_speed[i], __ATOMIC_RELAXED);
+    if (speed[i] == 0) {
+      // No idea how long to move for.
+      return ML_NOT_IMPLEMENTED;
+    }
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Works out the timed move along one axis, the same way
+ * ml_group_aim does.
+ *
+ * @param speed The axis speeds.
+ * @param from Where the launcher is on the axis.
+ * @param to Where it should be.
+ * @param lower The direction that lowers the position.
+ * @param higher The direction that raises the position.
+ * @param direction Where to put the direction, may be NULL.
+ *
+ * @return How long to move for in milliseconds, 0 for no move.
+ */
+static uint32_t
+_ml_engage_axis_ms(const uint32_t *speed, uint32_t from, uint32_t to,
+                   ml_launcher_direction lower, ml_launcher_direction higher,
+                   ml_launcher_direction *direction)
+{
+  ml_launcher_direction way = to > from ? higher : lower;
+  uint64_t distance = to > from ? to - from : from - to;
+
+  if (direction != NULL) {
+    (*direction) = way;
+  }
+  // Rounded to the nearest millisecond.
+  return (uint32_t)(((distance * 1000) + (speed[way] / 2)) / speed[way]);
+}
+
+/**
+ * @brief Estimates how long it takes to get from one target to another.
+ * The axes are driven one after the other and each move coasts before the
+ * next command runs.
+ *
+ * @param speed The axis speeds.
+ * @param from Where the launcher is.
+ * @param to Where it should be.
+ *
+ * @return The time in milliseconds.
+ */
+static uint32_t
+_ml_engage_cost(const uint32_t *speed, const ml_target_t *from,
+                const ml_target_t *to)
+{
+  uint32_t horizontal = 0, vertical = 0;
+
+  horizontal = _ml_engage_axis_ms(speed, from->horizontal, to->horizontal,
+                                  ML_LEFT, ML_RIGHT, NULL);
+  vertical = _ml_engage_axis_ms(speed, from->vertical, to->vertical,
+                                ML_DOWN, ML_UP, NULL);
+  return (horizontal != 0 ? horizontal + ML_COAST_MS : 0) +
+    (vertical != 0 ? vertical + ML_COAST_MS : 0);
+}
+
+/**
+ * @brief Sums the costs along a path, forwards and backwards, from a
+ * position onwards. Reversing a stretch of the path then costs its
+ * backward sum.
+ *
+ * @param cost The cost table.
+ * @param nodes The size of a row of the table.
+ * @param path The path.
+ * @param from The first position to update.
+ * @param forward The forward sums, forward[k] is the cost up to path[k].
+ * @param backward The same, driving each leg the other way.
+ */
+static void
+_ml_engage_sums(const uint32_t *cost, uint32_t nodes, const uint32_t *path,
+                uint32_t from, uint64_t *forward, uint64_t *backward)
+{
+  if (from == 0) {
+    forward[0] = 0;
+    backward[0] = 0;
+    from = 1;
+  }
+  for (uint32_t k = from; k < nodes; k++) {
+    forward[k] = forward[k - 1] + cost[(path[k - 1] * nodes) + path[k]];
+    backward[k] = backward[k - 1] + cost[(path[k] * nodes) + path[k - 1]];
+  }
+}
+
+/**
+ * @brief Orders targets so a launcher gets through them quickly, starting
+ * from where it is now. Travel times come from the launcher's axis speeds,
+ * see ml_launcher_set_axis_speed, and every move pays for its coast, so
+ * fewer and shorter moves win. The order is found by nearest neighbour and
+ * then improved with 2-opt until no reversal helps. It is near, not
+ * always exactly, optimal. Run it with ml_launcher_engage.
+ *
+ * @param launcher The launcher.
+ * @param targets The targets.
+ * @param count The number of targets, at most 1024.
+ * @param order Where to put the order, count indexes into targets.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_plan_engagement(ml_launcher_t *launcher, const ml_target_t *targets,
+                   uint32_t count, uint32_t *order)
+{
+  uint32_t speed[4];
+  ml_target_t start;
+  uint32_t *cost = NULL, *path = NULL;
+  uint64_t *forward = NULL, *backward = NULL;
+  uint64_t before = 0, after = 0, tail_before = 0, tail_after = 0;
+  uint32_t nodes = count + 1, best = 0, swap = 0;
+  const ml_target_t *from = NULL, *to = NULL;
+  ml_error_code result = ML_OK;
+  bool improved = true;
+
+  if (launcher == NULL || targets == NULL || order == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (count == 0) {
+    return ML_COUNT_ZERO;
+  }
+  if (count > ML_PLAN_MAX_TARGETS) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+  result = _ml_engage_speeds(launcher, speed);
+  if (result != ML_OK) {
+    return result;
+  }
+
+  cost = malloc(sizeof(uint32_t) * nodes * nodes);
+  path = malloc(sizeof(uint32_t) * nodes);
+  forward = malloc(sizeof(uint64_t) * nodes);
+  backward = malloc(sizeof(uint64_t) * nodes);
+  if (cost == NULL || path == NULL || forward == NULL || backward == NULL) {
+    result = ML_ALLOC_FAILED;
+    goto out;
+  }
+
+  // Node 0 is where the launcher is, target i is node i + 1.
+  start.horizontal = ML_FLEET(launcher, horizontal_position);
+  start.vertical = ML_FLEET(launcher, vertical_position);
+  for (uint32_t i = 0; i < nodes; i++) {
+    from = i == 0 ? &start : &targets[i - 1];
+    for (uint32_t j = 0; j < nodes; j++) {
+      to = j == 0 ? &start : &targets[j - 1];
+      cost[(i * nodes) + j] = _ml_engage_cost(speed, from, to);
+    }
+    path[i] = i;
+  }
+
+  // Always go to the closest target left.
+  for (uint32_t k = 1; k < nodes; k++) {
+    best = k;
+    for (uint32_t m = k + 1; m < nodes; m++) {
+      if (cost[(path[k - 1] * nodes) + path[m]] <
+          cost[(path[k - 1] * nodes) + path[best]]) {
+        best = m;
+      }
+    }
+    swap = path[k];
+    path[k] = path[best];
+    path[best] = swap;
+  }
+
+  // Reverse any stretch path[i..j] that makes the whole path shorter. The
+  // start stays put and the path doesn't return to it. Legs cost different
+  // amounts each way, so a reversed stretch is priced with its backward
+  // sum.
+  _ml_engage_sums(cost, nodes, path, 0, forward, backward);
+  while (improved) {
+    improved = false;
+    for (uint32_t i = 1; i + 1 < nodes; i++) {
+      for (uint32_t j = i + 1; j < nodes; j++) {
+        tail_before = j + 1 < nodes ?
+          cost[(path[j] * nodes) + path[j + 1]] : 0;
+        tail_after = j + 1 < nodes ?
+          cost[(path[i] * nodes) + path[j + 1]] : 0;
+        before = cost[(path[i - 1] * nodes) + path[i]] +
+          (forward[j] - forward[i]) + tail_before;
+        after = cost[(path[i - 1] * nodes) + path[j]] +
+          (backward[j] - backward[i]) + tail_after;
+        if (after >= before) {
+          continue;
+        }
+        for (uint32_t a = i, b = j; a < b; a++, b--) {
+          swap = path[a];
+          path[a] = path[b];
+          path[b] = swap;
+        }
+        _ml_engage_sums(cost, nodes, path, i, forward, backward);
+        improved = true;
+      }
+    }
+  }
+
+  for (uint32_t k = 1; k < nodes; k++) {
+    order[k - 1] = path[k] - 1;
+  }
+
+out:
+  free(backward);
+  free(forward);
+  free(path);
+  free(cost);
+  return result;
+}
+
+/**
+ * @brief Estimates how long a launcher takes to visit targets in an order,
+ * starting from where it is now. Fires aren't counted, they take as long in
+ * any order.
+ *
+ * @param launcher The launcher.
+ * @param targets The targets.
+ * @param count The number of targets.
+ * @param order The order to visit them in, NULL for the order given.
+ * @param time_ms Where to put the time in milliseconds.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_engagement_time(ml_launcher_t *launcher, const ml_target_t *targets,
+                   uint32_t count, const uint32_t *order, uint32_t *time_ms)
+{
+  uint32_t speed[4];
+  ml_target_t at;
+  const ml_target_t *to = NULL;
+  uint64_t total = 0;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL || targets == NULL || time_ms == NULL) {
+    return ML_NULL_POINTER;
+  }
+  result = _ml_engage_speeds(launcher, speed);
+  if (result != ML_OK) {
+    return result;
+  }
+
+  at.horizontal = ML_FLEET(launcher, horizontal_position);
+  at.vertical = ML_FLEET(launcher, vertical_position);
+  for (uint32_t i = 0; i < count; i++) {
+    if (order != NULL && order[i] >= count) {
+      return ML_INDEX_OUT_OF_BOUNDS;
+    }
+    to = &targets[order != NULL ? order[i] : i];
+    total += _ml_engage_cost(speed, &at, to);
+    at = (*to);
+  }
+
+  (*time_ms) = total > UINT32_MAX ? UINT32_MAX : (uint32_t)total;
+  return ML_OK;
+}
+
+static void _ml_engage_move_done(ml_launcher_t *, ml_error_code, void *);
+static void _ml_engage_fire_done(ml_launcher_t *, ml_error_code, void *);
+
+/**
+ * @brief Queues a command for an engagement. Hold the engagement lock.
+ *
+ * @param engagement The engagement.
+ * @param cmd The command, its callback already set.
+ */
+static void
+_ml_engage_submit(ml_engagement_t *engagement, ml_command_t *cmd)
+{
+  ml_error_code result = ML_OK;
+
+  cmd->user_data = engagement;
+  engagement->pending += 1;
+  result = ml_launcher_submit(engagement->launcher, cmd);
+  if (result != ML_OK) {
+    // Never queued, so the callback won't run.
+    engagement->pending -= 1;
+    engagement->status = result;
+  }
+}
+
+/**
+ * @brief Queues the moves to the next targets. A target that needs no
+ * move is fired at straight away, otherwise the fire is queued once its
+ * moves are done, see _ml_engage_move_done. Hold the engagement lock.
+ *
+ * @param engagement The engagement.
+ */
+static void
+_ml_engage_queue(ml_engagement_t *engagement)
+{
+  ml_command_t fire = {
+    .type = ML_COMMAND_FIRE,
+    .callback = _ml_engage_fire_done
+  };
+  ml_command_t move = {
+    .type = ML_COMMAND_MOVE_TIMED,
+    .callback = _ml_engage_move_done
+  };
+  const ml_target_t *target = NULL;
+  uint32_t speed[4];
+
+  if (_ml_engage_speeds(engagement->launcher, speed) != ML_OK) {
+    engagement->status = ML_NOT_IMPLEMENTED;
+    return;
+  }
+
+  while (engagement->status == ML_OK &&
+         engagement->next < engagement->count) {
+    target = &engagement->targets[engagement->order != NULL ?
+                                  engagement->order[engagement->next] :
+                                  engagement->next];
+    engagement->next += 1;
+    engagement->moves = 0;
+
+    // Turn first, then raise or lower, like ml_group_aim.
+    move.duration_ms = _ml_engage_axis_ms(speed, engagement->horizontal,
+                                          target->horizontal, ML_LEFT,
+                                          ML_RIGHT, &move.direction);
+    if (move.duration_ms != 0) {
+      engagement->moves += 1;
+      _ml_engage_submit(engagement, &move);
+    }
+    move.duration_ms = _ml_engage_axis_ms(speed, engagement->vertical,
+                                          target->vertical, ML_DOWN, ML_UP,
+                                          &move.direction);
+    if (move.duration_ms != 0 && engagement->status == ML_OK) {
+      engagement->moves += 1;
+      _ml_engage_submit(engagement, &move);
+    }
+    engagement->horizontal = target->horizontal;
+    engagement->vertical = target->vertical;
+
+    if (engagement->moves != 0) {
+      return;
+    }
+    if (engagement->status == ML_OK) {
+      _ml_engage_submit(engagement, &fire);
+    }
+  }
+}
+
+/**
+ * @brief Finishes a command of an engagement, waking the waiter once
+ * nothing is left. Hold the engagement lock.
+ *
+ * @param engagement The engagement.
+ * @param status How the command finished, the first error is kept.
+ */
+static void
+_ml_engage_finish(ml_engagement_t *engagement, ml_error_code status)
+{
+  if (status != ML_OK && engagement->status == ML_OK) {
+    engagement->status = status;
+  }
+  engagement->pending -= 1;
+  if (engagement->pending == 0) {
+    pthread_cond_signal(&engagement->cond);
+  }
+}
+
+/**
+ * @brief Callback for each move of an engagement. Once both moves to a
+ * target are done the fire is queued, and the moves to the next target
+ * right behind it so the queue never runs dry.
+ *
+ * @param launcher The launcher.
+ * @param status The result of the move.
+ * @param user_data The engagement.
+ */
+static void
+_ml_engage_move_done(ml_launcher_t *launcher, ml_error_code status,
+                     void *user_data)
+{
+  ml_engagement_t *engagement = user_data;
+  ml_command_t fire = {
+    .type = ML_COMMAND_FIRE,
+    .callback = _ml_engage_fire_done
+  };
+  (void)launcher;
+
+  pthread_mutex_lock(&engagement->lock);
+  engagement->moves -= 1;
+  if (status != ML_OK && engagement->status == ML_OK) {
+    engagement->status = status;
+  }
+  // Never fire if a move to the target went wrong.
+  if (engagement->moves == 0 && engagement->status == ML_OK) {
+    _ml_engage_submit(engagement, &fire);
+    _ml_engage_queue(engagement);
+  }
+  _ml_engage_finish(engagement, status);
+  pthread_mutex_unlock(&engagement->lock);
+}
+
+/**
+ * @brief Callback for each fire of an engagement.
+ *
+ * @param launcher The launcher.
+ * @param status The result of the fire.
+ * @param user_data The engagement.
+ */
+static void
+_ml_engage_fire_done(ml_launcher_t *launcher, ml_error_code status,
+                     void *user_data)
+{
+  ml_engagement_t *engagement = user_data;
+  (void)launcher;
+
+  pthread_mutex_lock(&engagement->lock);
+  _ml_engage_finish(engagement, status);
+  pthread_mutex_unlock(&engagement->lock);
+}
+
+/**
+ * @brief Visits targets in order and fires at each, then waits until the
+ * last one is done. Every move is worked out up front from the launcher's
+ * tracked position, like ml_group_aim, and the moves and fires are queued
+ * back to back so the launcher never waits on the caller. A target is only
+ * fired at once both moves to it succeeded, the first error ends the
+ * engagement.
+ *
+ * @param launcher The launcher.
+ * @param targets The targets.
+ * @param count The number of targets.
+ * @param order The order to visit them in, from ml_plan_engagement, NULL
+ * for the order given.
+ *
+ * @return A status code, the first error of any command.
+ */
+ml_error_code
+ml_launcher_engage(ml_launcher_t *launcher, const ml_target_t *targets,
+                   uint32_t count, const uint32_t *order)
+{
+  ml_engagement_t engagement = {
+    .launcher = launcher,
+    .targets = targets,
+    .order = order,
+    .count = count,
+    .status = ML_OK
+  };
+
+  if (launcher == NULL || targets == NULL) {
+    return ML_NULL_POINTER;
+  }
+  // Waiting on a scheduler thread could wait forever.
+  if (_ml_scheduler_is_current()) {
+    return ML_WOULD_BLOCK;
+  }
+  for (uint32_t i = 0; order != NULL && i < count; i++) {
+    if (order[i] >= count) {
+      return ML_INDEX_OUT_OF_BOUNDS;
+    }
+  }
+
+  pthread_mutex_init(&engagement.lock, NULL);
+  pthread_cond_init(&engagement.cond, NULL);
+  engagement.horizontal = ML_FLEET(launcher, horizontal_position);
+  engagement.vertical = ML_FLEET(launcher, vertical_position);
+
+  pthread_mutex_lock(&engagement.lock);
+  _ml_engage_queue(&engagement);
+  while (engagement.pending != 0) {
+    pthread_cond_wait(&engagement.cond, &engagement.lock);
+  }
+  pthread_mutex_unlock(&engagement.lock);
+
+  pthread_cond_destroy(&engagement.cond);
+  pthread_mutex_destroy(&engagement.lock);
+  return engagement.status;
+}
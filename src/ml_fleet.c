@@ -0,0 +1,178 @@
+/**
+ * @file ml_fleet.c
+ * @brief The fleet table, hot launcher state stored as one array per field.
+ * Every array starts on its own cache line, so a scan over one field for
+ * the whole fleet streams through memory.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+#define ML_FLEET_LOCATIONS (ML_MAX_USB_BUSES * ML_MAX_USB_DEVICES)
+
+/**
+ * @brief Rounds a size up to a whole number of cache lines.
+ *
+ * @param size The size in bytes.
+ *
+ * @return The rounded size.
+ */
+static size_t
+_ml_fleet_round(size_t size)
+{
+  return (size + ML_CACHE_LINE_SIZE - 1) & ~(size_t)(ML_CACHE_LINE_SIZE - 1);
+}
+
+/**
+ * @brief Hands out the next array from the fleet block.
+ *
+ * @param cursor The next free byte of the block, moved past the array.
+ * @param size The size of the array in bytes.
+ *
+ * @return The array.
+ */
+static void *
+_ml_fleet_carve(uint8_t **cursor, size_t size)
+{
+  void *array = (*cursor);
+  (*cursor) += _ml_fleet_round(size);
+  return array;
+}
+
+/**
+ * @brief Allocates the fleet table for ML_MAX_LAUNCHER_ARRAY_SIZE launchers.
+ * It is one zeroed block, pages nobody touches are never backed by memory.
+ *
+ * @param fleet The fleet to initialize.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_fleet_init(ml_fleet_t *fleet)
+{
+  const size_t n = ML_MAX_LAUNCHER_ARRAY_SIZE;
+  size_t size = 0;
+  uint8_t *cursor = NULL;
+
+  size = _ml_fleet_round(n) * 7 + _ml_fleet_round(n * sizeof(uint32_t)) * 4 +
+    _ml_fleet_round(ML_FLEET_LOCATIONS * sizeof(int16_t));
+  // Extra line to align the start.
+  fleet->block = calloc(size + ML_CACHE_LINE_SIZE, 1);
+  if (fleet->block == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  cursor = (uint8_t *)_ml_fleet_round((uintptr_t)fleet->block);
+
+  fleet->connected = _ml_fleet_carve(&cursor, n);
+  fleet->claimed = _ml_fleet_carve(&cursor, n);
+  fleet->led_status = _ml_fleet_carve(&cursor, n);
+  fleet->limit_status = _ml_fleet_carve(&cursor, n);
+  fleet->lease_count = _ml_fleet_carve(&cursor, n * sizeof(uint32_t));
+  fleet->horizontal_position = _ml_fleet_carve(&cursor, n * sizeof(uint32_t));
+  fleet->vertical_position = _ml_fleet_carve(&cursor, n * sizeof(uint32_t));
+  fleet->id = _ml_fleet_carve(&cursor, n * sizeof(uint32_t));
+  fleet->type = _ml_fleet_carve(&cursor, n);
+  fleet->usb_bus = _ml_fleet_carve(&cursor, n);
+  fleet->usb_device_number = _ml_fleet_carve(&cursor, n);
+  fleet->by_location = _ml_fleet_carve(&cursor,
+                                       ML_FLEET_LOCATIONS * sizeof(int16_t));
+  return ML_OK;
+}
+
+/**
+ * @brief Frees the fleet table.
+ *
+ * @param fleet The fleet to clean up.
+ */
+void
+_ml_fleet_cleanup(ml_fleet_t *fleet)
+{
+  free(fleet->block);
+  fleet->block = NULL;
+}
+
+/**
+ * @brief Gets the index of a USB location in by_location.
+ *
+ * @param usb_bus The USB bus.
+ * @param usb_device_number The device number on the bus.
+ *
+ * @return The index.
+ */
+static uint32_t
+_ml_fleet_location(uint8_t usb_bus, uint8_t usb_device_number)
+{
+  return (usb_bus * ML_MAX_USB_DEVICES) +
+    (usb_device_number & (ML_MAX_USB_DEVICES - 1));
+}
+
+/**
+ * @brief Marks a launcher in the array as connected at its current USB
+ * location. Hold the controller lock.
+ *
+ * @param launcher The launcher.
+ */
+void
+_ml_fleet_attach_unsafe(ml_launcher_t *launcher)
+{
+  ml_fleet_t *fleet = &launcher->controller->fleet;
+  int16_t slot = launcher->slot;
+
+  fleet->connected[slot] = 1;
+  fleet->type[slot] = launcher->type;
+  fleet->usb_bus[slot] = launcher->usb_bus;
+  fleet->usb_device_number[slot] = launcher->usb_device_number;
+  fleet->by_location[_ml_fleet_location(launcher->usb_bus,
+                                        launcher->usb_device_number)] =
+    slot + 1;
+}
+
+/**
+ * @brief Marks a launcher in the array as disconnected. Hold the controller
+ * lock.
+ *
+ * @param launcher The launcher.
+ */
+void
+_ml_fleet_detach_unsafe(ml_launcher_t *launcher)
+{
+  ml_fleet_t *fleet = &launcher->controller->fleet;
+  int16_t slot = launcher->slot;
+  uint32_t location = 0;
+
+  if (!fleet->connected[slot]) {
+    return;
+  }
+  fleet->connected[slot] = 0;
+  location = _ml_fleet_location(fleet->usb_bus[slot],
+                                fleet->usb_device_number[slot]);
+  if (fleet->by_location[location] == slot + 1) {
+    fleet->by_location[location] = 0;
+  }
+}
+
+/**
+ * @brief Finds the connected launcher at a USB location. Hold the
+ * controller lock.
+ *
+ * @param cont The active controller.
+ * @param usb_bus The USB bus.
+ * @param usb_device_number The device number on the bus.
+ *
+ * @return The launcher or NULL.
+ */
+ml_launcher_t *
+_ml_fleet_find_unsafe(ml_controller_t *cont, uint8_t usb_bus,
+                      uint8_t usb_device_number)
+{
+  int16_t slot = cont->fleet.by_location[
+    _ml_fleet_location(usb_bus, usb_device_number)];
+
+  return slot == 0 ? NULL : cont->launchers[slot - 1];
+}
@@ -0,0 +1,386 @@
+/**
+ * @file ml_group.c
+ * @brief Groups of launchers that are aimed together.
+ * Aiming a group works out each member's moves from its own tracked
+ * position and axis speeds and queues them all at once. Every member runs
+ * its moves on its own queue, so the group is on target once its slowest
+ * member is.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+typedef struct ml_group_aim_t ml_group_aim_t;
+
+/// One member's part of an aim.
+typedef struct ml_group_aim_member_t
+{
+  ml_group_aim_t *aim;
+  ml_launcher_t *launcher;
+  // Moves still running, plus one while they are being queued.
+  uint32_t pending;
+  ml_error_code status;
+  ml_error_code *result;
+} ml_group_aim_member_t;
+
+/// An aim in progress, freed once every member is done.
+struct ml_group_aim_t
+{
+  ml_command_callback callback;
+  void *user_data;
+  // Members still moving, plus one while they are being queued.
+  uint32_t pending;
+  ml_group_aim_member_t members[];
+};
+
+/// Waits for every member of a blocking aim.
+typedef struct ml_group_waiter_t
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t remaining;
+} ml_group_waiter_t;
+
+/**
+ * @brief Creates a group. Every launcher is referenced until the group is
+ * freed.
+ *
+ * @param launchers The launchers in the group.
+ * @param count The number of launchers.
+ * @param group Where to put the group, free it with ml_group_free.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_group_new(ml_launcher_t **launchers, uint32_t count, ml_group_t **group)
+{
+  ml_group_t *new_group = NULL;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (launchers == NULL || group == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if ((*group) != NULL) {
+    return ML_NOT_NULL_POINTER;
+  }
+  if (count == 0) {
+    return ML_COUNT_ZERO;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (launchers[i] == NULL) {
+      return ML_NULL_POINTER;
+    }
+  }
+
+  new_group = calloc(sizeof(ml_group_t), 1);
+  if (new_group == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  new_group->members = calloc(sizeof(ml_launcher_t *), count);
+  if (new_group->members == NULL) {
+    free(new_group);
+    return ML_ALLOC_FAILED;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    ml_launcher_reference(launchers[i]);
+    new_group->members[i] = launchers[i];
+  }
+  new_group->count = count;
+
+  (*group) = new_group;
+  return ML_OK;
+}
+
+/**
+ * @brief Frees a group and dereferences its launchers. Aims that are still
+ * running finish on their own.
+ *
+ * @param group The group to free.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_group_free(ml_group_t *group)
+{
+  if (group == NULL) {
+    return ML_NULL_POINTER;
+  }
+
+  for (uint32_t i = 0; i < group->count; i++) {
+    ml_launcher_dereference(group->members[i]);
+  }
+  free(group->members);
+  free(group);
+  return ML_OK;
+}
+
+/**
+ * @brief Finishes one part of a member's aim. The member is done once all
+ * of its moves are, and the aim once all of its members are.
+ *
+ * @param member The member.
+ * @param status How the part finished, the first error is kept.
+ */
+static void
+_ml_group_member_done(ml_group_aim_member_t *member, ml_error_code status)
+{
+  ml_group_aim_t *aim = member->aim;
+  ml_error_code expected = ML_OK;
+
+  if (status != ML_OK) {
+    __atomic_compare_exchange_n(&member->status, &expected, status, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  }
+  if (__atomic_sub_fetch(&member->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+
+  status = __atomic_load_n(&member->status, __ATOMIC_RELAXED);
+  if (member->result != NULL) {
+    (*member->result) = status;
+  }
+  if (aim->callback != NULL) {
+    aim->callback(member->launcher, status, aim->user_data);
+  }
+  if (__atomic_sub_fetch(&aim->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(aim);
+  }
+}
+
+/**
+ * @brief Callback for each queued move of an aim.
+ *
+ * @param launcher The launcher.
+ * @param status The result of the move.
+ * @param user_data The member.
+ */
+static void
+_ml_group_move_done(ml_launcher_t *launcher, ml_error_code status,
+                    void *user_data)
+{
+  (void)launcher;
+  _ml_group_member_done(user_data, status);
+}
+
+/**
+ * @brief Queues a timed move for a member towards a target on one axis.
+ *
+ * @param member The member.
+ * @param position Where the member is on the axis.
+ * @param target Where it should be.
+ * @param lower The direction that lowers the position.
+ * @param higher The direction that raises the position.
+ */
+static void
+_ml_group_queue_axis(ml_group_aim_member_t *member, uint32_t position,
+                     uint32_t target, ml_launcher_direction lower,
+                     ml_launcher_direction higher)
+{
+  ml_launcher_t *launcher = member->launcher;
+  ml_command_t cmd = {
+    .type = ML_COMMAND_MOVE_TIMED,
+    .callback = _ml_group_move_done,
+    .user_data = member
+  };
+  uint64_t distance = 0, speed = 0;
+  ml_error_code result = ML_OK;
+
+  if (target == position) {
+    return;
+  }
+  cmd.direction = target > position ? higher : lower;
+  distance = target > position ? target - position : position - target;
+  speed = __atomic_load_n(&launcher->axis_speed[cmd.direction],
+                          __ATOMIC_RELAXED);
+  if (speed == 0) {
+    // No idea how long to move for.
+    result = ML_NOT_IMPLEMENTED;
+  } else {
+    // Rounded to the nearest millisecond.
+    cmd.duration_ms = ((distance * 1000) + (speed / 2)) / speed;
+    if (cmd.duration_ms == 0) {
+      return;
+    }
+  }
+
+  __atomic_add_fetch(&member->pending, 1, __ATOMIC_RELAXED);
+  if (result == ML_OK) {
+    result = ml_launcher_submit(launcher, &cmd);
+  }
+  if (result != ML_OK) {
+    // Never queued, so the callback won't run.
+    _ml_group_member_done(member, result);
+  }
+}
+
+/**
+ * @brief Queues the moves that aim every member of a group, see
+ * ml_group_aim_submit.
+ *
+ * @param group The group.
+ * @param horizontal The horizontal target.
+ * @param vertical The vertical target.
+ * @param callback Called as each member finishes, may be NULL.
+ * @param user_data Passed to the callback.
+ * @param results Where to store each member's result, may be NULL.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_group_aim(ml_group_t *group, uint32_t horizontal, uint32_t vertical,
+              ml_command_callback callback, void *user_data,
+              ml_error_code *results)
+{
+  ml_group_aim_t *aim = NULL;
+  ml_group_aim_member_t *member = NULL;
+  uint32_t h_position = 0, v_position = 0;
+
+  aim = calloc(sizeof(ml_group_aim_t) +
+               (group->count * sizeof(ml_group_aim_member_t)), 1);
+  if (aim == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  aim->callback = callback;
+  aim->user_data = user_data;
+  aim->pending = group->count + 1;
+
+  for (uint32_t i = 0; i < group->count; i++) {
+    member = &aim->members[i];
+    member->aim = aim;
+    member->launcher = group->members[i];
+    member->pending = 1;
+    member->status = ML_OK;
+    member->result = results != NULL ? &results[i] : NULL;
+
+    ml_launcher_get_position(member->launcher, &h_position, &v_position);
+    // Turn first, then raise or lower, both from the same starting point.
+    _ml_group_queue_axis(member, h_position, horizontal, ML_LEFT, ML_RIGHT);
+    _ml_group_queue_axis(member, v_position, vertical, ML_DOWN, ML_UP);
+    _ml_group_member_done(member, ML_OK);
+  }
+
+  if (__atomic_sub_fetch(&aim->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(aim);
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Aims every member of a group at a position without waiting.
+ * Each member's moves are worked out from its tracked position and its
+ * axis speeds, see ml_launcher_get_position and ml_launcher_set_axis_speed,
+ * and queued on its own launcher so the members move at the same time.
+ * Aim members only once their queued moves are done, the position used is
+ * where they are when this is called.
+ *
+ * @param group The group to aim.
+ * @param horizontal The horizontal target, millidegrees from the left stop.
+ * @param vertical The vertical target, millidegrees from the bottom stop.
+ * @param callback Called on the scheduler thread as each member finishes,
+ * with that member's first error, may be NULL.
+ * @param user_data Passed to the callback.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_group_aim_submit(ml_group_t *group, uint32_t horizontal, uint32_t vertical,
+                    ml_command_callback callback, void *user_data)
+{
+  if (group == NULL) {
+    return ML_NULL_POINTER;
+  }
+  return _ml_group_aim(group, horizontal, vertical, callback, user_data,
+                       NULL);
+}
+
+/**
+ * @brief Callback used by ml_group_aim.
+ *
+ * @param launcher The member that finished.
+ * @param status Its result, already stored.
+ * @param user_data The waiter.
+ */
+static void
+_ml_group_waiter_done(ml_launcher_t *launcher, ml_error_code status,
+                      void *user_data)
+{
+  ml_group_waiter_t *waiter = user_data;
+  (void)launcher;
+  (void)status;
+
+  pthread_mutex_lock(&waiter->lock);
+  waiter->remaining -= 1;
+  if (waiter->remaining == 0) {
+    pthread_cond_signal(&waiter->cond);
+  }
+  pthread_mutex_unlock(&waiter->lock);
+}
+
+/**
+ * @brief Aims every member of a group at a position and waits until they
+ * are all there, see ml_group_aim_submit. Takes as long as the slowest
+ * member's moves.
+ *
+ * @param group The group to aim.
+ * @param horizontal The horizontal target, millidegrees from the left stop.
+ * @param vertical The vertical target, millidegrees from the bottom stop.
+ * @param results Where to store each member's result in group order, may be
+ * NULL.
+ *
+ * @return A status code, the first error of any member.
+ */
+ml_error_code
+ml_group_aim(ml_group_t *group, uint32_t horizontal, uint32_t vertical,
+             ml_error_code *results)
+{
+  ml_group_waiter_t waiter;
+  ml_error_code *statuses = results;
+  ml_error_code result = ML_OK;
+
+  if (group == NULL) {
+    return ML_NULL_POINTER;
+  }
+  // Waiting on a scheduler thread could wait forever.
+  if (_ml_scheduler_is_current()) {
+    return ML_WOULD_BLOCK;
+  }
+  if (statuses == NULL) {
+    statuses = calloc(sizeof(ml_error_code), group->count);
+    if (statuses == NULL) {
+      return ML_ALLOC_FAILED;
+    }
+  }
+
+  pthread_mutex_init(&waiter.lock, NULL);
+  pthread_cond_init(&waiter.cond, NULL);
+  waiter.remaining = group->count;
+
+  result = _ml_group_aim(group, horizontal, vertical, _ml_group_waiter_done,
+                         &waiter, statuses);
+  if (result == ML_OK) {
+    pthread_mutex_lock(&waiter.lock);
+    while (waiter.remaining != 0) {
+      pthread_cond_wait(&waiter.cond, &waiter.lock);
+    }
+    pthread_mutex_unlock(&waiter.lock);
+    for (uint32_t i = 0; i < group->count && result == ML_OK; i++) {
+      result = statuses[i];
+    }
+  }
+
+  pthread_cond_destroy(&waiter.cond);
+  pthread_mutex_destroy(&waiter.lock);
+  if (statuses != results) {
+    free(statuses);
+  }
+  return result;
+}
@@ -0,0 +1,330 @@
+/**
+ * @file ml_journal.c
+ * @brief Records every command sent to a launcher into a memory mapped ring
+ * file, so a command stream can be inspected or replayed later.
+ * Writers reserve a slot with a single atomic add and fill it in place, the
+ * file is never locked or written with a system call on the hot path.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/**
+ * @brief Starts journaling every command sent to any launcher.
+ * The journal is a ring, once capacity records have been written the oldest
+ * are overwritten. An existing file at path is replaced.
+ *
+ * @param path Where to put the journal file.
+ * @param capacity How many records the ring holds.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_journal_start(const char *path, uint32_t capacity)
+{
+  ml_journal_t *journal = NULL;
+  struct timespec realtime;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (path == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (capacity == 0) {
+    return ML_COUNT_ZERO;
+  }
+  if (ml_main_controller->journal != NULL) {
+    return ML_NOT_NULL_POINTER;
+  }
+
+  journal = calloc(sizeof(ml_journal_t), 1);
+  if (journal == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  journal->capacity = capacity;
+  journal->map_size = sizeof(ml_journal_header_t) +
+    ((size_t)capacity * sizeof(ml_journal_record_t));
+
+  journal->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (journal->fd < 0) {
+    free(journal);
+    return ML_NOT_FOUND;
+  }
+  if (ftruncate(journal->fd, journal->map_size) != 0) {
+    goto fail;
+  }
+  journal->map = mmap(NULL, journal->map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, journal->fd, 0);
+  if (journal->map == MAP_FAILED) {
+    goto fail;
+  }
+
+  journal->header = journal->map;
+  journal->records = (ml_journal_record_t *)(journal->header + 1);
+  memcpy(journal->header->magic, ML_JOURNAL_MAGIC, 8);
+  journal->header->version = ML_JOURNAL_VERSION;
+  journal->header->record_size = sizeof(ml_journal_record_t);
+  journal->header->capacity = capacity;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  journal->header->started_realtime_ns =
+    ((uint64_t)realtime.tv_sec * 1000000000) + realtime.tv_nsec;
+  journal->header->started_monotonic_ns = _ml_monotonic_nseconds();
+  journal->header->head = 0;
+
+  __atomic_store_n(&ml_main_controller->journal, journal, __ATOMIC_SEQ_CST);
+  return ML_OK;
+
+fail:
+  close(journal->fd);
+  free(journal);
+  return ML_ALLOC_FAILED;
+}
+
+/**
+ * @brief Stops journaling and closes the journal file.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_journal_stop()
+{
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  return _ml_journal_close(ml_main_controller);
+}
+
+/**
+ * @brief Detaches the journal from the controller, waits for any writer
+ * still using it and then unmaps it.
+ *
+ * @param cont The controller.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_journal_close(ml_controller_t *cont)
+{
+  ml_journal_t *journal = NULL;
+
+  journal = __atomic_exchange_n(&cont->journal, NULL, __ATOMIC_SEQ_CST);
+  if (journal == NULL) {
+    return ML_NULL_POINTER;
+  }
+  // Writers announce themselves before looking at the pointer, so once the
+  // count drops to zero nobody can still be writing.
+  while (__atomic_load_n(&cont->journal_writers, __ATOMIC_SEQ_CST) != 0) {
+    sched_yield();
+  }
+
+  msync(journal->map, journal->map_size, MS_SYNC);
+  munmap(journal->map, journal->map_size);
+  close(journal->fd);
+  free(journal);
+  return ML_OK;
+}
+
+/**
+ * @brief Appends a record for a command that was just sent, if journaling
+ * is on.
+ *
+ * @param cont The controller.
+ * @param launcher The launcher the command went to.
+ * @param cmd The command.
+ * @param status The result of the transfer.
+ * @param sent_ns When the transfer started, monotonic nanoseconds.
+ */
+void
+_ml_journal_append(ml_controller_t *cont, ml_launcher_t *launcher,
+                   ml_launcher_cmd cmd, ml_error_code status,
+                   uint64_t sent_ns)
+{
+  ml_journal_t *journal = NULL;
+  ml_journal_record_t *record = NULL;
+  uint64_t index = 0, now = _ml_monotonic_nseconds();
+
+  __atomic_add_fetch(&cont->journal_writers, 1, __ATOMIC_SEQ_CST);
+  journal = __atomic_load_n(&cont->journal, __ATOMIC_SEQ_CST);
+  if (journal == NULL) {
+    goto out;
+  }
+
+  index = __atomic_fetch_add(&journal->header->head, 1, __ATOMIC_RELAXED);
+  record = &journal->records[index % journal->capacity];
+  // Clear the sequence first so a reader never pairs it with half a record.
+  __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->timestamp_ns = sent_ns;
+  record->latency_ns = (uint32_t)(now - sent_ns);
+  record->launcher_id = (uint16_t)((launcher->usb_bus << 8) |
+                                   launcher->usb_device_number);
+  record->command = (uint8_t)cmd;
+  record->status = (uint8_t)status;
+  memset(record->reserved, 0, sizeof(record->reserved));
+  __atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+
+out:
+  __atomic_sub_fetch(&cont->journal_writers, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Reads a journal file, oldest record first. Works on a journal that
+ * is still being written, records that were mid write are skipped.
+ *
+ * @param path The journal file.
+ * @param records Set to a new array of records, free with
+ * ml_journal_records_free.
+ * @param count Set to the number of records.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_journal_read(const char *path, ml_journal_record_t **records,
+                uint32_t *count)
+{
+  ml_journal_header_t header;
+  ml_journal_record_t *ring = NULL, *out = NULL;
+  struct stat info;
+  void *map = NULL;
+  uint64_t head = 0, first = 0;
+  uint32_t found = 0;
+  ml_error_code result = ML_OK;
+  int fd = -1;
+
+  if (path == NULL || records == NULL || count == NULL) {
+    return ML_NULL_POINTER;
+  }
+  (*records) = NULL;
+  (*count) = 0;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return ML_NOT_FOUND;
+  }
+  if (fstat(fd, &info) != 0 ||
+      (size_t)info.st_size < sizeof(ml_journal_header_t)) {
+    close(fd);
+    return ML_NOT_FOUND;
+  }
+  map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return ML_ALLOC_FAILED;
+  }
+
+  memcpy(&header, map, sizeof(header));
+  if (memcmp(header.magic, ML_JOURNAL_MAGIC, 8) != 0 ||
+      header.version != ML_JOURNAL_VERSION ||
+      header.record_size != sizeof(ml_journal_record_t) ||
+      header.capacity == 0 ||
+      (size_t)info.st_size < sizeof(ml_journal_header_t) +
+      ((size_t)header.capacity * sizeof(ml_journal_record_t))) {
+    result = ML_NOT_FOUND;
+    goto out;
+  }
+
+  ring = (ml_journal_record_t *)((ml_journal_header_t *)map + 1);
+  head = __atomic_load_n(&((ml_journal_header_t *)map)->head,
+                         __ATOMIC_ACQUIRE);
+  first = head > header.capacity ? head - header.capacity : 0;
+  if (head == first) {
+    goto out;
+  }
+
+  out = malloc(sizeof(ml_journal_record_t) * (head - first));
+  if (out == NULL) {
+    result = ML_ALLOC_FAILED;
+    goto out;
+  }
+
+  for (uint64_t i = first; i < head; i++) {
+    ml_journal_record_t *record = &ring[i % header.capacity];
+    if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != i + 1) {
+      continue;
+    }
+    out[found] = (*record);
+    // Overwritten while we copied it.
+    if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != i + 1) {
+      continue;
+    }
+    found++;
+  }
+
+  (*records) = out;
+  (*count) = found;
+
+out:
+  munmap(map, info.st_size);
+  return result;
+}
+
+/**
+ * @brief Frees records returned by ml_journal_read.
+ *
+ * @param records The records.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_journal_records_free(ml_journal_record_t *records)
+{
+  free(records);
+  return ML_OK;
+}
+
+/**
+ * @brief Maps a raw journaled command back to the command to submit to
+ * repeat it.
+ *
+ * @param command The command field of a record.
+ * @param type Set to the command type.
+ * @param direction Set to the direction, for moves.
+ *
+ * @return A status code, ML_NOT_FOUND for an unknown command.
+ */
+ml_error_code
+ml_journal_command_to_type(uint8_t command, ml_command_type *type,
+                           ml_launcher_direction *direction)
+{
+  if (type == NULL || direction == NULL) {
+    return ML_NULL_POINTER;
+  }
+
+  switch ((ml_launcher_cmd)command) {
+  case ML_DOWN_CMD:
+  case ML_UP_CMD:
+  case ML_LEFT_CMD:
+  case ML_RIGHT_CMD:
+    (*type) = ML_COMMAND_MOVE;
+    (*direction) = (ml_launcher_direction)command;
+    return ML_OK;
+  case ML_FIRE_CMD:
+    (*type) = ML_COMMAND_FIRE;
+    return ML_OK;
+  case ML_STOP_CMD:
+    (*type) = ML_COMMAND_STOP;
+    return ML_OK;
+  case ML_LED_ON_CMD:
+    (*type) = ML_COMMAND_LED_ON;
+    return ML_OK;
+  case ML_LED_OFF_CMD:
+    (*type) = ML_COMMAND_LED_OFF;
+    return ML_OK;
+  default:
+    return ML_NOT_FOUND;
+  }
+}
@@ -6,12 +6,47 @@
  * @date 2016-11-27
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libmissilelauncher.h"
 #include "libmissilelauncher_internal.h"
 
+/**
+ * @brief Sets up position tracking and the tracker for a new launcher, see
+ * _ml_launcher_track_cmd, ml_launcher_nudge and ml_tracker_push.
+ *
+ * @param launcher The launcher, its driver already set.
+ */
+static void
+_ml_launcher_init_motion(ml_launcher_t *launcher)
+{
+  for (int i = 0; i < 4; i++) {
+    launcher->axis_speed[i] = launcher->driver != NULL ?
+      launcher->driver->axis_speed[i] : 0;
+    if (launcher->driver != NULL) {
+      memcpy(launcher->pulse_table[i], launcher->driver->pulse_table[i],
+             sizeof(launcher->pulse_table[i]));
+      launcher->pulse_count[i] = launcher->driver->pulse_count[i];
+    }
+  }
+  launcher->motion_direction = -1;
+  launcher->pose_slot = -1;
+  // Assume it came loaded.
+  launcher->ammo = launcher->driver != NULL ?
+    launcher->driver->ammo_capacity : 0;
+  launcher->fire_reported = true;
+  launcher->tracker.deadband = ML_TRACK_DEADBAND_MDEG;
+  launcher->tracker.latency_ms = ML_TRACK_LATENCY_MS;
+  launcher->tracker.node.launcher = launcher;
+}
+
 /**
  * @brief Initializes a newly connected launcher.
  *
@@ -33,422 +68,1692 @@ _ml_launcher_init(ml_controller_t *controller,
   }
   libusb_get_device_descriptor(device, &desc);
 
-  launcher->type = _ml_catagorize_device(&desc);
-  launcher->usb_device = device;
+  launcher->driver = _ml_driver_find(desc.idVendor, desc.idProduct);
+  launcher->type = launcher->driver != NULL ?
+    launcher->driver->type : ML_NOT_LAUNCHER;
+  // Held so the pointer stays unique while the launcher knows it.
+  launcher->usb_device = libusb_ref_device(device);
+  launcher->usb_bus = libusb_get_bus_number(device);
+  launcher->usb_device_number = libusb_get_device_address(device);
+  launcher->usb_fd = -1;
+  launcher->transport = &ml_usb_transport;
   launcher->ref_count = 0;
-  launcher->device_connected = 1;
+  launcher->slot = -1;
+  _ml_launcher_init_motion(launcher);
   launcher->controller = controller;
 
   return ML_OK;
 }
 
 /**
- * @brief Cleans up a launcher, This must be done so libusb devices are
- * released.
+ * @brief Initializes a launcher found in sysfs. Nothing is opened, the
+ * device is opened through usbfs when the launcher is first used.
  *
- * @param launcher The launcher to destroy.
+ * @param controller The active controller.
+ * @param launcher The launcher to initialize.
+ * @param device The device that was found.
  *
  * @return A status code.
  */
 ml_error_code
-_ml_launcher_cleanup(ml_launcher_t **launcher)
+_ml_launcher_init_sysfs(ml_controller_t *controller,
+                        ml_launcher_t *launcher, ml_sysfs_device_t *device)
 {
-  if ((*launcher) == NULL) {
+  if (launcher == NULL) {
     return ML_NULL_POINTER;
   }
 
+  launcher->driver = _ml_driver_find(device->vendor_id, device->product_id);
+  launcher->type = launcher->driver != NULL ?
+    launcher->driver->type : ML_NOT_LAUNCHER;
+  // Filled in from the handle once it's opened.
+  launcher->usb_device = NULL;
+  launcher->usb_wrapped = true;
+  launcher->usb_fd = -1;
+  launcher->transport = &ml_usb_transport;
+  launcher->usb_bus = device->usb_bus;
+  launcher->usb_device_number = device->usb_device_number;
+  strcpy(launcher->port_path, device->port_path);
+  strcpy(launcher->serial, device->serial);
+  launcher->ref_count = 0;
+  launcher->slot = -1;
+  _ml_launcher_init_motion(launcher);
+  launcher->controller = controller;
 
-  free((*launcher));
-  launcher = NULL;
   return ML_OK;
 }
 
 /**
- * @brief Claim the launcher.
+ * @brief Initializes a simulated launcher, see ml_sim_add. It is a standard
+ * launcher that is always connected and never opens anything.
  *
- * @param launcher The launcher to claim.
+ * @param controller The active controller.
+ * @param launcher The launcher to initialize.
+ * @param index How many simulated launchers came before it, which decides
+ * where it is plugged in.
+ * @param sim Its simulated device, freed with the launcher.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_claim(ml_launcher_t *launcher)
+_ml_launcher_init_sim(ml_controller_t *controller, ml_launcher_t *launcher,
+                      uint32_t index, ml_sim_device_t *sim)
 {
-  int rv;
-
-  if(launcher->claimed) {
-    return ML_OK;
-  }
-
-  rv = libusb_open(launcher->usb_device, &(launcher->usb_handle));
-  if(rv != 0) {
-    return rv;
-  }
-
-#ifdef LINUX
-  // Linux needs some workarounds
-  rv = libusb_kernel_driver_active(launcher->usb_handle, 0);
-  if(rv == 1) {
-    libusb_detach_kernel_driver(launcher->usb_handle, 0);
+  if (launcher == NULL || sim == NULL) {
+    return ML_NULL_POINTER;
   }
-  libusb_claim_interface(launcher->usb_handle, 0);
-#endif
 
-  launcher->claimed = true;
+  launcher->driver = _ml_driver_find(ML_STD_VENDOR_ID, ML_STD_PRODUCT_ID);
+  launcher->type = launcher->driver != NULL ?
+    launcher->driver->type : ML_NOT_LAUNCHER;
+  launcher->usb_device = NULL;
+  launcher->usb_fd = -1;
+  // Device number 0 is never handed out.
+  launcher->usb_bus = ML_MAX_USB_BUSES - 1 -
+    (index / (ML_MAX_USB_DEVICES - 1));
+  launcher->usb_device_number = 1 + (index % (ML_MAX_USB_DEVICES - 1));
+  snprintf(launcher->port_path, sizeof(launcher->port_path), "sim-%u.%u",
+           launcher->usb_bus, launcher->usb_device_number);
+  snprintf(launcher->serial, sizeof(launcher->serial), "SIM%04u", index);
+  launcher->transport = &ml_sim_transport;
+  launcher->sim = sim;
+  launcher->ref_count = 0;
+  launcher->slot = -1;
+  _ml_launcher_init_motion(launcher);
+  launcher->controller = controller;
 
   return ML_OK;
 }
 
 /**
- * @brief Unclaim the launcher.
+ * @brief Cleans up a launcher, This must be done so libusb devices are
+ * released.
  *
- * @param launcher The launcher to unclaim.
+ * @param launcher The launcher to destroy.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_unclaim(ml_launcher_t *launcher)
+_ml_launcher_cleanup(ml_launcher_t **launcher)
 {
-  if(!(launcher->claimed)) {
-    goto out;
+  if ((*launcher) == NULL) {
+    return ML_NULL_POINTER;
   }
 
-#ifdef LINUX
-  libusb_release_interface(launcher->usb_handle, 0);
-#endif
-
-	libusb_close(launcher->usb_handle);
-
-out:
-  launcher->claimed = false;
+  if ((*launcher)->power_pinned) {
+    // Freed while still claimed, don't leave the device pinned.
+    _ml_sysfs_restore_power((*launcher)->controller, (*launcher)->port_path,
+                            (*launcher)->power_control);
+  }
+  ml_usb_close_launcher(*launcher);
+  if ((*launcher)->usb_device != NULL) {
+    libusb_unref_device((*launcher)->usb_device);
+  }
+  if ((*launcher)->sim != NULL) {
+    _ml_sim_free((*launcher)->sim);
+  }
+  free((*launcher));
+  launcher = NULL;
   return ML_OK;
 }
 
 /**
- * @brief Refrences a launcher so that it isn't destroyed.
- * If a launcher isn't refrenced, when you call ml_free_launcher_array the
- * refrence may
- * or may not be freed. Thus you can't guarantee that the memory is still there
- * for
- * you to use. Using ml_refrence_launcher with ml_launcher_dereference avoids
- * this issue.
+ * @brief Builds the port path of a device, its bus and the port numbers
+ * down to it like 1-4.2. This is also its name in sysfs.
  *
- * @param launcher The launcher to reference.
+ * @param device The device.
+ * @param port_path Where to put the path, ML_PORT_PATH_SIZE long.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_reference(ml_launcher_t *launcher)
+_ml_usb_port_path(libusb_device *device, char *port_path)
 {
-  if (launcher == NULL) {
-    return ML_NULL_POINTER;
+  uint8_t ports[ML_MAX_PORT_DEPTH];
+  int depth = 0, length = 0;
+
+  depth = libusb_get_port_numbers(device, ports, ML_MAX_PORT_DEPTH);
+  if (depth < 0) {
+    depth = 0;
   }
-  launcher->ref_count += 1;
-  return ML_OK;
+  length = snprintf(port_path, ML_PORT_PATH_SIZE, "%u",
+                    libusb_get_bus_number(device));
+  for (int i = 0; i < depth; i++) {
+    length += snprintf(port_path + length, ML_PORT_PATH_SIZE - length,
+                       "%c%u", i == 0 ? '-' : '.', ports[i]);
+  }
+  return depth > 0 ? ML_OK : ML_NOT_FOUND;
 }
 
 /**
- * @brief Dereferences a launcher so that it can be eventually destroyed.
- * Just as with malloc and free, when using ml_launcher_reference you must use
- * ml_launcher_dereference or suffer memory leaks.
+ * @brief Reads the serial number string of a device, if it has one.
+ * Reading it needs an open handle, the device is opened briefly when
+ * handle is NULL.
  *
- * @param launcher The launcher to dereference.
+ * @param device The device.
+ * @param handle An open handle to the device or NULL.
+ * @param serial Where to put the serial, ML_SERIAL_SIZE long. Left empty
+ * when the device doesn't have one.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_dereference(ml_launcher_t *launcher)
+_ml_usb_read_serial(libusb_device *device, libusb_device_handle *handle,
+                    char *serial)
 {
-  if (launcher == NULL) {
-    return ML_NULL_POINTER;
+  struct libusb_device_descriptor desc;
+  libusb_device_handle *own_handle = NULL;
+  int rv = 0;
+
+  serial[0] = '\0';
+  libusb_get_device_descriptor(device, &desc);
+  if (desc.iSerialNumber == 0) {
+    return ML_OK;
   }
-  launcher->ref_count -= 1;
-  if (launcher->ref_count == 0 && launcher->device_connected == 0) {
-    // Not connected and not refrenced
-    _ml_remove_launcher(launcher->controller, launcher);
-    _ml_launcher_cleanup(&launcher);
+  if (handle == NULL) {
+    if (libusb_open(device, &own_handle) != 0) {
+      return ML_LIBUSB_ERROR;
+    }
+    handle = own_handle;
+  }
+  rv = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
+                                          (unsigned char *)serial,
+                                          ML_SERIAL_SIZE);
+  if (own_handle != NULL) {
+    libusb_close(own_handle);
+  }
+  if (rv < 0) {
+    serial[0] = '\0';
+    return ML_LIBUSB_ERROR;
   }
   return ML_OK;
 }
 
 /**
- * @brief Fires a missile from the launcher.
+ * @brief Checks if a device is this launcher. The serial number decides
+ * when there is one, so a launcher moved to another port is still found.
+ * Otherwise the launcher is whatever is plugged into its port.
  *
- * @param launcher The launcher to fire from.
+ * @param launcher The launcher.
+ * @param port_path The port path of the device.
+ * @param serial The serial of the device, empty if it has none.
  *
- * @return A status code.
+ * @return True if the device is the launcher.
  */
-ml_error_code
-ml_launcher_fire(ml_launcher_t *launcher)
+bool
+_ml_launcher_same_identity(ml_launcher_t *launcher, const char *port_path,
+                           const char *serial)
 {
-  if(!launcher->claimed) {
-    return ML_UNCLAIMED;
+  if (launcher->serial[0] != '\0' || serial[0] != '\0') {
+    return strcmp(launcher->serial, serial) == 0;
   }
-
-  // TODO implement error checking
-  return _ml_launcher_send_cmd_unsafe(launcher, ML_FIRE_CMD);
+  return strcmp(launcher->port_path, port_path) == 0;
 }
 
 /**
- * @brief Stop moving the launcher.
+ * @brief Points a launcher that was disconnected at the device it came
+ * back as. Claims and leases are kept, if the launcher still holds a USB
+ * handle it is swapped by _ml_launcher_usb_reopen_unsafe once the poll is
+ * done. Hold the controller lock.
  *
- * @param launcher The launcher to stop.
+ * @param launcher The disconnected launcher.
+ * @param device The device it reconnected as.
+ * @param port_path Where the device is plugged in now.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_stop(ml_launcher_t *launcher)
+_ml_launcher_reattach_unsafe(ml_launcher_t *launcher, libusb_device *device,
+                             const char *port_path)
 {
-  if(!launcher->claimed) {
-    return ML_UNCLAIMED;
-  }
+  libusb_unref_device(launcher->usb_device);
+  launcher->usb_device = libusb_ref_device(device);
+  launcher->usb_bus = libusb_get_bus_number(device);
+  launcher->usb_device_number = libusb_get_device_address(device);
+  strcpy(launcher->port_path, port_path);
+  _ml_fleet_attach_unsafe(launcher);
+  _ml_log(ML_LOG_LAUNCHER_RECONNECTED, launcher->usb_bus,
+          launcher->usb_device_number, ML_FLEET(launcher, id), 0);
+  // libusb knows the new device, no need to go through usbfs.
+  launcher->usb_wrapped = false;
 
-  return _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+  if (launcher->usb_open || launcher->usb_opening) {
+    launcher->usb_reattach = true;
+  }
+  return ML_OK;
 }
 
 /**
- * @brief Moves the launcher in the specified direction.
+ * @brief Points a launcher that was disconnected at the device it came
+ * back as, for devices found in sysfs. Like _ml_launcher_reattach_unsafe,
+ * but the new device is opened through usbfs. Hold the controller lock.
  *
- * @param launcher The launcher to move.
- * @param direction The specified direction.
+ * @param launcher The disconnected launcher.
+ * @param device The device it reconnected as.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_move(ml_launcher_t *launcher, ml_launcher_direction direction)
+_ml_launcher_reattach_sysfs_unsafe(ml_launcher_t *launcher,
+                                   ml_sysfs_device_t *device)
 {
-  if(!launcher->claimed) {
-    return ML_UNCLAIMED;
+  if (launcher->usb_device != NULL) {
+    libusb_unref_device(launcher->usb_device);
+    launcher->usb_device = NULL;
   }
+  launcher->usb_bus = device->usb_bus;
+  launcher->usb_device_number = device->usb_device_number;
+  strcpy(launcher->port_path, device->port_path);
+  _ml_fleet_attach_unsafe(launcher);
+  _ml_log(ML_LOG_LAUNCHER_RECONNECTED, launcher->usb_bus,
+          launcher->usb_device_number, ML_FLEET(launcher, id), 0);
+  launcher->usb_wrapped = true;
 
-  return _ml_launcher_move_unsafe(launcher, direction);
+  if (launcher->usb_open || launcher->usb_opening) {
+    launcher->usb_reattach = true;
+  }
+  return ML_OK;
 }
 
 /**
- * @brief Resets the launcher to 0 degrees of elevation and then centers the
- * launcher.
+ * @brief Swaps the USB handle of a reattached launcher for one on its new
+ * device and claims the interface again. Hold the controller lock, it is
+ * dropped while the device is opened.
  *
- * @param launcher The launcher to zero.
+ * @param launcher The reattached launcher.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_zero(ml_launcher_t *launcher)
+_ml_launcher_usb_reopen_unsafe(ml_launcher_t *launcher)
 {
-  ml_time_t left_time, down_time, right_time, up_time;
+  ml_controller_t *cont = launcher->controller;
+  ml_error_code result = ML_OK;
 
-  if(!launcher->claimed) {
-    return ML_UNCLAIMED;
+  while (launcher->usb_opening) {
+    pthread_cond_wait(&cont->open_cond, &cont->lock);
   }
+  launcher->usb_opening = true;
+  __atomic_store_n(&launcher->usb_stale, true, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&cont->lock);
 
-  switch (launcher->type) {
-  case ML_STANDARD_LAUNCHER:
-    // Setup movement constants
-    _ml_mseconds_to_time(6000, &left_time); // Correct
-    _ml_mseconds_to_time(2000, &down_time); // Correct
-    _ml_mseconds_to_time(2750, &right_time);
-    _ml_mseconds_to_time(100, &up_time); // Correct
-    break;
-  default:
-    return ML_NOT_IMPLEMENTED;
+  // Transfers on the old handle fail quickly, the device is gone.
+  while (__atomic_load_n(&launcher->usb_transfers, __ATOMIC_SEQ_CST) != 0) {
+    sched_yield();
+  }
+  ml_usb_close_launcher(launcher);
+  result = ml_usb_open_launcher(launcher);
+  if (result == ML_OK) {
+    __atomic_store_n(&launcher->usb_stale, false, __ATOMIC_RELEASE);
   }
 
-  // Move to known position then to 0 deg vert and center
-  _ml_launcher_move_time_unsafe(launcher, ML_LEFT, &left_time);
-  _ml_launcher_move_time_unsafe(launcher, ML_DOWN, &down_time);
-  _ml_launcher_move_time_unsafe(launcher, ML_RIGHT, &right_time);
-  _ml_launcher_move_time_unsafe(launcher, ML_UP, &up_time);
+  pthread_mutex_lock(&cont->lock);
+  launcher->usb_opening = false;
+  pthread_cond_broadcast(&cont->open_cond);
+  if (result != ML_OK) {
+    return result;
+  }
+  // The claim may have been dropped while the lock was.
+  return _ml_launcher_usb_release_unsafe(launcher);
+}
 
-  return ML_OK;
+/**
+ * @brief Marks the start of a transfer on the launcher's handle.
+ *
+ * @param launcher The launcher.
+ *
+ * @return False if the handle is being swapped, don't touch it.
+ */
+static bool
+_ml_launcher_usb_enter(ml_launcher_t *launcher)
+{
+  __atomic_add_fetch(&launcher->usb_transfers, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&launcher->usb_stale, __ATOMIC_SEQ_CST)) {
+    __atomic_sub_fetch(&launcher->usb_transfers, 1, __ATOMIC_RELEASE);
+    return false;
+  }
+  return true;
 }
 
 /**
- * @brief Turns on the led of the selected launcher.
+ * @brief Marks the end of a transfer started with _ml_launcher_usb_enter.
  *
- * @param launcher The launcher to get it's led turned on.
+ * @param launcher The launcher.
+ */
+static void
+_ml_launcher_usb_exit(ml_launcher_t *launcher)
+{
+  __atomic_sub_fetch(&launcher->usb_transfers, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Opens a launcher's device node and hands it to libusb, for
+ * launchers that were never enumerated by libusb.
+ *
+ * @param launcher The launcher to open.
  *
  * @return A status code.
  */
-ml_error_code
-ml_launcher_led_on(ml_launcher_t *launcher)
+static ml_error_code
+_ml_usb_wrap_launcher(ml_launcher_t *launcher)
 {
-  ml_error_code result = 0;
+#ifdef ML_HAVE_USB_WRAP
+  char path[ML_SYSFS_PATH_SIZE];
+  int fd = -1, rv = 0;
 
-  if(!launcher->claimed) {
-    return ML_UNCLAIMED;
+  snprintf(path, sizeof(path), "%s/%03u/%03u",
+           launcher->controller->usbfs_root, launcher->usb_bus,
+           launcher->usb_device_number);
+  fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    _ml_log(ML_LOG_USB_WRAP_FAILED, launcher->usb_bus,
+            launcher->usb_device_number, errno, 0);
+    return ML_NOT_FOUND;
   }
-
-  // TODO implement error checking
-  result = _ml_launcher_send_cmd_unsafe(launcher, ML_LED_ON_CMD);
-  if(result == ML_OK) {
-    launcher->led_status = 1;
+  rv = libusb_wrap_sys_device(NULL, fd, &(launcher->usb_handle));
+  if (rv != 0) {
+    _ml_log(ML_LOG_USB_OPEN_FAILED, launcher->usb_bus,
+            launcher->usb_device_number, rv, 0);
+    close(fd);
+    return ML_LIBUSB_ERROR;
   }
-
-  return result;
+  launcher->usb_fd = fd;
+  if (launcher->usb_device == NULL) {
+    launcher->usb_device = libusb_ref_device(
+        libusb_get_device(launcher->usb_handle));
+  }
+  return ML_OK;
+#else
+  (void)launcher;
+  return ML_NOT_IMPLEMENTED;
+#endif
 }
 
 /**
- * @brief Turns off the led of the selected launcher.
+ * @brief Opens the USB handle of a real launcher and claims its interface.
  *
- * @param launcher The launcher to get it's led turned off.
+ * @param launcher The launcher to open.
  *
  * @return A status code.
  */
-ml_error_code
-ml_launcher_led_off(ml_launcher_t *launcher)
+static ml_error_code
+_ml_usb_transport_open(ml_launcher_t *launcher)
 {
-  ml_error_code result = 0;
+  int rv;
 
-  if(!launcher->claimed) {
-    return ML_UNCLAIMED;
+  if (launcher->usb_wrapped) {
+    ml_error_code result = _ml_usb_wrap_launcher(launcher);
+    if (result != ML_OK) {
+      return result;
+    }
+  } else {
+    rv = libusb_open(launcher->usb_device, &(launcher->usb_handle));
+    if(rv != 0) {
+      _ml_log(ML_LOG_USB_OPEN_FAILED, launcher->usb_bus,
+              launcher->usb_device_number, rv, 0);
+      return ML_LIBUSB_ERROR;
+    }
   }
 
-  // TODO implement error checking
-  result = _ml_launcher_send_cmd_unsafe(launcher, ML_LED_OFF_CMD);
-  if(result == ML_OK) {
-    launcher->led_status = 0;
+#ifdef LINUX
+  // Linux needs some workarounds
+  rv = libusb_kernel_driver_active(launcher->usb_handle, 0);
+  if(rv == 1) {
+    rv = libusb_detach_kernel_driver(launcher->usb_handle, 0);
+    if (rv != 0) {
+      _ml_log(ML_LOG_USB_DETACH_FAILED, launcher->usb_bus,
+              launcher->usb_device_number, rv, 0);
+    }
   }
+  rv = libusb_claim_interface(launcher->usb_handle, 0);
+  if(rv != 0) {
+    _ml_log(ML_LOG_USB_CLAIM_FAILED, launcher->usb_bus,
+            launcher->usb_device_number, rv, 0);
+    libusb_close(launcher->usb_handle);
+    launcher->usb_handle = NULL;
+    if (launcher->usb_fd >= 0) {
+      close(launcher->usb_fd);
+      launcher->usb_fd = -1;
+    }
+    return ML_LIBUSB_ERROR;
+  }
+#endif
 
-  return result;
+  return ML_OK;
 }
 
 /**
- * @brief Determines if the LED is on or off.
- *
- * @param launcher The launcher to check.
+ * @brief Releases the interface of a real launcher and closes its USB
+ * handle.
  *
- * @return 1 = on 0 = off
+ * @param launcher The launcher to close.
  */
-uint8_t
-ml_launcher_get_led_state(ml_launcher_t *launcher)
+static void
+_ml_usb_transport_close(ml_launcher_t *launcher)
 {
-  uint8_t status = 0;
+#ifdef LINUX
+  libusb_release_interface(launcher->usb_handle, 0);
+#endif
 
-  status = launcher->led_status;
+  libusb_close(launcher->usb_handle);
+  launcher->usb_handle = NULL;
+  if (launcher->usb_fd >= 0) {
+    // libusb leaves wrapped descriptors to us.
+    close(launcher->usb_fd);
+    launcher->usb_fd = -1;
+  }
+}
 
-  return status;
+/**
+ * @brief Sends a control transfer to a real launcher.
+ *
+ * @param launcher The launcher.
+ * @param request_type The bmRequestType field.
+ * @param request The bRequest field.
+ * @param value The wValue field.
+ * @param index The wIndex field.
+ * @param data The data to send or the buffer to read into.
+ * @param length How long data is.
+ * @param timeout In milliseconds, 0 for none.
+ *
+ * @return The bytes transferred or a libusb error code.
+ */
+static int
+_ml_usb_transport_control(ml_launcher_t *launcher, uint8_t request_type,
+                          uint8_t request, uint16_t value, uint16_t index,
+                          unsigned char *data, uint16_t length,
+                          unsigned int timeout)
+{
+  return libusb_control_transfer(launcher->usb_handle, request_type, request,
+                                 value, index, data, length, timeout);
 }
 
 /**
- * @brief Moves the specified launcher, in the specified direction
- * for the specified number of milliseconds.
+ * @brief Reads an interrupt transfer from a real launcher.
  *
- * @param launcher The launcher the move.
- * @param direction The direction to move in.
- * @param mseconds The number of milliseconds to move for.
+ * @param launcher The launcher.
+ * @param endpoint The endpoint to read from.
+ * @param data The buffer to read into.
+ * @param length How long data is.
+ * @param transferred Where to put how much was read.
+ * @param timeout In milliseconds, 0 for none.
+ *
+ * @return 0 or a libusb error code.
+ */
+static int
+_ml_usb_transport_interrupt(ml_launcher_t *launcher, unsigned char endpoint,
+                            unsigned char *data, int length, int *transferred,
+                            unsigned int timeout)
+{
+  return libusb_interrupt_transfer(launcher->usb_handle, endpoint, data,
+                                   length, transferred, timeout);
+}
+
+const ml_transport_t ml_usb_transport = {
+  .open = _ml_usb_transport_open,
+  .close = _ml_usb_transport_close,
+  .control = _ml_usb_transport_control,
+  .interrupt = _ml_usb_transport_interrupt
+};
+
+/**
+ * @brief Opens the USB handle of the launcher and claims its interface.
+ *
+ * @param launcher The launcher to open.
  *
  * @return A status code.
  */
 ml_error_code
-ml_launcher_move_mseconds(ml_launcher_t *launcher,
-                          ml_launcher_direction direction,
-                          uint32_t mseconds)
+ml_usb_open_launcher(ml_launcher_t *launcher)
 {
-  ml_time_t time;
+  ml_error_code result = ML_OK;
 
-  if(!launcher->claimed) {
-    return ML_UNCLAIMED;
+  if (launcher->usb_open) {
+    return ML_LAUNCHER_OPEN;
+  }
+
+  result = launcher->transport->open(launcher);
+  if (result != ML_OK) {
+    return result;
   }
 
-  _ml_mseconds_to_time(mseconds, &time);
-  return _ml_launcher_move_time_unsafe(launcher, direction, &time);
+  launcher->usb_open = true;
+  return ML_OK;
 }
 
 /**
- * @brief Moves the launcher for a specified amount of time.
+ * @brief Releases the interface of the launcher and closes its USB handle.
  *
- * @param launcher Th launcher to move.
- * @param direction The direction to move in.
- * @param time The time to move for.
+ * @param launcher The launcher to close.
  *
- * @return A status code
+ * @return A status code.
  */
 ml_error_code
-_ml_launcher_move_time_unsafe(ml_launcher_t *launcher,
-                              ml_launcher_direction direction,
-                              ml_time_t *time)
+ml_usb_close_launcher(ml_launcher_t *launcher)
 {
-  ml_error_code result = 0;
-
-  result = _ml_launcher_move_unsafe(launcher, direction);
-  if (result != ML_OK) {
-    goto out;
+  if (!launcher->usb_open) {
+    return ML_OK;
   }
-  // Sleep the set amount of time:
-  ml_second_sleep(time->seconds);
-  ml_msecond_sleep(time->mseconds);
-  // Stop movement
-  result = _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
-  // Wait for device to stop coasting
-  ml_msecond_sleep(200);
 
-out:
-  return result;
+  launcher->transport->close(launcher);
+  launcher->usb_open = false;
+  return ML_OK;
 }
 
 /**
- * @brief Move the launcher in an unsafe manner.
- * Internal use only please! :)
+ * @brief Makes sure the launcher has an open USB handle, reusing the cached
+ * one if it is still around. Hold the controller lock.
+ * The lock is dropped while the device is opened so other launchers can be
+ * opened at the same time.
  *
- * @param launcher The launcher to move.
- * @param direction The direction to move the launcher in.
+ * @param launcher The launcher that is about to be used.
  *
  * @return A status code.
  */
 ml_error_code
-_ml_launcher_move_unsafe(ml_launcher_t *launcher,
-                         ml_launcher_direction direction)
+_ml_launcher_usb_acquire_unsafe(ml_launcher_t *launcher)
 {
-  return _ml_launcher_send_cmd_unsafe(launcher, (ml_launcher_cmd)direction);
+  ml_controller_t *cont = launcher->controller;
+  ml_error_code result = ML_OK;
+
+  // Someone else is opening it, wait for them.
+  while (launcher->usb_opening) {
+    pthread_cond_wait(&cont->open_cond, &cont->lock);
+  }
+  if (launcher->usb_open) {
+    return ML_OK;
+  }
+  if (!ML_FLEET(launcher, connected)) {
+    return ML_NOT_FOUND;
+  }
+
+  launcher->usb_opening = true;
+  pthread_mutex_unlock(&cont->lock);
+  result = ml_usb_open_launcher(launcher);
+  if (result == ML_OK) {
+    // A failed reopen after a reconnect leaves the handle marked stale.
+    __atomic_store_n(&launcher->usb_stale, false, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_lock(&cont->lock);
+  launcher->usb_opening = false;
+  pthread_cond_broadcast(&cont->open_cond);
+  return result;
 }
 
 /**
- * @brief Sends a cmd to the launcher.
- * Add to this switch statement if you have a different type of launcher.
+ * @brief Called when a user of the USB handle is done with it. Once nobody
+ * holds a claim or a lease the handle is left open and the reaper closes it
+ * after the idle timeout. Hold the controller lock.
  *
- * @param launcher The launcher to send the cmd to.
- * @param cmd The cmd to send to the launcher.
+ * @param launcher The launcher that is no longer being used.
  *
  * @return A status code.
  */
 ml_error_code
-_ml_launcher_send_cmd_unsafe(ml_launcher_t *launcher, ml_launcher_cmd cmd)
+_ml_launcher_usb_release_unsafe(ml_launcher_t *launcher)
 {
-  uint8_t request_type = 0, request_field = 0;
-  uint16_t value = 0, index = 0;
-  int16_t status = 0;
-  switch (launcher->type) {
-  case ML_STANDARD_LAUNCHER:
-    request_type = ML_REQUEST_TYPE_SEND;
-    request_field = ML_REQUEST_FIELD_SEND;
-    value = 0;
-    index = 0;
-    break;
-  default:
-    return ML_NOT_IMPLEMENTED;
-  }
+  ml_controller_t *cont = launcher->controller;
 
-  status = libusb_control_transfer(launcher->usb_handle, request_type,
-                                   request_field, value, index,
-                                   ml_cmd_arr[cmd], ML_CMD_ARR_SIZE, 0);
-  if (status < 0) {
-    return ML_LIBUSB_ERROR;
-  } else {
+  if (_ml_launcher_is_claimed(launcher) || !launcher->usb_open) {
     return ML_OK;
   }
+
+  if (cont->claim_idle_timeout_ms == 0 ||
+      !ML_FLEET(launcher, connected)) {
+    return ml_usb_close_launcher(launcher);
+  }
+
+  launcher->usb_idle_since = _ml_monotonic_mseconds();
+  if (!cont->reaper_running) {
+    return _ml_controller_start_reaper(cont);
+  }
+  _ml_cond_signal(&cont->reaper_cond);
+  return ML_OK;
 }
 
 /**
- * @brief Changes milliseconds to a time object.
+ * @brief Checks if someone holds a claim or a lease on the launcher.
  *
- * @param mseconds The milliseonds to convert.
- * @param time The time object to put it into.
+ * @param launcher The launcher to check.
+ *
+ * @return true if commands may be sent to the launcher.
+ */
+bool
+_ml_launcher_is_claimed(ml_launcher_t *launcher)
+{
+  return ML_FLEET(launcher, claimed) ||
+    ML_FLEET(launcher, lease_count) > 0;
+}
+
+/**
+ * @brief Claim the launcher.
+ * If the launcher was claimed recently the USB handle is still open and
+ * claiming it is cheap.
+ *
+ * @param launcher The launcher to claim.
  *
  * @return A status code.
  */
 ml_error_code
-_ml_mseconds_to_time(uint32_t mseconds, ml_time_t *time)
+ml_launcher_claim(ml_launcher_t *launcher)
 {
-  if (time == NULL) {
+  return ml_launcher_claim_flags(launcher, ML_CLAIM_DEFAULT);
+}
+
+/**
+ * @brief Keeps a claimed launcher out of USB autosuspend by pinning its
+ * power state on, see ML_CLAIM_NO_SUSPEND. Hold the controller lock.
+ *
+ * @param launcher The launcher.
+ */
+static void
+_ml_launcher_pin_power_unsafe(ml_launcher_t *launcher)
+{
+  ml_controller_t *cont = launcher->controller;
+
+  launcher->power_keep = true;
+  if (!launcher->power_pinned) {
+    launcher->power_pinned = _ml_sysfs_pin_power(
+      cont, launcher->port_path, launcher->power_control) == ML_OK;
+    if (!launcher->power_pinned) {
+      _ml_log(ML_LOG_POWER_PIN_FAILED, launcher->usb_bus,
+              launcher->usb_device_number, 0, 0);
+    }
+  }
+  if (cont->keep_alive_ms != 0) {
+    if (!cont->reaper_running) {
+      _ml_controller_start_reaper(cont);
+    }
+    _ml_cond_signal(&cont->reaper_cond);
+  }
+}
+
+/**
+ * @brief Puts back the power state pinned by _ml_launcher_pin_power_unsafe.
+ * Hold the controller lock.
+ *
+ * @param launcher The launcher.
+ */
+static void
+_ml_launcher_unpin_power_unsafe(ml_launcher_t *launcher)
+{
+  if (launcher->power_pinned) {
+    _ml_sysfs_restore_power(launcher->controller, launcher->port_path,
+                            launcher->power_control);
+    launcher->power_pinned = false;
+  }
+  launcher->power_keep = false;
+}
+
+/**
+ * @brief Claim the launcher with options.
+ * ML_CLAIM_NO_SUSPEND keeps the device from being autosuspended while it is
+ * claimed, so the first command after an idle period doesn't wait for it
+ * to wake up. The power state is pinned through sysfs, which needs write
+ * access to the device's power/control. Without it the claim still
+ * succeeds, ml_launcher_get_power_stats shows whether the pin took, and
+ * ml_library_set_keep_alive can keep the device busy instead.
+ *
+ * @param launcher The launcher to claim.
+ * @param flags ML_CLAIM_DEFAULT or ML_CLAIM_NO_SUSPEND. Use
+ * ml_launcher_lease for leases.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_claim_flags(ml_launcher_t *launcher, uint32_t flags)
+{
+  ml_controller_t *cont = NULL;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  cont = launcher->controller;
+
+  pthread_mutex_lock(&cont->lock);
+  if (!ML_FLEET(launcher, claimed)) {
+    result = _ml_launcher_usb_acquire_unsafe(launcher);
+    if (result == ML_OK) {
+      ML_FLEET(launcher, claimed) = true;
+    }
+  }
+  if (result == ML_OK && (flags & ML_CLAIM_NO_SUSPEND)) {
+    _ml_launcher_pin_power_unsafe(launcher);
+  }
+  pthread_mutex_unlock(&cont->lock);
+  return result;
+}
+
+/**
+ * @brief Unclaim the launcher.
+ * The USB handle stays open until it has been idle for the claim idle
+ * timeout, see ml_library_set_claim_idle_timeout. A power state pinned by
+ * ML_CLAIM_NO_SUSPEND is put back.
+ *
+ * @param launcher The launcher to unclaim.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_unclaim(ml_launcher_t *launcher)
+{
+  ml_controller_t *cont = NULL;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  cont = launcher->controller;
+
+  pthread_mutex_lock(&cont->lock);
+  if(!(ML_FLEET(launcher, claimed))) {
+    goto out;
+  }
+
+  ML_FLEET(launcher, claimed) = false;
+  _ml_launcher_unpin_power_unsafe(launcher);
+  result = _ml_launcher_usb_release_unsafe(launcher);
+
+out:
+  pthread_mutex_unlock(&cont->lock);
+  return result;
+}
+
+/**
+ * @brief Takes a counted lease on the launcher.
+ * Unlike ml_launcher_claim, leases stack: several parts of a program can
+ * share one open launcher, each taking and returning its own lease.
+ * A leased launcher accepts commands just like a claimed one.
+ *
+ * @param launcher The launcher to lease.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_lease(ml_launcher_t *launcher)
+{
+  ml_controller_t *cont = NULL;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  cont = launcher->controller;
+
+  pthread_mutex_lock(&cont->lock);
+  result = _ml_launcher_usb_acquire_unsafe(launcher);
+  if (result == ML_OK) {
+    ML_FLEET(launcher, lease_count) += 1;
+  }
+  pthread_mutex_unlock(&cont->lock);
+  return result;
+}
+
+/**
+ * @brief Returns a lease taken with ml_launcher_lease.
+ *
+ * @param launcher The launcher to release.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_release(ml_launcher_t *launcher)
+{
+  ml_controller_t *cont = NULL;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  cont = launcher->controller;
+
+  pthread_mutex_lock(&cont->lock);
+  if (ML_FLEET(launcher, lease_count) == 0) {
+    result = ML_COUNT_ZERO;
+    goto out;
+  }
+
+  ML_FLEET(launcher, lease_count) -= 1;
+  result = _ml_launcher_usb_release_unsafe(launcher);
+
+out:
+  pthread_mutex_unlock(&cont->lock);
+  return result;
+}
+
+/**
+ * @brief Refrences a launcher so that it isn't destroyed.
+ * If a launcher isn't refrenced, when you call ml_free_launcher_array the
+ * refrence may
+ * or may not be freed. Thus you can't guarantee that the memory is still there
+ * for
+ * you to use. Using ml_refrence_launcher with ml_launcher_dereference avoids
+ * this issue.
+ *
+ * @param launcher The launcher to reference.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_reference(ml_launcher_t *launcher)
+{
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  // The caller holds a reference already, so the count can't be hitting
+  // zero under us and no lock is needed.
+  __atomic_add_fetch(&launcher->ref_count, 1, __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Dereferences a launcher so that it can be eventually destroyed.
+ * Just as with malloc and free, when using ml_launcher_reference you must use
+ * ml_launcher_dereference or suffer memory leaks.
+ *
+ * @param launcher The launcher to dereference.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_dereference(ml_launcher_t *launcher)
+{
+  ml_controller_t *cont = NULL;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  cont = launcher->controller;
+
+  pthread_mutex_lock(&cont->lock);
+  if (__atomic_sub_fetch(&launcher->ref_count, 1, __ATOMIC_ACQ_REL) == 0 &&
+      ML_FLEET(launcher, connected) == 0) {
+    // Not connected and not refrenced
+    _ml_remove_launcher(cont, launcher);
+    _ml_launcher_cleanup(&launcher);
+  }
+  pthread_mutex_unlock(&cont->lock);
+  return ML_OK;
+}
+
+/**
+ * @brief Fires a missile from the launcher.
+ * Like the other blocking commands this goes through the launcher's command
+ * queue and returns once the command has run, that is once the firing
+ * cycle is over, see ml_launcher_fire_n.
+ *
+ * @param launcher The launcher to fire from.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_fire(ml_launcher_t *launcher)
+{
+  ml_command_t cmd = { .type = ML_COMMAND_FIRE };
+
+  return _ml_launcher_submit_wait(launcher, &cmd);
+}
+
+/**
+ * @brief Fires several missiles as fast as the launcher can and waits for
+ * the last one. All the shots are queued at once, and each one is done as
+ * soon as the status report says the firing cycle is over, or once the
+ * cycle has certainly ended on models that don't report it, so the next
+ * one goes out right away. Every shot takes one missile off the ammo count.
+ * Once the count has been set with ml_launcher_set_ammo, shots past the
+ * last missile aren't sent.
+ *
+ * @param launcher The launcher to fire from.
+ * @param count How many missiles to fire.
+ * @param flags ML_FIRE_* flags.
+ *
+ * @return A status code, ML_NO_AMMO if it ran out before count shots.
+ */
+ml_error_code
+ml_launcher_fire_n(ml_launcher_t *launcher, uint32_t count, uint32_t flags)
+{
+  ml_command_t *shots = NULL;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (count == 0) {
+    return ML_COUNT_ZERO;
+  }
+
+  shots = calloc(sizeof(ml_command_t), count);
+  if (shots == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    shots[i].type = ML_COMMAND_FIRE;
+    shots[i].flags = flags;
+  }
+  result = _ml_launcher_submit_wait_n(launcher, shots, count);
+  free(shots);
+  return result;
+}
+
+/**
+ * @brief Sets how many missiles the launcher has, call it after reloading.
+ * Launchers start out with their model's full load, but only once the count
+ * has been set do fires fail with ML_NO_AMMO when it runs out. Until then
+ * the count is kept and every shot is sent.
+ *
+ * @param launcher The launcher.
+ * @param ammo The number of missiles loaded.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_set_ammo(ml_launcher_t *launcher, uint32_t ammo)
+{
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  __atomic_store_n(&launcher->ammo, ammo, __ATOMIC_RELAXED);
+  __atomic_store_n(&launcher->ammo_enforced, true, __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Gets how many missiles the launcher has left.
+ *
+ * @param launcher The launcher.
+ * @param ammo Where to put the count.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_get_ammo(ml_launcher_t *launcher, uint32_t *ammo)
+{
+  if (launcher == NULL || ammo == NULL) {
+    return ML_NULL_POINTER;
+  }
+  (*ammo) = __atomic_load_n(&launcher->ammo, __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Stop moving the launcher.
+ *
+ * @param launcher The launcher to stop.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_stop(ml_launcher_t *launcher)
+{
+  ml_command_t cmd = { .type = ML_COMMAND_STOP };
+
+  return _ml_launcher_submit_wait(launcher, &cmd);
+}
+
+/**
+ * @brief Moves the launcher in the specified direction.
+ *
+ * @param launcher The launcher to move.
+ * @param direction The specified direction.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_move(ml_launcher_t *launcher, ml_launcher_direction direction)
+{
+  ml_command_t cmd = { .type = ML_COMMAND_MOVE, .direction = direction };
+
+  return _ml_launcher_submit_wait(launcher, &cmd);
+}
+
+/**
+ * @brief Resets the launcher to 0 degrees of elevation and then centers the
+ * launcher.
+ *
+ * @param launcher The launcher to zero.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_zero(ml_launcher_t *launcher)
+{
+  const ml_driver_t *driver = NULL;
+  ml_command_t step;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+
+  // Each model has its own travel, so the driver knows how to zero it.
+  driver = launcher->driver;
+  if (driver == NULL || driver->zero_step_count == 0) {
+    return ML_NOT_IMPLEMENTED;
+  }
+
+  for (uint32_t i = 0; i < driver->zero_step_count; i++) {
+    step = driver->zero_steps[i];
+    result = _ml_launcher_submit_wait(launcher, &step);
+    if (result != ML_OK) {
+      break;
+    }
+  }
+
+  if (result == ML_OK) {
+    __atomic_store_n(&launcher->pose_known, true, __ATOMIC_RELAXED);
+    _ml_pose_save(launcher);
+  }
+  return result;
+}
+
+/// A zero run by ml_launcher_zero_submit, one step at a time.
+typedef struct ml_zero_t
+{
+  uint32_t step;
+  ml_command_callback callback;
+  void *user_data;
+} ml_zero_t;
+
+/**
+ * @brief Callback for each step of ml_launcher_zero_submit, queues the next
+ * step or finishes the zero.
+ *
+ * @param launcher The launcher being zeroed.
+ * @param status The result of the step.
+ * @param user_data The zero.
+ */
+static void
+_ml_launcher_zero_step(ml_launcher_t *launcher, ml_error_code status,
+                       void *user_data)
+{
+  ml_zero_t *zero = user_data;
+  const ml_driver_t *driver = launcher->driver;
+  ml_command_t step;
+
+  zero->step += 1;
+  if (status == ML_OK && zero->step < driver->zero_step_count) {
+    step = driver->zero_steps[zero->step];
+    step.callback = _ml_launcher_zero_step;
+    step.user_data = zero;
+    status = ml_launcher_submit(launcher, &step);
+    if (status == ML_OK) {
+      return;
+    }
+  }
+
+  if (status == ML_OK) {
+    __atomic_store_n(&launcher->pose_known, true, __ATOMIC_RELAXED);
+    _ml_pose_save(launcher);
+  }
+  if (zero->callback != NULL) {
+    zero->callback(launcher, status, zero->user_data);
+  }
+  free(zero);
+}
+
+/**
+ * @brief Zeroes the launcher without waiting, see ml_launcher_zero. The
+ * steps are queued one after another as each one finishes, so commands
+ * submitted in the meantime may run between them.
+ *
+ * @param launcher The launcher to zero.
+ * @param callback Called on the scheduler thread once the zero is done or
+ * a step failed, may be NULL.
+ * @param user_data Passed to the callback.
+ *
+ * @return A status code, the callback only runs if this is ML_OK.
+ */
+ml_error_code
+ml_launcher_zero_submit(ml_launcher_t *launcher, ml_command_callback callback,
+                        void *user_data)
+{
+  const ml_driver_t *driver = NULL;
+  ml_command_t step;
+  ml_zero_t *zero = NULL;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  driver = launcher->driver;
+  if (driver == NULL || driver->zero_step_count == 0) {
+    return ML_NOT_IMPLEMENTED;
+  }
+
+  zero = calloc(sizeof(ml_zero_t), 1);
+  if (zero == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  zero->callback = callback;
+  zero->user_data = user_data;
+
+  step = driver->zero_steps[0];
+  step.callback = _ml_launcher_zero_step;
+  step.user_data = zero;
+  result = ml_launcher_submit(launcher, &step);
+  if (result != ML_OK) {
+    free(zero);
+  }
+  return result;
+}
+
+/**
+ * @brief Checks if the launcher's position is known, either because it was
+ * zeroed or because it was restored from the pose file, see ml_pose_start.
+ * A launcher whose position isn't known needs ml_launcher_zero before
+ * positions mean anything.
+ *
+ * @param launcher The launcher.
+ *
+ * @return 1 if the position is known, 0 otherwise.
+ */
+uint8_t
+ml_launcher_has_position(ml_launcher_t *launcher)
+{
+  if (launcher == NULL) {
+    return 0;
+  }
+  return __atomic_load_n(&launcher->pose_known, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Turns on the led of the selected launcher.
+ *
+ * @param launcher The launcher to get it's led turned on.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_led_on(ml_launcher_t *launcher)
+{
+  ml_command_t cmd = { .type = ML_COMMAND_LED_ON };
+
+  return _ml_launcher_submit_wait(launcher, &cmd);
+}
+
+/**
+ * @brief Turns off the led of the selected launcher.
+ *
+ * @param launcher The launcher to get it's led turned off.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_led_off(ml_launcher_t *launcher)
+{
+  ml_command_t cmd = { .type = ML_COMMAND_LED_OFF };
+
+  return _ml_launcher_submit_wait(launcher, &cmd);
+}
+
+/**
+ * @brief Determines if the LED is on or off.
+ *
+ * @param launcher The launcher to check.
+ *
+ * @return 1 = on 0 = off
+ */
+uint8_t
+ml_launcher_get_led_state(ml_launcher_t *launcher)
+{
+  uint8_t status = 0;
+
+  status = ML_FLEET(launcher, led_status);
+
+  return status;
+}
+
+/**
+ * @brief Gets the limit switches of the launcher as last read.
+ * The result is a mask of ML_LIMIT_* bits, a bit is set while that axis is
+ * against its end stop. Only the scheduler thread reads the switches, so
+ * reads never race a running move, and it does so whenever a
+ * ML_COMMAND_MOVE_TO_LIMIT starts and while it runs, see ml_launcher_zero.
+ *
+ * @param launcher The launcher to check.
+ * @param limits Where to store the limit mask.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_get_limits(ml_launcher_t *launcher, uint8_t *limits)
+{
+  if (launcher == NULL || limits == NULL) {
+    return ML_NULL_POINTER;
+  }
+
+  if(!_ml_launcher_is_claimed(launcher)) {
+    return ML_UNCLAIMED;
+  }
+
+  (*limits) = ML_FLEET(launcher, limit_status);
+  return ML_OK;
+}
+
+/**
+ * @brief Gets where the launcher is pointing, in millidegrees from the left
+ * and bottom end stops. The position is worked out from the moves sent to
+ * the launcher, so it is only meaningful once ml_launcher_zero has found
+ * the end stops.
+ *
+ * @param launcher The launcher to check.
+ * @param horizontal Where to store the horizontal position.
+ * @param vertical Where to store the vertical position.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_get_position(ml_launcher_t *launcher, uint32_t *horizontal,
+                         uint32_t *vertical)
+{
+  if (launcher == NULL || horizontal == NULL || vertical == NULL) {
+    return ML_NULL_POINTER;
+  }
+
+  (*horizontal) = ML_FLEET(launcher, horizontal_position);
+  (*vertical) = ML_FLEET(launcher, vertical_position);
+  return ML_OK;
+}
+
+/**
+ * @brief Sets how fast a launcher turns in one direction. The driver's
+ * figures are for a typical unit, measuring a launcher and setting its own
+ * speeds makes position tracking and ml_group_aim more accurate.
+ *
+ * @param launcher The launcher to calibrate.
+ * @param direction The direction.
+ * @param mdeg_per_second The speed in millidegrees per second.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_set_axis_speed(ml_launcher_t *launcher,
+                           ml_launcher_direction direction,
+                           uint32_t mdeg_per_second)
+{
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (direction > ML_RIGHT) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  __atomic_store_n(&launcher->axis_speed[direction], mdeg_per_second,
+                   __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Gets a launcher's power management counters, to check whether
+ * ML_CLAIM_NO_SUSPEND and the keep-alive are doing their job. A rising
+ * resumes count means commands are still waiting for the device to wake.
+ *
+ * @param launcher The launcher.
+ * @param stats Where to store the counters.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_get_power_stats(ml_launcher_t *launcher, ml_power_stats_t *stats)
+{
+  if (launcher == NULL || stats == NULL) {
+    return ML_NULL_POINTER;
+  }
+
+  pthread_mutex_lock(&launcher->controller->lock);
+  stats->pinned = launcher->power_pinned;
+  pthread_mutex_unlock(&launcher->controller->lock);
+  stats->commands = __atomic_load_n(&launcher->power_commands,
+                                    __ATOMIC_RELAXED);
+  stats->resumes = __atomic_load_n(&launcher->power_resumes,
+                                   __ATOMIC_RELAXED);
+  stats->keep_alives = __atomic_load_n(&launcher->power_keep_alives,
+                                       __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Moves the specified launcher, in the specified direction
+ * for the specified number of milliseconds.
+ *
+ * @param launcher The launcher the move.
+ * @param direction The direction to move in.
+ * @param mseconds The number of milliseconds to move for.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_move_mseconds(ml_launcher_t *launcher,
+                          ml_launcher_direction direction,
+                          uint32_t mseconds)
+{
+  ml_command_t cmd = {
+    .type = ML_COMMAND_MOVE_TIMED,
+    .direction = direction,
+    .duration_ms = mseconds
+  };
+
+  return _ml_launcher_submit_wait(launcher, &cmd);
+}
+
+/**
+ * @brief Move the launcher in an unsafe manner.
+ * Internal use only please! :)
+ *
+ * @param launcher The launcher to move.
+ * @param direction The direction to move the launcher in.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_launcher_move_unsafe(ml_launcher_t *launcher,
+                         ml_launcher_direction direction)
+{
+  return _ml_launcher_send_cmd_unsafe(launcher, (ml_launcher_cmd)direction);
+}
+
+/**
+ * @brief Works out where a launcher is at a point in time from its tracked
+ * position and the move it is making, see _ml_launcher_track_cmd. Only call
+ * from the scheduler thread.
+ *
+ * @param launcher The launcher.
+ * @param now_ns The time, monotonic nanoseconds.
+ * @param horizontal Where to store the horizontal position.
+ * @param vertical Where to store the vertical position.
+ */
+void
+_ml_launcher_position_at(ml_launcher_t *launcher, uint64_t now_ns,
+                         uint32_t *horizontal, uint32_t *vertical)
+{
+  uint64_t travel = 0;
+  uint32_t *position = NULL;
+  int8_t direction = launcher->motion_direction;
+
+  (*horizontal) = ML_FLEET(launcher, horizontal_position);
+  (*vertical) = ML_FLEET(launcher, vertical_position);
+  if (direction < 0 || now_ns <= launcher->motion_since_ns) {
+    return;
+  }
+
+  travel = ((now_ns - launcher->motion_since_ns) *
+            __atomic_load_n(&launcher->axis_speed[direction],
+                            __ATOMIC_RELAXED)) / 1000000000;
+  position = direction == ML_DOWN || direction == ML_UP ?
+    vertical : horizontal;
+  if (direction == ML_UP || direction == ML_RIGHT) {
+    (*position) += travel;
+  } else {
+    (*position) = travel >= (*position) ? 0 : (*position) - travel;
+  }
+}
+
+/**
+ * @brief Dead reckons the position of a launcher from the moves and stops
+ * sent to it. A move is timed from when it was sent until the next move or
+ * stop and covers the launcher's axis speed in that time. Positions can't
+ * go past the left and bottom end stops, which are 0. Only the scheduler
+ * thread sends moves, so this needs no lock.
+ *
+ * @param launcher The launcher.
+ * @param cmd The command that was sent.
+ */
+static void
+_ml_launcher_track_cmd(ml_launcher_t *launcher, ml_launcher_cmd cmd)
+{
+  uint64_t now = 0;
+  uint32_t horizontal = 0, vertical = 0;
+
+  if (cmd > ML_RIGHT_CMD && cmd != ML_STOP_CMD) {
+    return;
+  }
+
+  now = _ml_monotonic_nseconds();
+  _ml_launcher_position_at(launcher, now, &horizontal, &vertical);
+  ML_FLEET(launcher, horizontal_position) = horizontal;
+  ML_FLEET(launcher, vertical_position) = vertical;
+  launcher->motion_direction = cmd == ML_STOP_CMD ? -1 : (int8_t)cmd;
+  launcher->motion_since_ns = now;
+  _ml_pose_save(launcher);
+}
+
+/**
+ * @brief Counts a command for ml_launcher_get_power_stats. A command that
+ * was slow after the launcher sat idle most likely waited for the device
+ * to resume from autosuspend.
+ *
+ * @param launcher The launcher.
+ * @param cmd The command.
+ * @param sent_ns When the command was sent, monotonic nanoseconds.
+ * @param idle_since The end of the transfer before it, monotonic
+ * milliseconds, 0 if there was none.
+ */
+static void
+_ml_launcher_count_io(ml_launcher_t *launcher, ml_launcher_cmd cmd,
+                      uint64_t sent_ns, uint64_t idle_since)
+{
+  uint64_t done_ns = _ml_monotonic_nseconds();
+
+  __atomic_add_fetch(&launcher->power_commands, 1, __ATOMIC_RELAXED);
+  if (idle_since != 0 && done_ns - sent_ns >= ML_RESUME_SLOW_NS &&
+      (sent_ns / 1000000) - idle_since >= ML_RESUME_IDLE_MS) {
+    __atomic_add_fetch(&launcher->power_resumes, 1, __ATOMIC_RELAXED);
+    _ml_log(ML_LOG_CMD_RESUMED, launcher->usb_bus,
+            launcher->usb_device_number, cmd, (done_ns - sent_ns) / 1000);
+  } else {
+    _ml_log(ML_LOG_CMD_SENT, launcher->usb_bus,
+            launcher->usb_device_number, cmd, (done_ns - sent_ns) / 1000);
+  }
+  __atomic_store_n(&launcher->usb_last_io, done_ns / 1000000,
+                   __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sends a cmd to the launcher.
+ * How a cmd goes over the wire comes from the launcher's driver, a new
+ * model is added to the ml_drivers table in ml_driver.c.
+ *
+ * @param launcher The launcher to send the cmd to.
+ * @param cmd The cmd to send to the launcher.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_launcher_send_cmd_unsafe(ml_launcher_t *launcher, ml_launcher_cmd cmd)
+{
+  const ml_driver_t *driver = launcher->driver;
+  int16_t status = 0;
+  uint64_t sent_ns = 0, idle_since = 0;
+  ml_error_code result = ML_OK;
+
+  if (driver == NULL) {
+    return ML_NOT_IMPLEMENTED;
+  }
+
+  sent_ns = _ml_monotonic_nseconds();
+  idle_since = __atomic_load_n(&launcher->usb_last_io, __ATOMIC_RELAXED);
+  if (!_ml_launcher_usb_enter(launcher)) {
+    return ML_LIBUSB_ERROR;
+  }
+  // The buffer isn't written to on an OUT transfer.
+  status = launcher->transport->control(launcher, driver->request_type,
+                                       driver->request_field,
+                                       driver->request_value,
+                                       driver->request_index,
+                                       (unsigned char *)driver->cmds[cmd],
+                                       driver->cmd_size, 0);
+  _ml_launcher_usb_exit(launcher);
+  if (status < 0) {
+    _ml_log(ML_LOG_CMD_FAILED, launcher->usb_bus,
+            launcher->usb_device_number, cmd, status);
+    result = ML_LIBUSB_ERROR;
+  }
+
+  if (result == ML_OK) {
+    _ml_launcher_track_cmd(launcher, cmd);
+    _ml_launcher_count_io(launcher, cmd, sent_ns, idle_since);
+  }
+  if (__atomic_load_n(&launcher->controller->journal,
+                      __ATOMIC_RELAXED) != NULL) {
+    _ml_journal_append(launcher->controller, launcher, cmd, result, sent_ns);
+  }
+  return result;
+}
+
+/**
+ * @brief Reads a status report from the launcher.
+ *
+ * @param launcher The launcher to read from.
+ * @param report Where to put the report, ML_STATUS_SIZE long.
+ * @param length Where to put how much of it was read.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_launcher_read_report_unsafe(ml_launcher_t *launcher,
+                                unsigned char *report, int *length)
+{
+  int status = 0;
+
+  if (launcher->driver == NULL || launcher->driver->status_endpoint == 0) {
+    return ML_NOT_IMPLEMENTED;
+  }
+
+  if (!_ml_launcher_usb_enter(launcher)) {
+    return ML_LIBUSB_ERROR;
+  }
+  status = launcher->transport->interrupt(launcher,
+                                         launcher->driver->status_endpoint,
+                                         report, ML_STATUS_SIZE, length,
+                                         ML_STATUS_TIMEOUT_MS);
+  _ml_launcher_usb_exit(launcher);
+  if (status < 0 || (*length) < 1) {
+    _ml_log(ML_LOG_STATUS_FAILED, launcher->usb_bus,
+            launcher->usb_device_number,
+            status < 0 ? status : LIBUSB_ERROR_IO, 0);
+    return ML_LIBUSB_ERROR;
+  }
+  __atomic_store_n(&launcher->usb_last_io, _ml_monotonic_mseconds(),
+                   __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Reads a status report from the launcher and checks if the last
+ * shot is done.
+ *
+ * @param launcher The launcher to read from.
+ * @param done Set if the status report says the firing cycle is over.
+ *
+ * @return A status code, ML_NOT_IMPLEMENTED if the model doesn't report it.
+ */
+ml_error_code
+_ml_launcher_read_fire_unsafe(ml_launcher_t *launcher, bool *done)
+{
+  const ml_driver_t *driver = launcher->driver;
+  unsigned char report[ML_STATUS_SIZE] = {0};
+  int transferred = 0;
+  ml_error_code result = ML_OK;
+
+  if (driver == NULL || driver->fire_done_mask == 0) {
+    return ML_NOT_IMPLEMENTED;
+  }
+  result = _ml_launcher_read_report_unsafe(launcher, report, &transferred);
+  if (result != ML_OK) {
+    return result;
+  }
+  if (transferred <= driver->fire_done_byte) {
+    return ML_NOT_IMPLEMENTED;
+  }
+  (*done) = (report[driver->fire_done_byte] & driver->fire_done_mask) != 0;
+  return ML_OK;
+}
+
+/**
+ * @brief Reads a status report from the launcher and extracts the limit
+ * switches. The last value read is cached in the launcher, and the position
+ * of an axis against its low end stop is reset. Only call it from the
+ * scheduler thread.
+ *
+ * @param launcher The launcher to read from.
+ * @param limits Where to store the ML_LIMIT_* mask.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_launcher_read_limits_unsafe(ml_launcher_t *launcher, uint8_t *limits)
+{
+  unsigned char report[ML_STATUS_SIZE] = {0};
+  int transferred = 0;
+  ml_error_code result = ML_OK;
+
+  result = _ml_launcher_read_report_unsafe(launcher, report, &transferred);
+  if (result != ML_OK) {
+    return result;
+  }
+
+  ML_FLEET(launcher, limit_status) = report[0] &
+    (ML_LIMIT_DOWN | ML_LIMIT_UP | ML_LIMIT_LEFT | ML_LIMIT_RIGHT);
+  (*limits) = ML_FLEET(launcher, limit_status);
+  // The end stops are where positions are measured from.
+  if ((*limits) & ML_LIMIT_LEFT) {
+    ML_FLEET(launcher, horizontal_position) = 0;
+  }
+  if ((*limits) & ML_LIMIT_DOWN) {
+    ML_FLEET(launcher, vertical_position) = 0;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Sends a request that does nothing to keep the device from going
+ * idle, see ml_library_set_keep_alive. A standard GET_STATUS works on any
+ * device and doesn't move the launcher.
+ *
+ * @param launcher The launcher.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_launcher_keep_alive_unsafe(ml_launcher_t *launcher)
+{
+  unsigned char status[2] = {0, 0};
+  int rv = 0;
+
+  if (!_ml_launcher_usb_enter(launcher)) {
+    return ML_LIBUSB_ERROR;
+  }
+  rv = launcher->transport->control(launcher,
+                                    LIBUSB_ENDPOINT_IN |
+                                    LIBUSB_REQUEST_TYPE_STANDARD |
+                                    LIBUSB_RECIPIENT_DEVICE,
+                                    LIBUSB_REQUEST_GET_STATUS, 0, 0, status,
+                                    sizeof(status), ML_STATUS_TIMEOUT_MS);
+  _ml_launcher_usb_exit(launcher);
+  if (rv < 0) {
+    _ml_log(ML_LOG_KEEP_ALIVE_FAILED, launcher->usb_bus,
+            launcher->usb_device_number, rv, 0);
+  }
+  // Counted either way, a failed request still went over the bus.
+  __atomic_add_fetch(&launcher->power_keep_alives, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&launcher->usb_last_io, _ml_monotonic_mseconds(),
+                   __ATOMIC_RELAXED);
+  return rv < 0 ? ML_LIBUSB_ERROR : ML_OK;
+}
+
+/**
+ * @brief Changes milliseconds to a time object.
+ *
+ * @param mseconds The milliseonds to convert.
+ * @param time The time object to put it into.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_mseconds_to_time(uint32_t mseconds, ml_time_t *time)
+{
+  if (time == NULL) {
     return ML_NULL_POINTER;
   }
   // Time conversion
@@ -457,6 +1762,71 @@ _ml_mseconds_to_time(uint32_t mseconds, ml_time_t *time)
   return ML_OK;
 }
 
+/**
+ * @brief Gets where the launcher is plugged in. Launchers on the same bus
+ * share a root hub and a scheduler thread.
+ *
+ * @param launcher The launcher to check.
+ * @param usb_bus Where to put the bus number.
+ * @param usb_device_number Where to put the device address on the bus.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_get_usb_location(ml_launcher_t *launcher, uint8_t *usb_bus,
+                             uint8_t *usb_device_number)
+{
+  if (launcher == NULL || usb_bus == NULL || usb_device_number == NULL) {
+    return ML_NULL_POINTER;
+  }
+  (*usb_bus) = launcher->usb_bus;
+  (*usb_device_number) = launcher->usb_device_number;
+  return ML_OK;
+}
+
+/**
+ * @brief Gets the port path of the launcher, its bus and port numbers like
+ * 1-4.2. It doesn't change when the launcher is unplugged and plugged back
+ * into the same port, see ml_launcher_open_by_path.
+ *
+ * @param launcher The launcher to check.
+ * @param port_path Where to put the path.
+ * @param size The size of port_path.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_get_port_path(ml_launcher_t *launcher, char *port_path,
+                          uint32_t size)
+{
+  if (launcher == NULL || port_path == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (strlen(launcher->port_path) >= size) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+  strcpy(port_path, launcher->port_path);
+  return ML_OK;
+}
+
+/**
+ * @brief Gets the ID of a launcher. IDs are handed out as launchers are
+ * found and stay the same across reconnects, unlike the USB location. They
+ * aren't reused while the library is running.
+ *
+ * @param launcher The launcher to check.
+ *
+ * @return The ID, 0 if launcher is NULL.
+ */
+uint32_t
+ml_launcher_get_id(ml_launcher_t *launcher)
+{
+  if (launcher == NULL) {
+    return 0;
+  }
+  return ML_FLEET(launcher, id);
+}
+
 /**
  * @brief Gets the type of launcher from the launcher.
  *
@@ -8,10 +8,13 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libmissilelauncher.h"
 #include "libmissilelauncher_internal.h"
 
+ml_controller_t *ml_main_controller = NULL;
+
 const char *ml_launcher_type_strs[] = {
   "invalid",
   "standard",
@@ -45,9 +48,20 @@ const char *ml_error_code_strs[] = {
   "not null pointer",
   "no launchers",
   "launcher already open",
+  "deadline missed",
+  "preempted",
+  "cancelled",
+  "would block",
+  "out of ammo",
+  "real clock",
+  "in use",
   NULL,
 };
 
+// One string for every error code, add to both together.
+_Static_assert(sizeof(ml_error_code_strs) / sizeof(ml_error_code_strs[0]) ==
+               ML_ERROR_END + 1, "ml_error_code_strs is out of date");
+
 /**
  * @brief Initializes the library.
  * This function must be called before all others.
@@ -56,6 +70,28 @@ const char *ml_error_code_strs[] = {
  */
 ml_error_code
 ml_library_init()
+{
+  return ml_library_init_flags(ML_INIT_DEFAULT);
+}
+
+/**
+ * @brief Initializes the library with options.
+ * With ML_INIT_SKIP_SCAN the bus is never enumerated, launchers are opened
+ * with ml_launcher_open_by_path or ml_launcher_open_by_vid_pid and
+ * ml_launcher_array_new only lists those. Where libusb supports it, libusb
+ * is also told not to scan when it starts, which holds for the rest of the
+ * process.
+ * With ML_INIT_VIRTUAL_CLOCK every timed wait in the library runs on a
+ * virtual clock that only moves with ml_clock_advance, so tests of zeroing,
+ * timed moves and the scheduler finish in milliseconds and the same way
+ * every time.
+ *
+ * @param flags ML_INIT_* flags.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_library_init_flags(uint32_t flags)
 {
   int init_result;
   int16_t failed = 0;
@@ -71,6 +107,12 @@ ml_library_init()
     return ML_ALLOC_FAILED;
   }
 
+#if defined(ML_HAVE_USB_WRAP) && LIBUSB_API_VERSION >= 0x01000108
+  if (flags & ML_INIT_SKIP_SCAN) {
+    libusb_set_option(NULL, LIBUSB_OPTION_WEAK_AUTHORITY);
+  }
+#endif
+
   // Initialize libusb
   init_result = libusb_init(NULL);
   if (init_result < 0) {
@@ -79,8 +121,12 @@ ml_library_init()
     return ML_LIBUSB_ERROR;
   }
 
+  // Before anything can start a thread.
+  _ml_clock_init((flags & ML_INIT_VIRTUAL_CLOCK) != 0);
+
   // Initialize the main controller
   failed = _ml_controller_init(ml_main_controller);
+  ml_main_controller->init_flags = flags;
   // Check result
   if (failed != ML_OK) {
     // Setup failed
@@ -89,6 +135,7 @@ ml_library_init()
     }
     free(ml_main_controller);
     ml_main_controller = NULL;
+    _ml_clock_cleanup();
   }
 
   return failed;
@@ -111,6 +158,10 @@ ml_library_cleanup()
   // Free everything
   free(ml_main_controller);
   ml_main_controller = NULL;
+  // Deliver whatever was logged on the way down.
+  _ml_log_cleanup();
+  // Every library thread has exited.
+  _ml_clock_cleanup();
   // Cleanup libusb
   libusb_exit(NULL);
   return failed;
@@ -134,6 +185,198 @@ ml_library_is_init()
   return result;
 }
 
+/**
+ * @brief Sets how long a launcher keeps its USB handle open after the last
+ * claim or lease is dropped. Claiming it again within that window skips
+ * opening the device. 0 closes handles as soon as they are unclaimed.
+ *
+ * @param mseconds The idle timeout in milliseconds.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_library_set_claim_idle_timeout(uint32_t mseconds)
+{
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+
+  pthread_mutex_lock(&ml_main_controller->lock);
+  ml_main_controller->claim_idle_timeout_ms = mseconds;
+  if (mseconds == 0) {
+    // Caching is off, drop every idle handle right away.
+    uint64_t next_expiry = 0;
+    _ml_controller_reap_idle_unsafe(ml_main_controller, &next_expiry);
+  }
+  // Let the reaper pick up the new timeout.
+  _ml_cond_signal(&ml_main_controller->reaper_cond);
+  pthread_mutex_unlock(&ml_main_controller->lock);
+  return ML_OK;
+}
+
+/**
+ * @brief Sets how often launchers claimed with ML_CLAIM_NO_SUSPEND are sent
+ * a keep-alive. A keep-alive is only sent to a launcher that has had no
+ * other traffic for the interval, so a busy launcher never gets one. This
+ * keeps devices awake where their power state can't be pinned, set it
+ * below the autosuspend delay, 2 seconds by default.
+ *
+ * @param mseconds The interval in milliseconds, 0 turns keep-alives off.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_library_set_keep_alive(uint32_t mseconds)
+{
+  ml_error_code result = ML_OK;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+
+  pthread_mutex_lock(&ml_main_controller->lock);
+  ml_main_controller->keep_alive_ms = mseconds;
+  if (mseconds != 0) {
+    result = _ml_controller_start_reaper(ml_main_controller);
+  }
+  _ml_cond_signal(&ml_main_controller->reaper_cond);
+  pthread_mutex_unlock(&ml_main_controller->lock);
+  return result;
+}
+
+/**
+ * @brief Gets the claim idle timeout.
+ *
+ * @return The idle timeout in milliseconds, 0 if the library isn't
+ * initialized.
+ */
+uint32_t
+ml_library_get_claim_idle_timeout()
+{
+  if (ml_library_is_init() == 0) {
+    return 0;
+  }
+  return ml_main_controller->claim_idle_timeout_ms;
+}
+
+/**
+ * @brief Pins the scheduler thread of a USB bus to a CPU.
+ * Commands for launchers on different buses run on different threads, so
+ * spreading busy buses over CPUs lets them run side by side.
+ *
+ * @param usb_bus The bus number, see ml_launcher_get_usb_location.
+ * @param cpu The CPU to run on, -1 to run anywhere.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_library_set_bus_affinity(uint8_t usb_bus, int cpu)
+{
+  ml_scheduler_t *sched = NULL;
+  ml_error_code result = ML_OK;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+
+  result = _ml_controller_get_scheduler(ml_main_controller, usb_bus, &sched);
+  if (result != ML_OK) {
+    return result;
+  }
+  return _ml_scheduler_set_affinity(sched, cpu);
+}
+
+/**
+ * @brief Limits how many commands per second are started on a USB bus, so
+ * a burst of commands on one bus can't flood it. Stops that end a timed
+ * move are never held back.
+ *
+ * @param usb_bus The bus number, see ml_launcher_get_usb_location.
+ * @param per_second The limit, 0 for no limit.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_library_set_bus_rate_limit(uint8_t usb_bus, uint32_t per_second)
+{
+  ml_scheduler_t *sched = NULL;
+  ml_error_code result = ML_OK;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+
+  result = _ml_controller_get_scheduler(ml_main_controller, usb_bus, &sched);
+  if (result != ML_OK) {
+    return result;
+  }
+  return _ml_scheduler_set_rate_limit(sched, per_second);
+}
+
+/**
+ * @brief Sets how the scheduler times the stop at the end of timed moves.
+ * In precise mode the scheduler sleeps to the exact stop time instead of
+ * waking on the millisecond, with no timer slack on its thread, and can
+ * busy wait for the last part so a late wake up doesn't become aiming
+ * error. Commands submitted within two milliseconds of a stop wait for it.
+ *
+ * @param mode The timing mode.
+ * @param spin_us How long to spin before each stop in precise mode.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_library_set_timing(ml_timing_mode mode, uint32_t spin_us)
+{
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (mode != ML_TIMING_DEFAULT && mode != ML_TIMING_PRECISE) {
+    return ML_NOT_IMPLEMENTED;
+  }
+  if ((uint64_t)spin_us * 1000 > ML_PRECISE_WINDOW_NS) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  __atomic_store_n(&ml_main_controller->timing_spin_us, spin_us,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&ml_main_controller->timing_mode, mode, __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Sets where launchers are looked up and opened on Linux, mostly so
+ * the library can be pointed at a fake device tree. Call it before any
+ * launchers are found.
+ *
+ * @param sysfs_root Where sysfs is mounted, NULL for /sys.
+ * @param usbfs_root Where the USB device nodes are, NULL for /dev/bus/usb.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_library_set_sysfs_root(const char *sysfs_root, const char *usbfs_root)
+{
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (sysfs_root == NULL) {
+    sysfs_root = ML_SYSFS_ROOT;
+  }
+  if (usbfs_root == NULL) {
+    usbfs_root = ML_USBFS_ROOT;
+  }
+  if (strlen(sysfs_root) >= ML_SYSFS_ROOT_SIZE ||
+      strlen(usbfs_root) >= ML_SYSFS_ROOT_SIZE) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  pthread_mutex_lock(&ml_main_controller->lock);
+  strcpy(ml_main_controller->sysfs_root, sysfs_root);
+  strcpy(ml_main_controller->usbfs_root, usbfs_root);
+  pthread_mutex_unlock(&ml_main_controller->lock);
+  return ML_OK;
+}
 
 /**
  * @brief Convert an error code to its string.
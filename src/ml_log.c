@@ -0,0 +1,424 @@
+/**
+ * @file ml_log.c
+ * @brief Logging that stays off the hot path.
+ * Logging an event only stores its ID and raw arguments in a lock free
+ * ring, nothing is formatted and nothing blocks. The records are formatted
+ * later, when the application calls ml_log_drain or by the log thread, and
+ * handed to a callback or written to stderr.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/// How an event is logged.
+typedef struct ml_log_format_t
+{
+  ml_log_level level;
+  // Placeholders take the next argument: %d signed, %u unsigned, %x hex,
+  // %E a libusb error, %e an errno value and %C a launcher command.
+  const char *format;
+} ml_log_format_t;
+
+static const ml_log_format_t ml_log_formats[ML_LOG_EVENT_COUNT] = {
+  [ML_LOG_USB_OPEN_FAILED] = {
+    ML_LOG_ERROR, "launcher %u-%u: libusb_open failed: %E" },
+  [ML_LOG_USB_WRAP_FAILED] = {
+    ML_LOG_ERROR, "launcher %u-%u: opening the usbfs node failed: %e" },
+  [ML_LOG_USB_DETACH_FAILED] = {
+    ML_LOG_WARNING, "launcher %u-%u: detaching the kernel driver failed: %E" },
+  [ML_LOG_USB_CLAIM_FAILED] = {
+    ML_LOG_ERROR, "launcher %u-%u: libusb_claim_interface failed: %E" },
+  [ML_LOG_CMD_FAILED] = {
+    ML_LOG_ERROR, "launcher %u-%u: %C failed: %E" },
+  [ML_LOG_CMD_SENT] = {
+    ML_LOG_DEBUG, "launcher %u-%u: %C took %u us" },
+  [ML_LOG_CMD_RESUMED] = {
+    ML_LOG_INFO, "launcher %u-%u: %C took %u us, the device was resuming "
+    "from autosuspend" },
+  [ML_LOG_STATUS_FAILED] = {
+    ML_LOG_WARNING, "launcher %u-%u: status read failed: %E" },
+  [ML_LOG_KEEP_ALIVE_FAILED] = {
+    ML_LOG_WARNING, "launcher %u-%u: keep-alive failed: %E" },
+  [ML_LOG_POWER_PIN_FAILED] = {
+    ML_LOG_WARNING, "launcher %u-%u: can't write power/control, "
+    "autosuspend stays on" },
+  [ML_LOG_LAUNCHER_ADDED] = {
+    ML_LOG_INFO, "launcher %u-%u: found, id %u" },
+  [ML_LOG_LAUNCHER_DISCONNECTED] = {
+    ML_LOG_INFO, "launcher %u-%u: disconnected, id %u" },
+  [ML_LOG_LAUNCHER_RECONNECTED] = {
+    ML_LOG_INFO, "launcher %u-%u: reconnected, id %u" },
+  [ML_LOG_DEADLINE_MISSED] = {
+    ML_LOG_INFO, "launcher %u-%u: dropped a command %u ms past its deadline" }
+};
+
+static const char *ml_log_level_names[] = {
+  [ML_LOG_NONE] = "none",
+  [ML_LOG_ERROR] = "error",
+  [ML_LOG_WARNING] = "warning",
+  [ML_LOG_INFO] = "info",
+  [ML_LOG_DEBUG] = "debug"
+};
+
+static const char *ml_log_cmd_names[ML_COMMAND_COUNT] = {
+  [ML_DOWN_CMD] = "down",
+  [ML_UP_CMD] = "up",
+  [ML_LEFT_CMD] = "left",
+  [ML_RIGHT_CMD] = "right",
+  [ML_FIRE_CMD] = "fire",
+  [ML_STOP_CMD] = "stop",
+  [ML_LED_ON_CMD] = "led on",
+  [ML_LED_OFF_CMD] = "led off"
+};
+
+static ml_log_level ml_log_current_level = ML_LOG_NONE;
+static uint64_t ml_log_dropped = 0;
+
+// Producers claim slots by moving head, the one consumer follows with tail.
+static ml_log_record_t ml_log_ring[ML_LOG_RING_SIZE];
+static uint64_t ml_log_head = 0;
+static uint64_t ml_log_tail = 0;
+static pthread_once_t ml_log_once = PTHREAD_ONCE_INIT;
+
+// Protects the consumer side: the tail, the sink and the log thread.
+static pthread_mutex_t ml_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ml_log_cond;
+static ml_log_callback ml_log_sink = NULL;
+static void *ml_log_sink_data = NULL;
+static pthread_t ml_log_thread;
+static bool ml_log_running = false;
+
+/**
+ * @brief Sets up the ring, every slot starts out free for the producer
+ * that claims its index.
+ */
+static void
+_ml_log_init()
+{
+  for (uint32_t i = 0; i < ML_LOG_RING_SIZE; i++) {
+    ml_log_ring[i].seq = i;
+  }
+  _ml_cond_init(&ml_log_cond);
+}
+
+/**
+ * @brief Logs an event if its level is enabled. Lock free and never
+ * formats anything, so it is safe on the scheduler thread. If the ring is
+ * full the record is dropped and counted, see ml_log_get_dropped.
+ *
+ * @param event The event.
+ * @param a0 The first argument of the event's format.
+ * @param a1 The second.
+ * @param a2 The third.
+ * @param a3 The fourth.
+ */
+void
+_ml_log(ml_log_event event, int64_t a0, int64_t a1, int64_t a2, int64_t a3)
+{
+  ml_log_record_t *record = NULL;
+  uint64_t pos = 0, seq = 0;
+
+  // The ring is set up before the level is first raised.
+  if (ml_log_formats[event].level >
+      __atomic_load_n(&ml_log_current_level, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+
+  pos = __atomic_load_n(&ml_log_head, __ATOMIC_RELAXED);
+  for (;;) {
+    record = &ml_log_ring[pos & (ML_LOG_RING_SIZE - 1)];
+    seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&ml_log_head, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (seq < pos) {
+      // Still holds a record from the last lap, the ring is full.
+      __atomic_add_fetch(&ml_log_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      pos = __atomic_load_n(&ml_log_head, __ATOMIC_RELAXED);
+    }
+  }
+
+  record->timestamp_ns = _ml_monotonic_nseconds();
+  record->event = event;
+  record->args[0] = a0;
+  record->args[1] = a1;
+  record->args[2] = a2;
+  record->args[3] = a3;
+  // Hand the slot to the consumer.
+  __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Formats a record into a message.
+ *
+ * @param record The record.
+ * @param message Where to put the message, ML_LOG_MESSAGE_SIZE long.
+ */
+static void
+_ml_log_format(const ml_log_record_t *record, char *message)
+{
+  const char *format = ml_log_formats[record->event].format;
+  size_t length = 0, left = 0;
+  int64_t arg = 0;
+  int next = 0, written = 0;
+  bool consumed = false;
+
+  for (; *format != '\0' && length < ML_LOG_MESSAGE_SIZE - 1; format++) {
+    left = ML_LOG_MESSAGE_SIZE - length;
+    if (format[0] != '%' || format[1] == '\0') {
+      message[length++] = format[0];
+      continue;
+    }
+
+    format++;
+    consumed = next < ML_LOG_MAX_ARGS;
+    arg = consumed ? record->args[next++] : 0;
+    switch (format[0]) {
+    case 'd':
+      written = snprintf(message + length, left, "%lld", (long long)arg);
+      break;
+    case 'u':
+      written = snprintf(message + length, left, "%llu",
+                         (unsigned long long)arg);
+      break;
+    case 'x':
+      written = snprintf(message + length, left, "%llx",
+                         (unsigned long long)arg);
+      break;
+    case 'E':
+      written = snprintf(message + length, left, "%s",
+                         libusb_error_name((int)arg));
+      break;
+    case 'e':
+      written = snprintf(message + length, left, "%s", strerror((int)arg));
+      break;
+    case 'C':
+      written = snprintf(message + length, left, "%s",
+                         arg >= 0 && arg < ML_COMMAND_COUNT ?
+                         ml_log_cmd_names[arg] : "unknown command");
+      break;
+    default:
+      written = snprintf(message + length, left, "%%%c", format[0]);
+      // Not a conversion, leave the argument for the next one.
+      if (consumed) {
+        next--;
+      }
+      break;
+    }
+    length += (size_t)written < left ? (size_t)written : left - 1;
+  }
+  message[length] = '\0';
+}
+
+/**
+ * @brief Sets which events are logged. Raising the level costs nothing
+ * until an event is logged, ML_LOG_NONE turns logging off.
+ *
+ * @param level The most detailed level to log.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_log_set_level(ml_log_level level)
+{
+  if (level > ML_LOG_DEBUG) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  pthread_once(&ml_log_once, _ml_log_init);
+  __atomic_store_n(&ml_log_current_level, level, __ATOMIC_RELEASE);
+  return ML_OK;
+}
+
+/**
+ * @brief Gets which events are logged.
+ *
+ * @return The current level.
+ */
+ml_log_level
+ml_log_get_level()
+{
+  return __atomic_load_n(&ml_log_current_level, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sets where drained messages go. Without a callback they are
+ * written to stderr. The callback runs on whichever thread drains, the log
+ * thread or the caller of ml_log_drain, and must not drain itself.
+ *
+ * @param callback The callback, NULL for stderr.
+ * @param user_data Passed to the callback.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_log_set_callback(ml_log_callback callback, void *user_data)
+{
+  pthread_mutex_lock(&ml_log_lock);
+  ml_log_sink = callback;
+  ml_log_sink_data = user_data;
+  pthread_mutex_unlock(&ml_log_lock);
+  return ML_OK;
+}
+
+/**
+ * @brief Formats every logged record and hands it to the sink. Hold the
+ * log lock.
+ *
+ * @return The number of messages delivered.
+ */
+static uint32_t
+_ml_log_drain_locked()
+{
+  char message[ML_LOG_MESSAGE_SIZE];
+  ml_log_record_t *record = NULL;
+  ml_log_level level = ML_LOG_NONE;
+  uint64_t timestamp_ns = 0;
+  uint32_t count = 0;
+
+  pthread_once(&ml_log_once, _ml_log_init);
+  for (;;) {
+    record = &ml_log_ring[ml_log_tail & (ML_LOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != ml_log_tail + 1) {
+      break;
+    }
+    _ml_log_format(record, message);
+    level = ml_log_formats[record->event].level;
+    timestamp_ns = record->timestamp_ns;
+    // Free the slot for the producer one lap ahead.
+    __atomic_store_n(&record->seq, ml_log_tail + ML_LOG_RING_SIZE,
+                     __ATOMIC_RELEASE);
+    ml_log_tail += 1;
+
+    if (ml_log_sink != NULL) {
+      ml_log_sink(level, timestamp_ns, message, ml_log_sink_data);
+    } else {
+      fprintf(stderr, "libmissilelauncher: %s: %s\n",
+              ml_log_level_names[level], message);
+    }
+    count++;
+  }
+  return count;
+}
+
+/**
+ * @brief Formats everything logged so far and hands it to the sink, see
+ * ml_log_set_callback. Call this periodically from the application, or let
+ * the log thread do it, see ml_log_start.
+ *
+ * @return The number of messages delivered.
+ */
+uint32_t
+ml_log_drain()
+{
+  uint32_t count = 0;
+
+  pthread_mutex_lock(&ml_log_lock);
+  count = _ml_log_drain_locked();
+  pthread_mutex_unlock(&ml_log_lock);
+  return count;
+}
+
+/**
+ * @brief Gets how many records were dropped because the ring was full.
+ * Drain more often if this keeps rising.
+ *
+ * @return The number of dropped records.
+ */
+uint64_t
+ml_log_get_dropped()
+{
+  return __atomic_load_n(&ml_log_dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Body of the log thread, drains the ring every ML_LOG_DRAIN_MS.
+ *
+ * @param arg Unused.
+ *
+ * @return Nothing.
+ */
+static void *
+_ml_log_run(void *arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&ml_log_lock);
+  while (ml_log_running) {
+    _ml_log_drain_locked();
+    _ml_cond_wait_until(&ml_log_cond, &ml_log_lock,
+                        _ml_monotonic_mseconds() + ML_LOG_DRAIN_MS);
+  }
+  _ml_log_drain_locked();
+  pthread_mutex_unlock(&ml_log_lock);
+  return NULL;
+}
+
+/**
+ * @brief Starts a thread that drains the log in the background, so the
+ * application doesn't have to call ml_log_drain. Producers never wake it,
+ * it polls, so messages arrive up to ML_LOG_DRAIN_MS late.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_log_start()
+{
+  ml_error_code result = ML_OK;
+
+  pthread_once(&ml_log_once, _ml_log_init);
+  pthread_mutex_lock(&ml_log_lock);
+  if (!ml_log_running) {
+    ml_log_running = true;
+    if (_ml_thread_create(&ml_log_thread, _ml_log_run, NULL) != ML_OK) {
+      ml_log_running = false;
+      result = ML_ALLOC_FAILED;
+    }
+  }
+  pthread_mutex_unlock(&ml_log_lock);
+  return result;
+}
+
+/**
+ * @brief Stops the log thread after it drains what is left.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_log_stop()
+{
+  pthread_mutex_lock(&ml_log_lock);
+  if (!ml_log_running) {
+    pthread_mutex_unlock(&ml_log_lock);
+    return ML_OK;
+  }
+  ml_log_running = false;
+  _ml_cond_signal(&ml_log_cond);
+  pthread_mutex_unlock(&ml_log_lock);
+
+  pthread_join(ml_log_thread, NULL);
+  return ML_OK;
+}
+
+/**
+ * @brief Stops the log thread and delivers what is left when the library
+ * is cleaned up.
+ */
+void
+_ml_log_cleanup()
+{
+  ml_log_stop();
+  ml_log_drain();
+}
@@ -0,0 +1,336 @@
+/**
+ * @file ml_nudge.c
+ * @brief Fine aiming with trains of short pulses.
+ * A timed move can't correct by less than its stop and 200 ms of coast
+ * allow. A pulse drives the motor for a few milliseconds and stops it
+ * before it gets up to speed, so it barely coasts. How far a pulse turns
+ * isn't proportional to its length, so every launcher has a table of
+ * measured pulses per direction, and both planning and position tracking
+ * interpolate in it.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/**
+ * @brief Copies a launcher's pulse table for one direction.
+ *
+ * @param launcher The launcher.
+ * @param direction The direction.
+ * @param table Where to put the points, ML_PULSE_TABLE_SIZE of them.
+ *
+ * @return The number of points, 0 if the launcher has no table.
+ */
+static uint32_t
+_ml_pulse_load(ml_launcher_t *launcher, ml_launcher_direction direction,
+               ml_pulse_t *table)
+{
+  uint32_t count = __atomic_load_n(&launcher->pulse_count[direction],
+                                   __ATOMIC_ACQUIRE);
+
+  for (uint32_t i = 0; i < count; i++) {
+    table[i].duration_ms =
+      __atomic_load_n(&launcher->pulse_table[direction][i].duration_ms,
+                      __ATOMIC_RELAXED);
+    table[i].mdeg = __atomic_load_n(&launcher->pulse_table[direction][i].mdeg,
+                                    __ATOMIC_RELAXED);
+  }
+  return count;
+}
+
+/**
+ * @brief Works out how far a pulse turns. Between the points of the table
+ * the travel is interpolated, from the first point down to nothing at
+ * 0 ms. Past the last point the motor is up to speed, so the rest goes at
+ * the axis speed.
+ *
+ * @param table The pulse table.
+ * @param count The number of points, 0 to only use the axis speed.
+ * @param speed The axis speed, millidegrees per second.
+ * @param duration_ms How long the pulse drives the motor.
+ *
+ * @return The travel in millidegrees.
+ */
+static uint32_t
+_ml_pulse_interpolate(const ml_pulse_t *table, uint32_t count, uint32_t speed,
+                      uint32_t duration_ms)
+{
+  uint32_t prev_ms = 0, prev_mdeg = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (duration_ms <= table[i].duration_ms) {
+      return prev_mdeg + (uint32_t)(((uint64_t)(duration_ms - prev_ms) *
+                                     (table[i].mdeg - prev_mdeg)) /
+                                    (table[i].duration_ms - prev_ms));
+    }
+    prev_ms = table[i].duration_ms;
+    prev_mdeg = table[i].mdeg;
+  }
+  return prev_mdeg +
+    (uint32_t)(((uint64_t)(duration_ms - prev_ms) * speed) / 1000);
+}
+
+/**
+ * @brief Finds the pulse that turns a given distance, the inverse of
+ * _ml_pulse_interpolate within the table.
+ *
+ * @param table The pulse table, at least one point.
+ * @param count The number of points.
+ * @param mdeg The distance, at most the last point's.
+ *
+ * @return The pulse length in milliseconds, rounded to the nearest.
+ */
+static uint32_t
+_ml_pulse_invert(const ml_pulse_t *table, uint32_t count, uint32_t mdeg)
+{
+  uint32_t prev_ms = 0, prev_mdeg = 0, span = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (mdeg <= table[i].mdeg) {
+      span = table[i].mdeg - prev_mdeg;
+      return prev_ms + (uint32_t)(((uint64_t)(mdeg - prev_mdeg) *
+                                   (table[i].duration_ms - prev_ms) +
+                                   (span / 2)) / span);
+    }
+    prev_ms = table[i].duration_ms;
+    prev_mdeg = table[i].mdeg;
+  }
+  return prev_ms;
+}
+
+/**
+ * @brief Notes where a pulse starts, called by the scheduler once the
+ * launcher's active pulse has been sent.
+ *
+ * @param launcher The launcher.
+ */
+void
+_ml_pulse_begin(ml_launcher_t *launcher)
+{
+  ml_launcher_direction direction = launcher->active.cmd.direction;
+
+  launcher->pulse_from = direction == ML_DOWN || direction == ML_UP ?
+    ML_FLEET(launcher, vertical_position) :
+    ML_FLEET(launcher, horizontal_position);
+}
+
+/**
+ * @brief Works out how long the active pulse drove the motor when it was
+ * stopped early, by a preempting command.
+ *
+ * @param launcher The launcher, its pulse just stopped.
+ *
+ * @return The time in milliseconds, at most the pulse's length.
+ */
+uint32_t
+_ml_pulse_ran_ms(ml_launcher_t *launcher)
+{
+  uint64_t now = _ml_monotonic_nseconds(), left_ms = 0;
+  uint32_t duration_ms = launcher->active.cmd.duration_ms;
+
+  if (now < launcher->stop_at_ns) {
+    left_ms = (launcher->stop_at_ns - now) / 1000000;
+  }
+  return left_ms >= duration_ms ? 0 : duration_ms - (uint32_t)left_ms;
+}
+
+/**
+ * @brief Corrects the tracked position once a pulse has been stopped.
+ * Dead reckoning times the pulse at full axis speed, the pulse table knows
+ * better and includes the short coast.
+ *
+ * @param launcher The launcher.
+ * @param duration_ms How long the pulse drove the motor, less than its
+ * length if it was cut short.
+ */
+void
+_ml_pulse_end(ml_launcher_t *launcher, uint32_t duration_ms)
+{
+  ml_launcher_direction direction = launcher->active.cmd.direction;
+  ml_pulse_t table[ML_PULSE_TABLE_SIZE];
+  uint32_t count = 0, speed = 0, travel = 0, from = launcher->pulse_from;
+  uint32_t *position = NULL;
+
+  count = _ml_pulse_load(launcher, direction, table);
+  speed = __atomic_load_n(&launcher->axis_speed[direction], __ATOMIC_RELAXED);
+  travel = _ml_pulse_interpolate(table, count, speed, duration_ms);
+  position = direction == ML_DOWN || direction == ML_UP ?
+    &ML_FLEET(launcher, vertical_position) :
+    &ML_FLEET(launcher, horizontal_position);
+  if (direction == ML_UP || direction == ML_RIGHT) {
+    (*position) = from + travel;
+  } else {
+    (*position) = travel >= from ? 0 : from - travel;
+  }
+  _ml_pose_save(launcher);
+}
+
+/**
+ * @brief Sets how far a launcher turns for short pulses in one direction.
+ * Every point is a pulse length and the distance it turned, measured from
+ * standing still until the launcher stopped again. Points go from the
+ * shortest pulse up and both columns have to increase. Launchers start out
+ * with their model's table, which is only a rough guide, measuring a unit
+ * makes ml_launcher_nudge land much closer. Don't change a table while the
+ * launcher is being nudged.
+ *
+ * @param launcher The launcher to calibrate.
+ * @param direction The direction.
+ * @param pulses The points, may be NULL if count is 0.
+ * @param count The number of points, at most ML_PULSE_TABLE_SIZE, 0 to go
+ * back to the model's table.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_launcher_set_pulse_table(ml_launcher_t *launcher,
+                            ml_launcher_direction direction,
+                            const ml_pulse_t *pulses, uint32_t count)
+{
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (direction > ML_RIGHT || count > ML_PULSE_TABLE_SIZE) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+  if (count == 0) {
+    if (launcher->driver == NULL) {
+      return ML_NOT_IMPLEMENTED;
+    }
+    pulses = launcher->driver->pulse_table[direction];
+    count = launcher->driver->pulse_count[direction];
+  }
+  if (pulses == NULL) {
+    return ML_NULL_POINTER;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (pulses[i].duration_ms == 0 || pulses[i].mdeg == 0 ||
+        (i > 0 && (pulses[i].duration_ms <= pulses[i - 1].duration_ms ||
+                   pulses[i].mdeg <= pulses[i - 1].mdeg))) {
+      return ML_INDEX_OUT_OF_BOUNDS;
+    }
+  }
+
+  // Shrink first, so a reader never sees more points than are written.
+  __atomic_store_n(&launcher->pulse_count[direction], 0, __ATOMIC_RELEASE);
+  for (uint32_t i = 0; i < count; i++) {
+    __atomic_store_n(&launcher->pulse_table[direction][i].duration_ms,
+                     pulses[i].duration_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&launcher->pulse_table[direction][i].mdeg,
+                     pulses[i].mdeg, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&launcher->pulse_count[direction], count,
+                   __ATOMIC_RELEASE);
+  return ML_OK;
+}
+
+/**
+ * @brief Plans the pulses that turn a launcher along one axis. Whole
+ * pulses of the table's longest length cover the bulk, one pulse
+ * interpolated in the table covers the rest. A remainder under half the
+ * shortest pulse is closer left alone.
+ *
+ * @param launcher The launcher.
+ * @param delta How far to turn, millidegrees towards higher.
+ * @param lower The direction that lowers the position.
+ * @param higher The direction that raises the position.
+ * @param pulses Where to add the pulses.
+ * @param count The number of pulses so far, updated.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_nudge_plan_axis(ml_launcher_t *launcher, int32_t delta,
+                    ml_launcher_direction lower, ml_launcher_direction higher,
+                    ml_command_t *pulses, uint32_t *count)
+{
+  ml_launcher_direction direction = delta > 0 ? higher : lower;
+  ml_pulse_t table[ML_PULSE_TABLE_SIZE];
+  ml_pulse_t pulse;
+  uint32_t points = 0, planned = 0;
+  uint64_t remaining = delta > 0 ? (uint64_t)delta :
+    (uint64_t)(-(int64_t)delta);
+
+  if (remaining == 0) {
+    return ML_OK;
+  }
+  points = _ml_pulse_load(launcher, direction, table);
+  if (points == 0) {
+    // No idea how far a pulse goes.
+    return ML_NOT_IMPLEMENTED;
+  }
+  if (remaining > (uint64_t)table[points - 1].mdeg * ML_NUDGE_MAX_PULSES) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  while (remaining * 2 > table[0].mdeg && planned < ML_NUDGE_MAX_PULSES) {
+    if (remaining >= table[points - 1].mdeg) {
+      pulse = table[points - 1];
+    } else if (remaining <= table[0].mdeg) {
+      pulse = table[0];
+    } else {
+      pulse.duration_ms = _ml_pulse_invert(table, points, remaining);
+      pulse.mdeg = _ml_pulse_interpolate(table, points, 0,
+                                         pulse.duration_ms);
+    }
+    pulses[*count].type = ML_COMMAND_PULSE;
+    pulses[*count].direction = direction;
+    pulses[*count].duration_ms = pulse.duration_ms;
+    (*count)++;
+    planned++;
+    remaining = pulse.mdeg >= remaining ? 0 : remaining - pulse.mdeg;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Makes a small correction to where a launcher points and waits for
+ * it. Each axis is turned with a train of short pulses planned from the
+ * launcher's pulse tables, see ml_launcher_set_pulse_table, which lands
+ * within half the shortest pulse in tens of milliseconds where a timed
+ * move would take hundreds. The tracked position moves by what the tables
+ * say the pulses turned.
+ *
+ * @param launcher A claimed launcher.
+ * @param horizontal How far to turn, millidegrees to the right, negative
+ * for left.
+ * @param vertical How far to turn, millidegrees up, negative for down.
+ *
+ * @return A status code, ML_INDEX_OUT_OF_BOUNDS if the correction is too
+ * big for a pulse train, use a move for those.
+ */
+ml_error_code
+ml_launcher_nudge(ml_launcher_t *launcher, int32_t horizontal,
+                  int32_t vertical)
+{
+  ml_command_t pulses[2 * ML_NUDGE_MAX_PULSES] = {{0}};
+  uint32_t count = 0;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  // Waiting on a scheduler thread could wait forever.
+  if (_ml_scheduler_is_current()) {
+    return ML_WOULD_BLOCK;
+  }
+
+  // Turn first, then raise or lower, like ml_group_aim.
+  result = _ml_nudge_plan_axis(launcher, horizontal, ML_LEFT, ML_RIGHT,
+                               pulses, &count);
+  if (result == ML_OK) {
+    result = _ml_nudge_plan_axis(launcher, vertical, ML_DOWN, ML_UP,
+                                 pulses, &count);
+  }
+  if (result != ML_OK || count == 0) {
+    return result;
+  }
+
+  return _ml_launcher_submit_wait_n(launcher, pulses, count);
+}
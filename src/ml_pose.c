@@ -0,0 +1,334 @@
+/**
+ * @file ml_pose.c
+ * @brief Keeps every launcher's pose in a memory mapped file, so a restarted
+ * process can pick up where the last one left off instead of zeroing.
+ * Entries are updated in place as moves finish, the file is never written
+ * with a system call on the hot path. A launcher's pose is only trusted
+ * again if the library let go of it in an orderly way.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/**
+ * @brief Writes a launcher's current pose into its entry. The moving flag
+ * is raised before and dropped after the position, so an entry that was
+ * cut off mid write is never restored.
+ *
+ * @param entry The launcher's entry.
+ * @param launcher The launcher.
+ */
+static void
+_ml_pose_write(ml_pose_entry_t *entry, ml_launcher_t *launcher)
+{
+  bool moving = launcher->motion_direction >= 0;
+
+  if (moving) {
+    __atomic_store_n(&entry->moving, 1, __ATOMIC_RELEASE);
+  }
+  entry->known = __atomic_load_n(&launcher->pose_known, __ATOMIC_RELAXED);
+  entry->horizontal = ML_FLEET(launcher, horizontal_position);
+  entry->vertical = ML_FLEET(launcher, vertical_position);
+  if (!moving) {
+    __atomic_store_n(&entry->moving, 0, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief Finds or makes the entry for a launcher. If the launcher was let
+ * go of cleanly, at rest and with a known position, that position is
+ * restored. Hold the controller lock.
+ *
+ * @param pose The pose file.
+ * @param launcher The launcher.
+ */
+static void
+_ml_pose_attach(ml_pose_t *pose, ml_launcher_t *launcher)
+{
+  ml_pose_entry_t *entry = NULL;
+  int32_t slot = -1;
+
+  for (int32_t i = 0; i < ML_POSE_CAPACITY; i++) {
+    entry = &pose->entries[i];
+    if (!entry->used) {
+      if (slot < 0) {
+        slot = i;
+      }
+      continue;
+    }
+    if (_ml_launcher_same_identity(launcher, entry->port_path,
+                                   entry->serial)) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    // Full, this launcher will have to be zeroed every time.
+    return;
+  }
+
+  entry = &pose->entries[slot];
+  if (entry->used && entry->clean && entry->known && !entry->moving &&
+      !launcher->pose_known) {
+    ML_FLEET(launcher, horizontal_position) = entry->horizontal;
+    ML_FLEET(launcher, vertical_position) = entry->vertical;
+    __atomic_store_n(&launcher->pose_known, true, __ATOMIC_RELAXED);
+  }
+
+  // In use now, a crash from here on leaves it dirty.
+  entry->clean = 0;
+  entry->used = 1;
+  // Same sized fields, the terminator comes along with the rest.
+  memcpy(entry->port_path, launcher->port_path, sizeof(entry->port_path));
+  memcpy(entry->serial, launcher->serial, sizeof(entry->serial));
+  _ml_pose_write(entry, launcher);
+  __atomic_store_n(&launcher->pose_slot, slot, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Lets go of a launcher's entry and marks it clean. Nothing may be
+ * sending to the launcher. Hold the controller lock.
+ *
+ * @param pose The pose file.
+ * @param launcher The launcher.
+ */
+static void
+_ml_pose_release(ml_pose_t *pose, ml_launcher_t *launcher)
+{
+  int32_t slot = __atomic_load_n(&launcher->pose_slot, __ATOMIC_RELAXED);
+
+  if (slot < 0) {
+    return;
+  }
+  _ml_pose_write(&pose->entries[slot], launcher);
+  pose->entries[slot].clean = 1;
+  __atomic_store_n(&launcher->pose_slot, -1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Starts saving every launcher's pose to a file. Launchers that are
+ * in the file from an earlier run that stopped cleanly get their position
+ * back, check ml_launcher_has_position before zeroing. Launchers found
+ * later are looked up as they are added. An unreadable file is started
+ * over. Only one process may use a pose file at a time, it is locked until
+ * ml_pose_stop.
+ *
+ * @param path Where to keep the pose file.
+ *
+ * @return A status code, ML_IN_USE if another process has the file.
+ */
+ml_error_code
+ml_pose_start(const char *path)
+{
+  ml_controller_t *cont = ml_main_controller;
+  ml_pose_t *pose = NULL;
+  struct stat info;
+  bool valid = false;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (path == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (__atomic_load_n(&cont->pose, __ATOMIC_SEQ_CST) != NULL) {
+    return ML_NOT_NULL_POINTER;
+  }
+
+  pose = calloc(sizeof(ml_pose_t), 1);
+  if (pose == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  pose->map_size = sizeof(ml_pose_header_t) +
+    (ML_POSE_CAPACITY * sizeof(ml_pose_entry_t));
+
+  pose->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (pose->fd < 0) {
+    free(pose);
+    return ML_NOT_FOUND;
+  }
+  // Two processes restoring from and writing to the same entries would
+  // each think the other's launchers are theirs.
+  if (flock(pose->fd, LOCK_EX | LOCK_NB) != 0) {
+    if (errno != EWOULDBLOCK) {
+      goto fail;
+    }
+    close(pose->fd);
+    free(pose);
+    return ML_IN_USE;
+  }
+  if (fstat(pose->fd, &info) != 0) {
+    goto fail;
+  }
+  if ((size_t)info.st_size != pose->map_size &&
+      ftruncate(pose->fd, pose->map_size) != 0) {
+    goto fail;
+  }
+  pose->map = mmap(NULL, pose->map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, pose->fd, 0);
+  if (pose->map == MAP_FAILED) {
+    goto fail;
+  }
+
+  pose->header = pose->map;
+  pose->entries = (ml_pose_entry_t *)(pose->header + 1);
+  valid = (size_t)info.st_size == pose->map_size &&
+    memcmp(pose->header->magic, ML_POSE_MAGIC, 8) == 0 &&
+    pose->header->version == ML_POSE_VERSION &&
+    pose->header->entry_size == sizeof(ml_pose_entry_t) &&
+    pose->header->capacity == ML_POSE_CAPACITY;
+  if (!valid) {
+    memset(pose->map, 0, pose->map_size);
+    memcpy(pose->header->magic, ML_POSE_MAGIC, 8);
+    pose->header->version = ML_POSE_VERSION;
+    pose->header->entry_size = sizeof(ml_pose_entry_t);
+    pose->header->capacity = ML_POSE_CAPACITY;
+  }
+
+  pthread_mutex_lock(&cont->lock);
+  if (cont->pose != NULL) {
+    pthread_mutex_unlock(&cont->lock);
+    munmap(pose->map, pose->map_size);
+    close(pose->fd);
+    free(pose);
+    return ML_NOT_NULL_POINTER;
+  }
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+    if (cont->launchers[i] != NULL) {
+      _ml_pose_attach(pose, cont->launchers[i]);
+    }
+  }
+  // Every slot is set before anyone can see the file.
+  __atomic_store_n(&cont->pose, pose, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&cont->lock);
+  return ML_OK;
+
+fail:
+  close(pose->fd);
+  free(pose);
+  return ML_ALLOC_FAILED;
+}
+
+/**
+ * @brief Stops saving poses, marks every launcher as let go of cleanly and
+ * closes the pose file. Stop the launchers first, one that is still moving
+ * won't be restored. ml_library_cleanup does this too.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_pose_stop()
+{
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  return _ml_pose_close(ml_main_controller);
+}
+
+/**
+ * @brief Detaches the pose file from the controller, waits for any writer
+ * still using it, then marks the launchers clean and unmaps it.
+ *
+ * @param cont The controller.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_pose_close(ml_controller_t *cont)
+{
+  ml_pose_t *pose = NULL;
+
+  pthread_mutex_lock(&cont->lock);
+  pose = __atomic_exchange_n(&cont->pose, NULL, __ATOMIC_SEQ_CST);
+  if (pose == NULL) {
+    pthread_mutex_unlock(&cont->lock);
+    return ML_NULL_POINTER;
+  }
+  // Writers announce themselves before looking at the pointer, so once the
+  // count drops to zero nobody can still be writing.
+  while (__atomic_load_n(&cont->pose_writers, __ATOMIC_SEQ_CST) != 0) {
+    sched_yield();
+  }
+  for (int16_t i = 0; i < cont->launcher_array_size; i++) {
+    if (cont->launchers[i] != NULL) {
+      _ml_pose_release(pose, cont->launchers[i]);
+    }
+  }
+  pthread_mutex_unlock(&cont->lock);
+
+  msync(pose->map, pose->map_size, MS_SYNC);
+  munmap(pose->map, pose->map_size);
+  close(pose->fd);
+  free(pose);
+  return ML_OK;
+}
+
+/**
+ * @brief Gives a newly added launcher its entry in the pose file, if one is
+ * open. Hold the controller lock.
+ *
+ * @param cont The controller.
+ * @param launcher The launcher, its identity already set.
+ */
+void
+_ml_pose_attach_unsafe(ml_controller_t *cont, ml_launcher_t *launcher)
+{
+  if (cont->pose != NULL) {
+    _ml_pose_attach(cont->pose, launcher);
+  }
+}
+
+/**
+ * @brief Lets go of the entry of a launcher that is being removed. Hold the
+ * controller lock.
+ *
+ * @param cont The controller.
+ * @param launcher The launcher.
+ */
+void
+_ml_pose_release_unsafe(ml_controller_t *cont, ml_launcher_t *launcher)
+{
+  if (cont->pose != NULL) {
+    _ml_pose_release(cont->pose, launcher);
+  }
+}
+
+/**
+ * @brief Saves a launcher's pose after a command changed it, if a pose file
+ * is open.
+ *
+ * @param launcher The launcher.
+ */
+void
+_ml_pose_save(ml_launcher_t *launcher)
+{
+  ml_controller_t *cont = launcher->controller;
+  ml_pose_t *pose = NULL;
+  int32_t slot = -1;
+
+  if (__atomic_load_n(&cont->pose, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+
+  __atomic_add_fetch(&cont->pose_writers, 1, __ATOMIC_SEQ_CST);
+  pose = __atomic_load_n(&cont->pose, __ATOMIC_SEQ_CST);
+  slot = __atomic_load_n(&launcher->pose_slot, __ATOMIC_RELAXED);
+  if (pose != NULL && slot >= 0) {
+    _ml_pose_write(&pose->entries[slot], launcher);
+  }
+  __atomic_sub_fetch(&cont->pose_writers, 1, __ATOMIC_SEQ_CST);
+}
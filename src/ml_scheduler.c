@@ -0,0 +1,1357 @@
+/**
+ * @file ml_scheduler.c
+ * @brief Per launcher command queues and the threads that run them.
+ * Each launcher has a priority queue of commands. Timed moves don't block,
+ * the scheduler remembers when to send the stop so that fire and stop
+ * commands can cut in while a launcher is moving. There is one scheduler
+ * thread per USB bus, optionally pinned to a CPU and rate limited.
+ * Submitting doesn't take a lock unless the scheduler is asleep. Commands are
+ * pushed onto a lock free stack on the launcher and the scheduler thread
+ * moves them into the priority queue on its next pass. A launcher with
+ * nothing queued is steered by its tracker, see ml_tracker.c.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#ifdef LINUX
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/// A finished command that still needs its callback run.
+typedef struct ml_sched_completion_t
+{
+  ml_command_callback callback;
+  void *user_data;
+  ml_error_code status;
+} ml_sched_completion_t;
+
+/// Lets a blocking call wait on queued commands.
+typedef struct ml_sched_waiter_t
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // Commands that haven't finished yet.
+  uint32_t remaining;
+  // The first error, ML_OK if none.
+  ml_error_code status;
+} ml_sched_waiter_t;
+
+static void *_ml_scheduler_run(void *);
+
+/// Set on scheduler threads, blocking calls from there would never return.
+static __thread bool ml_on_scheduler_thread = false;
+
+/**
+ * @brief Initializes a scheduler. The thread is started on first use.
+ *
+ * @param sched The scheduler to initialize.
+ * @param usb_bus The bus the scheduler is for.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_scheduler_init(ml_scheduler_t *sched, uint8_t usb_bus)
+{
+  memset(sched, 0, sizeof(ml_scheduler_t));
+  sched->usb_bus = usb_bus;
+  sched->cpu = -1;
+
+  sched->members = calloc(sizeof(ml_launcher_t *), ML_INITIAL_SCHEDULER_SIZE);
+  if (sched->members == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  sched->member_size = ML_INITIAL_SCHEDULER_SIZE;
+
+  if (pthread_mutex_init(&sched->lock, NULL) != 0 ||
+      _ml_cond_init(&sched->cond) != ML_OK) {
+    free(sched->members);
+    sched->members = NULL;
+    return ML_ALLOC_FAILED;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Stops the scheduler thread. Queued commands are dropped and
+ * completed with ML_CANCELLED, a running move is stopped.
+ *
+ * @param sched The scheduler to clean up.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_scheduler_cleanup(ml_scheduler_t *sched)
+{
+  bool was_running = false;
+
+  pthread_mutex_lock(&sched->lock);
+  was_running = sched->running;
+  sched->running = false;
+  _ml_cond_signal(&sched->cond);
+  pthread_mutex_unlock(&sched->lock);
+
+  if (was_running) {
+    pthread_join(sched->thread, NULL);
+  }
+
+  pthread_cond_destroy(&sched->cond);
+  pthread_mutex_destroy(&sched->lock);
+  free(sched->members);
+  sched->members = NULL;
+  sched->member_count = 0;
+  sched->member_size = 0;
+  return ML_OK;
+}
+
+/**
+ * @brief Gets the effective priority of a command.
+ *
+ * @param cmd The command.
+ *
+ * @return The priority, never ML_PRIORITY_DEFAULT.
+ */
+static ml_command_priority
+_ml_command_priority(const ml_command_t *cmd)
+{
+  if (cmd->priority != ML_PRIORITY_DEFAULT) {
+    return cmd->priority;
+  }
+  switch (cmd->type) {
+  case ML_COMMAND_STOP:
+  case ML_COMMAND_FIRE:
+    return ML_PRIORITY_HIGH;
+  default:
+    return ML_PRIORITY_NORMAL;
+  }
+}
+
+/**
+ * @brief Orders queue entries, higher priority first, then earlier deadline,
+ * then first come first served.
+ *
+ * @param a An entry.
+ * @param b Another entry.
+ *
+ * @return true if a should run before b.
+ */
+static bool
+_ml_sched_entry_before(const ml_sched_entry_t *a, const ml_sched_entry_t *b)
+{
+  ml_command_priority pa = _ml_command_priority(&a->cmd);
+  ml_command_priority pb = _ml_command_priority(&b->cmd);
+
+  if (pa != pb) {
+    return pa > pb;
+  }
+  if (a->deadline != b->deadline) {
+    // No deadline sorts last.
+    if (a->deadline == 0 || b->deadline == 0) {
+      return a->deadline != 0;
+    }
+    return a->deadline < b->deadline;
+  }
+  return a->seq < b->seq;
+}
+
+/**
+ * @brief Moves the entry at index up the heap until it is in order.
+ *
+ * @param launcher The launcher that owns the queue.
+ * @param index The entry to move.
+ */
+static void
+_ml_queue_sift_up(ml_launcher_t *launcher, uint32_t index)
+{
+  ml_sched_entry_t tmp;
+  uint32_t parent = 0;
+
+  while (index > 0) {
+    parent = (index - 1) / 2;
+    if (!_ml_sched_entry_before(&launcher->queue[index],
+                                &launcher->queue[parent])) {
+      break;
+    }
+    tmp = launcher->queue[parent];
+    launcher->queue[parent] = launcher->queue[index];
+    launcher->queue[index] = tmp;
+    index = parent;
+  }
+}
+
+/**
+ * @brief Moves the entry at index down the heap until it is in order.
+ *
+ * @param launcher The launcher that owns the queue.
+ * @param index The entry to move.
+ */
+static void
+_ml_queue_sift_down(ml_launcher_t *launcher, uint32_t index)
+{
+  ml_sched_entry_t tmp;
+  uint32_t child = 0;
+
+  while ((child = (index * 2) + 1) < launcher->queue_length) {
+    if (child + 1 < launcher->queue_length &&
+        _ml_sched_entry_before(&launcher->queue[child + 1],
+                               &launcher->queue[child])) {
+      child += 1;
+    }
+    if (!_ml_sched_entry_before(&launcher->queue[child],
+                                &launcher->queue[index])) {
+      break;
+    }
+    tmp = launcher->queue[child];
+    launcher->queue[child] = launcher->queue[index];
+    launcher->queue[index] = tmp;
+    index = child;
+  }
+}
+
+/**
+ * @brief Adds an entry to a launcher's queue. Hold the scheduler lock.
+ *
+ * @param launcher The launcher.
+ * @param entry The entry to add.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_queue_push(ml_launcher_t *launcher, const ml_sched_entry_t *entry)
+{
+  ml_sched_entry_t *resized = NULL;
+  uint32_t new_size = 0;
+
+  if (launcher->queue_length == launcher->queue_size) {
+    new_size = launcher->queue_size == 0 ?
+      ML_INITIAL_QUEUE_SIZE : launcher->queue_size * 2;
+    resized = realloc(launcher->queue, sizeof(ml_sched_entry_t) * new_size);
+    if (resized == NULL) {
+      return ML_ALLOC_FAILED;
+    }
+    launcher->queue = resized;
+    launcher->queue_size = new_size;
+  }
+
+  launcher->queue[launcher->queue_length] = (*entry);
+  launcher->queue_length += 1;
+  _ml_queue_sift_up(launcher, launcher->queue_length - 1);
+  return ML_OK;
+}
+
+/**
+ * @brief Removes an entry from a launcher's queue. Hold the scheduler lock.
+ *
+ * @param launcher The launcher.
+ * @param index The entry to remove, 0 is the next to run.
+ * @param entry Where to put the removed entry.
+ */
+static void
+_ml_queue_remove(ml_launcher_t *launcher, uint32_t index,
+                 ml_sched_entry_t *entry)
+{
+  (*entry) = launcher->queue[index];
+  launcher->queue_length -= 1;
+  if (index == launcher->queue_length) {
+    return;
+  }
+  launcher->queue[index] = launcher->queue[launcher->queue_length];
+  _ml_queue_sift_down(launcher, index);
+  _ml_queue_sift_up(launcher, index);
+}
+
+/**
+ * @brief Adds a launcher to the scheduler's list of launchers with work.
+ * The scheduler holds a reference and a lease on its members so they stay
+ * around and open until their queue drains. Hold the scheduler lock.
+ *
+ * @param sched The scheduler.
+ * @param launcher The launcher, not a member yet. On success the membership
+ * takes over the reference and lease of the node that brought it in.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_scheduler_add_member(ml_scheduler_t *sched, ml_launcher_t *launcher)
+{
+  ml_launcher_t **resized = NULL;
+
+  if (sched->member_count == sched->member_size) {
+    resized = realloc(sched->members,
+                      sizeof(ml_launcher_t *) * sched->member_size * 2);
+    if (resized == NULL) {
+      return ML_ALLOC_FAILED;
+    }
+    sched->members = resized;
+    sched->member_size *= 2;
+  }
+
+  sched->members[sched->member_count] = launcher;
+  sched->member_count += 1;
+  launcher->sched_member = true;
+  return ML_OK;
+}
+
+/**
+ * @brief Drops a launcher from the scheduler once it has nothing left to do.
+ * Hold the scheduler lock. It is let go while the lease is returned, which
+ * may close the launcher. Only the scheduler thread changes the members, so
+ * they are as they were afterwards.
+ *
+ * @param sched The scheduler.
+ * @param index The member to remove.
+ */
+static void
+_ml_scheduler_remove_member(ml_scheduler_t *sched, uint32_t index)
+{
+  ml_launcher_t *launcher = sched->members[index];
+
+  sched->member_count -= 1;
+  sched->members[index] = sched->members[sched->member_count];
+  sched->members[sched->member_count] = NULL;
+  launcher->sched_member = false;
+
+  free(launcher->queue);
+  launcher->queue = NULL;
+  launcher->queue_size = 0;
+
+  pthread_mutex_unlock(&sched->lock);
+  ml_launcher_release(launcher);
+  ml_launcher_dereference(launcher);
+  pthread_mutex_lock(&sched->lock);
+}
+
+/**
+ * @brief Pins the scheduler thread to its CPU, if it has one. Call from the
+ * scheduler thread or with the scheduler lock held.
+ *
+ * @param sched The scheduler.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_scheduler_apply_affinity(ml_scheduler_t *sched)
+{
+#ifdef LINUX
+  cpu_set_t cpus;
+
+  CPU_ZERO(&cpus);
+  if (sched->cpu < 0) {
+    // Unpinned, allow every CPU.
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      CPU_SET(i, &cpus);
+    }
+  } else {
+    CPU_SET(sched->cpu, &cpus);
+  }
+  if (pthread_setaffinity_np(sched->thread, sizeof(cpus), &cpus) != 0) {
+    return ML_NOT_FOUND;
+  }
+  return ML_OK;
+#else
+  return sched->cpu < 0 ? ML_OK : ML_NOT_IMPLEMENTED;
+#endif
+}
+
+/**
+ * @brief Pins a scheduler to a CPU.
+ *
+ * @param sched The scheduler.
+ * @param cpu The CPU, -1 to let it run anywhere.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_scheduler_set_affinity(ml_scheduler_t *sched, int cpu)
+{
+  ml_error_code result = ML_OK;
+
+  pthread_mutex_lock(&sched->lock);
+  sched->cpu = cpu;
+  if (sched->running) {
+    result = _ml_scheduler_apply_affinity(sched);
+  }
+  pthread_mutex_unlock(&sched->lock);
+  return result;
+}
+
+/**
+ * @brief Sets how many commands per second the scheduler may start.
+ * Stops that end a timed move are never held back.
+ *
+ * @param sched The scheduler.
+ * @param per_second The limit, 0 for no limit.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_scheduler_set_rate_limit(ml_scheduler_t *sched, uint32_t per_second)
+{
+  pthread_mutex_lock(&sched->lock);
+  sched->rate_limit = per_second;
+  // Start with a full bucket.
+  sched->rate_tokens = (uint64_t)per_second * 1000;
+  sched->rate_refilled = _ml_monotonic_mseconds();
+  _ml_cond_signal(&sched->cond);
+  pthread_mutex_unlock(&sched->lock);
+  return ML_OK;
+}
+
+/**
+ * @brief Takes a token from the rate limiter. Tokens are kept in
+ * thousandths, refilling rate_limit whole tokens a second up to a one
+ * second burst. Hold the scheduler lock.
+ *
+ * @param sched The scheduler.
+ * @param now The current monotonic time.
+ * @param retry Set to when a token will be available if there is none.
+ *
+ * @return true if a command may start.
+ */
+static bool
+_ml_scheduler_take_token(ml_scheduler_t *sched, uint64_t now, uint64_t *retry)
+{
+  uint64_t capacity = 0;
+
+  if (sched->rate_limit == 0) {
+    return true;
+  }
+
+  capacity = (uint64_t)sched->rate_limit * 1000;
+  sched->rate_tokens += (now - sched->rate_refilled) * sched->rate_limit;
+  if (sched->rate_tokens > capacity) {
+    sched->rate_tokens = capacity;
+  }
+  sched->rate_refilled = now;
+
+  if (sched->rate_tokens < 1000) {
+    (*retry) = now + ((1000 - sched->rate_tokens) + sched->rate_limit - 1) /
+      sched->rate_limit;
+    return false;
+  }
+  sched->rate_tokens -= 1000;
+  return true;
+}
+
+/**
+ * @brief Sends a simple command to the launcher.
+ *
+ * @param launcher The launcher.
+ * @param cmd The command to send.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_scheduler_execute(ml_launcher_t *launcher, const ml_command_t *cmd)
+{
+  ml_error_code result = ML_OK;
+
+  switch (cmd->type) {
+  case ML_COMMAND_MOVE:
+  case ML_COMMAND_MOVE_TIMED:
+  case ML_COMMAND_MOVE_TO_LIMIT:
+  case ML_COMMAND_PULSE:
+    return _ml_launcher_move_unsafe(launcher, cmd->direction);
+  case ML_COMMAND_STOP:
+    return _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+  case ML_COMMAND_FIRE:
+    return _ml_launcher_send_cmd_unsafe(launcher, ML_FIRE_CMD);
+  case ML_COMMAND_LED_ON:
+    result = _ml_launcher_send_cmd_unsafe(launcher, ML_LED_ON_CMD);
+    if (result == ML_OK) {
+      ML_FLEET(launcher, led_status) = 1;
+    }
+    return result;
+  case ML_COMMAND_LED_OFF:
+    result = _ml_launcher_send_cmd_unsafe(launcher, ML_LED_OFF_CMD);
+    if (result == ML_OK) {
+      ML_FLEET(launcher, led_status) = 0;
+    }
+    return result;
+  }
+  return ML_NOT_IMPLEMENTED;
+}
+
+/**
+ * @brief Fills in a completion for an entry.
+ *
+ * @param entry The finished entry.
+ * @param status How it finished.
+ * @param completion The completion to fill in.
+ *
+ * @return true, for convenience.
+ */
+static bool
+_ml_sched_complete(const ml_sched_entry_t *entry, ml_error_code status,
+                   ml_sched_completion_t *completion)
+{
+  completion->callback = entry->cmd.callback;
+  completion->user_data = entry->cmd.user_data;
+  completion->status = status;
+  return true;
+}
+
+/**
+ * @brief Keeps the earliest of two wake up times, 0 means never.
+ *
+ * @param wake The current wake up time.
+ * @param when A candidate.
+ */
+static void
+_ml_sched_wake_at(uint64_t *wake, uint64_t when)
+{
+  if ((*wake) == 0 || when < (*wake)) {
+    (*wake) = when;
+  }
+}
+
+/**
+ * @brief Lets the tracker steer a launcher that has nothing queued, see
+ * _ml_tracker_plan. Direction changes take a token from the rate limiter
+ * like any other command, stops never wait. The tracker stays active until
+ * the launcher has stopped on a target that isn't moving. Hold the
+ * scheduler lock.
+ *
+ * @param sched The scheduler.
+ * @param launcher The launcher.
+ * @param now The current monotonic time.
+ */
+static void
+_ml_scheduler_track(ml_scheduler_t *sched, ml_launcher_t *launcher,
+                    uint64_t now)
+{
+  ml_launcher_cmd cmd = ML_STOP_CMD;
+  uint64_t wake_ns = 0, retry = 0;
+
+  if (!launcher->usb_open) {
+    launcher->tracker.active = false;
+    return;
+  }
+
+  if (_ml_tracker_plan(launcher, _ml_monotonic_nseconds(), &cmd, &wake_ns)) {
+    if (cmd != ML_STOP_CMD && !_ml_scheduler_take_token(sched, now, &retry)) {
+      launcher->sched_wake = retry;
+      return;
+    }
+    if (_ml_launcher_send_cmd_unsafe(launcher, cmd) != ML_OK) {
+      // Nothing to steer with, the next push tries again.
+      launcher->tracker.active = false;
+      return;
+    }
+  }
+
+  if (wake_ns == 0) {
+    if (launcher->motion_direction < 0) {
+      launcher->tracker.active = false;
+      return;
+    }
+    wake_ns = _ml_monotonic_nseconds() + (ML_TRACK_REPLAN_MS * 1000000);
+  }
+  // Round up, waking early would just go back to sleep.
+  launcher->sched_wake = (wake_ns + 999999) / 1000000;
+}
+
+/**
+ * @brief Advances a launcher's queue by one step.
+ * Hold the scheduler lock. At most one command finishes per step, the
+ * caller runs its callback without the lock.
+ *
+ * @param sched The scheduler.
+ * @param launcher The launcher to service.
+ * @param now The current monotonic time.
+ * @param completion Filled in if a command finished.
+ *
+ * @return true if a command finished.
+ */
+static bool
+_ml_scheduler_step(ml_scheduler_t *sched, ml_launcher_t *launcher,
+                   uint64_t now, ml_sched_completion_t *completion)
+{
+  uint64_t retry = 0;
+  ml_sched_entry_t entry;
+  ml_error_code result = ML_OK;
+  uint8_t limits = 0;
+  uint32_t ammo = 0;
+  bool preempt = false, fired = false;
+
+  launcher->sched_wake = 0;
+
+  // Drop anything that can no longer start in time.
+  for (uint32_t i = 0; i < launcher->queue_length; i++) {
+    if (launcher->queue[i].deadline != 0 &&
+        launcher->queue[i].deadline < now) {
+      _ml_log(ML_LOG_DEADLINE_MISSED, launcher->usb_bus,
+              launcher->usb_device_number,
+              now - launcher->queue[i].deadline, 0);
+      _ml_queue_remove(launcher, i, &entry);
+      return _ml_sched_complete(&entry, ML_DEADLINE_MISSED, completion);
+    }
+  }
+
+  preempt = launcher->queue_length > 0 &&
+    _ml_command_priority(&launcher->queue[0].cmd) >
+    _ml_command_priority(&launcher->active.cmd);
+
+  switch (launcher->active_phase) {
+  case ML_SCHED_MOVING:
+    if (preempt) {
+      // Something more important came in, cut the move short.
+      _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+      if (launcher->active.cmd.type == ML_COMMAND_PULSE) {
+        _ml_pulse_end(launcher, _ml_pulse_ran_ms(launcher));
+      }
+      launcher->active_phase = ML_SCHED_IDLE;
+      return _ml_sched_complete(&launcher->active, ML_PREEMPTED, completion);
+    }
+    if (launcher->limit_polling && now >= launcher->next_limit_poll) {
+      if (_ml_launcher_read_limits_unsafe(launcher, &limits) != ML_OK) {
+        // No status report, fall back to the worst case.
+        launcher->limit_polling = false;
+      } else if (limits & (1 << launcher->active.cmd.direction)) {
+        // Against the end stop there is nothing left to coast.
+        result = _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+        launcher->active_phase = ML_SCHED_IDLE;
+        return _ml_sched_complete(&launcher->active, result, completion);
+      }
+      launcher->next_limit_poll = now + ML_LIMIT_POLL_MS;
+    }
+    if (_ml_monotonic_nseconds() >= launcher->stop_at_ns) {
+      result = _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+      if (result != ML_OK) {
+        launcher->active_phase = ML_SCHED_IDLE;
+        return _ml_sched_complete(&launcher->active, result, completion);
+      }
+      // Wait for device to stop coasting
+      launcher->active_phase = ML_SCHED_COASTING;
+      launcher->active_until = now + ML_COAST_MS;
+      if (launcher->active.cmd.type == ML_COMMAND_PULSE) {
+        _ml_pulse_end(launcher, launcher->active.cmd.duration_ms);
+        launcher->active_until = now + ML_PULSE_SETTLE_MS;
+      }
+      launcher->sched_wake = launcher->active_until;
+      return false;
+    }
+    // Round up, waking early would just go back to sleep.
+    launcher->sched_wake = (launcher->stop_at_ns + 999999) / 1000000;
+    if (launcher->limit_polling) {
+      _ml_sched_wake_at(&launcher->sched_wake, launcher->next_limit_poll);
+    }
+    return false;
+
+  case ML_SCHED_COASTING:
+    // The move is done, only the settling time is left.
+    if (preempt || now >= launcher->active_until) {
+      launcher->active_phase = ML_SCHED_IDLE;
+      return _ml_sched_complete(&launcher->active, ML_OK, completion);
+    }
+    launcher->sched_wake = launcher->active_until;
+    return false;
+
+  case ML_SCHED_FIRING:
+    if (preempt) {
+      _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+      launcher->active_phase = ML_SCHED_IDLE;
+      return _ml_sched_complete(&launcher->active, ML_PREEMPTED, completion);
+    }
+    if (launcher->limit_polling && now >= launcher->next_limit_poll) {
+      if (_ml_launcher_read_fire_unsafe(launcher, &fired) != ML_OK) {
+        // No status report, fall back to the firing cycle.
+        launcher->limit_polling = false;
+        launcher->active_until = launcher->fire_sent +
+          launcher->driver->fire_cycle_ms;
+      } else if (fired) {
+        // Ready for the next shot straight away.
+        launcher->active_phase = ML_SCHED_IDLE;
+        return _ml_sched_complete(&launcher->active, ML_OK, completion);
+      } else {
+        launcher->next_limit_poll = now + ML_LIMIT_POLL_MS;
+      }
+    }
+    if (now >= launcher->active_until) {
+      if (launcher->limit_polling) {
+        // The report never said, this model doesn't. Time the rest.
+        launcher->fire_reported = false;
+      }
+      launcher->active_phase = ML_SCHED_IDLE;
+      return _ml_sched_complete(&launcher->active, ML_OK, completion);
+    }
+    launcher->sched_wake = launcher->active_until;
+    if (launcher->limit_polling) {
+      _ml_sched_wake_at(&launcher->sched_wake, launcher->next_limit_poll);
+    }
+    return false;
+
+  case ML_SCHED_IDLE:
+    break;
+  }
+
+  if (launcher->queue_length == 0) {
+    if (launcher->tracker.active) {
+      _ml_scheduler_track(sched, launcher, now);
+    }
+    return false;
+  }
+  if (!_ml_scheduler_take_token(sched, now, &retry)) {
+    launcher->sched_wake = retry;
+    return false;
+  }
+
+  _ml_queue_remove(launcher, 0, &entry);
+  if (!launcher->usb_open) {
+    return _ml_sched_complete(&entry, ML_UNCLAIMED, completion);
+  }
+
+  switch (entry.cmd.type) {
+  case ML_COMMAND_MOVE_TO_LIMIT:
+    if (_ml_launcher_read_limits_unsafe(launcher, &limits) == ML_OK &&
+        (limits & (1 << entry.cmd.direction))) {
+      // Already there, nothing to do.
+      return _ml_sched_complete(&entry, ML_OK, completion);
+    }
+    // Fall through
+  case ML_COMMAND_MOVE_TIMED:
+  case ML_COMMAND_PULSE:
+    if (entry.cmd.duration_ms == 0) {
+      return _ml_sched_complete(&entry, ML_OK, completion);
+    }
+    // Timed from when the move is sent, like the journal records it.
+    launcher->stop_at_ns = _ml_monotonic_nseconds() +
+      ((uint64_t)entry.cmd.duration_ms * 1000000);
+    result = _ml_scheduler_execute(launcher, &entry.cmd);
+    if (result != ML_OK) {
+      return _ml_sched_complete(&entry, result, completion);
+    }
+    launcher->active = entry;
+    launcher->active_phase = ML_SCHED_MOVING;
+    if (entry.cmd.type == ML_COMMAND_PULSE) {
+      _ml_pulse_begin(launcher);
+    }
+    launcher->limit_polling = entry.cmd.type == ML_COMMAND_MOVE_TO_LIMIT;
+    launcher->next_limit_poll = now + ML_LIMIT_POLL_MS;
+    launcher->sched_wake = now;
+    return false;
+  case ML_COMMAND_FIRE:
+    ammo = __atomic_load_n(&launcher->ammo, __ATOMIC_RELAXED);
+    if (ammo == 0 &&
+        __atomic_load_n(&launcher->ammo_enforced, __ATOMIC_RELAXED) &&
+        !(entry.cmd.flags & ML_FIRE_IGNORE_AMMO)) {
+      return _ml_sched_complete(&entry, ML_NO_AMMO, completion);
+    }
+    result = _ml_scheduler_execute(launcher, &entry.cmd);
+    if (result != ML_OK) {
+      return _ml_sched_complete(&entry, result, completion);
+    }
+    // A reload in the meantime wins.
+    if (ammo > 0) {
+      __atomic_compare_exchange_n(&launcher->ammo, &ammo, ammo - 1, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    // Done once the status report says so, or the cycle is surely over.
+    launcher->active = entry;
+    launcher->active_phase = ML_SCHED_FIRING;
+    launcher->fire_sent = now;
+    launcher->limit_polling = launcher->fire_reported &&
+      launcher->driver->fire_done_mask != 0 &&
+      !(entry.cmd.flags & ML_FIRE_TIMED);
+    launcher->active_until = now + launcher->driver->fire_cycle_ms +
+      (launcher->limit_polling ? ML_FIRE_GRACE_MS : 0);
+    launcher->next_limit_poll = now + ML_FIRE_SETTLE_MS;
+    launcher->sched_wake = launcher->limit_polling ?
+      launcher->next_limit_poll : launcher->active_until;
+    return false;
+  default:
+    result = _ml_scheduler_execute(launcher, &entry.cmd);
+    return _ml_sched_complete(&entry, result, completion);
+  }
+}
+
+/**
+ * @brief Pushes a submitted command onto a launcher's inbox and makes sure
+ * the scheduler knows to look at it. Lock free unless the scheduler is
+ * asleep.
+ *
+ * @param sched The scheduler.
+ * @param launcher The launcher.
+ * @param node The command, owned by the scheduler from here on.
+ */
+static void
+_ml_scheduler_push(ml_scheduler_t *sched, ml_launcher_t *launcher,
+                   ml_sched_node_t *node)
+{
+  ml_sched_node_t *head = NULL;
+  ml_launcher_t *ready = NULL;
+
+  head = __atomic_load_n(&launcher->inbox, __ATOMIC_RELAXED);
+  do {
+    node->next = head;
+  } while (!__atomic_compare_exchange_n(&launcher->inbox, &head, node, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+  // A launcher is on the ready list while its inbox isn't empty, so only
+  // the first command since the scheduler last looked has to add it.
+  if (head == NULL) {
+    ready = __atomic_load_n(&sched->ready, __ATOMIC_RELAXED);
+    do {
+      launcher->ready_next = ready;
+    } while (!__atomic_compare_exchange_n(&sched->ready, &ready, launcher,
+                                          false, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+  }
+
+  if (__atomic_load_n(&sched->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&sched->lock);
+    _ml_cond_signal(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+  }
+}
+
+/**
+ * @brief Moves every submitted command into its launcher's queue. The
+ * first node for a launcher that isn't a member makes it one. Hold the
+ * scheduler lock.
+ *
+ * @param sched The scheduler.
+ *
+ * @return The nodes left to finish without the lock, see
+ * _ml_scheduler_finish.
+ */
+static ml_sched_node_t *
+_ml_scheduler_collect(ml_scheduler_t *sched)
+{
+  ml_launcher_t *launcher = NULL, *next = NULL;
+  ml_sched_node_t *node = NULL, *tmp = NULL, *done = NULL;
+
+  launcher = __atomic_exchange_n(&sched->ready, NULL, __ATOMIC_SEQ_CST);
+  for (; launcher != NULL; launcher = next) {
+    // Read the link first, a submitter may push the launcher again as soon
+    // as its inbox is empty.
+    next = launcher->ready_next;
+    node = __atomic_exchange_n(&launcher->inbox, NULL, __ATOMIC_SEQ_CST);
+
+    // The inbox is newest first, but the queue orders by sequence number so
+    // that doesn't matter.
+    for (; node != NULL; node = tmp) {
+      tmp = node->next;
+      node->status = ML_OK;
+      if (!launcher->sched_member) {
+        node->status = _ml_scheduler_add_member(sched, launcher);
+        node->held = node->status != ML_OK;
+      }
+
+      if (node == &launcher->tracker.node) {
+        // Not a command, a new sample for the tracker.
+        launcher->tracker.active = launcher->sched_member;
+        if (!node->held) {
+          // It can be pushed again from here on.
+          __atomic_store_n(&launcher->tracker.queued, false,
+                           __ATOMIC_SEQ_CST);
+          continue;
+        }
+      } else {
+        if (node->status == ML_OK) {
+          node->status = _ml_queue_push(launcher, &node->entry);
+        }
+        if (node->status == ML_OK && !node->held) {
+          free(node);
+          continue;
+        }
+      }
+      node->next = done;
+      done = node;
+    }
+  }
+  return done;
+}
+
+/**
+ * @brief Completes commands that never made it into a queue and hands back
+ * the references and leases that the launchers' memberships didn't need.
+ * Call without the scheduler lock.
+ *
+ * @param done The list returned by _ml_scheduler_collect.
+ */
+static void
+_ml_scheduler_finish(ml_sched_node_t *done)
+{
+  ml_sched_node_t *tmp = NULL;
+  ml_launcher_t *launcher = NULL;
+  bool tracker = false, held = false;
+
+  for (; done != NULL; done = tmp) {
+    tmp = done->next;
+    launcher = done->launcher;
+    tracker = done == &launcher->tracker.node;
+    held = done->held;
+    if (!tracker && done->status != ML_OK &&
+        done->entry.cmd.callback != NULL) {
+      done->entry.cmd.callback(launcher, done->status,
+                               done->entry.cmd.user_data);
+    }
+    if (held) {
+      ml_launcher_release(launcher);
+    }
+    if (tracker) {
+      // Pushes in the meantime were skipped, but the scheduler reads the
+      // latest sample when it next steps the launcher.
+      __atomic_store_n(&launcher->tracker.queued, false, __ATOMIC_SEQ_CST);
+    } else {
+      free(done);
+    }
+    if (held) {
+      ml_launcher_dereference(launcher);
+    }
+  }
+}
+
+/**
+ * @brief Completes everything left in a launcher's queue with ML_CANCELLED
+ * and stops it if it was moving or tracking. Used at shutdown. Hold the
+ * scheduler lock.
+ *
+ * @param sched The scheduler.
+ * @param launcher The launcher to flush.
+ */
+static void
+_ml_scheduler_flush(ml_scheduler_t *sched, ml_launcher_t *launcher)
+{
+  ml_sched_entry_t entry;
+
+  if (launcher->tracker.active) {
+    if (launcher->active_phase == ML_SCHED_IDLE &&
+        launcher->motion_direction >= 0) {
+      _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+    }
+    launcher->tracker.active = false;
+  }
+  if (launcher->active_phase != ML_SCHED_IDLE) {
+    if (launcher->active_phase == ML_SCHED_MOVING) {
+      _ml_launcher_send_cmd_unsafe(launcher, ML_STOP_CMD);
+    }
+    launcher->active_phase = ML_SCHED_IDLE;
+    if (launcher->active.cmd.callback != NULL) {
+      pthread_mutex_unlock(&sched->lock);
+      launcher->active.cmd.callback(launcher, ML_CANCELLED,
+                                    launcher->active.cmd.user_data);
+      pthread_mutex_lock(&sched->lock);
+    }
+  }
+
+  while (launcher->queue_length > 0) {
+    _ml_queue_remove(launcher, 0, &entry);
+    if (entry.cmd.callback != NULL) {
+      pthread_mutex_unlock(&sched->lock);
+      entry.cmd.callback(launcher, ML_CANCELLED, entry.cmd.user_data);
+      pthread_mutex_lock(&sched->lock);
+    }
+  }
+}
+
+/**
+ * @brief Sleeps until a stop is due in precise timing mode. The first time
+ * a scheduler thread does this it drops its timer slack, otherwise the
+ * kernel may wake it up to 50us late to batch wake ups.
+ *
+ * @param deadline When the stop is due, monotonic nanoseconds.
+ * @param spin How long to spin before it.
+ */
+static void
+_ml_scheduler_precise_sleep(uint64_t deadline, uint64_t spin)
+{
+#ifdef LINUX
+  static __thread bool slack_dropped = false;
+
+  if (!slack_dropped) {
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+    slack_dropped = true;
+  }
+#endif
+  _ml_sleep_until_ns(deadline, spin);
+}
+
+/**
+ * @brief The scheduler thread. Steps every launcher with work in turn,
+ * then sleeps until the next stop, limit check or deadline is due or a new
+ * command arrives.
+ *
+ * @param arg The scheduler.
+ *
+ * @return Nothing.
+ */
+static void *
+_ml_scheduler_run(void *arg)
+{
+  ml_scheduler_t *sched = arg;
+  ml_sched_completion_t completion;
+  ml_launcher_t *launcher = NULL;
+  ml_sched_node_t *done = NULL;
+  uint64_t now = 0, wake = 0, stop_at = 0, wake_ns = 0, spin_ns = 0;
+  bool progressed = false, precise = false;
+
+  ml_on_scheduler_thread = true;
+
+  pthread_mutex_lock(&sched->lock);
+  _ml_scheduler_apply_affinity(sched);
+  while (sched->running) {
+    wake = 0;
+    stop_at = 0;
+    progressed = false;
+
+    done = _ml_scheduler_collect(sched);
+    if (done != NULL) {
+      pthread_mutex_unlock(&sched->lock);
+      _ml_scheduler_finish(done);
+      pthread_mutex_lock(&sched->lock);
+    }
+    now = _ml_monotonic_mseconds();
+
+    // One step per launcher per pass so a long queue can't starve the
+    // others. Only this thread adds and removes members, removing swaps
+    // in the last one, so walk by index.
+    for (uint32_t i = 0; i < sched->member_count;) {
+      launcher = sched->members[i];
+      if (_ml_scheduler_step(sched, launcher, now, &completion)) {
+        if (completion.callback != NULL) {
+          pthread_mutex_unlock(&sched->lock);
+          completion.callback(launcher, completion.status,
+                              completion.user_data);
+          pthread_mutex_lock(&sched->lock);
+        }
+        now = _ml_monotonic_mseconds();
+        progressed = true;
+        i++;
+        continue;
+      }
+
+      if (launcher->active_phase == ML_SCHED_IDLE &&
+          launcher->queue_length == 0 && !launcher->tracker.active) {
+        _ml_scheduler_remove_member(sched, i);
+        continue;
+      }
+
+      for (uint32_t q = 0; q < launcher->queue_length; q++) {
+        if (launcher->queue[q].deadline != 0) {
+          _ml_sched_wake_at(&launcher->sched_wake,
+                            launcher->queue[q].deadline + 1);
+        }
+      }
+      if (launcher->sched_wake != 0) {
+        _ml_sched_wake_at(&wake, launcher->sched_wake);
+      }
+      if (launcher->active_phase == ML_SCHED_MOVING) {
+        _ml_sched_wake_at(&stop_at, launcher->stop_at_ns);
+      }
+      i++;
+    }
+
+    if (!sched->running) {
+      break;
+    }
+    if (progressed) {
+      continue;
+    }
+
+    precise = stop_at != 0 &&
+      __atomic_load_n(&ml_main_controller->timing_mode, __ATOMIC_RELAXED) ==
+      ML_TIMING_PRECISE;
+    if (precise &&
+        stop_at <= _ml_monotonic_nseconds() + ML_PRECISE_WINDOW_NS) {
+      // Close enough that new commands can wait, sleep straight to the
+      // stop instead of waking on the next millisecond.
+      spin_ns = (uint64_t)__atomic_load_n(&ml_main_controller->timing_spin_us,
+                                          __ATOMIC_RELAXED) * 1000;
+      pthread_mutex_unlock(&sched->lock);
+      _ml_scheduler_precise_sleep(stop_at, spin_ns);
+      pthread_mutex_lock(&sched->lock);
+      continue;
+    }
+
+    // Submitters check this after pushing, so either they see it and
+    // signal or we see their launcher on the ready list.
+    __atomic_store_n(&sched->sleeping, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sched->ready, __ATOMIC_SEQ_CST) == NULL) {
+      wake_ns = wake * 1000000;
+      if (precise && (wake == 0 ||
+                      stop_at - ML_PRECISE_WINDOW_NS < wake_ns)) {
+        wake_ns = stop_at - ML_PRECISE_WINDOW_NS;
+      }
+      if (wake_ns == 0) {
+        _ml_cond_wait(&sched->cond, &sched->lock);
+      } else if (wake_ns > _ml_monotonic_nseconds()) {
+        _ml_cond_wait_until_ns(&sched->cond, &sched->lock, wake_ns);
+      }
+    }
+    __atomic_store_n(&sched->sleeping, false, __ATOMIC_RELAXED);
+  }
+
+  // Shutting down, nothing queued gets to run.
+  done = _ml_scheduler_collect(sched);
+  if (done != NULL) {
+    pthread_mutex_unlock(&sched->lock);
+    _ml_scheduler_finish(done);
+    pthread_mutex_lock(&sched->lock);
+  }
+  while (sched->member_count > 0) {
+    _ml_scheduler_flush(sched, sched->members[0]);
+    _ml_scheduler_remove_member(sched, 0);
+  }
+  pthread_mutex_unlock(&sched->lock);
+  return NULL;
+}
+
+/**
+ * @brief Gets the scheduler for a launcher's bus and starts its thread if
+ * this is the first use of it.
+ *
+ * @param launcher The launcher.
+ * @param sched Where to put the scheduler.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_scheduler_for_launcher(ml_launcher_t *launcher, ml_scheduler_t **sched)
+{
+  ml_scheduler_t *bus_sched = NULL;
+  ml_error_code result = ML_OK;
+
+  result = _ml_controller_get_scheduler(launcher->controller,
+                                        launcher->usb_bus, &bus_sched);
+  if (result != ML_OK) {
+    return result;
+  }
+
+  // Only the first submission on a bus takes the lock.
+  if (!__atomic_load_n(&bus_sched->running, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&bus_sched->lock);
+    if (!bus_sched->running) {
+      if (_ml_thread_create(&bus_sched->thread, _ml_scheduler_run,
+                            bus_sched) != ML_OK) {
+        result = ML_ALLOC_FAILED;
+      } else {
+        __atomic_store_n(&bus_sched->running, true, __ATOMIC_RELEASE);
+      }
+    }
+    pthread_mutex_unlock(&bus_sched->lock);
+    if (result != ML_OK) {
+      return result;
+    }
+  }
+
+  (*sched) = bus_sched;
+  return ML_OK;
+}
+
+/**
+ * @brief Queues a command on a launcher without waiting for it.
+ * Commands run in priority order, see ml_command_priority. Stop and fire
+ * default to a high priority so they cut a running timed move short, and
+ * any command whose deadline passes before it starts is dropped.
+ * The callback, if any, runs on the scheduler thread once the command is
+ * done, it must not call the blocking launcher functions.
+ *
+ * @param launcher A claimed launcher.
+ * @param cmd The command, copied before this returns.
+ *
+ * @return A status code for queuing the command, the result of the command
+ * itself goes to the callback.
+ */
+ml_error_code
+ml_launcher_submit(ml_launcher_t *launcher, const ml_command_t *cmd)
+{
+  ml_scheduler_t *sched = NULL;
+  ml_sched_node_t *node = NULL;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL || cmd == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (!_ml_launcher_is_claimed(launcher)) {
+    return ML_UNCLAIMED;
+  }
+
+  if (launcher->driver == NULL) {
+    return ML_NOT_IMPLEMENTED;
+  }
+
+  result = _ml_scheduler_for_launcher(launcher, &sched);
+  if (result != ML_OK) {
+    return result;
+  }
+
+  node = malloc(sizeof(ml_sched_node_t));
+  if (node == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  // Taken here rather than on the scheduler thread, so opening the launcher
+  // never holds up the rest of the bus.
+  result = ml_launcher_lease(launcher);
+  if (result != ML_OK) {
+    free(node);
+    return result;
+  }
+  node->entry.cmd = (*cmd);
+  node->entry.deadline = 0;
+  if (cmd->deadline_ms != 0) {
+    node->entry.deadline = _ml_monotonic_mseconds() + cmd->deadline_ms;
+  }
+  node->entry.seq = __atomic_fetch_add(&sched->next_seq, 1, __ATOMIC_RELAXED);
+  node->launcher = launcher;
+  node->status = ML_OK;
+  node->held = true;
+
+  ml_launcher_reference(launcher);
+  _ml_scheduler_push(sched, launcher, node);
+  return ML_OK;
+}
+
+/**
+ * @brief Tells the scheduler a launcher's tracker has a new sample. The
+ * tracker's node goes through the inbox like a command, with a lease, but
+ * at most once however fast samples come in. Samples pushed while it is on
+ * its way are lock free unless the scheduler is asleep.
+ *
+ * @param launcher The launcher.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_scheduler_wake_tracker(ml_launcher_t *launcher)
+{
+  ml_scheduler_t *sched = NULL;
+  ml_error_code result = ML_OK;
+
+  result = _ml_scheduler_for_launcher(launcher, &sched);
+  if (result != ML_OK) {
+    return result;
+  }
+
+  if (__atomic_exchange_n(&launcher->tracker.queued, true,
+                          __ATOMIC_SEQ_CST)) {
+    // Already on its way, the scheduler reads the latest sample.
+    return ML_OK;
+  }
+  result = ml_launcher_lease(launcher);
+  if (result != ML_OK) {
+    __atomic_store_n(&launcher->tracker.queued, false, __ATOMIC_SEQ_CST);
+    return result;
+  }
+  launcher->tracker.node.held = true;
+  ml_launcher_reference(launcher);
+  _ml_scheduler_push(sched, launcher, &launcher->tracker.node);
+  return ML_OK;
+}
+
+/**
+ * @brief Callback used by _ml_launcher_submit_wait_n.
+ *
+ * @param launcher The launcher.
+ * @param status The result of the command, the first error is kept.
+ * @param user_data The waiter.
+ */
+static void
+_ml_sched_waiter_done(ml_launcher_t *launcher, ml_error_code status,
+                      void *user_data)
+{
+  ml_sched_waiter_t *waiter = user_data;
+  (void)launcher;
+
+  pthread_mutex_lock(&waiter->lock);
+  if (status != ML_OK && waiter->status == ML_OK) {
+    waiter->status = status;
+  }
+  waiter->remaining -= 1;
+  if (waiter->remaining == 0) {
+    pthread_cond_signal(&waiter->cond);
+  }
+  pthread_mutex_unlock(&waiter->lock);
+}
+
+/**
+ * @brief Checks if the calling thread is a scheduler thread, where waiting
+ * for a command could wait forever.
+ *
+ * @return true on a scheduler thread.
+ */
+bool
+_ml_scheduler_is_current()
+{
+  return ml_on_scheduler_thread;
+}
+
+/**
+ * @brief Queues a command and waits for it to finish.
+ *
+ * @param launcher The launcher.
+ * @param cmd The command, its callback is replaced.
+ *
+ * @return The result of the command.
+ */
+ml_error_code
+_ml_launcher_submit_wait(ml_launcher_t *launcher, ml_command_t *cmd)
+{
+  return _ml_launcher_submit_wait_n(launcher, cmd, 1);
+}
+
+/**
+ * @brief Queues several commands at once and waits for all of them to
+ * finish. If one can't be queued the rest aren't either, the ones already
+ * queued are still waited for.
+ *
+ * @param launcher The launcher.
+ * @param cmds The commands, their callbacks are replaced.
+ * @param count How many there are.
+ *
+ * @return The first error, ML_OK if every command went through.
+ */
+ml_error_code
+_ml_launcher_submit_wait_n(ml_launcher_t *launcher, ml_command_t *cmds,
+                           uint32_t count)
+{
+  ml_sched_waiter_t waiter;
+  ml_error_code result = ML_OK;
+
+  if (launcher == NULL || cmds == NULL) {
+    return ML_NULL_POINTER;
+  }
+  // Waiting on a scheduler thread could wait forever.
+  if (ml_on_scheduler_thread) {
+    return ML_WOULD_BLOCK;
+  }
+
+  pthread_mutex_init(&waiter.lock, NULL);
+  pthread_cond_init(&waiter.cond, NULL);
+  waiter.remaining = count;
+  waiter.status = ML_OK;
+
+  pthread_mutex_lock(&waiter.lock);
+  for (uint32_t i = 0; i < count; i++) {
+    cmds[i].callback = _ml_sched_waiter_done;
+    cmds[i].user_data = &waiter;
+    result = ml_launcher_submit(launcher, &cmds[i]);
+    if (result != ML_OK) {
+      // The rest were never queued, so their callbacks won't run.
+      waiter.remaining -= count - i;
+      if (waiter.status == ML_OK) {
+        waiter.status = result;
+      }
+      break;
+    }
+  }
+  while (waiter.remaining != 0) {
+    pthread_cond_wait(&waiter.cond, &waiter.lock);
+  }
+  result = waiter.status;
+  pthread_mutex_unlock(&waiter.lock);
+
+  pthread_cond_destroy(&waiter.cond);
+  pthread_mutex_destroy(&waiter.lock);
+  return result;
+}
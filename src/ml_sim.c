@@ -0,0 +1,440 @@
+/**
+ * @file ml_sim.c
+ * @brief Simulated launchers for tests.
+ * A simulated launcher sits behind the same transport as a real one, so
+ * everything above the transfers, the scheduler, zeroing, the tracker and
+ * the rest, runs exactly as it does against hardware. Its motors speed up
+ * and coast down, it stops at its end stops and its status report says
+ * where the limit switches are and when a shot is done. Time comes from the
+ * library's clock, so on ML_INIT_VIRTUAL_CLOCK hundreds of them run through
+ * minutes of moves in milliseconds.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/// How far each axis of a simulated launcher turns, horizontal first.
+static const double ml_sim_travel[2] = {
+  ML_SIM_TRAVEL_HORIZONTAL, ML_SIM_TRAVEL_VERTICAL
+};
+
+/**
+ * @brief Gets the axis a direction turns, 0 for horizontal, 1 for vertical.
+ *
+ * @param direction The direction.
+ *
+ * @return The axis.
+ */
+static int
+_ml_sim_axis(int direction)
+{
+  return direction == ML_DOWN || direction == ML_UP ? 1 : 0;
+}
+
+/**
+ * @brief Moves one axis of a simulated launcher on by some time. The motor
+ * speeds up or slows down at a steady rate, ML_SIM_RAMP_MS from standing
+ * to full speed, and the axis stops dead at its end stops.
+ *
+ * @param launcher The launcher.
+ * @param sim Its device.
+ * @param axis The axis.
+ * @param dt How long to move on by, in seconds.
+ */
+static void
+_ml_sim_step_axis(ml_launcher_t *launcher, ml_sim_device_t *sim, int axis,
+                  double dt)
+{
+  double target = 0, accel = 0, dv = 0, t_ramp = 0, sign = 0;
+  double velocity = sim->velocity[axis], position = sim->position[axis];
+  int direction = -1;
+
+  if (sim->driven >= 0 && _ml_sim_axis(sim->driven) == axis) {
+    direction = sim->driven;
+  } else if (velocity != 0) {
+    // Coasting slows down as fast as it sped up.
+    direction = axis == 0 ? (velocity > 0 ? ML_RIGHT : ML_LEFT) :
+      (velocity > 0 ? ML_UP : ML_DOWN);
+  }
+  if (direction < 0) {
+    return;
+  }
+
+  accel = (double)launcher->driver->axis_speed[direction] * 1000 /
+    ML_SIM_RAMP_MS;
+  if (sim->driven == direction) {
+    target = launcher->driver->axis_speed[direction];
+    if (direction == ML_DOWN || direction == ML_LEFT) {
+      target = -target;
+    }
+  }
+
+  dv = target - velocity;
+  sign = dv > 0 ? 1 : -1;
+  t_ramp = (dv * sign) / accel;
+  if (t_ramp >= dt) {
+    position += (velocity * dt) + (0.5 * sign * accel * dt * dt);
+    velocity += sign * accel * dt;
+  } else {
+    position += (velocity * t_ramp) + (0.5 * sign * accel * t_ramp * t_ramp);
+    velocity = target;
+    position += velocity * (dt - t_ramp);
+  }
+
+  if (position <= 0) {
+    position = 0;
+    velocity = 0;
+  } else if (position >= ml_sim_travel[axis]) {
+    position = ml_sim_travel[axis];
+    velocity = 0;
+  }
+  sim->position[axis] = position;
+  sim->velocity[axis] = velocity;
+}
+
+/**
+ * @brief Brings a simulated launcher up to the current time. Hold its lock.
+ *
+ * @param launcher The launcher.
+ * @param sim Its device.
+ *
+ * @return The current time, monotonic nanoseconds.
+ */
+static uint64_t
+_ml_sim_update(ml_launcher_t *launcher, ml_sim_device_t *sim)
+{
+  uint64_t now = _ml_monotonic_nseconds();
+  double dt = 0;
+
+  if (now > sim->updated_ns) {
+    dt = (double)(now - sim->updated_ns) / 1000000000;
+    _ml_sim_step_axis(launcher, sim, 0, dt);
+    _ml_sim_step_axis(launcher, sim, 1, dt);
+  }
+  sim->updated_ns = now;
+  return now;
+}
+
+/**
+ * @brief Rounds a position to whole millidegrees.
+ *
+ * @param position The position, never negative.
+ *
+ * @return The rounded position.
+ */
+static uint32_t
+_ml_sim_round(double position)
+{
+  return (uint32_t)(position + 0.5);
+}
+
+/**
+ * @brief Opens a simulated launcher, there is nothing to open.
+ *
+ * @param launcher The launcher.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_sim_transport_open(ml_launcher_t *launcher)
+{
+  (void)launcher;
+  return ML_OK;
+}
+
+/**
+ * @brief Closes a simulated launcher, there is nothing to close.
+ *
+ * @param launcher The launcher.
+ */
+static void
+_ml_sim_transport_close(ml_launcher_t *launcher)
+{
+  (void)launcher;
+}
+
+/**
+ * @brief Takes a control transfer on a simulated launcher. Commands are
+ * looked up in the launcher's driver, a request for data is answered with
+ * zeros like a GET_STATUS.
+ *
+ * @param launcher The launcher.
+ * @param request_type The bmRequestType field.
+ * @param request The bRequest field.
+ * @param value The wValue field.
+ * @param index The wIndex field.
+ * @param data The data sent or the buffer to read into.
+ * @param length How long data is.
+ * @param timeout In milliseconds, not used.
+ *
+ * @return The bytes transferred or a libusb error code.
+ */
+static int
+_ml_sim_transport_control(ml_launcher_t *launcher, uint8_t request_type,
+                          uint8_t request, uint16_t value, uint16_t index,
+                          unsigned char *data, uint16_t length,
+                          unsigned int timeout)
+{
+  const ml_driver_t *driver = launcher->driver;
+  ml_sim_device_t *sim = launcher->sim;
+  int cmd = -1;
+  uint64_t now = 0;
+  (void)timeout;
+
+  if (request_type & LIBUSB_ENDPOINT_IN) {
+    memset(data, 0, length);
+    return length;
+  }
+  if (request_type != driver->request_type ||
+      request != driver->request_field || value != driver->request_value ||
+      index != driver->request_index || length != driver->cmd_size) {
+    return LIBUSB_ERROR_PIPE;
+  }
+  for (int i = 0; i < ML_COMMAND_COUNT && cmd < 0; i++) {
+    if (memcmp(data, driver->cmds[i], length) == 0) {
+      cmd = i;
+    }
+  }
+  if (cmd < 0) {
+    return LIBUSB_ERROR_PIPE;
+  }
+
+  pthread_mutex_lock(&sim->lock);
+  now = _ml_sim_update(launcher, sim);
+  sim->commands += 1;
+  switch (cmd) {
+  case ML_DOWN_CMD:
+  case ML_UP_CMD:
+  case ML_LEFT_CMD:
+  case ML_RIGHT_CMD:
+    sim->driven = (int8_t)cmd;
+    break;
+  case ML_STOP_CMD:
+    sim->driven = -1;
+    break;
+  case ML_FIRE_CMD:
+    sim->fired_ns = now;
+    sim->shots += 1;
+    break;
+  case ML_LED_ON_CMD:
+    sim->led = true;
+    break;
+  case ML_LED_OFF_CMD:
+    sim->led = false;
+    break;
+  }
+  pthread_mutex_unlock(&sim->lock);
+  return length;
+}
+
+/**
+ * @brief Reads the status report of a simulated launcher. The limit switch
+ * bits are set at the end stops and the fire done bit once the last shot
+ * has had ML_SIM_FIRE_MS, unless the launcher was added without them.
+ *
+ * @param launcher The launcher.
+ * @param endpoint The endpoint to read from.
+ * @param data The buffer to read into.
+ * @param length How long data is.
+ * @param transferred Where to put how much was read.
+ * @param timeout In milliseconds, not used.
+ *
+ * @return 0 or a libusb error code.
+ */
+static int
+_ml_sim_transport_interrupt(ml_launcher_t *launcher, unsigned char endpoint,
+                            unsigned char *data, int length, int *transferred,
+                            unsigned int timeout)
+{
+  const ml_driver_t *driver = launcher->driver;
+  ml_sim_device_t *sim = launcher->sim;
+  uint64_t now = 0;
+  (void)timeout;
+
+  if ((sim->flags & ML_SIM_NO_STATUS) ||
+      endpoint != driver->status_endpoint) {
+    // Nothing ever comes.
+    return LIBUSB_ERROR_TIMEOUT;
+  }
+
+  memset(data, 0, length);
+  pthread_mutex_lock(&sim->lock);
+  now = _ml_sim_update(launcher, sim);
+  if (sim->position[0] <= 0) {
+    data[0] |= ML_LIMIT_LEFT;
+  } else if (sim->position[0] >= ML_SIM_TRAVEL_HORIZONTAL) {
+    data[0] |= ML_LIMIT_RIGHT;
+  }
+  if (sim->position[1] <= 0) {
+    data[0] |= ML_LIMIT_DOWN;
+  } else if (sim->position[1] >= ML_SIM_TRAVEL_VERTICAL) {
+    data[0] |= ML_LIMIT_UP;
+  }
+  if (!(sim->flags & ML_SIM_NO_FIRE_REPORT) &&
+      length > driver->fire_done_byte &&
+      (sim->fired_ns == 0 ||
+       now - sim->fired_ns >= (uint64_t)ML_SIM_FIRE_MS * 1000000)) {
+    data[driver->fire_done_byte] |= driver->fire_done_mask;
+  }
+  pthread_mutex_unlock(&sim->lock);
+  (*transferred) = length;
+  return 0;
+}
+
+const ml_transport_t ml_sim_transport = {
+  .open = _ml_sim_transport_open,
+  .close = _ml_sim_transport_close,
+  .control = _ml_sim_transport_control,
+  .interrupt = _ml_sim_transport_interrupt
+};
+
+/**
+ * @brief Frees a simulated device.
+ *
+ * @param sim The device.
+ */
+void
+_ml_sim_free(ml_sim_device_t *sim)
+{
+  pthread_mutex_destroy(&sim->lock);
+  free(sim);
+}
+
+/**
+ * @brief Adds simulated launchers, for tests. They behave like standard
+ * launchers that are always plugged in, see ml_sim_get_state for what they
+ * are really doing. Each one starts out in the middle of its travel with a
+ * position the library doesn't know, so zero it first like a real one.
+ * They are listed by ml_launcher_array_new, on bus numbers counting down
+ * from 255, and stay until the library is cleaned up.
+ *
+ * @param count How many to add.
+ * @param flags ML_SIM_* flags.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_sim_add(uint32_t count, uint32_t flags)
+{
+  ml_controller_t *cont = ml_main_controller;
+  ml_launcher_t *launcher = NULL;
+  ml_sim_device_t *sim = NULL;
+  ml_error_code result = ML_OK;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (count == 0) {
+    return ML_COUNT_ZERO;
+  }
+
+  pthread_mutex_lock(&cont->lock);
+  for (uint32_t i = 0; i < count && result == ML_OK; i++) {
+    launcher = calloc(sizeof(ml_launcher_t), 1);
+    sim = calloc(sizeof(ml_sim_device_t), 1);
+    if (launcher == NULL || sim == NULL) {
+      free(launcher);
+      free(sim);
+      result = ML_ALLOC_FAILED;
+      break;
+    }
+    pthread_mutex_init(&sim->lock, NULL);
+    sim->flags = flags;
+    sim->position[0] = ML_SIM_TRAVEL_HORIZONTAL / 2;
+    sim->position[1] = ML_SIM_TRAVEL_VERTICAL / 2;
+    sim->driven = -1;
+    sim->updated_ns = _ml_monotonic_nseconds();
+
+    _ml_launcher_init_sim(cont, launcher, cont->sim_count, sim);
+    result = _ml_add_launcher(cont, launcher);
+    if (result != ML_OK) {
+      _ml_launcher_cleanup(&launcher);
+      break;
+    }
+    cont->sim_count += 1;
+  }
+  pthread_mutex_unlock(&cont->lock);
+  return result;
+}
+
+/**
+ * @brief Gets what a simulated launcher is really doing, as opposed to what
+ * the library thinks it is doing.
+ *
+ * @param launcher The launcher, added with ml_sim_add.
+ * @param state Where to put its state.
+ *
+ * @return A status code, ML_NOT_IMPLEMENTED if it isn't simulated.
+ */
+ml_error_code
+ml_sim_get_state(ml_launcher_t *launcher, ml_sim_state_t *state)
+{
+  ml_sim_device_t *sim = NULL;
+
+  if (launcher == NULL || state == NULL) {
+    return ML_NULL_POINTER;
+  }
+  sim = launcher->sim;
+  if (sim == NULL) {
+    return ML_NOT_IMPLEMENTED;
+  }
+
+  pthread_mutex_lock(&sim->lock);
+  _ml_sim_update(launcher, sim);
+  state->horizontal = _ml_sim_round(sim->position[0]);
+  state->vertical = _ml_sim_round(sim->position[1]);
+  state->moving = sim->driven >= 0 || sim->velocity[0] != 0 ||
+    sim->velocity[1] != 0;
+  state->led_state = sim->led;
+  state->shots = sim->shots;
+  state->commands = sim->commands;
+  pthread_mutex_unlock(&sim->lock);
+  return ML_OK;
+}
+
+/**
+ * @brief Puts a simulated launcher somewhere else, as if someone had turned
+ * it by hand. Whatever it was coasting through is lost, but a motor that is
+ * driven keeps going. The library isn't told.
+ *
+ * @param launcher The launcher, added with ml_sim_add.
+ * @param horizontal Millidegrees from the left stop.
+ * @param vertical Millidegrees from the bottom stop.
+ *
+ * @return A status code, ML_NOT_IMPLEMENTED if it isn't simulated.
+ */
+ml_error_code
+ml_sim_set_position(ml_launcher_t *launcher, uint32_t horizontal,
+                    uint32_t vertical)
+{
+  ml_sim_device_t *sim = NULL;
+
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  sim = launcher->sim;
+  if (sim == NULL) {
+    return ML_NOT_IMPLEMENTED;
+  }
+  if (horizontal > ML_SIM_TRAVEL_HORIZONTAL ||
+      vertical > ML_SIM_TRAVEL_VERTICAL) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  pthread_mutex_lock(&sim->lock);
+  _ml_sim_update(launcher, sim);
+  sim->position[0] = horizontal;
+  sim->position[1] = vertical;
+  sim->velocity[0] = 0;
+  sim->velocity[1] = 0;
+  pthread_mutex_unlock(&sim->lock);
+  return ML_OK;
+}
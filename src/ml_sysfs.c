@@ -0,0 +1,425 @@
+/**
+ * @file ml_sysfs.c
+ * @brief Looks up USB devices through sysfs on Linux.
+ * Reading a few attribute files is enough to find a launcher by its port
+ * path or its IDs, so nothing has to ask libusb to enumerate the bus. Polls
+ * use this too, only the IDs of devices that aren't launchers are read.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LINUX
+#include <dirent.h>
+#endif
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+#ifdef LINUX
+
+/**
+ * @brief Reads a numeric sysfs attribute.
+ *
+ * @param dir The device directory.
+ * @param attr The attribute to read.
+ * @param base 16 for IDs, 10 for everything else.
+ * @param value Where to put the value.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_sysfs_read_attr(const char *dir, const char *attr, int base,
+                    uint32_t *value)
+{
+  char path[ML_SYSFS_PATH_SIZE];
+  char buffer[32];
+  char *end = NULL;
+  FILE *file = NULL;
+
+  if (snprintf(path, sizeof(path), "%s/%s", dir, attr) >= (int)sizeof(path)) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+  file = fopen(path, "re");
+  if (file == NULL) {
+    return ML_NOT_FOUND;
+  }
+  if (fgets(buffer, sizeof(buffer), file) == NULL) {
+    fclose(file);
+    return ML_NOT_FOUND;
+  }
+  fclose(file);
+
+  (*value) = strtoul(buffer, &end, base);
+  if (end == buffer) {
+    return ML_NOT_FOUND;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Reads the serial number of a device, empty if it has none.
+ *
+ * @param dir The device directory.
+ * @param serial Where to put the serial, ML_SERIAL_SIZE long.
+ *
+ * @return A status code, ML_OK when there is no serial.
+ */
+static ml_error_code
+_ml_sysfs_read_serial(const char *dir, char *serial)
+{
+  char path[ML_SYSFS_PATH_SIZE];
+  FILE *file = NULL;
+
+  serial[0] = '\0';
+  if (snprintf(path, sizeof(path), "%s/serial", dir) >= (int)sizeof(path)) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+  file = fopen(path, "re");
+  if (file == NULL) {
+    return ML_OK;
+  }
+  if (fgets(serial, ML_SERIAL_SIZE, file) == NULL) {
+    serial[0] = '\0';
+  }
+  fclose(file);
+  serial[strcspn(serial, "\n")] = '\0';
+  return ML_OK;
+}
+
+/**
+ * @brief Builds the sysfs directory of a device.
+ *
+ * @param cont The active controller.
+ * @param name The sysfs name of the device.
+ * @param dir Where to put the directory, ML_SYSFS_PATH_SIZE long.
+ *
+ * @return A status code, ML_NOT_FOUND if the name isn't a device name.
+ */
+static ml_error_code
+_ml_sysfs_device_dir(ml_controller_t *cont, const char *name, char *dir)
+{
+  // Only plain device names, nothing that walks out of the directory.
+  if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL ||
+      strlen(name) >= ML_PORT_PATH_SIZE) {
+    return ML_NOT_FOUND;
+  }
+  if (snprintf(dir, ML_SYSFS_PATH_SIZE, "%s/bus/usb/devices/%s",
+               cont->sysfs_root, name) >= ML_SYSFS_PATH_SIZE) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Reads the USB location and serial of a device whose IDs are
+ * already known.
+ *
+ * @param dir The device directory.
+ * @param name The sysfs name of the device.
+ * @param device Where to put what was found.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_sysfs_read_location(const char *dir, const char *name,
+                        ml_sysfs_device_t *device)
+{
+  uint32_t bus = 0, number = 0;
+
+  if (_ml_sysfs_read_attr(dir, "busnum", 10, &bus) != ML_OK ||
+      _ml_sysfs_read_attr(dir, "devnum", 10, &number) != ML_OK) {
+    return ML_NOT_FOUND;
+  }
+  strcpy(device->port_path, name);
+  device->usb_bus = bus;
+  device->usb_device_number = number;
+  return _ml_sysfs_read_serial(dir, device->serial);
+}
+
+/**
+ * @brief Reads the IDs and USB location of a device.
+ *
+ * @param cont The active controller.
+ * @param name The sysfs name of the device, its bus and port path.
+ * @param device Where to put what was found.
+ *
+ * @return A status code, ML_NOT_FOUND if there is no such device.
+ */
+ml_error_code
+_ml_sysfs_read_device(ml_controller_t *cont, const char *name,
+                      ml_sysfs_device_t *device)
+{
+  char dir[ML_SYSFS_PATH_SIZE];
+  uint32_t vendor_id = 0, product_id = 0;
+  ml_error_code result = ML_OK;
+
+  result = _ml_sysfs_device_dir(cont, name, dir);
+  if (result != ML_OK) {
+    return result;
+  }
+  if (_ml_sysfs_read_attr(dir, "idVendor", 16, &vendor_id) != ML_OK ||
+      _ml_sysfs_read_attr(dir, "idProduct", 16, &product_id) != ML_OK) {
+    return ML_NOT_FOUND;
+  }
+  device->vendor_id = vendor_id;
+  device->product_id = product_id;
+  return _ml_sysfs_read_location(dir, name, device);
+}
+
+/**
+ * @brief Finds the first device with a vendor and product ID.
+ *
+ * @param cont The active controller.
+ * @param vendor_id The USB vendor ID.
+ * @param product_id The USB product ID.
+ * @param device Where to put what was found.
+ *
+ * @return A status code, ML_NOT_FOUND if no device matched.
+ */
+ml_error_code
+_ml_sysfs_find_vid_pid(ml_controller_t *cont, uint16_t vendor_id,
+                       uint16_t product_id, ml_sysfs_device_t *device)
+{
+  char dir_path[ML_SYSFS_PATH_SIZE];
+  char device_dir[ML_SYSFS_PATH_SIZE];
+  struct dirent *entry = NULL;
+  ml_error_code result = ML_NOT_FOUND;
+  uint32_t id = 0;
+  DIR *dir = NULL;
+
+  snprintf(dir_path, sizeof(dir_path), "%s/bus/usb/devices",
+           cont->sysfs_root);
+  dir = opendir(dir_path);
+  if (dir == NULL) {
+    return ML_NOT_FOUND;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    // Interfaces have a colon in their name, skip them.
+    if (strchr(entry->d_name, ':') != NULL ||
+        _ml_sysfs_device_dir(cont, entry->d_name, device_dir) != ML_OK ||
+        _ml_sysfs_read_attr(device_dir, "idVendor", 16, &id) != ML_OK ||
+        id != vendor_id ||
+        _ml_sysfs_read_attr(device_dir, "idProduct", 16, &id) != ML_OK ||
+        id != product_id) {
+      continue;
+    }
+    device->vendor_id = vendor_id;
+    device->product_id = product_id;
+    result = _ml_sysfs_read_location(device_dir, entry->d_name, device);
+    if (result == ML_OK) {
+      break;
+    }
+  }
+  closedir(dir);
+  return result;
+}
+
+/**
+ * @brief Lists every launcher in sysfs. Devices that aren't launchers cost
+ * two small reads and nothing is opened.
+ *
+ * @param cont The active controller.
+ * @param found Where to put the launchers, free it when done.
+ * @param found_count Where to put the number of launchers.
+ *
+ * @return A status code, ML_NOT_FOUND if sysfs can't be read.
+ */
+ml_error_code
+_ml_sysfs_find_launchers(ml_controller_t *cont, ml_sysfs_device_t **found,
+                         uint32_t *found_count)
+{
+  char dir_path[ML_SYSFS_PATH_SIZE];
+  char device_dir[ML_SYSFS_PATH_SIZE];
+  ml_sysfs_device_t *devices = NULL, *resized = NULL;
+  uint32_t count = 0, size = 0, vendor_id = 0, product_id = 0;
+  struct dirent *entry = NULL;
+  DIR *dir = NULL;
+
+  snprintf(dir_path, sizeof(dir_path), "%s/bus/usb/devices",
+           cont->sysfs_root);
+  dir = opendir(dir_path);
+  if (dir == NULL) {
+    return ML_NOT_FOUND;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (strchr(entry->d_name, ':') != NULL ||
+        _ml_sysfs_device_dir(cont, entry->d_name, device_dir) != ML_OK ||
+        _ml_sysfs_read_attr(device_dir, "idVendor", 16,
+                            &vendor_id) != ML_OK ||
+        _ml_sysfs_read_attr(device_dir, "idProduct", 16,
+                            &product_id) != ML_OK ||
+        _ml_driver_find(vendor_id, product_id) == NULL) {
+      continue;
+    }
+    if (count == size) {
+      size = size == 0 ? ML_INITIAL_LAUNCHER_ARRAY_SIZE : size * 2;
+      resized = realloc(devices, size * sizeof(ml_sysfs_device_t));
+      if (resized == NULL) {
+        closedir(dir);
+        free(devices);
+        return ML_ALLOC_FAILED;
+      }
+      devices = resized;
+    }
+    devices[count].vendor_id = vendor_id;
+    devices[count].product_id = product_id;
+    if (_ml_sysfs_read_location(device_dir, entry->d_name,
+                                &devices[count]) == ML_OK) {
+      count++;
+    }
+  }
+  closedir(dir);
+
+  (*found) = devices;
+  (*found_count) = count;
+  return ML_OK;
+}
+
+/**
+ * @brief Pins a device's runtime power management on, so it is never
+ * autosuspended and its first command after an idle period doesn't wait
+ * for it to resume. Writing needs permission on the attribute, usually
+ * root or a udev rule.
+ *
+ * @param cont The active controller.
+ * @param name The sysfs name of the device, its port path.
+ * @param saved Where to put the old setting, ML_POWER_CONTROL_SIZE long.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_sysfs_pin_power(ml_controller_t *cont, const char *name, char *saved)
+{
+  char dir[ML_SYSFS_PATH_SIZE];
+  char path[ML_SYSFS_PATH_SIZE];
+  FILE *file = NULL;
+  ml_error_code result = ML_OK;
+
+  result = _ml_sysfs_device_dir(cont, name, dir);
+  if (result != ML_OK) {
+    return result;
+  }
+  if (snprintf(path, sizeof(path), "%s/power/control", dir) >=
+      (int)sizeof(path)) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  file = fopen(path, "re");
+  if (file == NULL) {
+    return ML_NOT_FOUND;
+  }
+  if (fgets(saved, ML_POWER_CONTROL_SIZE, file) == NULL) {
+    fclose(file);
+    return ML_NOT_FOUND;
+  }
+  fclose(file);
+  saved[strcspn(saved, "\n")] = '\0';
+
+  file = fopen(path, "we");
+  if (file == NULL) {
+    return ML_NOT_FOUND;
+  }
+  fputs("on", file);
+  if (fclose(file) != 0) {
+    return ML_NOT_FOUND;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Puts back a power setting saved by _ml_sysfs_pin_power.
+ *
+ * @param cont The active controller.
+ * @param name The sysfs name of the device, its port path.
+ * @param saved The old setting.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_sysfs_restore_power(ml_controller_t *cont, const char *name,
+                        const char *saved)
+{
+  char dir[ML_SYSFS_PATH_SIZE];
+  char path[ML_SYSFS_PATH_SIZE];
+  FILE *file = NULL;
+  ml_error_code result = ML_OK;
+
+  result = _ml_sysfs_device_dir(cont, name, dir);
+  if (result != ML_OK) {
+    return result;
+  }
+  if (snprintf(path, sizeof(path), "%s/power/control", dir) >=
+      (int)sizeof(path)) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  file = fopen(path, "we");
+  if (file == NULL) {
+    return ML_NOT_FOUND;
+  }
+  fputs(saved, file);
+  if (fclose(file) != 0) {
+    return ML_NOT_FOUND;
+  }
+  return ML_OK;
+}
+
+#else
+
+ml_error_code
+_ml_sysfs_read_device(ml_controller_t *cont, const char *name,
+                      ml_sysfs_device_t *device)
+{
+  (void)cont;
+  (void)name;
+  (void)device;
+  return ML_NOT_IMPLEMENTED;
+}
+
+ml_error_code
+_ml_sysfs_find_vid_pid(ml_controller_t *cont, uint16_t vendor_id,
+                       uint16_t product_id, ml_sysfs_device_t *device)
+{
+  (void)cont;
+  (void)vendor_id;
+  (void)product_id;
+  (void)device;
+  return ML_NOT_IMPLEMENTED;
+}
+
+ml_error_code
+_ml_sysfs_find_launchers(ml_controller_t *cont, ml_sysfs_device_t **found,
+                         uint32_t *found_count)
+{
+  (void)cont;
+  (void)found;
+  (void)found_count;
+  return ML_NOT_IMPLEMENTED;
+}
+
+ml_error_code
+_ml_sysfs_pin_power(ml_controller_t *cont, const char *name, char *saved)
+{
+  (void)cont;
+  (void)name;
+  (void)saved;
+  return ML_NOT_IMPLEMENTED;
+}
+
+ml_error_code
+_ml_sysfs_restore_power(ml_controller_t *cont, const char *name,
+                        const char *saved)
+{
+  (void)cont;
+  (void)name;
+  (void)saved;
+  return ML_NOT_IMPLEMENTED;
+}
+
+#endif
@@ -0,0 +1,518 @@
+/**
+ * @file ml_time.c
+ * @brief Clock and timed wait helpers used across the library.
+ * Every wait a library thread does goes through here, so under
+ * ML_INIT_VIRTUAL_CLOCK they can all be driven from ml_clock_advance instead
+ * of the monotonic clock. The virtual clock keeps a list of the threads
+ * waiting on it and only moves time on once every library thread is waiting
+ * again, which makes a run depend on nothing but the calls made.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/// A thread waiting on the virtual clock, lives on the waiter's stack.
+typedef struct ml_clock_waiter_t
+{
+  uint64_t deadline;
+  bool timed;
+  // NULL for sleeps, those wait on ml_clock_tick.
+  pthread_cond_t *cond;
+  pthread_mutex_t *mutex;
+  // Set once the waiter was signaled or timed out.
+  bool woken;
+  bool counted;
+  struct ml_clock_waiter_t *next;
+} ml_clock_waiter_t;
+
+/// What a library thread started with _ml_thread_create runs.
+typedef struct ml_clock_thread_t
+{
+  void *(*body)(void *);
+  void *arg;
+} ml_clock_thread_t;
+
+static bool ml_clock_virtual = false;
+static uint64_t ml_clock_now = 0;
+// Protects the waiter list and the busy count.
+static pthread_mutex_t ml_clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ml_clock_tick = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ml_clock_settled = PTHREAD_COND_INITIALIZER;
+static ml_clock_waiter_t *ml_clock_waiters = NULL;
+// Library threads that are running rather than waiting on the clock.
+static int32_t ml_clock_busy = 0;
+/// Set on library threads started while the clock is virtual.
+static __thread bool ml_clock_counted = false;
+
+/**
+ * @brief Gets the current value of a monotonic clock.
+ *
+ * @return Milliseconds since some unspecified starting point.
+ */
+uint64_t
+_ml_monotonic_mseconds()
+{
+  struct timespec now;
+
+  if (__atomic_load_n(&ml_clock_virtual, __ATOMIC_RELAXED)) {
+    return __atomic_load_n(&ml_clock_now, __ATOMIC_ACQUIRE) / 1000000;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+/**
+ * @brief Gets the current value of the monotonic clock in nanoseconds.
+ *
+ * @return Nanoseconds since some unspecified starting point.
+ */
+uint64_t
+_ml_monotonic_nseconds()
+{
+  struct timespec now;
+
+  if (__atomic_load_n(&ml_clock_virtual, __ATOMIC_RELAXED)) {
+    return __atomic_load_n(&ml_clock_now, __ATOMIC_ACQUIRE);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+/**
+ * @brief Gets the time on the library's clock, the monotonic clock or the
+ * virtual one with ML_INIT_VIRTUAL_CLOCK. Timestamps passed to the library,
+ * like ml_tracker_push's, have to come from this clock.
+ *
+ * @return Nanoseconds since some unspecified starting point.
+ */
+uint64_t
+ml_clock_now_ns()
+{
+  return _ml_monotonic_nseconds();
+}
+
+/**
+ * @brief Switches the library's clock, called before any library thread
+ * is started.
+ *
+ * @param virtual True to run on the virtual clock.
+ */
+void
+_ml_clock_init(bool virtual)
+{
+  pthread_mutex_lock(&ml_clock_lock);
+  __atomic_store_n(&ml_clock_now, ML_VIRTUAL_CLOCK_START_NS,
+                   __ATOMIC_RELEASE);
+  __atomic_store_n(&ml_clock_virtual, virtual, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&ml_clock_lock);
+}
+
+/**
+ * @brief Goes back to the monotonic clock once every library thread has
+ * exited.
+ */
+void
+_ml_clock_cleanup()
+{
+  _ml_clock_init(false);
+}
+
+/**
+ * @brief Lets ml_clock_advance know when the last busy thread is waiting
+ * again. Hold ml_clock_lock.
+ */
+static void
+_ml_clock_idle_locked()
+{
+  ml_clock_busy--;
+  if (ml_clock_busy == 0) {
+    pthread_cond_broadcast(&ml_clock_settled);
+  }
+}
+
+/**
+ * @brief Runs a library thread and counts it as busy until it exits.
+ *
+ * @param arg The thread's ml_clock_thread_t.
+ *
+ * @return What the thread returned.
+ */
+static void *
+_ml_clock_thread(void *arg)
+{
+  ml_clock_thread_t thread = *(ml_clock_thread_t *)arg;
+  void *result = NULL;
+
+  free(arg);
+  ml_clock_counted = true;
+  result = thread.body(thread.arg);
+
+  pthread_mutex_lock(&ml_clock_lock);
+  _ml_clock_idle_locked();
+  pthread_mutex_unlock(&ml_clock_lock);
+  return result;
+}
+
+/**
+ * @brief Starts a library thread. Under the virtual clock the thread
+ * counts as busy from here on, so time doesn't move until it first waits.
+ *
+ * @param thread Where to put the thread.
+ * @param body What the thread runs.
+ * @param arg The argument to body.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_thread_create(pthread_t *thread, void *(*body)(void *), void *arg)
+{
+  ml_clock_thread_t *start = NULL;
+
+  if (!__atomic_load_n(&ml_clock_virtual, __ATOMIC_ACQUIRE)) {
+    if (pthread_create(thread, NULL, body, arg) != 0) {
+      return ML_ALLOC_FAILED;
+    }
+    return ML_OK;
+  }
+
+  start = malloc(sizeof(ml_clock_thread_t));
+  if (start == NULL) {
+    return ML_ALLOC_FAILED;
+  }
+  start->body = body;
+  start->arg = arg;
+
+  pthread_mutex_lock(&ml_clock_lock);
+  ml_clock_busy++;
+  pthread_mutex_unlock(&ml_clock_lock);
+  if (pthread_create(thread, NULL, _ml_clock_thread, start) != 0) {
+    pthread_mutex_lock(&ml_clock_lock);
+    _ml_clock_idle_locked();
+    pthread_mutex_unlock(&ml_clock_lock);
+    free(start);
+    return ML_ALLOC_FAILED;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Adds a waiter to the virtual clock. Hold ml_clock_lock.
+ *
+ * @param waiter The waiter.
+ */
+static void
+_ml_clock_park_locked(ml_clock_waiter_t *waiter)
+{
+  waiter->counted = ml_clock_counted;
+  waiter->next = ml_clock_waiters;
+  ml_clock_waiters = waiter;
+  if (waiter->counted) {
+    _ml_clock_idle_locked();
+  }
+}
+
+/**
+ * @brief Removes a waiter from the virtual clock. Whoever woke it already
+ * counted it as busy again, a spurious wake up still has to. Hold
+ * ml_clock_lock.
+ *
+ * @param waiter The waiter.
+ *
+ * @return true if its deadline passed.
+ */
+static bool
+_ml_clock_unpark_locked(ml_clock_waiter_t *waiter)
+{
+  ml_clock_waiter_t **cur = &ml_clock_waiters;
+
+  while (*cur != waiter) {
+    cur = &(*cur)->next;
+  }
+  *cur = waiter->next;
+  if (waiter->counted && !waiter->woken) {
+    ml_clock_busy++;
+  }
+  return waiter->timed && ml_clock_now >= waiter->deadline;
+}
+
+/**
+ * @brief Waits on a condition variable against the virtual clock. The
+ * mutex must be held.
+ *
+ * @param cond The condition variable.
+ * @param mutex The mutex protecting the condition.
+ * @param deadline Virtual nanoseconds to give up at.
+ * @param timed False to wait for a signal only.
+ *
+ * @return true if the deadline passed, false if we were woken up.
+ */
+static bool
+_ml_clock_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+               uint64_t deadline, bool timed)
+{
+  ml_clock_waiter_t waiter = {deadline, timed, cond, mutex, false, false,
+                              NULL};
+  bool expired = false;
+
+  pthread_mutex_lock(&ml_clock_lock);
+  if (timed && ml_clock_now >= deadline) {
+    pthread_mutex_unlock(&ml_clock_lock);
+    return true;
+  }
+  _ml_clock_park_locked(&waiter);
+  pthread_mutex_unlock(&ml_clock_lock);
+
+  // ml_clock_advance takes the mutex before signaling, so it can't slip in
+  // before we are waiting.
+  pthread_cond_wait(cond, mutex);
+
+  pthread_mutex_lock(&ml_clock_lock);
+  expired = _ml_clock_unpark_locked(&waiter);
+  pthread_mutex_unlock(&ml_clock_lock);
+  return expired;
+}
+
+/**
+ * @brief Moves the virtual clock forward, waking every library thread that
+ * waits for a time on the way in order. After each step it waits for the
+ * woken threads, and anything they wake in turn, to finish and wait again,
+ * so commands run at the same virtual times on every run. Zeroing, timed
+ * moves and everything else queued finish as fast as the threads can step
+ * through them.
+ * Blocking calls like ml_launcher_zero wait for virtual time too, make them
+ * from another thread or use ml_launcher_submit. An advance of 0 waits for
+ * the library to finish with the current time.
+ *
+ * @param nseconds How far to move the clock.
+ *
+ * @return A status code, ML_REAL_CLOCK if the library wasn't initialized
+ * with ML_INIT_VIRTUAL_CLOCK.
+ */
+ml_error_code
+ml_clock_advance(uint64_t nseconds)
+{
+  ml_clock_waiter_t *cur = NULL;
+  pthread_cond_t *cond = NULL;
+  pthread_mutex_t *mutex = NULL;
+  uint64_t target = 0, next = 0;
+
+  if (ml_library_is_init() == 0) {
+    return ML_LIBRARY_NOT_INIT;
+  }
+  if (!__atomic_load_n(&ml_clock_virtual, __ATOMIC_ACQUIRE)) {
+    return ML_REAL_CLOCK;
+  }
+  if (ml_clock_counted) {
+    // We'd wait for ourselves to settle.
+    return ML_WOULD_BLOCK;
+  }
+
+  pthread_mutex_lock(&ml_clock_lock);
+  target = ml_clock_now + nseconds;
+  for (;;) {
+    while (ml_clock_busy > 0) {
+      pthread_cond_wait(&ml_clock_settled, &ml_clock_lock);
+    }
+
+    next = target;
+    for (cur = ml_clock_waiters; cur != NULL; cur = cur->next) {
+      if (!cur->woken && cur->timed && cur->deadline < next) {
+        next = cur->deadline;
+      }
+    }
+    if (next > ml_clock_now) {
+      __atomic_store_n(&ml_clock_now, next, __ATOMIC_RELEASE);
+    }
+
+    // Wake everything due now, one at a time since signaling takes the
+    // waiter's mutex, which can't be done holding ours.
+    cond = NULL;
+    for (cur = ml_clock_waiters; cur != NULL; cur = cur->next) {
+      if (!cur->woken && cur->timed && cur->deadline <= ml_clock_now) {
+        cur->woken = true;
+        if (cur->counted) {
+          ml_clock_busy++;
+        }
+        if (cur->cond == NULL) {
+          pthread_cond_broadcast(&ml_clock_tick);
+          continue;
+        }
+        cond = cur->cond;
+        mutex = cur->mutex;
+        break;
+      }
+    }
+    if (cond != NULL) {
+      pthread_mutex_unlock(&ml_clock_lock);
+      pthread_mutex_lock(mutex);
+      pthread_cond_signal(cond);
+      pthread_mutex_unlock(mutex);
+      pthread_mutex_lock(&ml_clock_lock);
+      continue;
+    }
+    if (ml_clock_now >= target && ml_clock_busy == 0) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ml_clock_lock);
+  return ML_OK;
+}
+
+/**
+ * @brief Initializes a condition variable that waits against the monotonic
+ * clock, so wall clock changes don't stretch or cut short our timeouts.
+ *
+ * @param cond The condition variable to initialize.
+ *
+ * @return A status code.
+ */
+ml_error_code
+_ml_cond_init(pthread_cond_t *cond)
+{
+  pthread_condattr_t attr;
+
+  if (pthread_condattr_init(&attr) != 0) {
+    return ML_ALLOC_FAILED;
+  }
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  if (pthread_cond_init(cond, &attr) != 0) {
+    pthread_condattr_destroy(&attr);
+    return ML_ALLOC_FAILED;
+  }
+  pthread_condattr_destroy(&attr);
+  return ML_OK;
+}
+
+/**
+ * @brief Waits on a condition variable until it is signaled. The mutex
+ * must be held. Library threads use this rather than pthread_cond_wait so
+ * the virtual clock knows they are waiting.
+ *
+ * @param cond A condition variable set up with _ml_cond_init.
+ * @param mutex The mutex protecting the condition.
+ */
+void
+_ml_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+  if (__atomic_load_n(&ml_clock_virtual, __ATOMIC_ACQUIRE)) {
+    _ml_clock_wait(cond, mutex, 0, false);
+    return;
+  }
+  pthread_cond_wait(cond, mutex);
+}
+
+/**
+ * @brief Wakes a library thread waiting on a condition variable. Hold the
+ * mutex it waits with, the virtual clock counts the thread as busy from
+ * here so it can't move on before the thread has run.
+ *
+ * @param cond The condition variable.
+ */
+void
+_ml_cond_signal(pthread_cond_t *cond)
+{
+  ml_clock_waiter_t *cur = NULL;
+
+  if (__atomic_load_n(&ml_clock_virtual, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&ml_clock_lock);
+    for (cur = ml_clock_waiters; cur != NULL; cur = cur->next) {
+      if (cur->cond == cond && !cur->woken) {
+        cur->woken = true;
+        if (cur->counted) {
+          ml_clock_busy++;
+        }
+        break;
+      }
+    }
+    pthread_mutex_unlock(&ml_clock_lock);
+  }
+  pthread_cond_signal(cond);
+}
+
+/**
+ * @brief Waits on a condition variable until it is signaled or the deadline
+ * passes. The mutex must be held.
+ *
+ * @param cond A condition variable set up with _ml_cond_init.
+ * @param mutex The mutex protecting the condition.
+ * @param deadline Monotonic milliseconds to give up at.
+ *
+ * @return true if the deadline passed, false if we were woken up.
+ */
+bool
+_ml_cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                    uint64_t deadline)
+{
+  return _ml_cond_wait_until_ns(cond, mutex, deadline * 1000000);
+}
+
+/**
+ * @brief Like _ml_cond_wait_until with a deadline in nanoseconds.
+ *
+ * @param cond A condition variable set up with _ml_cond_init.
+ * @param mutex The mutex protecting the condition.
+ * @param deadline Monotonic nanoseconds to give up at.
+ *
+ * @return true if the deadline passed, false if we were woken up.
+ */
+bool
+_ml_cond_wait_until_ns(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                       uint64_t deadline)
+{
+  struct timespec abs_time;
+
+  if (__atomic_load_n(&ml_clock_virtual, __ATOMIC_ACQUIRE)) {
+    return _ml_clock_wait(cond, mutex, deadline, true);
+  }
+  abs_time.tv_sec = deadline / 1000000000;
+  abs_time.tv_nsec = deadline % 1000000000;
+  return pthread_cond_timedwait(cond, mutex, &abs_time) == ETIMEDOUT;
+}
+
+/**
+ * @brief Sleeps until an absolute monotonic time. The sleep ends spin
+ * nanoseconds early and the rest is spent polling the clock, which trades
+ * CPU time for not depending on how late the kernel wakes us. The virtual
+ * clock is always on time, so it never spins.
+ *
+ * @param deadline Monotonic nanoseconds to return at.
+ * @param spin How long to spin before the deadline.
+ */
+void
+_ml_sleep_until_ns(uint64_t deadline, uint64_t spin)
+{
+  struct timespec abs_time;
+  ml_clock_waiter_t waiter = {deadline, true, NULL, NULL, false, false,
+                              NULL};
+  uint64_t wake = deadline > spin ? deadline - spin : 0;
+
+  if (__atomic_load_n(&ml_clock_virtual, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&ml_clock_lock);
+    if (ml_clock_now < deadline) {
+      _ml_clock_park_locked(&waiter);
+      while (!waiter.woken) {
+        pthread_cond_wait(&ml_clock_tick, &ml_clock_lock);
+      }
+      _ml_clock_unpark_locked(&waiter);
+    }
+    pthread_mutex_unlock(&ml_clock_lock);
+    return;
+  }
+
+  abs_time.tv_sec = wake / 1000000000;
+  abs_time.tv_nsec = wake % 1000000000;
+  // Relative sleeps would add the time lost to signals on every retry.
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &abs_time,
+                         NULL) == EINTR) {
+  }
+  while (_ml_monotonic_nseconds() < deadline) {
+  }
+}
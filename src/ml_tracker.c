@@ -0,0 +1,307 @@
+/**
+ * @file ml_tracker.c
+ * @brief Streaming target tracking.
+ * Callers push where a launcher should point as often as they like. The
+ * scheduler thread keeps the latest sample as the goal, estimates how fast
+ * it is moving and only sends the moves and stops needed to get there, so
+ * USB traffic follows how much the launcher moves rather than how often
+ * samples arrive.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libmissilelauncher.h"
+#include "libmissilelauncher_internal.h"
+
+/**
+ * @brief Checks that a launcher can be tracked.
+ *
+ * @param launcher The launcher.
+ *
+ * @return A status code.
+ */
+static ml_error_code
+_ml_tracker_check(ml_launcher_t *launcher)
+{
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (!_ml_launcher_is_claimed(launcher)) {
+    return ML_UNCLAIMED;
+  }
+  if (launcher->driver == NULL) {
+    return ML_NOT_IMPLEMENTED;
+  }
+  return ML_OK;
+}
+
+/**
+ * @brief Sets where a launcher should point and lets the library steer it
+ * there without waiting. Push as often as new positions come in, only the
+ * latest counts. The target's velocity is estimated from successive
+ * samples and the launcher is aimed where the target will be once a
+ * command reaches it, see ml_tracker_configure. The launcher stops once it
+ * is within the deadband of a target that isn't moving. Positions are
+ * worked out the same way as ml_launcher_get_position. Push samples for one
+ * launcher from one thread at a time.
+ *
+ * @param launcher A claimed launcher.
+ * @param horizontal The horizontal target, millidegrees from the left stop.
+ * @param vertical The vertical target, millidegrees from the bottom stop.
+ * @param timestamp_ns When the target was there, see ml_clock_now_ns, 0 for
+ * now.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_tracker_push(ml_launcher_t *launcher, uint32_t horizontal,
+                uint32_t vertical, uint64_t timestamp_ns)
+{
+  ml_tracker_t *tracker = NULL;
+  uint32_t seq = 0;
+  ml_error_code result = ML_OK;
+
+  result = _ml_tracker_check(launcher);
+  if (result != ML_OK) {
+    return result;
+  }
+  if (timestamp_ns == 0) {
+    timestamp_ns = _ml_monotonic_nseconds();
+  }
+
+  tracker = &launcher->tracker;
+  seq = __atomic_load_n(&tracker->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&tracker->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&tracker->horizontal, horizontal, __ATOMIC_RELAXED);
+  __atomic_store_n(&tracker->vertical, vertical, __ATOMIC_RELAXED);
+  __atomic_store_n(&tracker->sample_ns, timestamp_ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&tracker->stop, false, __ATOMIC_RELAXED);
+  __atomic_store_n(&tracker->seq, seq + 2, __ATOMIC_RELEASE);
+
+  return _ml_scheduler_wake_tracker(launcher);
+}
+
+/**
+ * @brief Stops tracking. The launcher is stopped where it is, the next
+ * ml_tracker_push starts tracking again.
+ *
+ * @param launcher A claimed launcher.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_tracker_stop(ml_launcher_t *launcher)
+{
+  ml_error_code result = ML_OK;
+
+  result = _ml_tracker_check(launcher);
+  if (result != ML_OK) {
+    return result;
+  }
+
+  __atomic_store_n(&launcher->tracker.stop, true, __ATOMIC_RELEASE);
+  return _ml_scheduler_wake_tracker(launcher);
+}
+
+/**
+ * @brief Tunes a launcher's tracker. A wider deadband means fewer small
+ * corrections, and the latency is how far ahead of the moving target the
+ * launcher is aimed to make up for the time a command takes to act.
+ *
+ * @param launcher The launcher.
+ * @param deadband_mdeg How far off target the launcher may be before it
+ * moves, in millidegrees. The default is ML_TRACK_DEADBAND_MDEG.
+ * @param latency_ms How long a command takes to act, in milliseconds. The
+ * default is ML_TRACK_LATENCY_MS.
+ *
+ * @return A status code.
+ */
+ml_error_code
+ml_tracker_configure(ml_launcher_t *launcher, uint32_t deadband_mdeg,
+                     uint32_t latency_ms)
+{
+  if (launcher == NULL) {
+    return ML_NULL_POINTER;
+  }
+  if (latency_ms > ML_TRACK_STALE_MS) {
+    return ML_INDEX_OUT_OF_BOUNDS;
+  }
+
+  __atomic_store_n(&launcher->tracker.deadband, deadband_mdeg,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&launcher->tracker.latency_ms, latency_ms,
+                   __ATOMIC_RELAXED);
+  return ML_OK;
+}
+
+/**
+ * @brief Takes in the latest sample, if there is a new one. A sample that
+ * is being written is skipped, its push wakes the scheduler again once it
+ * is done. Velocity is averaged over successive samples to smooth out
+ * jitter in the caller's measurements.
+ *
+ * @param tracker The tracker.
+ */
+static void
+_ml_tracker_update(ml_tracker_t *tracker)
+{
+  uint32_t seq = 0, sample[2] = {0, 0};
+  uint64_t sample_ns = 0, elapsed = 0;
+  int64_t rate = 0;
+
+  seq = __atomic_load_n(&tracker->seq, __ATOMIC_ACQUIRE);
+  if (seq == tracker->seen || (seq & 1) != 0) {
+    return;
+  }
+  sample[0] = __atomic_load_n(&tracker->horizontal, __ATOMIC_RELAXED);
+  sample[1] = __atomic_load_n(&tracker->vertical, __ATOMIC_RELAXED);
+  sample_ns = __atomic_load_n(&tracker->sample_ns, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&tracker->seq, __ATOMIC_RELAXED) != seq) {
+    return;
+  }
+  tracker->seen = seq;
+
+  if (sample_ns <= tracker->goal_ns) {
+    // Same time or out of order, no velocity to be had.
+    tracker->goal[0] = sample[0];
+    tracker->goal[1] = sample[1];
+    return;
+  }
+
+  elapsed = sample_ns - tracker->goal_ns;
+  for (int axis = 0; axis < 2; axis++) {
+    if (tracker->goal_ns == 0 || elapsed > ML_TRACK_STALE_MS * 1000000ULL) {
+      tracker->rate[axis] = 0;
+    } else {
+      rate = ((sample[axis] - tracker->goal[axis]) * 1000000000) /
+        (int64_t)elapsed;
+      tracker->rate[axis] = (tracker->rate[axis] + rate) / 2;
+    }
+    tracker->goal[axis] = sample[axis];
+  }
+  tracker->goal_ns = sample_ns;
+}
+
+/**
+ * @brief Works out how much further a launcher should go in a direction.
+ * Against a target moving the same way the move runs on past it by the
+ * deadband, so the launcher waits for the target instead of chasing it a
+ * deadband at a time.
+ *
+ * @param error How far off target the launcher is on each axis.
+ * @param rate How fast the target is moving on each axis, 0 if it isn't.
+ * @param deadband The deadband.
+ * @param direction The direction.
+ *
+ * @return How far to go in millidegrees, 0 or less to stop.
+ */
+static int64_t
+_ml_tracker_remaining(const int64_t *error, const int64_t *rate,
+                      int64_t deadband, int8_t direction)
+{
+  int axis = direction == ML_LEFT || direction == ML_RIGHT ? 0 : 1;
+  bool raising = direction == ML_RIGHT || direction == ML_UP;
+  int64_t remaining = raising ? error[axis] : -error[axis];
+
+  if ((raising && rate[axis] > 0) || (!raising && rate[axis] < 0)) {
+    remaining += deadband;
+  }
+  return remaining;
+}
+
+/**
+ * @brief Decides what a tracked launcher should do next. Moves one axis at
+ * a time, horizontal first. A move starts once the launcher is further off
+ * target than the deadband and ends once it is there, and only direction
+ * changes and stops need a command. Starts and stops reach the launcher
+ * equally late, so the latency only matters for where the target will be.
+ * Only call from the scheduler thread.
+ *
+ * @param launcher The launcher.
+ * @param now_ns The time, monotonic nanoseconds.
+ * @param cmd Set to the command to send.
+ * @param wake_ns Set to when to decide again, or 0 if the launcher is on a
+ * target that isn't moving.
+ *
+ * @return true if cmd should be sent.
+ */
+bool
+_ml_tracker_plan(ml_launcher_t *launcher, uint64_t now_ns,
+                 ml_launcher_cmd *cmd, uint64_t *wake_ns)
+{
+  ml_tracker_t *tracker = &launcher->tracker;
+  static const int8_t lower[2] = {ML_LEFT, ML_DOWN};
+  static const int8_t higher[2] = {ML_RIGHT, ML_UP};
+  int64_t error[2] = {0, 0}, rate[2] = {0, 0};
+  int64_t goal = 0, speed = 0, remaining = 0, deadband = 0, threshold = 0;
+  uint64_t latency_ns = 0, ahead = 0;
+  uint32_t position[2] = {0, 0};
+  int8_t direction = launcher->motion_direction, want = -1;
+
+  (*wake_ns) = 0;
+  _ml_tracker_update(tracker);
+
+  if (!__atomic_load_n(&tracker->stop, __ATOMIC_ACQUIRE)) {
+    deadband = __atomic_load_n(&tracker->deadband, __ATOMIC_RELAXED);
+    latency_ns = (uint64_t)__atomic_load_n(&tracker->latency_ms,
+                                           __ATOMIC_RELAXED) * 1000000;
+    // Aim where the target will be when the command lands, but don't
+    // extrapolate a target that has stopped reporting.
+    ahead = now_ns + latency_ns > tracker->goal_ns ?
+      now_ns + latency_ns - tracker->goal_ns : 0;
+    if (ahead <= ML_TRACK_STALE_MS * 1000000ULL) {
+      rate[0] = tracker->rate[0];
+      rate[1] = tracker->rate[1];
+    }
+    _ml_launcher_position_at(launcher, now_ns, &position[0], &position[1]);
+    for (int i = 0; i < 2; i++) {
+      goal = tracker->goal[i] + ((rate[i] * (int64_t)ahead) / 1000000000);
+      error[i] = (goal < 0 ? 0 : goal) - position[i];
+    }
+
+    // Keep going until the launcher gets there.
+    if (direction >= 0 &&
+        _ml_tracker_remaining(error, rate, deadband, direction) > 0) {
+      want = direction;
+    }
+    for (int i = 0; i < 2 && want < 0; i++) {
+      threshold = deadband;
+      if ((error[i] > 0 && rate[i] < 0) || (error[i] < 0 && rate[i] > 0)) {
+        // The target is coming back by itself, give it room.
+        threshold *= 2;
+      }
+      if (error[i] <= threshold && -error[i] <= threshold) {
+        continue;
+      }
+      direction = error[i] > 0 ? higher[i] : lower[i];
+      if (__atomic_load_n(&launcher->axis_speed[direction],
+                          __ATOMIC_RELAXED) != 0) {
+        want = direction;
+      }
+    }
+  }
+
+  if (want >= 0) {
+    // Look again when it should be there.
+    speed = __atomic_load_n(&launcher->axis_speed[want], __ATOMIC_RELAXED);
+    remaining = _ml_tracker_remaining(error, rate, deadband, want);
+    (*wake_ns) = now_ns + ((remaining * 1000000000) / speed);
+  }
+  if ((rate[0] != 0 || rate[1] != 0) &&
+      ((*wake_ns) == 0 ||
+       (*wake_ns) > now_ns + (ML_TRACK_REPLAN_MS * 1000000ULL))) {
+    (*wake_ns) = now_ns + (ML_TRACK_REPLAN_MS * 1000000ULL);
+  }
+
+  if (want == launcher->motion_direction) {
+    return false;
+  }
+  (*cmd) = want < 0 ? ML_STOP_CMD : (ml_launcher_cmd)want;
+  return true;
+}
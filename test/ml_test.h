@@ -0,0 +1,155 @@
+/**
+ * @file ml_test.h
+ * @brief Helpers shared by the tests.
+ * Every test runs on simulated launchers and the virtual clock, see
+ * ml_sim_add and ML_INIT_VIRTUAL_CLOCK. Commands are submitted without
+ * waiting and the clock is moved on with ml_clock_advance, which returns
+ * once everything due in that time has run, so results never depend on
+ * how fast the machine is.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#ifndef ML_TEST_H
+#define ML_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libmissilelauncher.h"
+
+/// Fails the test if a condition doesn't hold.
+#define ML_CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond); \
+      exit(1); \
+    } \
+  } while (0)
+
+/// Fails the test if a call doesn't return ML_OK.
+#define ML_CHECK_OK(call) \
+  do { \
+    ml_error_code ml_check_result = (call); \
+    if (ml_check_result != ML_OK) { \
+      fprintf(stderr, "%s:%d: %s: %s\n", __FILE__, __LINE__, #call, \
+              ml_error_to_str(ml_check_result)); \
+      exit(1); \
+    } \
+  } while (0)
+
+/// Fails the test if two numbers differ by more than a tolerance.
+#define ML_CHECK_NEAR(a, b, tolerance) \
+  do { \
+    int64_t ml_check_a = (int64_t)(a), ml_check_b = (int64_t)(b); \
+    if (ml_check_a - ml_check_b > (int64_t)(tolerance) || \
+        ml_check_b - ml_check_a > (int64_t)(tolerance)) { \
+      fprintf(stderr, "%s:%d: %s is %lld, %s is %lld\n", __FILE__, \
+              __LINE__, #a, (long long)ml_check_a, #b, \
+              (long long)ml_check_b); \
+      exit(1); \
+    } \
+  } while (0)
+
+/// How one submitted command finished, see ml_test_done.
+typedef struct ml_test_result_t
+{
+  uint32_t calls;
+  ml_error_code status;
+  uint64_t done_ns;
+} ml_test_result_t;
+
+/**
+ * @brief Command callback that records how a command finished in the
+ * ml_test_result_t passed as its user data.
+ *
+ * @param launcher The launcher.
+ * @param status How the command finished.
+ * @param user_data The result to fill in.
+ */
+static inline void
+ml_test_done(ml_launcher_t *launcher, ml_error_code status, void *user_data)
+{
+  ml_test_result_t *result = user_data;
+  (void)launcher;
+
+  result->calls += 1;
+  result->status = status;
+  result->done_ns = ml_clock_now_ns();
+}
+
+/**
+ * @brief Starts the library on the virtual clock with simulated launchers
+ * and claims all of them.
+ *
+ * @param count How many simulated launchers to add.
+ * @param flags ML_SIM_* flags for them.
+ * @param launchers Where to put the launcher array.
+ * @param launcher_count Where to put the number of launchers.
+ */
+static inline void
+ml_test_start(uint32_t count, uint32_t flags, ml_launcher_t ***launchers,
+              uint32_t *launcher_count)
+{
+  (*launchers) = NULL;
+  ML_CHECK_OK(ml_library_init_flags(ML_INIT_SKIP_SCAN |
+                                    ML_INIT_VIRTUAL_CLOCK));
+  ML_CHECK_OK(ml_sim_add(count, flags));
+  ML_CHECK_OK(ml_launcher_array_new(launchers, launcher_count));
+  ML_CHECK((*launcher_count) == count);
+  ML_CHECK_OK(ml_launcher_array_claim((*launchers), ML_CLAIM_DEFAULT, NULL));
+}
+
+/**
+ * @brief Lets the clock run for a while.
+ *
+ * @param mseconds How long, in milliseconds.
+ */
+static inline void
+ml_test_run(uint64_t mseconds)
+{
+  ML_CHECK_OK(ml_clock_advance(mseconds * 1000000));
+}
+
+/**
+ * @brief Zeroes every launcher and waits until they are done.
+ *
+ * @param launchers The launchers.
+ * @param count How many there are.
+ */
+static inline void
+ml_test_zero_all(ml_launcher_t **launchers, uint32_t count)
+{
+  ml_test_result_t *results = calloc(sizeof(ml_test_result_t), count);
+
+  ML_CHECK(results != NULL);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_launcher_zero_submit(launchers[i], ml_test_done,
+                                        &results[i]));
+  }
+  // Zeroing from anywhere takes under 12 seconds.
+  ml_test_run(15000);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(results[i].calls == 1);
+    ML_CHECK_OK(results[i].status);
+  }
+  free(results);
+}
+
+/**
+ * @brief Unclaims every launcher and shuts the library down.
+ *
+ * @param launchers The launcher array from ml_test_start.
+ */
+static inline void
+ml_test_stop(ml_launcher_t **launchers)
+{
+  ML_CHECK_OK(ml_launcher_array_unclaim(launchers, ML_CLAIM_DEFAULT, NULL));
+  ML_CHECK_OK(ml_launcher_array_free(launchers));
+  ML_CHECK_OK(ml_library_cleanup());
+}
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * @file test_ammo.c
+ * @brief Fires hundreds of simulated launchers past their model's load and
+ * checks every shot is sent until the application sets the ammo count, and
+ * that from then on shots past the last missile are refused.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <string.h>
+
+#include "ml_test.h"
+
+#define TEST_LAUNCHERS 256
+// The standard launcher's load.
+#define TEST_CAPACITY 4
+// Longer than a simulated shot takes to be reported done.
+#define TEST_FIRE_MS 3000
+#define TEST_SHOTS (TEST_CAPACITY + 2)
+
+/**
+ * @brief Queues the same number of shots on every launcher and lets them
+ * all run.
+ *
+ * @param launchers The launchers.
+ * @param shots How many shots each.
+ * @param flags ML_FIRE_* flags.
+ * @param results Where each shot finished, shots to a launcher.
+ */
+static void
+test_fire(ml_launcher_t **launchers, uint32_t shots, uint32_t flags,
+          ml_test_result_t results[][TEST_SHOTS])
+{
+  ml_command_t cmd = { .type = ML_COMMAND_FIRE, .flags = flags,
+                       .callback = ml_test_done };
+
+  memset(results, 0, sizeof(ml_test_result_t) * TEST_SHOTS * TEST_LAUNCHERS);
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    for (uint32_t k = 0; k < shots; k++) {
+      cmd.user_data = &results[i][k];
+      ML_CHECK_OK(ml_launcher_submit(launchers[i], &cmd));
+    }
+  }
+  ml_test_run(shots * TEST_FIRE_MS);
+}
+
+int
+main()
+{
+  static ml_test_result_t results[TEST_LAUNCHERS][TEST_SHOTS];
+  ml_launcher_t **launchers = NULL;
+  ml_sim_state_t before[TEST_LAUNCHERS], state;
+  uint32_t count = 0, ammo = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_DEFAULT, &launchers, &count);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_launcher_get_ammo(launchers[i], &ammo));
+    ML_CHECK(ammo == TEST_CAPACITY);
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+  }
+
+  // Nobody said how many are loaded, so every shot goes out and the count
+  // just stops at zero.
+  test_fire(launchers, TEST_SHOTS, ML_FIRE_DEFAULT, results);
+  for (uint32_t i = 0; i < count; i++) {
+    for (uint32_t k = 0; k < TEST_SHOTS; k++) {
+      ML_CHECK(results[i][k].calls == 1);
+      ML_CHECK_OK(results[i][k].status);
+    }
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &state));
+    ML_CHECK(state.shots == before[i].shots + TEST_SHOTS);
+    ML_CHECK_OK(ml_launcher_get_ammo(launchers[i], &ammo));
+    ML_CHECK(ammo == 0);
+    before[i] = state;
+  }
+
+  // Reloaded with two, the third shot is refused without being sent.
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_launcher_set_ammo(launchers[i], 2));
+  }
+  test_fire(launchers, 3, ML_FIRE_DEFAULT, results);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(results[i][0].status);
+    ML_CHECK_OK(results[i][1].status);
+    ML_CHECK(results[i][2].calls == 1);
+    ML_CHECK(results[i][2].status == ML_NO_AMMO);
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &state));
+    ML_CHECK(state.shots == before[i].shots + 2);
+    ML_CHECK_OK(ml_launcher_get_ammo(launchers[i], &ammo));
+    ML_CHECK(ammo == 0);
+    before[i] = state;
+  }
+
+  // Unless the shot says to go anyway.
+  test_fire(launchers, 1, ML_FIRE_IGNORE_AMMO, results);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(results[i][0].calls == 1);
+    ML_CHECK_OK(results[i][0].status);
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &state));
+    ML_CHECK(state.shots == before[i].shots + 1);
+  }
+
+  ml_test_stop(launchers);
+  return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file test_engage.c
+ * @brief Plans engagements from hundreds of simulated launchers and checks
+ * every plan visits each target once, is no slower than the order given
+ * and can't be improved by reversing any stretch of it.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <string.h>
+
+#include "ml_test.h"
+
+#define TEST_LAUNCHERS 256
+#define TEST_TARGETS 24
+
+/**
+ * @brief Fills in targets from a seed, spread over the whole travel.
+ *
+ * @param targets The targets.
+ * @param count How many.
+ * @param seed The seed.
+ */
+static void
+test_make_targets(ml_target_t *targets, uint32_t count, uint32_t seed)
+{
+  for (uint32_t i = 0; i < count; i++) {
+    seed = (seed * 1103515245) + 12345;
+    targets[i].horizontal = (seed >> 8) % 270001;
+    seed = (seed * 1103515245) + 12345;
+    targets[i].vertical = (seed >> 8) % 45001;
+  }
+}
+
+/**
+ * @brief Checks a plan is a permutation of the targets and that no reversal
+ * of a stretch of it is faster.
+ *
+ * @param launcher The launcher.
+ * @param targets The targets.
+ * @param count How many.
+ * @param order The plan.
+ */
+static void
+test_check_plan(ml_launcher_t *launcher, const ml_target_t *targets,
+                uint32_t count, const uint32_t *order)
+{
+  uint32_t seen[TEST_TARGETS], reversed[TEST_TARGETS];
+  uint32_t planned_ms = 0, given_ms = 0, reversed_ms = 0;
+
+  memset(seen, 0, sizeof(seen));
+  for (uint32_t k = 0; k < count; k++) {
+    ML_CHECK(order[k] < count);
+    seen[order[k]] += 1;
+  }
+  for (uint32_t k = 0; k < count; k++) {
+    ML_CHECK(seen[k] == 1);
+  }
+
+  ML_CHECK_OK(ml_engagement_time(launcher, targets, count, order,
+                                 &planned_ms));
+  ML_CHECK_OK(ml_engagement_time(launcher, targets, count, NULL,
+                                 &given_ms));
+  ML_CHECK(planned_ms <= given_ms);
+
+  for (uint32_t i = 0; i + 1 < count; i++) {
+    for (uint32_t j = i + 1; j < count; j++) {
+      memcpy(reversed, order, sizeof(uint32_t) * count);
+      for (uint32_t a = i, b = j; a < b; a++, b--) {
+        reversed[a] = order[b];
+        reversed[b] = order[a];
+      }
+      ML_CHECK_OK(ml_engagement_time(launcher, targets, count, reversed,
+                                     &reversed_ms));
+      ML_CHECK(reversed_ms >= planned_ms);
+    }
+  }
+}
+
+int
+main()
+{
+  ml_launcher_t **launchers = NULL;
+  ml_target_t targets[TEST_TARGETS];
+  uint32_t order[TEST_TARGETS];
+  uint32_t count = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_DEFAULT, &launchers, &count);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_set_position(launchers[i], (i * 7919) % 270001,
+                                    (i * 104729) % 45001));
+  }
+  ml_test_zero_all(launchers, count);
+
+  // Scattered targets, a different set from each launcher.
+  for (uint32_t i = 0; i < count; i++) {
+    test_make_targets(targets, TEST_TARGETS, i);
+    ML_CHECK_OK(ml_plan_engagement(launchers[i], targets, TEST_TARGETS,
+                                   order));
+    test_check_plan(launchers[i], targets, TEST_TARGETS, order);
+  }
+
+  // Targets in a row to the right of the zero position, given back to
+  // front. The only sensible plan is to sweep along the row.
+  for (uint32_t k = 0; k < TEST_TARGETS; k++) {
+    targets[k].horizontal = 140000 + ((TEST_TARGETS - k) * 5000);
+    targets[k].vertical = 3000;
+  }
+  ML_CHECK_OK(ml_plan_engagement(launchers[0], targets, TEST_TARGETS,
+                                 order));
+  test_check_plan(launchers[0], targets, TEST_TARGETS, order);
+  for (uint32_t k = 0; k < TEST_TARGETS; k++) {
+    ML_CHECK(order[k] == TEST_TARGETS - 1 - k);
+  }
+
+  ml_test_stop(launchers);
+  return 0;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file test_errors.c
+ * @brief Checks every error code has a string of its own, so printing the
+ * result of any call is safe.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <string.h>
+
+#include "ml_test.h"
+
+int
+main()
+{
+  const char *str = NULL;
+
+  for (int ec = ML_OK; ec < ML_ERROR_END; ec++) {
+    str = ml_error_to_str((ml_error_code)ec);
+    ML_CHECK(str != NULL);
+    ML_CHECK(strcmp(str, "invalid error code") != 0);
+    for (int other = ML_OK; other < ec; other++) {
+      ML_CHECK(strcmp(str, ml_error_to_str((ml_error_code)other)) != 0);
+    }
+  }
+  ML_CHECK(strcmp(ml_error_to_str(ML_ERROR_END), "invalid error code") == 0);
+  return 0;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file test_inbox.c
+ * @brief Submits commands to the same launchers from several threads at
+ * once and checks every command runs exactly once, and that each thread's
+ * commands run in the order it submitted them.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "ml_test.h"
+
+#define TEST_LAUNCHERS 128
+#define TEST_PRODUCERS 8
+#define TEST_COMMANDS 64
+
+/// What one command saw when it finished.
+typedef struct test_done_t
+{
+  uint32_t calls;
+  ml_error_code status;
+  // The order it finished in on its launcher.
+  uint32_t position;
+} test_done_t;
+
+/// One launcher's finished commands.
+typedef struct test_launcher_t
+{
+  uint32_t finished;
+  test_done_t done[TEST_PRODUCERS][TEST_COMMANDS];
+} test_launcher_t;
+
+/// A thread submitting commands.
+typedef struct test_producer_t
+{
+  pthread_t thread;
+  uint32_t id;
+  ml_launcher_t **launchers;
+} test_producer_t;
+
+static test_launcher_t test_launchers[TEST_LAUNCHERS];
+
+/**
+ * @brief Records a command finishing. A launcher's callbacks all run on its
+ * scheduler thread, one at a time.
+ *
+ * @param launcher The launcher.
+ * @param status How the command finished.
+ * @param user_data The command's test_done_t.
+ */
+static void
+test_done(ml_launcher_t *launcher, ml_error_code status, void *user_data)
+{
+  test_done_t *done = user_data;
+  test_launcher_t *owner = NULL;
+  (void)launcher;
+
+  // Every done entry lives in test_launchers, find the one it is in.
+  owner = &test_launchers[((uint8_t *)done - (uint8_t *)test_launchers) /
+                          sizeof(test_launcher_t)];
+  done->calls += 1;
+  done->status = status;
+  done->position = owner->finished++;
+}
+
+/**
+ * @brief Submits every command for one producer, sweeping across the
+ * launchers so every producer hits every launcher at the same time.
+ *
+ * @param arg The test_producer_t.
+ *
+ * @return Nothing.
+ */
+static void *
+test_produce(void *arg)
+{
+  test_producer_t *producer = arg;
+  ml_command_t cmd = { .callback = test_done };
+
+  for (uint32_t seq = 0; seq < TEST_COMMANDS; seq++) {
+    for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+      cmd.type = (seq & 1) ? ML_COMMAND_LED_OFF : ML_COMMAND_LED_ON;
+      cmd.user_data = &test_launchers[i].done[producer->id][seq];
+      ML_CHECK_OK(ml_launcher_submit(producer->launchers[i], &cmd));
+    }
+  }
+  return NULL;
+}
+
+int
+main()
+{
+  test_producer_t producers[TEST_PRODUCERS];
+  ml_launcher_t **launchers = NULL;
+  ml_sim_state_t before[TEST_LAUNCHERS], state;
+  test_done_t *done = NULL, *last = NULL;
+  uint32_t count = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_DEFAULT, &launchers, &count);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+  }
+
+  memset(test_launchers, 0, sizeof(test_launchers));
+  for (uint32_t p = 0; p < TEST_PRODUCERS; p++) {
+    producers[p].id = p;
+    producers[p].launchers = launchers;
+    ML_CHECK(pthread_create(&producers[p].thread, NULL, test_produce,
+                            &producers[p]) == 0);
+  }
+  for (uint32_t p = 0; p < TEST_PRODUCERS; p++) {
+    ML_CHECK(pthread_join(producers[p].thread, NULL) == 0);
+  }
+  // LED commands take no time, only the commands already submitted have
+  // to run.
+  ml_test_run(0);
+
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(test_launchers[i].finished == TEST_PRODUCERS * TEST_COMMANDS);
+    for (uint32_t p = 0; p < TEST_PRODUCERS; p++) {
+      last = NULL;
+      for (uint32_t seq = 0; seq < TEST_COMMANDS; seq++) {
+        done = &test_launchers[i].done[p][seq];
+        ML_CHECK(done->calls == 1);
+        ML_CHECK_OK(done->status);
+        ML_CHECK(last == NULL || done->position > last->position);
+        last = done;
+      }
+    }
+
+    // Every command reached the launcher, and the last one any producer
+    // sent was an LED off.
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &state));
+    ML_CHECK(state.commands ==
+             before[i].commands + (TEST_PRODUCERS * TEST_COMMANDS));
+    ML_CHECK(!state.led_state);
+  }
+
+  ml_test_stop(launchers);
+  return 0;
+}
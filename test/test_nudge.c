@@ -0,0 +1,113 @@
+/**
+ * @file test_nudge.c
+ * @brief Sends pulses to hundreds of simulated launchers, some of them cut
+ * short by a fire, and checks the library's idea of where each launcher
+ * ended up matches where it really is.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <string.h>
+
+#include "ml_test.h"
+
+#define TEST_LAUNCHERS 256
+// A simulated motor spins up and down over 40 ms at 49 millidegrees a
+// millisecond, a pulse of t ms turns 49 t t / 40. These points are on that
+// curve, in between them it is off by at most 31 millidegrees.
+#define TEST_PULSE_ERROR 35
+// Longer than a simulated shot takes to be reported done.
+#define TEST_FIRE_MS 3000
+
+static const ml_pulse_t test_pulses[] = {
+  { 10, 123 }, { 20, 490 }, { 30, 1103 }, { 40, 1960 }
+};
+
+/**
+ * @brief Checks a launcher has stopped where the library thinks it is.
+ *
+ * @param launcher The launcher.
+ * @param state Where to put its real state.
+ */
+static void
+test_check_position(ml_launcher_t *launcher, ml_sim_state_t *state)
+{
+  uint32_t horizontal = 0, vertical = 0;
+
+  ML_CHECK_OK(ml_sim_get_state(launcher, state));
+  ML_CHECK_OK(ml_launcher_get_position(launcher, &horizontal, &vertical));
+  ML_CHECK(!state->moving);
+  ML_CHECK_NEAR(horizontal, state->horizontal, TEST_PULSE_ERROR);
+  ML_CHECK_NEAR(vertical, state->vertical, 1);
+}
+
+int
+main()
+{
+  static ml_test_result_t pulse[TEST_LAUNCHERS], fire[TEST_LAUNCHERS];
+  ml_launcher_t **launchers = NULL;
+  ml_sim_state_t before[TEST_LAUNCHERS], state;
+  ml_command_t cmd = { .type = ML_COMMAND_PULSE, .direction = ML_RIGHT,
+                       .callback = ml_test_done };
+  uint32_t count = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_DEFAULT, &launchers, &count);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_set_position(launchers[i], (i * 7919) % 270001,
+                                    (i * 104729) % 45001));
+    ML_CHECK_OK(ml_launcher_set_pulse_table(launchers[i], ML_RIGHT,
+                                            test_pulses, 4));
+  }
+  ml_test_zero_all(launchers, count);
+
+  // Whole pulses of different lengths.
+  memset(pulse, 0, sizeof(pulse));
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+    cmd.duration_ms = 10 + (i % 31);
+    cmd.user_data = &pulse[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &cmd));
+  }
+  ml_test_run(500);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(pulse[i].calls == 1);
+    ML_CHECK_OK(pulse[i].status);
+    test_check_position(launchers[i], &state);
+    ML_CHECK(state.horizontal > before[i].horizontal);
+  }
+
+  // Pulses cut short halfway by a fire, long before the motor is up to
+  // speed. The position has to come from the pulse table, not the axis
+  // speed, or it is out by twice as much as the launcher turned.
+  memset(pulse, 0, sizeof(pulse));
+  memset(fire, 0, sizeof(fire));
+  cmd.duration_ms = 40;
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+    cmd.user_data = &pulse[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &cmd));
+  }
+  ml_test_run(20);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(pulse[i].calls == 0);
+    ML_CHECK_OK(ml_launcher_submit(launchers[i],
+                                   &(ml_command_t){
+                                     .type = ML_COMMAND_FIRE,
+                                     .callback = ml_test_done,
+                                     .user_data = &fire[i] }));
+  }
+  ml_test_run(TEST_FIRE_MS);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(pulse[i].calls == 1);
+    ML_CHECK(pulse[i].status == ML_PREEMPTED);
+    ML_CHECK(fire[i].calls == 1);
+    ML_CHECK_OK(fire[i].status);
+    test_check_position(launchers[i], &state);
+    ML_CHECK_NEAR(state.horizontal, before[i].horizontal + 490,
+                  TEST_PULSE_ERROR);
+  }
+
+  ml_test_stop(launchers);
+  return 0;
+}
@@ -0,0 +1,265 @@
+/**
+ * @file test_scheduler.c
+ * @brief Runs timed moves, preemption and deadlines on hundreds of
+ * simulated launchers and checks what they did and when against the
+ * virtual clock. The whole run is done twice and must come out the same.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include <string.h>
+
+#include "ml_test.h"
+
+#define TEST_LAUNCHERS 256
+#define TEST_COAST_MS 200
+// A simulated launcher reports a shot as done this long after it fires.
+#define TEST_FIRE_MS 2800
+// Axis speeds of the standard launcher, millidegrees per millisecond.
+#define TEST_HORIZONTAL_SPEED 49
+#define TEST_VERTICAL_SPEED 30
+
+/// Everything a run found out, compared between runs.
+typedef struct test_run_t
+{
+  ml_error_code status[TEST_LAUNCHERS][6];
+  uint64_t done_ms[TEST_LAUNCHERS][6];
+  ml_sim_state_t state[TEST_LAUNCHERS];
+} test_run_t;
+
+/**
+ * @brief Gets how long after a start time a command finished.
+ *
+ * @param result The command's result.
+ * @param start_ns The start time.
+ *
+ * @return The time in milliseconds.
+ */
+static uint64_t
+test_elapsed_ms(const ml_test_result_t *result, uint64_t start_ns)
+{
+  ML_CHECK(result->calls == 1);
+  return (result->done_ns - start_ns) / 1000000;
+}
+
+/**
+ * @brief Checks that the library's idea of where a launcher is matches
+ * where it really is.
+ *
+ * @param launcher The launcher.
+ * @param state Where to put its real state.
+ */
+static void
+test_check_position(ml_launcher_t *launcher, ml_sim_state_t *state)
+{
+  uint32_t horizontal = 0, vertical = 0;
+
+  ML_CHECK_OK(ml_sim_get_state(launcher, state));
+  ML_CHECK_OK(ml_launcher_get_position(launcher, &horizontal, &vertical));
+  ML_CHECK(!state->moving);
+  ML_CHECK_NEAR(horizontal, state->horizontal, 1);
+  ML_CHECK_NEAR(vertical, state->vertical, 1);
+}
+
+/**
+ * @brief Moves every launcher right, then up, by a different amount each,
+ * and checks each move takes exactly its time plus the coast.
+ *
+ * @param launchers The launchers, just zeroed.
+ * @param run Where to record what happened.
+ */
+static void
+test_timed_moves(ml_launcher_t **launchers, test_run_t *run)
+{
+  ml_test_result_t right[TEST_LAUNCHERS], up[TEST_LAUNCHERS];
+  ml_sim_state_t before[TEST_LAUNCHERS], state;
+  ml_command_t cmd = { .type = ML_COMMAND_MOVE_TIMED,
+                       .callback = ml_test_done };
+  uint32_t right_ms = 0, up_ms = 0;
+  uint64_t start = ml_clock_now_ns();
+
+  memset(right, 0, sizeof(right));
+  memset(up, 0, sizeof(up));
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+    cmd.direction = ML_RIGHT;
+    cmd.duration_ms = 100 + ((i % 50) * 20);
+    cmd.user_data = &right[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &cmd));
+    cmd.direction = ML_UP;
+    cmd.duration_ms = 50 + ((i % 10) * 30);
+    cmd.user_data = &up[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &cmd));
+  }
+  ml_test_run(5000);
+
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    right_ms = 100 + ((i % 50) * 20);
+    up_ms = 50 + ((i % 10) * 30);
+    ML_CHECK_OK(right[i].status);
+    ML_CHECK_OK(up[i].status);
+    run->status[i][0] = right[i].status;
+    run->status[i][1] = up[i].status;
+    run->done_ms[i][0] = test_elapsed_ms(&right[i], start);
+    run->done_ms[i][1] = test_elapsed_ms(&up[i], start);
+    ML_CHECK(run->done_ms[i][0] == right_ms + TEST_COAST_MS);
+    ML_CHECK(run->done_ms[i][1] ==
+             right_ms + up_ms + (2 * TEST_COAST_MS));
+
+    test_check_position(launchers[i], &state);
+    ML_CHECK_NEAR(state.horizontal, before[i].horizontal +
+                  (right_ms * TEST_HORIZONTAL_SPEED), 1);
+    ML_CHECK_NEAR(state.vertical, before[i].vertical +
+                  (up_ms * TEST_VERTICAL_SPEED), 1);
+  }
+}
+
+/**
+ * @brief Starts a long move on every launcher and cuts it short with a
+ * fire, which has a higher priority.
+ *
+ * @param launchers The launchers.
+ * @param run Where to record what happened.
+ */
+static void
+test_preemption(ml_launcher_t **launchers, test_run_t *run)
+{
+  ml_test_result_t move[TEST_LAUNCHERS], fire[TEST_LAUNCHERS];
+  ml_sim_state_t before[TEST_LAUNCHERS], state;
+  ml_command_t cmd = { .type = ML_COMMAND_MOVE_TIMED, .direction = ML_LEFT,
+                       .duration_ms = 2000, .callback = ml_test_done };
+  uint64_t start = ml_clock_now_ns();
+
+  memset(move, 0, sizeof(move));
+  memset(fire, 0, sizeof(fire));
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+    cmd.user_data = &move[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &cmd));
+  }
+  ml_test_run(500);
+
+  cmd.type = ML_COMMAND_FIRE;
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    ML_CHECK(move[i].calls == 0);
+    cmd.user_data = &fire[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &cmd));
+  }
+  ml_test_run(TEST_FIRE_MS + 1000);
+
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    ML_CHECK(move[i].status == ML_PREEMPTED);
+    ML_CHECK_OK(fire[i].status);
+    run->status[i][2] = move[i].status;
+    run->status[i][3] = fire[i].status;
+    run->done_ms[i][2] = test_elapsed_ms(&move[i], start);
+    run->done_ms[i][3] = test_elapsed_ms(&fire[i], start);
+    ML_CHECK(run->done_ms[i][2] == 500);
+    ML_CHECK(run->done_ms[i][3] == 500 + TEST_FIRE_MS);
+
+    test_check_position(launchers[i], &state);
+    ML_CHECK(state.shots == before[i].shots + 1);
+    ML_CHECK_NEAR(state.horizontal, before[i].horizontal -
+                  (500 * TEST_HORIZONTAL_SPEED), 1);
+  }
+}
+
+/**
+ * @brief Queues commands behind a running move, one with a deadline that
+ * runs out while the move is going and one that has time to spare.
+ *
+ * @param launchers The launchers.
+ * @param run Where to record what happened.
+ */
+static void
+test_deadlines(ml_launcher_t **launchers, test_run_t *run)
+{
+  ml_test_result_t missed[TEST_LAUNCHERS], met[TEST_LAUNCHERS];
+  ml_sim_state_t before[TEST_LAUNCHERS], state;
+  ml_command_t move = { .type = ML_COMMAND_MOVE_TIMED,
+                        .direction = ML_RIGHT, .duration_ms = 1000 };
+  ml_command_t led = { .callback = ml_test_done };
+  uint64_t start = ml_clock_now_ns();
+
+  memset(missed, 0, sizeof(missed));
+  memset(met, 0, sizeof(met));
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &move));
+  }
+  // Let the moves start, queued commands with a deadline go ahead of ones
+  // without.
+  ml_test_run(10);
+
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    led.type = ML_COMMAND_LED_ON;
+    led.deadline_ms = 100;
+    led.user_data = &missed[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &led));
+    led.type = ML_COMMAND_LED_OFF;
+    led.deadline_ms = 5000;
+    led.user_data = &met[i];
+    ML_CHECK_OK(ml_launcher_submit(launchers[i], &led));
+  }
+  ml_test_run(2000);
+
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    ML_CHECK(missed[i].status == ML_DEADLINE_MISSED);
+    ML_CHECK_OK(met[i].status);
+    run->status[i][4] = missed[i].status;
+    run->status[i][5] = met[i].status;
+    run->done_ms[i][4] = test_elapsed_ms(&missed[i], start);
+    run->done_ms[i][5] = test_elapsed_ms(&met[i], start);
+    // Dropped as soon as its deadline passed, not when the move was done.
+    ML_CHECK(run->done_ms[i][4] > 110);
+    ML_CHECK(run->done_ms[i][4] < 1000);
+    // Nothing else runs until the move and its coast are over.
+    ML_CHECK(run->done_ms[i][5] == 1000 + TEST_COAST_MS);
+
+    // The move, its stop and the LED off, never the LED on.
+    test_check_position(launchers[i], &state);
+    ML_CHECK(state.commands == before[i].commands + 3);
+    ML_CHECK(!state.led_state);
+    ML_CHECK_NEAR(state.horizontal, before[i].horizontal +
+                  (1000 * TEST_HORIZONTAL_SPEED), 1);
+  }
+}
+
+/**
+ * @brief Runs every test from a fresh start.
+ *
+ * @param run Where to record what happened.
+ */
+static void
+test_run(test_run_t *run)
+{
+  ml_launcher_t **launchers = NULL;
+  uint32_t count = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_DEFAULT, &launchers, &count);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_set_position(launchers[i], (i * 7919) % 270001,
+                                    (i * 104729) % 45001));
+  }
+  ml_test_zero_all(launchers, count);
+
+  test_timed_moves(launchers, run);
+  test_preemption(launchers, run);
+  test_deadlines(launchers, run);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &run->state[i]));
+  }
+  ml_test_stop(launchers);
+}
+
+int
+main()
+{
+  static test_run_t first, second;
+
+  test_run(&first);
+  test_run(&second);
+  ML_CHECK(memcmp(&first, &second, sizeof(first)) == 0);
+  return 0;
+}
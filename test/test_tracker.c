@@ -0,0 +1,150 @@
+/**
+ * @file test_tracker.c
+ * @brief Tracks still and moving targets with hundreds of simulated
+ * launchers and checks they end up on target, that the library agrees with
+ * where they are, and that they were sent far fewer commands than samples.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include "ml_test.h"
+
+#define TEST_LAUNCHERS 256
+#define TEST_DEADBAND 1000
+// A move shorter than the motor takes to spin up comes up short of what
+// the library reckons, by at most a quarter of the spin up at full speed:
+// 49 millidegrees a millisecond for 10 ms. The library never finds out, so
+// this adds up with every short correction until the launcher is zeroed.
+#define TEST_SLIP 490
+// How often a moving target reports where it is, in milliseconds.
+#define TEST_SAMPLE_MS 20
+// How many samples a moving target sends.
+#define TEST_SAMPLES 150
+
+/**
+ * @brief Checks a stopped launcher is on target and the library roughly
+ * agrees with where it is, see TEST_SLIP.
+ *
+ * @param launcher The launcher.
+ * @param horizontal The horizontal target.
+ * @param vertical The vertical target.
+ * @param tolerance How far off target it may be.
+ * @param slip How far off the library may be.
+ * @param state Where to put its real state.
+ */
+static void
+test_check_on_target(ml_launcher_t *launcher, uint32_t horizontal,
+                     uint32_t vertical, uint32_t tolerance, uint32_t slip,
+                     ml_sim_state_t *state)
+{
+  uint32_t tracked_horizontal = 0, tracked_vertical = 0;
+
+  ML_CHECK_OK(ml_sim_get_state(launcher, state));
+  ML_CHECK_OK(ml_launcher_get_position(launcher, &tracked_horizontal,
+                                       &tracked_vertical));
+  ML_CHECK(!state->moving);
+  ML_CHECK_NEAR(tracked_horizontal, horizontal, tolerance);
+  ML_CHECK_NEAR(tracked_vertical, vertical, tolerance);
+  ML_CHECK_NEAR(state->horizontal, tracked_horizontal, slip);
+  ML_CHECK_NEAR(state->vertical, tracked_vertical, slip);
+}
+
+/**
+ * @brief Sends every launcher to a target that doesn't move, a few times
+ * over. Each time is one move per axis, and at most one of them short.
+ *
+ * @param launchers The launchers.
+ */
+static void
+test_still_targets(ml_launcher_t **launchers)
+{
+  ml_sim_state_t state;
+  uint32_t horizontal = 0, vertical = 0;
+
+  for (uint32_t round = 0; round < 3; round++) {
+    ml_test_zero_all(launchers, TEST_LAUNCHERS);
+    for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+      horizontal = 10000 + (((i + round) * 15485863) % 250000);
+      vertical = 5000 + (((i + round) * 32452843) % 35000);
+      ML_CHECK_OK(ml_tracker_push(launchers[i], horizontal, vertical, 0));
+    }
+    // Corner to corner is under seven seconds.
+    ml_test_run(8000);
+
+    for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+      horizontal = 10000 + (((i + round) * 15485863) % 250000);
+      vertical = 5000 + (((i + round) * 32452843) % 35000);
+      test_check_on_target(launchers[i], horizontal, vertical,
+                           TEST_DEADBAND, TEST_SLIP, &state);
+    }
+  }
+}
+
+/**
+ * @brief Follows a target that sweeps across at a steady rate, slower than
+ * the launcher, and then stops.
+ *
+ * @param launchers The launchers, each still on a target.
+ */
+static void
+test_moving_target(ml_launcher_t **launchers)
+{
+  ml_sim_state_t before[TEST_LAUNCHERS], state;
+  uint32_t start[TEST_LAUNCHERS][2];
+  uint32_t horizontal = 0, vertical = 0;
+  uint64_t now = 0;
+
+  ml_test_zero_all(launchers, TEST_LAUNCHERS);
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &before[i]));
+    start[i][0] = 20000 + ((i * 7919) % 100000);
+    start[i][1] = 10000 + ((i * 104729) % 20000);
+  }
+
+  // Ten millidegrees a millisecond across and four up.
+  for (uint32_t sample = 0; sample < TEST_SAMPLES; sample++) {
+    now = ml_clock_now_ns();
+    for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+      horizontal = start[i][0] + (sample * TEST_SAMPLE_MS * 10);
+      vertical = start[i][1] + (sample * TEST_SAMPLE_MS * 4);
+      ML_CHECK_OK(ml_tracker_push(launchers[i], horizontal, vertical, now));
+    }
+    ml_test_run(TEST_SAMPLE_MS);
+  }
+  // Long enough for the target to go stale and the launcher to settle.
+  ml_test_run(3000);
+
+  for (uint32_t i = 0; i < TEST_LAUNCHERS; i++) {
+    horizontal = start[i][0] + ((TEST_SAMPLES - 1) * TEST_SAMPLE_MS * 10);
+    vertical = start[i][1] + ((TEST_SAMPLES - 1) * TEST_SAMPLE_MS * 4);
+    // A launcher running on ahead of the target may stop up to a deadband
+    // past it, and following takes a handful of short corrections.
+    test_check_on_target(launchers[i], horizontal, vertical,
+                         2 * TEST_DEADBAND, 6 * TEST_SLIP, &state);
+    ML_CHECK(state.commands - before[i].commands < TEST_SAMPLES / 4);
+  }
+}
+
+int
+main()
+{
+  ml_launcher_t **launchers = NULL;
+  uint32_t count = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_DEFAULT, &launchers, &count);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_set_position(launchers[i], (i * 7919) % 270001,
+                                    (i * 104729) % 45001));
+  }
+
+  test_still_targets(launchers);
+  test_moving_target(launchers);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_tracker_stop(launchers[i]));
+  }
+  ml_test_run(100);
+
+  ml_test_stop(launchers);
+  return 0;
+}
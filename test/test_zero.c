@@ -0,0 +1,113 @@
+/**
+ * @file test_zero.c
+ * @brief Zeroes hundreds of simulated launchers from all over their travel,
+ * with and without status reports, and checks they all end up where
+ * zeroing says, and that the library agrees with them.
+ * @author Travis Lane
+ * @version 0.5.0
+ * @date 2016-11-27
+ */
+
+#include "ml_test.h"
+
+#define TEST_LAUNCHERS 512
+
+// Where the standard zero leaves a launcher, 2750 ms right of the left
+// stop and 100 ms up from the bottom one.
+#define TEST_ZERO_HORIZONTAL 134750
+#define TEST_ZERO_VERTICAL 3000
+// How long zeroing takes when no move can be cut short by a limit switch,
+// four moves and a coast after each.
+#define TEST_ZERO_FULL_MS (6000 + 2000 + 2750 + 100 + (4 * 200))
+
+/**
+ * @brief Checks every launcher finished zeroing where it should, and that
+ * the library agrees with it.
+ *
+ * @param launchers The launchers.
+ * @param count How many there are.
+ */
+static void
+test_check_zeroed(ml_launcher_t **launchers, uint32_t count)
+{
+  ml_sim_state_t state;
+  uint32_t horizontal = 0, vertical = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(ml_launcher_has_position(launchers[i]));
+    ML_CHECK_OK(ml_sim_get_state(launchers[i], &state));
+    ML_CHECK_OK(ml_launcher_get_position(launchers[i], &horizontal,
+                                         &vertical));
+    ML_CHECK(!state.moving);
+    ML_CHECK_NEAR(state.horizontal, TEST_ZERO_HORIZONTAL, 1);
+    ML_CHECK_NEAR(state.vertical, TEST_ZERO_VERTICAL, 1);
+    ML_CHECK_NEAR(horizontal, state.horizontal, 1);
+    ML_CHECK_NEAR(vertical, state.vertical, 1);
+  }
+}
+
+/**
+ * @brief Zeroes launchers from all over their travel using their limit
+ * switches.
+ */
+static void
+test_zero_with_status()
+{
+  ml_launcher_t **launchers = NULL;
+  uint32_t count = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_DEFAULT, &launchers, &count);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(!ml_launcher_has_position(launchers[i]));
+    ML_CHECK_OK(ml_sim_set_position(launchers[i], (i * 7919) % 270001,
+                                    (i * 104729) % 45001));
+  }
+  ml_test_zero_all(launchers, count);
+  test_check_zeroed(launchers, count);
+  ml_test_stop(launchers);
+}
+
+/**
+ * @brief Zeroes launchers that never answer a status report. Every move
+ * has to run for its whole time, and still end up in the same place.
+ */
+static void
+test_zero_without_status()
+{
+  ml_launcher_t **launchers = NULL;
+  ml_test_result_t *results = NULL;
+  uint32_t count = 0;
+  uint64_t start = 0;
+
+  ml_test_start(TEST_LAUNCHERS, ML_SIM_NO_STATUS, &launchers, &count);
+  results = calloc(sizeof(ml_test_result_t), count);
+  ML_CHECK(results != NULL);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_sim_set_position(launchers[i], (i * 7919) % 270001,
+                                    (i * 104729) % 45001));
+  }
+
+  start = ml_clock_now_ns();
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK_OK(ml_launcher_zero_submit(launchers[i], ml_test_done,
+                                        &results[i]));
+  }
+  ml_test_run(15000);
+  for (uint32_t i = 0; i < count; i++) {
+    ML_CHECK(results[i].calls == 1);
+    ML_CHECK_OK(results[i].status);
+    ML_CHECK((results[i].done_ns - start) / 1000000 == TEST_ZERO_FULL_MS);
+  }
+  test_check_zeroed(launchers, count);
+
+  free(results);
+  ml_test_stop(launchers);
+}
+
+int
+main()
+{
+  test_zero_with_status();
+  test_zero_without_status();
+  return 0;
+}